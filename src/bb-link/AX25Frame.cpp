@@ -0,0 +1,145 @@
+#include "AX25Frame.h"
+
+static const uint8_t FEND = 0xC0;
+static const uint8_t FESC = 0xDB;
+static const uint8_t TFEND = 0xDC;
+static const uint8_t TFESC = 0xDD;
+static const uint8_t KISS_DATA = 0x00;
+
+/*
+  Takes a whole KISS frame, FENDs included. Anything but a data frame holding
+  well formed addresses and a control byte is refused.
+*/
+bool AX25Frame::parse(const uint8_t *kissFrame, size_t size)
+{
+  length = 0;
+  addressesLength = 0;
+
+  size_t i = 0;
+  while (i < size && kissFrame[i] == FEND)
+  {
+    i++;
+  }
+  // Any port, the radio link decides which one it is
+  if (i >= size || (kissFrame[i] & 0x0F) != KISS_DATA)
+  {
+    return false;
+  }
+
+  for (i++; i < size && kissFrame[i] != FEND; i++)
+  {
+    uint8_t byte = kissFrame[i];
+    if (byte == FESC)
+    {
+      if (++i >= size)
+      {
+        return false;
+      }
+      if (kissFrame[i] == TFEND)
+      {
+        byte = FEND;
+      }
+      else if (kissFrame[i] == TFESC)
+      {
+        byte = FESC;
+      }
+      else
+      {
+        return false;
+      }
+    }
+    if (length >= AX25_MAX_FRAME_SIZE)
+    {
+      return false;
+    }
+    frame[length++] = byte;
+  }
+
+  // The last address has its extension bit set
+  for (size_t address = 0; address < AX25_MAX_ADDRESSES; address++)
+  {
+    size_t end = (address + 1) * AX25_ADDRESS_SIZE;
+    if (end > length)
+    {
+      return false;
+    }
+    if (frame[end - 1] & 0x01)
+    {
+      addressesLength = end;
+      break;
+    }
+  }
+  if (addressesLength < 2 * AX25_ADDRESS_SIZE || addressesLength >= length)
+  {
+    addressesLength = 0;
+    return false;
+  }
+  return true;
+}
+
+const uint8_t *AX25Frame::destination() const
+{
+  return frame;
+}
+
+const uint8_t *AX25Frame::source() const
+{
+  return frame + AX25_ADDRESS_SIZE;
+}
+
+uint8_t AX25Frame::digipeaterCount() const
+{
+  return addressesLength / AX25_ADDRESS_SIZE - 2;
+}
+
+uint8_t AX25Frame::control() const
+{
+  return frame[addressesLength];
+}
+
+/*
+  I and UI frames have one, poll/final bit aside
+*/
+bool AX25Frame::hasPid() const
+{
+  uint8_t control = this->control();
+  return ((control & 0x01) == 0 || (control & 0xEF) == AX25_CONTROL_UI) && addressesLength + 1 < length;
+}
+
+uint8_t AX25Frame::pid() const
+{
+  return hasPid() ? frame[addressesLength + 1] : 0;
+}
+
+const uint8_t *AX25Frame::info() const
+{
+  return frame + addressesLength + (hasPid() ? 2 : 1);
+}
+
+size_t AX25Frame::infoLength() const
+{
+  return length - addressesLength - (hasPid() ? 2 : 1);
+}
+
+const uint8_t *AX25Frame::payload() const
+{
+  return frame + addressesLength;
+}
+
+size_t AX25Frame::payloadLength() const
+{
+  return length - addressesLength;
+}
+
+uint8_t AX25Frame::ssid(const uint8_t *address)
+{
+  return (address[AX25_CALLSIGN_SIZE] >> 1) & 0x0F;
+}
+
+/*
+  Same callsign and SSID, whatever the command/response and has-been-repeated bits
+*/
+bool AX25Frame::sameStation(const uint8_t *address, const uint8_t *other)
+{
+  return memcmp(address, other, AX25_CALLSIGN_SIZE) == 0 && ssid(address) == ssid(other);
+}
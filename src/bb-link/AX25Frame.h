@@ -0,0 +1,47 @@
+#pragma once
+#ifndef AX25FRAME_H
+#define AX25FRAME_H
+
+#include "Arduino.h"
+
+#define AX25_ADDRESS_SIZE 7
+#define AX25_CALLSIGN_SIZE 6
+#define AX25_MAX_ADDRESSES 10   // Destination, source and up to 8 digipeaters
+#define AX25_MAX_FRAME_SIZE 340 // Addresses, control, PID and 256 bytes of info
+#define AX25_CONTROL_UI 0x03
+
+/*
+  The AX.25 frame carried by a KISS data frame, unescaped into a buffer of its
+  own. Addresses are kept as they are on air, each character shifted left by
+  one.
+
+  https://www.tapr.org/pdf/AX25.2.2.pdf
+*/
+class AX25Frame
+{
+public:
+  bool parse(const uint8_t *kissFrame, size_t size);
+
+  const uint8_t *destination() const;
+  const uint8_t *source() const;
+  uint8_t digipeaterCount() const;
+  uint8_t control() const;
+  bool hasPid() const;
+  uint8_t pid() const;
+  const uint8_t *info() const;
+  size_t infoLength() const;
+
+  // Control, PID and info: what the frame says, whoever repeated it
+  const uint8_t *payload() const;
+  size_t payloadLength() const;
+
+  static uint8_t ssid(const uint8_t *address);
+  static bool sameStation(const uint8_t *address, const uint8_t *other);
+
+private:
+  uint8_t frame[AX25_MAX_FRAME_SIZE];
+  size_t length = 0;
+  size_t addressesLength = 0;
+};
+
+#endif
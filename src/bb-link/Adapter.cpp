@@ -7,53 +7,33 @@
 #define BATTERY_FULL_VOLTAGE 3.750                // Voltage above which to consider LiPo battery charged
 #define BATTERY_MIN_VOLTAGE 3.500                 // Voltage below which esp32 should go to sleep as battery is going to rapidely drop its charge
 #define SHOW_BATTERY_DURATION 3000                // Duration for battery indicator to stay on
-#define BATTERY_WATCHGUARD_INTERVAL 3 * 60 * 1000 // Interval between battery check
+#define BATTERY_WATCHGUARD_INTERVAL 3 * 60 * 1000 // Interval between battery status logs
+#define BATTERY_SAMPLE_INTERVAL 5000              // Interval between battery voltage samples
+#define BATTERY_SAMPLE_MAX_DELAY 30000            // Longest a sample waits for traffic to settle
+#define BATTERY_OVERSAMPLING 16                   // Number of ADC readings averaged into one sample
+#define BATTERY_CAPACITY_MAH 600                  // Capacity of the LiPo battery, 602248 cell
 
 #define VBUS_SENSE_GPIO 9
 
 #define SERVICE_UUID_OTA "1A68D2B0-C2E4-453F-A2BB-B659D66CF442"
 #define CHARACTERISTIC_UUID_OTA_FLASH "1A68D2B1-C2E4-453F-A2BB-B659D66CF442"
 #define CHARACTERISTIC_UUID_OTA_IDENTITY "1A68D2B2-C2E4-453F-A2BB-B659D66CF442"
+#define CHARACTERISTIC_UUID_OTA_CONTROL "1A68D2B3-C2E4-453F-A2BB-B659D66CF442"
 
 extern const char *logLevels[];
 
-// AdapterState
-Adapter::Adapter() : idleState(
-                         [this]
-                         { this->idleEnter(); },
-                         [this]
-                         { this->idleUpdate(); },
-                         [this]
-                         { this->idleExit(); }),
-                     inUseState(
-                         [this]
-                         { this->inUseEnter(); },
-                         [this]
-                         { this->inUseUpdate(); },
-                         [this]
-                         { this->inUseExit(); }),
-                     shutdownState(
-                         [this]
-                         { this->shutdownEnter(); },
-                         [this]
-                         { this->shutdownUpdate(); },
-                         [this]
-                         { this->shutdownExit(); }),
-                     showBatteryState(
-                         [this]
-                         { this->showBatteryEnter(); },
-                         [this]
-                         { this->showBatteryUpdate(); },
-                         [this]
-                         { this->showBatteryExit(); }),
-                     otaFlashState(
-                         [this]
-                         { this->otaFlashEnter(); },
-                         [this]
-                         { this->otaFlashUpdate(); },
-                         [this]
-                         { this->otaFlashExit(); }),
-                     adapterStateMachine(idleState),
+static const char *const ADAPTER_STATE_NAMES[adapterStateCount] = {"idle", "inUse", "shutdown", "showBattery", "otaFlash"};
+
+// Enter, update and exit of each adapter_state_t
+const Adapter::AdapterStateMachine::Table Adapter::adapterStates = {
+    {&Adapter::idleEnter, &Adapter::idleUpdate, &Adapter::idleExit},
+    {&Adapter::inUseEnter, &Adapter::inUseUpdate, &Adapter::inUseExit},
+    {&Adapter::shutdownEnter, &Adapter::shutdownUpdate, &Adapter::shutdownExit},
+    {&Adapter::showBatteryEnter, &Adapter::showBatteryUpdate, &Adapter::showBatteryExit},
+    {&Adapter::otaFlashEnter, &Adapter::otaFlashUpdate, &Adapter::otaFlashExit}};
+
+Adapter::Adapter() : adapterStateMachine(this, adapterStates, idleState),
+                     batteryMonitor(BATTERY_CAPACITY_MAH, BATTERY_MIN_VOLTAGE),
                      bridge(fetchAdapterName())
 {
 }
@@ -79,6 +59,7 @@ String Adapter::getAdapterName()
 void Adapter::init()
 {
   Log.traceln("Adapter: init");
+  Log.traceln("Adapter: state machine saves %d bytes of RAM", AdapterStateMachine::savedMemory());
   pinMode(VBUS_SENSE_GPIO, INPUT);
 
   statusIndicator.init();
@@ -86,6 +67,11 @@ void Adapter::init()
 
   touchButton.setOnLongPressedCallback(std::bind(&Adapter::onLongPressed, this));
   touchButton.setOnShortPressedCallback(std::bind(&Adapter::onShortPressed, this));
+  bridge.setOnHardwareCommandCallback(std::bind(&Adapter::onHardwareCommand, this, std::placeholders::_1));
+
+#if defined(ARDUINO_TINYPICO)
+  bridge.addCapabilities(CAP_BATTERY);
+#endif
 
 #if defined(ARDUINO_TINYPICO)
   touchSleepWakeUpEnable(CAPACITIVE_TOUCH_INPUT_PIN, TOUCH_THRESHOLD);
@@ -150,21 +136,35 @@ void Adapter::initBLEOtaService()
 
   pOtaFlash = pOtaService->createCharacteristic(
       CHARACTERISTIC_UUID_OTA_FLASH,
-      BLECharacteristic::PROPERTY_WRITE);
+      BLECharacteristic::PROPERTY_WRITE | BLECharacteristic::PROPERTY_WRITE_NR);
+
+  pOtaControl = pOtaService->createCharacteristic(
+      CHARACTERISTIC_UUID_OTA_CONTROL,
+      BLECharacteristic::PROPERTY_WRITE | BLECharacteristic::PROPERTY_NOTIFY);
 
   pOtaIdentity = pOtaService->createCharacteristic(
       CHARACTERISTIC_UUID_OTA_IDENTITY,
       BLECharacteristic::PROPERTY_READ);
 
   pOtaFlash->addDescriptor(new BLE2902());
+  pOtaControl->addDescriptor(new BLE2902());
 
   pOtaFlash->setAccessPermissions(ESP_GATT_PERM_WRITE);
+  pOtaControl->setAccessPermissions(ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE);
   pOtaIdentity->setAccessPermissions(ESP_GATT_PERM_READ);
 
   pOtaFlash->setCallbacks(this);
+  pOtaControl->setCallbacks(this);
 
-  uint8_t identity[6] = {HARDWARE_BOARD, HARDWARE_VERSION_MAJOR, HARDWARE_VERSION_MINOR, FIRMWARE_VERSION_MAJOR, FIRMWARE_VERSION_MINOR, FIRMWARE_VERSION_PATCH};
-  pOtaIdentity->setValue(identity, 6);
+  if (!otaUpdater.init(pOtaControl))
+  {
+    Log.errorln("OTA: init failed");
+  }
+
+  // Running firmware id goes last, the app picks the delta base from it
+  uint8_t identity[8 + DELTA_BASE_ID_LEN] = {HARDWARE_BOARD, HARDWARE_VERSION_MAJOR, HARDWARE_VERSION_MINOR, FIRMWARE_VERSION_MAJOR, FIRMWARE_VERSION_MINOR, FIRMWARE_VERSION_PATCH, OTA_FEATURE_VERIFIED_STREAM | OTA_FEATURE_HEATSHRINK | OTA_FEATURE_DELTA, OTA_HEATSHRINK_PARAMS};
+  OtaUpdater::getBaseId(&identity[8]);
+  pOtaIdentity->setValue(identity, sizeof(identity));
 
   pOtaService->start();
 }
@@ -172,12 +172,24 @@ void Adapter::initBLEOtaService()
 void Adapter::perform()
 {
   statusIndicator.render();
+  otaUpdater.checkTimeout();
+
+  // Updates start on the BLE task, only this task drives the state machine
+  if (otaUpdater.isActive() && !adapterStateMachine.isInState(otaFlashState))
+  {
+    Log.infoln("OTA: begin flash");
+    adapterStateMachine.immediateTransitionTo(otaFlashState);
+  }
+
   if (!adapterStateMachine.isInState(otaFlashState))
   {
     touchButton.process();
     lowBatteryWatchguard();
   }
   adapterStateMachine.update();
+
+  // Let the tasks below this one run until a Bluetooth callback brings work
+  taskLayout.waitForWork(bridge.hasPendingWork() ? 0 : BRIDGE_PUMP_IDLE_WAIT);
 }
 
 void Adapter::updateSendReceiveStatus()
@@ -205,12 +217,28 @@ void Adapter::lowBatteryWatchguard()
 {
 #if defined(ARDUINO_TINYPICO)
   unsigned long now = millis();
-  if (now - lastBatteryCheck > BATTERY_WATCHGUARD_INTERVAL)
+  if (now - lastBatterySample > BATTERY_SAMPLE_INTERVAL)
   {
-    lastBatteryCheck = now;
-    float level = tp.GetBatteryVoltage();
-    Log.infoln("Battery voltage %F V", level);
-    if (level < BATTERY_MIN_VOLTAGE)
+    // Voltage sags while the radio links are busy, wait for traffic to settle. On a
+    // channel that never goes quiet, sample anyway and leave the sag to the monitor's
+    // slew limit and critical confirmations.
+    if ((bridge.isTx() || bridge.isRx()) && now - lastBatterySample < BATTERY_SAMPLE_MAX_DELAY)
+    {
+      return;
+    }
+
+    lastBatterySample = now;
+    batteryMonitor.setExternalPower(isUSBPower(), now);
+    batteryMonitor.setPowerProfile(currentPowerProfile(), now);
+    batteryMonitor.addSample(readBatteryVoltage(), now);
+
+    if (now - lastBatteryCheck > BATTERY_WATCHGUARD_INTERVAL)
+    {
+      lastBatteryCheck = now;
+      Log.infoln("Battery voltage %F V, charge %d %%, runtime %d min", batteryMonitor.getVoltage(), (int)batteryMonitor.getStateOfCharge(), batteryMonitor.estimateRuntimeMinutes());
+    }
+
+    if (batteryMonitor.isCritical())
     {
       Log.warningln("Voltage too low, initiating shutdown");
       shutdownReason = lowBattery;
@@ -220,6 +248,46 @@ void Adapter::lowBatteryWatchguard()
 #endif
 }
 
+float Adapter::readBatteryVoltage()
+{
+#if defined(ARDUINO_TINYPICO)
+  // Average out ADC noise
+  float sum = 0;
+  for (int i = 0; i < BATTERY_OVERSAMPLING; i++)
+  {
+    sum += tp.GetBatteryVoltage();
+  }
+  return sum / BATTERY_OVERSAMPLING;
+#else
+  return 0;
+#endif
+}
+
+power_profile_t Adapter::currentPowerProfile()
+{
+  if (adapterStateMachine.isInState(inUseState))
+  {
+    return powerProfileInUse;
+  }
+  else if (bridge.btcConnected())
+  {
+    return powerProfileRadioConnected;
+  }
+  return powerProfileIdle;
+}
+
+void Adapter::printBatteryStatus()
+{
+  if (!batteryMonitor.hasReading())
+  {
+    Serial.println("Battery: no reading yet");
+    return;
+  }
+  Serial.printf("Battery: %.3f V, charge %d %%, %s\n", batteryMonitor.getVoltage(), (int)batteryMonitor.getStateOfCharge(), isUSBPower() ? "on USB power" : "on battery");
+  Serial.printf("Runtime: %d min\n", batteryMonitor.estimateRuntimeMinutes());
+  Serial.printf("Current draw: idle %d mA, radio %d mA, in use %d mA\n", batteryMonitor.getCurrentDraw(powerProfileIdle), batteryMonitor.getCurrentDraw(powerProfileRadioConnected), batteryMonitor.getCurrentDraw(powerProfileInUse));
+}
+
 bool Adapter::isUSBPower()
 {
 #if defined(ARDUINO_TINYPICO)
@@ -267,39 +335,63 @@ void Adapter::onShortPressed()
 }
 
 /*
-  BLECharacteristicCallbacks
+  Extended hardware commands not handled by the bridge
 */
-void Adapter::onWrite(BLECharacteristic *pCharacteristic)
+bool Adapter::onHardwareCommand(extended_hw_cmd_t *cmd)
 {
-  std::string rxData = pCharacteristic->getValue();
-
-  if (!adapterStateMachine.isInState(otaFlashState))
+  switch (cmd->action)
   {
-    Log.infoln("OTA: begin flash");
-    adapterStateMachine.immediateTransitionTo(otaFlashState);
-    esp_ota_begin(esp_ota_get_next_update_partition(NULL), OTA_SIZE_UNKNOWN, &otaHandle);
+#if defined(ARDUINO_TINYPICO)
+  case extended_hw_get_battery:
+  {
+    Log.traceln("Adapter: extended_hw_get_battery");
+    uint16_t millivolts = batteryMonitor.getVoltage() * 1000;
+    uint16_t runtime = batteryMonitor.estimateRuntimeMinutes();
+    uint8_t flags = (isUSBPower() ? 0x01 : 0x00) | (batteryMonitor.isCritical() ? 0x02 : 0x00);
+    // Big endian
+    uint8_t status[6] = {
+        uint8_t((millivolts >> 8) & 0xFF), uint8_t(millivolts & 0xFF),
+        uint8_t(batteryMonitor.getStateOfCharge()),
+        uint8_t((runtime >> 8) & 0xFF), uint8_t(runtime & 0xFF),
+        flags};
+    bridge.reply(EXTENDED_HW_CMD_GET_BATTERY, status, sizeof(status));
+    return true;
+  }
+#endif
+  case extended_hw_get_state_stats:
+  {
+    Log.traceln("Adapter: extended_hw_get_state_stats");
+    uint8_t stats[1 + AdapterStateMachine::maxStatsSize()];
+    stats[0] = stateMachineAdapter;
+    size_t size = adapterStateMachine.serializeStats(stats + 1);
+    bridge.reply(EXTENDED_HW_CMD_GET_STATE_STATS, stats, size + 1);
+    return true;
   }
+  default:
+    return false;
+  }
+}
+
+void Adapter::printStateStats()
+{
+  Serial.println("Adapter state machine:");
+  adapterStateMachine.printStats(Serial, ADAPTER_STATE_NAMES);
+  bridge.printStateStats(Serial);
+}
 
-  if (rxData.length() > 0)
+/*
+  BLECharacteristicCallbacks
+*/
+void Adapter::onWrite(BLECharacteristic *pCharacteristic)
+{
+  // Flash writes happen on the OTA writer task, this only queues data
+  if (pCharacteristic == pOtaControl)
   {
-    esp_ota_write(otaHandle, rxData.c_str(), rxData.length());
-    Log.infoln("OTA: written %i bytes", rxData.length());
+    otaUpdater.onControl(pCharacteristic->getData(), pCharacteristic->getLength());
   }
   else
   {
-    Log.infoln("OTA: end flash");
-    esp_ota_end(otaHandle);
-    if (esp_ota_set_boot_partition(esp_ota_get_next_update_partition(NULL)) == ESP_OK)
-    {
-      Log.infoln("OTA: success, rebooting");
-      delay(2000);
-      esp_restart();
-    }
-    else
-    {
-      Log.errorln("OTA: failed");
-    }
-    adapterStateMachine.transitionTo(idleState);
+    otaUpdater.onData(pCharacteristic->getData(), pCharacteristic->getLength());
   }
 }
 
@@ -392,6 +484,22 @@ void Adapter::idleUpdate()
       }
       Serial.printf("Log level: %s\n", logLevels[Log.getLevel()]);
       break;
+    case 'b':
+      // Print battery status
+      printBatteryStatus();
+      break;
+    case 's':
+      // Print time spent in each state and recent transitions
+      printStateStats();
+      break;
+    case 'l':
+      // Print frame latency histograms
+      bridge.printLatency(Serial);
+      break;
+    case 't':
+      // Print tasks and the stack they never used
+      taskLayout.print(Serial);
+      break;
     case 'i':
       // Print identity
       Serial.printf("Identity: %s\n", getAdapterName().c_str());
@@ -508,7 +616,7 @@ void Adapter::shutdownExit()
 void Adapter::showBatteryEnter()
 {
 #if defined(ARDUINO_TINYPICO)
-  float level = tp.GetBatteryVoltage();
+  float level = batteryMonitor.hasReading() ? batteryMonitor.getVoltage() : readBatteryVoltage();
   Log.infoln("Battery voltage %F V", level);
   if (level > BATTERY_FULL_VOLTAGE)
   {
@@ -542,10 +650,15 @@ void Adapter::otaFlashEnter()
 
 void Adapter::otaFlashUpdate()
 {
-  // Do nothing, OTA is handled by BLECharacteristicCallbacks
+  // Data is handled by the OTA updater. If flashing was successful the device
+  // reboots, otherwise the update failed or was abandoned.
+  if (!otaUpdater.isActive())
+  {
+    adapterStateMachine.transitionTo(idleState);
+  }
 }
 
 void Adapter::otaFlashExit()
 {
-  // If OTA flash was successful, the device will reboot
+  Log.infoln("OTA: ended without reboot");
 }
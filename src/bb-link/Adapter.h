@@ -21,17 +21,16 @@
 #endif
 
 #include "Bridge.h"
-#include "FiniteStateMachine.h"
+#include "BatteryMonitor.h"
+#include "OtaUpdater.h"
+#include "StateMachine.h"
+#include "Version.h"
 
 #include <esp_ota_ops.h>
 
 #define CAPACITIVE_TOUCH_INPUT_PIN T0  // Pin 4
 #define ADAPTER_NAME "B.B. Link"       // Changing this will prevent RadioMail to know that QSY is supported.
 
-#define FIRMWARE_VERSION_MAJOR 0
-#define FIRMWARE_VERSION_MINOR 7
-#define FIRMWARE_VERSION_PATCH 8
-
 #define DEVICE_NAMESPACE "bb-link-hw"
 #define IDENTITY_KEY "identity"
 
@@ -57,7 +56,15 @@ enum hardware_board_t {
 #error "Unknown hardware board. Please define HARDWARE_BOARD so that OTA updater knows what to do."
 #endif
 
-DECLARE_STATE(AdapterState);
+enum adapter_state_t : uint8_t
+{
+  idleState = 0x00,
+  inUseState = 0x01,
+  shutdownState = 0x02,
+  showBatteryState = 0x03,
+  otaFlashState = 0x04,
+  adapterStateCount = 0x05
+};
 
 enum shutdown_reason_t {
   userInitiated = 0x00,
@@ -84,23 +91,28 @@ private:
 #endif
 
   unsigned long lastBatteryCheck = 0;
+  unsigned long lastBatterySample = 0;
+  BatteryMonitor batteryMonitor;
   shutdown_reason_t shutdownReason;
 
-  AdapterState idleState;
-  AdapterState inUseState;
-  AdapterState shutdownState;
-  AdapterState showBatteryState;
-  AdapterState otaFlashState;
-  FSMT<AdapterState> adapterStateMachine;
+  typedef StateMachine<Adapter, adapter_state_t, adapterStateCount> AdapterStateMachine;
+  static const AdapterStateMachine::Table adapterStates;
+  AdapterStateMachine adapterStateMachine;
 
   BLECharacteristic *pOtaFlash;
+  BLECharacteristic *pOtaControl;
   BLECharacteristic *pOtaIdentity;
-  esp_ota_handle_t otaHandle = 0;
+  OtaUpdater otaUpdater;
 
   void verifyFirmware();
   void onLongPressed();
   void onShortPressed();
   void lowBatteryWatchguard();
+  float readBatteryVoltage();
+  power_profile_t currentPowerProfile();
+  void printBatteryStatus();
+  void printStateStats();
+  bool onHardwareCommand(extended_hw_cmd_t *cmd);
   void updateSendReceiveStatus();
   bool isUSBPower();
   void doShutdown();
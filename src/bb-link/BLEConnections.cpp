@@ -0,0 +1,205 @@
+#include "BLEConnections.h"
+
+static const uint8_t FEND = 0xC0;
+
+BLEConnections::BLEConnections()
+{
+  clear();
+}
+
+bool BLEConnections::add(uint16_t connId)
+{
+  if (find(connId) != nullptr)
+  {
+    return true;
+  }
+  for (uint8_t i = 0; i < BLE_MAX_CONNECTIONS; i++)
+  {
+    ble_connection_t &connection = connections[i];
+    if (!connection.active)
+    {
+      connection.connId = connId;
+      connection.mtu = BLE_DEFAULT_MTU;
+      connection.subscribed = false;
+      connection.framed = false;
+      connection.assembled = 0;
+      connection.dropping = false;
+      connection.active = true;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool BLEConnections::remove(uint16_t connId)
+{
+  ble_connection_t *connection = find(connId);
+  if (connection == nullptr)
+  {
+    return false;
+  }
+  connection->active = false;
+  connection->subscribed = false;
+  return true;
+}
+
+void BLEConnections::clear()
+{
+  for (uint8_t i = 0; i < BLE_MAX_CONNECTIONS; i++)
+  {
+    connections[i].active = false;
+    connections[i].subscribed = false;
+  }
+}
+
+void BLEConnections::setMtu(uint16_t connId, uint16_t mtu)
+{
+  ble_connection_t *connection = find(connId);
+  if (connection != nullptr)
+  {
+    connection->mtu = mtu;
+  }
+}
+
+void BLEConnections::setSubscribed(uint16_t connId, bool subscribed)
+{
+  ble_connection_t *connection = find(connId);
+  if (connection != nullptr)
+  {
+    connection->subscribed = subscribed;
+  }
+}
+
+uint8_t BLEConnections::count() const
+{
+  uint8_t active = 0;
+  for (uint8_t i = 0; i < BLE_MAX_CONNECTIONS; i++)
+  {
+    if (connections[i].active)
+    {
+      active++;
+    }
+  }
+  return active;
+}
+
+uint8_t BLEConnections::subscriberCount() const
+{
+  uint8_t subscribers = 0;
+  forEachSubscriber([&subscribers](uint16_t, size_t)
+                    { subscribers++; });
+  return subscribers;
+}
+
+/*
+  Largest notification payload among the subscribers, 0 when nobody listens.
+  Centrals with a smaller MTU get the same buffer in several notifications.
+*/
+size_t BLEConnections::maxPayload() const
+{
+  size_t largest = 0;
+  forEachSubscriber([&largest](uint16_t, size_t payload)
+                    { largest = max(largest, payload); });
+  return largest;
+}
+
+void BLEConnections::discardPartialFrame(uint16_t connId)
+{
+  ble_connection_t *connection = find(connId);
+  if (connection != nullptr)
+  {
+    connection->assembled = 0;
+    connection->dropping = false;
+  }
+}
+
+void BLEConnections::assemble(uint16_t connId, const uint8_t *data, size_t size, const FrameSink &sink)
+{
+  ble_connection_t *connection = find(connId);
+  if (connection == nullptr)
+  {
+    sink(data, size);
+    return;
+  }
+
+  size_t last = size;
+  for (size_t i = size; i-- > 0;)
+  {
+    if (data[i] == FEND)
+    {
+      last = i;
+      break;
+    }
+  }
+
+  if (last == size)
+  {
+    // No FEND, the middle of a frame or not KISS at all
+    if (connection->framed)
+    {
+      append(connection, data, size);
+    }
+    else
+    {
+      sink(data, size);
+    }
+    return;
+  }
+
+  // Up to the last FEND frames are complete. Held back bytes go first, nothing can come in between.
+  size_t start = 0;
+  if (connection->assembled > 0 || connection->dropping)
+  {
+    size_t first = (const uint8_t *)memchr(data, FEND, size) - data;
+    if (!connection->dropping && connection->assembled + first + 1 <= BLE_FRAME_ASSEMBLY_SIZE)
+    {
+      memcpy(connection->assembly + connection->assembled, data, first + 1);
+      sink(connection->assembly, connection->assembled + first + 1);
+    }
+    connection->assembled = 0;
+    connection->dropping = false;
+    start = first + 1;
+  }
+  if (last + 1 > start)
+  {
+    sink(data + start, last + 1 - start);
+  }
+
+  // Whatever goes to the radio last ends with a FEND, it opens the frame held back
+  connection->framed = true;
+  append(connection, data + last + 1, size - last - 1);
+}
+
+ble_connection_t *BLEConnections::find(uint16_t connId)
+{
+  for (uint8_t i = 0; i < BLE_MAX_CONNECTIONS; i++)
+  {
+    if (connections[i].active && connections[i].connId == connId)
+    {
+      return &connections[i];
+    }
+  }
+  return nullptr;
+}
+
+size_t BLEConnections::payload(const ble_connection_t &connection)
+{
+  return connection.mtu - BLE_ATT_HEADER_SIZE;
+}
+
+void BLEConnections::append(ble_connection_t *connection, const uint8_t *data, size_t size)
+{
+  if (size == 0 || connection->dropping)
+  {
+    return;
+  }
+  if (connection->assembled + size > BLE_FRAME_ASSEMBLY_SIZE)
+  {
+    // Too long to keep whole, it can't go out whole either
+    connection->assembled = 0;
+    connection->dropping = true;
+    return;
+  }
+  memcpy(connection->assembly + connection->assembled, data, size);
+  connection->assembled += size;
+}
@@ -0,0 +1,79 @@
+#pragma once
+#ifndef BLECONNECTIONS_H
+#define BLECONNECTIONS_H
+
+#include "Arduino.h"
+#include <functional>
+
+#define BLE_MAX_CONNECTIONS 3        // CONFIG_BTDM_CTRL_BLE_MAX_CONN of the Arduino core
+#define BLE_DEFAULT_MTU 23           // Until the central negotiates a bigger one
+#define BLE_ATT_HEADER_SIZE 3        // Opcode and handle in front of a notification
+#define BLE_FRAME_ASSEMBLY_SIZE 1024 // Longest KISS frame held back for one central
+
+struct ble_connection_t
+{
+  bool active;
+  bool subscribed; // Notifications turned on in its CCCD
+  uint16_t connId;
+  uint16_t mtu;
+  bool framed;      // Has sent a FEND, bytes after one belong to a frame
+  size_t assembled; // Bytes of a frame started in an earlier write
+  bool dropping;    // Frame too long to hold back, dropped up to its closing FEND
+  uint8_t assembly[BLE_FRAME_ASSEMBLY_SIZE];
+};
+
+/*
+  The centrals connected to the GATT server.
+
+  Entries are added, removed and updated from the Bluedroid task, the loop task
+  only reads them to notify subscribers. A notification racing a disconnect is
+  refused by the stack, nothing worse.
+
+  Writes go thru assemble(): whatever follows the last FEND of a write is held
+  back until the write closing it comes in, so a KISS frame split over several
+  writes reaches the radio in one piece and frames from different centrals
+  never interleave. Complete frames are passed on from the write itself.
+  Every call of the sink holds whole frames, each up to its closing FEND, so
+  the radio gets all of them or none: the held back bytes go out in one call
+  with what closes them, a frame too long to hold back is dropped.
+*/
+class BLEConnections
+{
+public:
+  typedef std::function<void(const uint8_t *data, size_t size)> FrameSink;
+
+  BLEConnections();
+  bool add(uint16_t connId);
+  bool remove(uint16_t connId);
+  void clear();
+  void setMtu(uint16_t connId, uint16_t mtu);
+  void setSubscribed(uint16_t connId, bool subscribed);
+  uint8_t count() const;
+  uint8_t subscriberCount() const;
+  size_t maxPayload() const;
+  void discardPartialFrame(uint16_t connId);
+  void assemble(uint16_t connId, const uint8_t *data, size_t size, const FrameSink &sink);
+
+  // Calls f(connId, payload) for every subscribed central, payload being the most a notification can carry
+  template <typename F>
+  void forEachSubscriber(F f) const
+  {
+    for (uint8_t i = 0; i < BLE_MAX_CONNECTIONS; i++)
+    {
+      const ble_connection_t &connection = connections[i];
+      if (connection.active && connection.subscribed)
+      {
+        f(connection.connId, payload(connection));
+      }
+    }
+  }
+
+private:
+  ble_connection_t connections[BLE_MAX_CONNECTIONS];
+
+  ble_connection_t *find(uint16_t connId);
+  static size_t payload(const ble_connection_t &connection);
+  static void append(ble_connection_t *connection, const uint8_t *data, size_t size);
+};
+
+#endif
@@ -0,0 +1,169 @@
+#include <ArduinoLog.h>
+#include "BatteryMonitor.h"
+
+/*
+  Single cell LiPo discharge curve, voltage to state of charge in percent.
+  Typical values for a small pouch cell at light load (C/5).
+*/
+struct discharge_point_t
+{
+  float voltage;
+  float charge;
+};
+
+static const discharge_point_t DISCHARGE_CURVE[] = {
+    {4.20, 100}, {4.15, 95}, {4.11, 90}, {4.08, 85}, {4.02, 80}, {3.98, 75}, {3.95, 70}, {3.91, 65}, {3.87, 60}, {3.85, 55}, {3.84, 50}, {3.82, 45}, {3.80, 40}, {3.79, 35}, {3.77, 30}, {3.75, 25}, {3.73, 20}, {3.71, 15}, {3.69, 10}, {3.61, 5}, {3.27, 0}};
+
+static const size_t DISCHARGE_CURVE_POINTS = sizeof(DISCHARGE_CURVE) / sizeof(DISCHARGE_CURVE[0]);
+
+/*
+  Initial current draw per power profile in mA, as measured on a TinyPICO at 80 MHz.
+  Refined at runtime from the observed discharge rate.
+*/
+static const float DEFAULT_CURRENT_DRAW[powerProfileCount] = {80, 110, 140};
+
+BatteryMonitor::BatteryMonitor(uint16_t capacityMah, float criticalVoltage)
+    : capacityMah(capacityMah), criticalVoltage(criticalVoltage)
+{
+  for (int i = 0; i < powerProfileCount; i++)
+  {
+    currentDraw[i] = DEFAULT_CURRENT_DRAW[i];
+  }
+}
+
+float BatteryMonitor::stateOfChargeForVoltage(float voltage)
+{
+  if (voltage >= DISCHARGE_CURVE[0].voltage)
+  {
+    return 100;
+  }
+  for (size_t i = 1; i < DISCHARGE_CURVE_POINTS; i++)
+  {
+    if (voltage >= DISCHARGE_CURVE[i].voltage)
+    {
+      // Linear interpolation between the two surrounding points
+      const discharge_point_t &upper = DISCHARGE_CURVE[i - 1];
+      const discharge_point_t &lower = DISCHARGE_CURVE[i];
+      return lower.charge + (voltage - lower.voltage) * (upper.charge - lower.charge) / (upper.voltage - lower.voltage);
+    }
+  }
+  return 0;
+}
+
+void BatteryMonitor::addSample(float voltage, unsigned long now)
+{
+  if (!primed)
+  {
+    filteredVoltage = voltage;
+    primed = true;
+    restartLearning(now);
+  }
+  else
+  {
+    // A real discharge moves by a few mV per minute. A sudden drop is the battery
+    // sagging under a current burst, so only let a fraction of it thru.
+    if (voltage < filteredVoltage - BATTERY_SAG_STEP)
+    {
+      voltage = filteredVoltage - BATTERY_SAG_STEP;
+    }
+    filteredVoltage += (voltage - filteredVoltage) / BATTERY_FILTER_WEIGHT;
+  }
+
+  if (!externalPower && filteredVoltage < criticalVoltage)
+  {
+    if (criticalCount < BATTERY_CRITICAL_CONFIRMATIONS)
+    {
+      criticalCount++;
+    }
+  }
+  else
+  {
+    criticalCount = 0;
+  }
+
+  learnCurrentDraw(now);
+}
+
+void BatteryMonitor::setPowerProfile(power_profile_t newProfile, unsigned long now)
+{
+  if (newProfile != profile)
+  {
+    learnCurrentDraw(now);
+    profile = newProfile;
+    restartLearning(now);
+  }
+}
+
+void BatteryMonitor::setExternalPower(bool newExternalPower, unsigned long now)
+{
+  if (newExternalPower != externalPower)
+  {
+    externalPower = newExternalPower;
+    criticalCount = 0;
+    restartLearning(now);
+  }
+}
+
+void BatteryMonitor::restartLearning(unsigned long now)
+{
+  learnSince = now;
+  learnStartCharge = primed ? getStateOfCharge() : -1;
+}
+
+void BatteryMonitor::learnCurrentDraw(unsigned long now)
+{
+  // Charging or no reference point, nothing to learn from
+  if (externalPower || learnStartCharge < 0)
+  {
+    return;
+  }
+
+  unsigned long elapsed = now - learnSince;
+  float drop = learnStartCharge - getStateOfCharge();
+  if (elapsed < BATTERY_LEARN_MIN_DURATION || drop < BATTERY_LEARN_MIN_DROP)
+  {
+    return;
+  }
+
+  float hours = elapsed / 3600000.0;
+  float observed = (drop / 100.0) * capacityMah / hours;
+  currentDraw[profile] = (currentDraw[profile] * 3 + observed) / 4;
+  Log.traceln("Battery: profile %d draws %d mA", profile, (int)currentDraw[profile]);
+  restartLearning(now);
+}
+
+bool BatteryMonitor::hasReading()
+{
+  return primed;
+}
+
+float BatteryMonitor::getVoltage()
+{
+  return filteredVoltage;
+}
+
+float BatteryMonitor::getStateOfCharge()
+{
+  return stateOfChargeForVoltage(filteredVoltage);
+}
+
+uint16_t BatteryMonitor::getCurrentDraw(power_profile_t forProfile)
+{
+  return (uint16_t)currentDraw[forProfile];
+}
+
+uint16_t BatteryMonitor::estimateRuntimeMinutes()
+{
+  if (externalPower || !primed)
+  {
+    return UINT16_MAX;
+  }
+  float remainingMah = getStateOfCharge() / 100.0 * capacityMah;
+  float minutes = remainingMah / currentDraw[profile] * 60;
+  return minutes < UINT16_MAX ? (uint16_t)minutes : UINT16_MAX - 1;
+}
+
+bool BatteryMonitor::isCritical()
+{
+  return criticalCount >= BATTERY_CRITICAL_CONFIRMATIONS;
+}
@@ -0,0 +1,61 @@
+#pragma once
+#ifndef BATTERYMONITOR_H
+#define BATTERYMONITOR_H
+
+#include "Arduino.h"
+
+#define BATTERY_FILTER_WEIGHT 8                   // Exponential filter weight, each sample moves the estimate by 1/weight
+#define BATTERY_SAG_STEP 0.050                    // Max voltage drop accepted per sample, anything larger is a load transient
+#define BATTERY_CRITICAL_CONFIRMATIONS 6          // Consecutive filtered readings below critical voltage before declaring it
+#define BATTERY_LEARN_MIN_DURATION 10 * 60 * 1000 // Min time spent in a power profile before learning its current draw
+#define BATTERY_LEARN_MIN_DROP 2.0                // Min state of charge drop, in percent, before learning current draw
+
+/*
+  Power profiles the adapter goes thru. Each one draws a different current,
+  which is what the runtime estimate is based on.
+*/
+enum power_profile_t : uint8_t
+{
+  powerProfileIdle = 0x00,           // Nothing connected
+  powerProfileRadioConnected = 0x01, // Radio connected, no BLE central
+  powerProfileInUse = 0x02,          // Radio and BLE central connected
+  powerProfileCount = 0x03
+};
+
+class BatteryMonitor
+{
+public:
+  BatteryMonitor(uint16_t capacityMah, float criticalVoltage);
+
+  void addSample(float voltage, unsigned long now);
+  void setPowerProfile(power_profile_t profile, unsigned long now);
+  void setExternalPower(bool externalPower, unsigned long now);
+
+  bool hasReading();
+  float getVoltage();
+  float getStateOfCharge();
+  uint16_t getCurrentDraw(power_profile_t profile);
+  uint16_t estimateRuntimeMinutes();
+  bool isCritical();
+
+  static float stateOfChargeForVoltage(float voltage);
+
+private:
+  uint16_t capacityMah;
+  float criticalVoltage;
+
+  float filteredVoltage = 0;
+  bool primed = false;
+  uint8_t criticalCount = 0;
+
+  bool externalPower = false;
+  power_profile_t profile = powerProfileIdle;
+  float currentDraw[powerProfileCount];
+  unsigned long learnSince = 0;
+  float learnStartCharge = -1;
+
+  void learnCurrentDraw(unsigned long now);
+  void restartLearning(unsigned long now);
+};
+
+#endif
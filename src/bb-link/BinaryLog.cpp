@@ -0,0 +1,98 @@
+#include "BinaryLog.h"
+
+BinaryLog binaryLog;
+
+void BinaryLog::begin()
+{
+#if !defined(EPOXY_DUINO)
+  if (!taskLayout.start(
+          drainTask,                  // Task function
+          "logDrain",                 // Task name
+          BINARY_LOG_TASK_STACK_SIZE, // Stack size
+          this,                       // Task input parameter
+          BINARY_LOG_TASK_PRIORITY,   // Priority of the task
+          &drainTaskHandle            // Task handle
+          ))
+  {
+    Log.errorln("Log: failed to start drain task, logging synchronously");
+    return;
+  }
+#endif
+  async = true;
+}
+
+#if !defined(EPOXY_DUINO)
+void BinaryLog::drainTask(void *param)
+{
+  BinaryLog *log = (BinaryLog *)param;
+  for (;;)
+  {
+    log->drain();
+    vTaskDelay(pdMS_TO_TICKS(BINARY_LOG_DRAIN_INTERVAL));
+  }
+}
+#endif
+
+/*
+  Formats and prints records, on the drain task
+*/
+void BinaryLog::drain()
+{
+  log_record_t record;
+  while (records.receive(&record))
+  {
+    // The prefix shows when the record was posted, not when it is printed
+    drainingTime = record.time;
+    draining = true;
+    switch (record.argc)
+    {
+    case 0:
+      emit(record.level, record.format);
+      break;
+    case 1:
+      emit(record.level, record.format, record.args[0]);
+      break;
+    case 2:
+      emit(record.level, record.format, record.args[0], record.args[1]);
+      break;
+    case 3:
+      emit(record.level, record.format, record.args[0], record.args[1], record.args[2]);
+      break;
+    default:
+      emit(record.level, record.format, record.args[0], record.args[1], record.args[2], record.args[3]);
+      break;
+    }
+    draining = false;
+  }
+
+  uint32_t dropped = records.getDropped();
+  if (dropped != reportedDropped)
+  {
+    Log.warningln("Log: %d records dropped", dropped - reportedDropped);
+    reportedDropped = dropped;
+  }
+}
+
+/*
+  For the log prefix
+*/
+unsigned long BinaryLog::timestamp()
+{
+#if !defined(EPOXY_DUINO)
+  if (draining && xTaskGetCurrentTaskHandle() == drainTaskHandle)
+  {
+    return drainingTime;
+  }
+#else
+  if (draining)
+  {
+    return drainingTime;
+  }
+#endif
+  return millis();
+}
+
+uint32_t BinaryLog::getDropped()
+{
+  return records.getDropped();
+}
@@ -0,0 +1,151 @@
+#pragma once
+#ifndef BINARYLOG_H
+#define BINARYLOG_H
+
+#include "Arduino.h"
+#include <ArduinoLog.h>
+#include <type_traits>
+
+#include "EventInbox.h"
+#include "TaskLayout.h"
+
+#define BINARY_LOG_SIZE 64             // Records waiting to be printed, power of two
+#define BINARY_LOG_MAX_ARGS 4
+#define BINARY_LOG_DRAIN_INTERVAL 20   // ms between two drains of the ring
+#define BINARY_LOG_TASK_STACK_SIZE 3072
+
+/*
+  Per module compile time levels. Call sites above the module level are removed
+  by the compiler, override with -DBLOG_LEVEL_BRIDGE=LOG_LEVEL_WARNING and the like.
+*/
+#ifndef BLOG_LEVEL_BRIDGE
+#define BLOG_LEVEL_BRIDGE LOG_LEVEL_VERBOSE
+#endif
+#ifndef BLOG_LEVEL_KISS
+#define BLOG_LEVEL_KISS LOG_LEVEL_VERBOSE
+#endif
+#ifndef BLOG_LEVEL_OTA
+#define BLOG_LEVEL_OTA LOG_LEVEL_VERBOSE
+#endif
+
+#define BLOG_ENABLED(module, level) ((level) <= BLOG_LEVEL_##module && (level) <= Log.getLevel())
+
+#define BLOG(module, level, ...)          \
+  do                                      \
+  {                                       \
+    if ((level) <= BLOG_LEVEL_##module)   \
+    {                                     \
+      binaryLog.post((level), __VA_ARGS__); \
+    }                                     \
+  } while (0)
+
+#define BLOG_ERROR(module, ...) BLOG(module, LOG_LEVEL_ERROR, __VA_ARGS__)
+#define BLOG_WARNING(module, ...) BLOG(module, LOG_LEVEL_WARNING, __VA_ARGS__)
+#define BLOG_INFO(module, ...) BLOG(module, LOG_LEVEL_INFO, __VA_ARGS__)
+#define BLOG_TRACE(module, ...) BLOG(module, LOG_LEVEL_TRACE, __VA_ARGS__)
+#define BLOG_VERBOSE(module, ...) BLOG(module, LOG_LEVEL_VERBOSE, __VA_ARGS__)
+
+/*
+  The format string address is the record id, it lives in flash and is only
+  read when the record is printed. Arguments are stored as machine words, so
+  integers only, or string literals.
+*/
+struct log_record_t
+{
+  uint32_t time;
+  const char *format;
+  uint8_t level;
+  uint8_t argc;
+  uintptr_t args[BINARY_LOG_MAX_ARGS];
+};
+
+/*
+  Logging for hot paths. Posting a record costs a few stores into a lock-free
+  ring, a low priority task formats and prints them to the ArduinoLog output.
+  Until begin() is called, and on the host, records are printed right away.
+*/
+class BinaryLog
+{
+public:
+  void begin();
+
+  template <typename... Args>
+  void post(uint8_t level, const char *format, Args... args)
+  {
+    static_assert(sizeof...(Args) <= BINARY_LOG_MAX_ARGS, "Too many arguments for a binary log record");
+    if (level > Log.getLevel())
+    {
+      return;
+    }
+    if (!async)
+    {
+      emit(level, format, args...);
+      return;
+    }
+    log_record_t record;
+    record.time = millis();
+    record.format = format;
+    record.level = level;
+    record.argc = sizeof...(Args);
+    uintptr_t values[] = {0, toWord(args)...};
+    memcpy(record.args, values + 1, sizeof...(Args) * sizeof(uintptr_t));
+    records.post(record);
+  }
+
+  void drain();
+  unsigned long timestamp();
+  uint32_t getDropped();
+
+private:
+  EventInbox<log_record_t, BINARY_LOG_SIZE> records;
+  bool async = false;
+  volatile bool draining = false;
+  uint32_t drainingTime = 0;
+  uint32_t reportedDropped = 0;
+#if !defined(EPOXY_DUINO)
+  TaskHandle_t drainTaskHandle = NULL;
+  static void drainTask(void *param);
+#endif
+
+  template <typename T>
+  static inline uintptr_t toWord(T value)
+  {
+    static_assert(std::is_integral<T>::value || std::is_enum<T>::value, "Binary log arguments must be integers or string literals");
+    return (uintptr_t)value;
+  }
+
+  static inline uintptr_t toWord(const char *value)
+  {
+    return (uintptr_t)value;
+  }
+
+  template <typename... Args>
+  static void emit(uint8_t level, const char *format, Args... args)
+  {
+    switch (level)
+    {
+    case LOG_LEVEL_FATAL:
+      Log.fatalln(format, args...);
+      break;
+    case LOG_LEVEL_ERROR:
+      Log.errorln(format, args...);
+      break;
+    case LOG_LEVEL_WARNING:
+      Log.warningln(format, args...);
+      break;
+    case LOG_LEVEL_INFO:
+      Log.infoln(format, args...);
+      break;
+    case LOG_LEVEL_TRACE:
+      Log.traceln(format, args...);
+      break;
+    default:
+      Log.verboseln(format, args...);
+      break;
+    }
+  }
+};
+
+extern BinaryLog binaryLog;
+
+#endif
@@ -1,6 +1,6 @@
 #include <ArduinoLog.h>
 #include "Bridge.h"
-#include "Adapter.h"
+#include "Version.h"
 #include <map>
 
 /*
@@ -13,77 +13,78 @@
 
 #define BYTE_TRANSMIT_TIME 7             // Aprox time in ms to transmit a byte at 1200 baud
 #define RETRY_BTC_CONNECT_INTERVAL 15000 // Try to connect to radio Bluetooth Classic interface every x ms
+#define BTC_CONNECT_TASK_STACK_SIZE 4096
+const size_t JOURNAL_PAGE_SIZE = 512;    // Records in a GET_JOURNAL reply, header included
 const size_t RX_BUF_SIZE = 1024;         // BLE 4.2 supports up to 512. MTU is negotiated by client.
 
 const char PREF_RADIO_NAME[] = "radioName";
 const char PREF_RADIO_ADDRESS[] = "radioAddress";
 const char PREF_RIG_CTRL[] = "rigCtrl";
+const char PREF_DUPLICATE_WINDOW[] = "dupWindow";
+const char PREF_FRAME_FILTER[] = "frameFilter";
+const char PREF_JOURNAL[] = "journal";
+const char PREF_STORE_POLICY[] = "storePolicy";
+const char PREF_STORE_RETENTION[] = "storeRetention";
 
 extern char _remote_name[ESP_BT_GAP_MAX_BDNAME_LEN + 1];
 extern bool _isRemoteAddressSet;
 
-extern Adapter adapter;
+// Enter, update and exit of each ble_state_t
+const Bridge::BLEStateMachine::Table Bridge::bleStates = {
+    {&Bridge::bleDisconnectedEnter, &Bridge::bleDisconnectedUpdate, &Bridge::bleDisconnectedExit},
+    {&Bridge::bleConnectedEnter, &Bridge::bleConnectedUpdate, &Bridge::bleConnectedExit}};
 
-void connectToBluetooth(void *address)
-{
-  Log.traceln("BTC: connecting to Bluetooth Classic interface");
-  adapter.bridge.btSerial.connect((uint8_t *)address, 0, ESP_SPP_SEC_NONE, ESP_SPP_ROLE_MASTER);
-  vTaskDelete(NULL);
-}
-
-Bridge::Bridge(String adapterName) : bleDisconnectedState(
-                                         [this]
-                                         { this->bleDisconnectedEnter(); },
-                                         [this]
-                                         { this->bleDisconnectedUpdate(); },
-                                         [this]
-                                         { this->bleDisconnectedExit(); }),
-                                     bleConnectedState(
-                                         [this]
-                                         { this->bleConnectedEnter(); },
-                                         [this]
-                                         { this->bleConnectedUpdate(); },
-                                         [this]
-                                         { this->bleConnectedExit(); }),
-                                     bleStateMachine(bleDisconnectedState),
-                                     btcDisconnectedState(
-                                         [this]
-                                         { this->btcDisconnectedEnter(); },
-                                         [this]
-                                         { this->btcDisconnectedUpdate(); },
-                                         [this]
-                                         { this->btcDisconnectedExit(); }),
-                                     btcConnectedState(
-                                         [this]
-                                         { this->btcConnectedEnter(); },
-                                         [this]
-                                         { this->btcConnectedUpdate(); },
-                                         [this]
-                                         { this->btcConnectedExit(); }),
-                                     btcDiscoveryState(
-                                         [this]
-                                         { this->btcDiscoveryEnter(); },
-                                         [this]
-                                         { this->btcDiscoveryUpdate(); },
-                                         [this]
-                                         { this->btcDiscoveryExit(); }),
-                                     btcStateMachine(btcDisconnectedState),
+// Enter, update and exit of each btc_state_t
+const Bridge::BTCStateMachine::Table Bridge::btcStates = {
+    {&Bridge::btcDisconnectedEnter, &Bridge::btcDisconnectedUpdate, &Bridge::btcDisconnectedExit},
+    {&Bridge::btcConnectedEnter, &Bridge::btcConnectedUpdate, &Bridge::btcConnectedExit},
+    {&Bridge::btcDiscoveryEnter, &Bridge::btcDiscoveryUpdate, &Bridge::btcDiscoveryExit}};
+
+static const char *const BLE_STATE_NAMES[bleStateCount] = {"bleDisconnected", "bleConnected"};
+static const char *const BTC_STATE_NAMES[btcStateCount] = {"btcDisconnected", "btcConnected", "btcDiscovery"};
+
+static const char *const LATENCY_STAGE_NAMES[latencyStageCount] = {"outboundTotal", "outboundSpp", "inboundQueue", "inboundNotify", "inboundTotal"};
+
+// Raw SPP and GATTS callbacks are plain functions
+static Bridge *callbackBridge = nullptr;
+
+Bridge::Bridge(String adapterName) : bleStateMachine(this, bleStates, bleDisconnectedState),
+                                     btcStateMachine(this, btcStates, btcDisconnectedState),
                                      adapterName(adapterName),
-                                     cmdQueue(10)
+                                     notifier([this](const uint8_t *data, size_t size)
+                                              { notify(data, size); })
 {
 }
 
 bool Bridge::init()
 {
   Log.traceln("Bridge: init");
+  Log.traceln("Bridge: state machines save %d bytes of RAM", BLEStateMachine::savedMemory() + BTCStateMachine::savedMemory());
   rxLingerUntil = millis();
   txLingerUntil = millis();
+  LatencyHistogram::calibrate();
 
   preferences.begin(PREFERENCES_NAMESPACE, false);
   useRigControl = preferences.getBool(PREF_RIG_CTRL, true);
+  duplicates.setWindow(preferences.getUChar(PREF_DUPLICATE_WINDOW, 0) * 1000);
+  frame_filter_rule_t rules[FRAME_FILTER_MAX_RULES];
+  size_t rulesSize = preferences.getBytes(PREF_FRAME_FILTER, rules, sizeof(rules));
+  frameFilter.restore(rules, rulesSize / sizeof(frame_filter_rule_t));
+  frameStore.configure((frame_store_policy_t)preferences.getUChar(PREF_STORE_POLICY, frameStoreOff),
+                       preferences.getUShort(PREF_STORE_RETENTION, 0) * 60000UL);
+  bool useJournal = preferences.getBool(PREF_JOURNAL, false);
   preferences.end();
 
   Log.infoln("Use rig control: %s", useRigControl ? "true" : "false");
+  Log.infoln("Duplicate window: %d ms", duplicates.getWindow());
+  Log.infoln("Frame filter rules: %d", frameFilter.getRuleCount());
+  Log.infoln("Store and forward: %d, %d ms", frameStore.getPolicy(), frameStore.getRetention());
+
+  // Off unless asked for, its flash writes stall both cores
+  if (journal.init())
+  {
+    journal.setRecording(useJournal);
+  }
 
   bool ok = initBTC();
   if (ok)
@@ -96,37 +97,391 @@ bool Bridge::init()
 
 void Bridge::perform()
 {
+  processEvents();
   bleStateMachine.update();
   btcStateMachine.update();
 
+  // Whatever the link would not take while congested
+  pumpToRadio();
+
   uint8_t rxBuf[RX_BUF_SIZE];
   size_t rxLen = 0;
 
   // Process any command received from BLE
+  extended_hw_cmd_t cmd;
   while (!cmdQueue.isEmpty())
   {
-    Log.traceln("BLE: dequeueing extended hardware command");
-    processingCmdQueue = true;
-    extended_hw_cmd_t cmd = cmdQueue.dequeue();
-    processExtendedHardwareCommand(&cmd);
+    BLOG_TRACE(BRIDGE, "BLE: dequeueing extended hardware command");
+    // Raised before the command leaves the queue, onWrite sees one or the other
+    processingCmdQueue.store(true);
+    if (cmdQueue.pop(&cmd))
+    {
+      processExtendedHardwareCommand(&cmd);
+    }
+  }
+  processingCmdQueue.store(false);
+
+  // Connected both ways, the data path takes nothing from the heap
+  HeapWatch::Scope steady(isReady());
+
+  // Done, out of time or stopped, the app gets the figures
+  if (selfTest.expire((uint32_t)esp_timer_get_time()) || selfTest.takeFinished())
+  {
+    replySelfTest();
   }
-  processingCmdQueue = false;
 
-  if (isReady())
+  // Self test traffic takes the place of the radio's, which waits
+  if (selfTest.isDownloading())
+  {
+    pumpSelfTest();
+  }
+  else if (selfTest.isUploading())
+  {
+    // The app has the link to itself
+  }
+  // Nobody to tell, keep what the radio hears for later
+  else if (frameStore.isEnabled() && btcConnected() && connections.subscriberCount() == 0)
+  {
+    storeFramesFromRadio();
+  }
+  else if (isReady())
   {
-    // Buffer data available from BTC
-    while (btSerial.available() && rxLen < mtuSize)
+    uint32_t readStart = LatencyHistogram::now();
+    bool replaying = false;
+
+    // Buffer data available from BTC, as much as the central with the largest MTU takes.
+    // Nobody subscribed yet, it is drained all the same.
+    size_t payload = connections.maxPayload();
+    if (payload == 0 || payload > RX_BUF_SIZE)
+    {
+      payload = RX_BUF_SIZE;
+    }
+    if (frameStore.getCount() > 0)
+    {
+      // What was stored goes first, in bulk, the radio waits its turn
+      rxLen = frameStore.replay(rxBuf, RX_BUF_SIZE, millis());
+      metrics.add(metricFramesReplayed, fromRadioFrames.count(rxBuf, rxLen));
+      replaying = true;
+    }
+    else if (filteringInbound())
     {
-      rxBuf[rxLen++] = btSerial.read();
+      rxLen = readFramesFromRadio(rxBuf, payload);
+    }
+    else
+    {
+      // A frame left over from when filtering was on
+      if (inboundFrame.size() > 0)
+      {
+        memcpy(rxBuf, inboundFrame.data(), inboundFrame.size());
+        rxLen = inboundFrame.size();
+        inboundFrame.clear();
+      }
+      while (btSerial.available() && rxLen < payload)
+      {
+        rxBuf[rxLen++] = btSerial.read();
+      }
     }
     // Send data to BLE
     if (rxLen > 0)
     {
-      Log.traceln("BLE < BTC: %i", rxLen);
-      setRxLinger(BYTE_TRANSMIT_TIME * rxLen);
-      pRx->setValue(rxBuf, rxLen);
-      pRx->notify();
+      uint32_t arrived = replaying ? 0 : inboundSince.exchange(0);
+      uint32_t queued = (uint32_t)esp_timer_get_time() - arrived;
+
+      BLOG_TRACE(BRIDGE, "BLE < BTC: %i", rxLen);
+      // Stored frames are not on the air anymore
+      if (!replaying)
+      {
+        setRxLinger(BYTE_TRANSMIT_TIME * rxLen);
+      }
+      uint32_t notifyStart = LatencyHistogram::now();
+      notifier.sendData(rxBuf, rxLen);
+      if (!replaying)
+      {
+        journal.append(journalFromRadio, rxBuf, rxLen);
+      }
+      latency[latencyInboundNotify].record(LatencyHistogram::elapsedMicros(notifyStart));
+      if (arrived != 0)
+      {
+        latency[latencyInboundQueue].record(queued);
+        latency[latencyInboundTotal].record(queued + LatencyHistogram::elapsedMicros(readStart));
+        // More than a MTU worth came in, the rest has been waiting as long
+        if (btSerial.available())
+        {
+          uint32_t none = 0;
+          inboundSince.compare_exchange_strong(none, arrived);
+        }
+      }
+      metrics.add(metricBytesFromRadio, rxLen);
+      metrics.add(metricFramesFromRadio, fromRadioFrames.count(rxBuf, rxLen));
+    }
+  }
+
+  // Replies held back by a frame the radio has not finished
+  notifier.poll(millis());
+}
+
+/*
+  Something perform() would get to right away, the loop task does not sleep
+*/
+bool Bridge::hasPendingWork()
+{
+  // Only what perform() reads from the radio counts, bytes left alone would keep the loop task
+  // from ever waiting and starve the tasks below it
+  bool readingRadio = !selfTest.isDownloading() && !selfTest.isUploading() &&
+                      (isReady() || (frameStore.isEnabled() && btcConnected()));
+  return !cmdQueue.isEmpty() || (readingRadio && btSerial.available() > 0) || (isReady() && frameStore.getCount() > 0) ||
+         selfTest.isDownloading() || (!sppOutbound.isEmpty() && !sppOutbound.isCongested());
+}
+
+/*
+  A few pattern frames per round, as fast as the stack takes them
+*/
+void Bridge::pumpSelfTest()
+{
+  if (connections.subscriberCount() == 0)
+  {
+    return;
+  }
+  uint8_t frame[SELF_TEST_MAX_FRAME];
+  uint8_t escaped[SELF_TEST_MAX_FRAME * 2 + 2];
+  for (int i = 0; i < SELF_TEST_FRAMES_PER_ROUND; i++)
+  {
+    size_t length = selfTest.nextFrame(frame, (uint32_t)esp_timer_get_time());
+    if (length == 0)
+    {
+      break;
+    }
+    size_t escapedSize = sizeof(escaped);
+    kissInterceptor.escape(frame, length, escaped, &escapedSize);
+    uint32_t failed = metrics.get(metricNotificationsFailed);
+    notifier.sendData(escaped, escapedSize);
+    selfTest.sent(metrics.get(metricNotificationsFailed) == failed, (uint32_t)esp_timer_get_time());
+  }
+}
+
+void Bridge::replySelfTest()
+{
+  uint8_t report[SELF_TEST_REPORT_SIZE];
+  size_t size = selfTest.report(report, (uint32_t)esp_timer_get_time());
+  reply(EXTENDED_HW_CMD_SELF_TEST, report, size);
+}
+
+bool Bridge::filteringInbound()
+{
+  return duplicates.isEnabled() || frameFilter.isEnabled();
+}
+
+/*
+  Whole frames only, those dropped never wake the phone. A frame still coming
+  in waits in inboundFrame for the next round.
+*/
+size_t Bridge::readFramesFromRadio(uint8_t *buffer, size_t payload)
+{
+  size_t length = 0;
+  while (btSerial.available() && length < payload && length + inboundFrame.size() < RX_BUF_SIZE)
+  {
+    if (!inboundFrame.push(btSerial.read()))
+    {
+      continue;
+    }
+    if (keepInbound(inboundFrame.data(), inboundFrame.size()))
+    {
+      memcpy(buffer + length, inboundFrame.data(), inboundFrame.size());
+      length += inboundFrame.size();
     }
+    inboundFrame.clear();
+  }
+
+  // All dropped, nothing waits for a notification
+  if (length == 0 && inboundFrame.size() == 0 && !btSerial.available())
+  {
+    inboundSince.store(0);
+  }
+  return length;
+}
+
+/*
+  Whole frames, those the filters drop are not worth the room
+*/
+void Bridge::storeFramesFromRadio()
+{
+  while (btSerial.available())
+  {
+    if (!inboundFrame.push(btSerial.read()))
+    {
+      continue;
+    }
+    if (keepInbound(inboundFrame.data(), inboundFrame.size()))
+    {
+      // Journaled as heard, not as replayed
+      journal.append(journalFromRadio, inboundFrame.data(), inboundFrame.size());
+      if (frameStore.store(inboundFrame.data(), inboundFrame.size(), millis()))
+      {
+        metrics.add(metricFramesStored);
+      }
+    }
+    inboundFrame.clear();
+  }
+  inboundSince.store(0);
+}
+
+bool Bridge::keepInbound(const uint8_t *frame, size_t size)
+{
+  // Not AX.25, nothing to judge it by
+  if (!ax25.parse(frame, size))
+  {
+    return true;
+  }
+  // Before the duplicates, a frame nobody wants should not be remembered
+  if (frameFilter.isEnabled() && !frameFilter.matches(ax25))
+  {
+    BLOG_TRACE(BRIDGE, "Bridge: frame filtered out");
+    metrics.add(metricFramesFiltered);
+    return false;
+  }
+  if (duplicates.isEnabled() && duplicates.seen(ax25, millis()))
+  {
+    BLOG_TRACE(BRIDGE, "Bridge: duplicate frame dropped");
+    metrics.add(metricDuplicatesDropped);
+    return false;
+  }
+  return true;
+}
+
+void Bridge::postEvent(const bridge_event_t &event)
+{
+  if (!events.post(event))
+  {
+    Log.warningln("Bridge: event inbox full, %d events dropped", events.getDropped());
+  }
+  taskLayout.wake();
+}
+
+/*
+  Events are handled one at a time, to completion. A transition an event asks for
+  is applied before the next event is looked at, so a quick connect and disconnect
+  still runs both.
+
+  The BLE side is connected from the first central in to the last one out. The
+  controller stops advertising on each connection, it is started again as long
+  as there is room for another central by the time the event is handled.
+*/
+void Bridge::processEvents()
+{
+  bridge_event_t event;
+  while (events.receive(&event))
+  {
+    switch (event.type)
+    {
+    case bleConnectEvent:
+      Log.infoln("BLE: central %d connected, %d in all", event.connId, event.centrals);
+      metrics.add(metricBleConnects);
+      metrics.highWater(metricBleCentralsHighWater, event.centrals);
+      if (!bleStateMachine.isInState(bleConnectedState))
+      {
+        bleStateMachine.transitionTo(bleConnectedState);
+        bleStateMachine.applyPendingTransition();
+      }
+      // Later connections may have been made already
+      if (connections.count() < BLE_MAX_CONNECTIONS)
+      {
+        startAdvertisingBLE();
+      }
+      break;
+
+    case bleDisconnectEvent:
+      Log.infoln("BLE: central %d disconnected, %d left", event.connId, event.centrals);
+      if (event.centrals == 0)
+      {
+        bleStateMachine.transitionTo(bleDisconnectedState);
+        bleStateMachine.applyPendingTransition();
+      }
+      else if (connections.count() < BLE_MAX_CONNECTIONS)
+      {
+        startAdvertisingBLE();
+      }
+      break;
+
+    case btcDeviceFoundEvent:
+      // A late result after the scan was stopped is of no use to the app
+      if (btcStateMachine.isInState(btcDiscoveryState))
+      {
+        reply(EXTENDED_HW_CMD_FOUND_DEVICE, reinterpret_cast<uint8_t *>(&event.device), 1 + sizeof(esp_bd_addr_t) + strlen(event.device.name));
+      }
+      break;
+    }
+  }
+}
+
+void Bridge::printStateStats(Print &out)
+{
+  out.println("BLE state machine:");
+  bleStateMachine.printStats(out, BLE_STATE_NAMES);
+  out.println("BTC state machine:");
+  btcStateMachine.printStats(out, BTC_STATE_NAMES);
+}
+
+void Bridge::printLatency(Print &out)
+{
+  for (uint8_t i = 0; i < latencyStageCount; i++)
+  {
+    latency[i].print(out, LATENCY_STAGE_NAMES[i]);
+  }
+}
+
+/*
+  The connect method in BT serial is blocking, it runs on its own task
+*/
+void Bridge::connectTask(void *param)
+{
+  Bridge *bridge = (Bridge *)param;
+  Log.traceln("BTC: connecting to Bluetooth Classic interface");
+  bridge->btSerial.connect(bridge->remoteAddress, 0, ESP_SPP_SEC_NONE, ESP_SPP_ROLE_MASTER);
+  taskLayout.exit();
+}
+
+/*
+  Raw SPP events, called on the BT task in addition to BluetoothSerial's own handling
+*/
+void Bridge::onSppEvent(esp_spp_cb_event_t event, esp_spp_cb_param_t *param)
+{
+  if (callbackBridge == nullptr)
+  {
+    return;
+  }
+  if (event == ESP_SPP_CONG_EVT || event == ESP_SPP_WRITE_EVT)
+  {
+    bool congested = event == ESP_SPP_CONG_EVT ? param->cong.cong : param->write.cong;
+    callbackBridge->sppOutbound.setCongested(congested, (uint32_t)esp_timer_get_time());
+    if (!congested && !callbackBridge->sppOutbound.isEmpty())
+    {
+      taskLayout.wake();
+    }
+  }
+  else if (event == ESP_SPP_DATA_IND_EVT)
+  {
+    // Only the first byte not yet notified counts, 0 means none pending
+    uint32_t now = (uint32_t)esp_timer_get_time() | 1;
+    uint32_t none = 0;
+    callbackBridge->inboundSince.compare_exchange_strong(none, now);
+    taskLayout.wake();
+  }
+}
+
+/*
+  Raw GATTS events, called on the Bluedroid task after BLEServer's own handling.
+  BLE2902 keeps a single CCCD value for everybody, the subscription of each
+  central is tracked here instead.
+*/
+void Bridge::onGattsEvent(esp_gatts_cb_event_t event, esp_gatt_if_t gattsIf, esp_ble_gatts_cb_param_t *param)
+{
+  Bridge *bridge = callbackBridge;
+  if (event == ESP_GATTS_WRITE_EVT && bridge != nullptr && param->write.handle == bridge->pRxCccd->getHandle() && param->write.len == 2)
+  {
+    // Little endian, bit 0 turns notifications on
+    bool subscribed = (param->write.value[0] & 0x01) != 0;
+    Log.traceln("BLE: central %d %s", param->write.conn_id, subscribed ? "subscribed" : "unsubscribed");
+    bridge->connections.setSubscribed(param->write.conn_id, subscribed);
   }
 }
 
@@ -156,6 +511,16 @@ String Bridge::getAdapterName()
   return adapterName;
 }
 
+void Bridge::addCapabilities(uint16_t caps)
+{
+  extraCapabilities |= caps;
+}
+
+void Bridge::setOnHardwareCommandCallback(std::function<bool(extended_hw_cmd_t *cmd)> callback)
+{
+  onHardwareCommandCallback = callback;
+}
+
 bool Bridge::isReady()
 {
   return (bleStateMachine.isInState(bleConnectedState) && btcStateMachine.isInState(btcConnectedState));
@@ -183,6 +548,9 @@ bool Bridge::initBTC()
   btSerial.onAuthComplete([this](bool success)
                           { this->onBTAuthCompleteCallback(success); });
 
+  callbackBridge = this;
+  btSerial.register_callback(onSppEvent);
+
   if (!btSerial.begin(adapterName, true))
   {
     Log.fatalln("FATAL: BTC init failed !!!!!");
@@ -222,7 +590,8 @@ bool Bridge::initBLE()
       RX_UUID,
       BLECharacteristic::PROPERTY_NOTIFY);
 
-  pRx->addDescriptor(new BLE2902());
+  pRxCccd = new BLE2902();
+  pRx->addDescriptor(pRxCccd);
 
   pRx->setAccessPermissions(ESP_GATT_PERM_READ);
   pTx->setAccessPermissions(ESP_GATT_PERM_WRITE);
@@ -232,6 +601,9 @@ bool Bridge::initBLE()
 
   pService->start();
 
+  callbackBridge = this;
+  BLEDevice::setCustomGattsHandler(onGattsEvent);
+
   return true;
 }
 
@@ -256,10 +628,11 @@ void Bridge::stopAdvertisingBLE()
 
 void Bridge::clearAllPendingBTCData()
 {
-  // Purge anything that may be pending
+  // Purge anything that may be pending, flush() would wait on a congested link
+  sppOutbound.clear();
+  outboundSince.store(0);
   if (btSerial.connected())
   {
-    btSerial.flush();
     while (btSerial.available())
     {
       btSerial.read();
@@ -305,7 +678,7 @@ void Bridge::lookUpLastPairedDevice()
         // Check if address match
         if (BTAddress(radioAddress).equals(BTAddress(pairedDeviceBtAddr[i])))
         {
-          Log.infoln("Found paired device name: %s", radioName);
+          Log.infoln("Found paired device name: %s", radioName.c_str());
           memcpy(remoteAddress, pairedDeviceBtAddr[i], ESP_BD_ADDR_LEN);
           strcpy(remoteName, radioName.c_str());
           connectToPairedDevice = true;
@@ -313,7 +686,7 @@ void Bridge::lookUpLastPairedDevice()
         }
         else
         {
-          Log.infoln("Found paired device name does not match saved, name: %s address: %s", radioName, BTAddress(radioAddress).toString().c_str());
+          Log.infoln("Found paired device name does not match saved, name: %s address: %s", radioName.c_str(), BTAddress(radioAddress).toString().c_str());
           clearPairedDevices();
           break;
         }
@@ -409,62 +782,12 @@ void Bridge::processExtendedHardwareCommand(extended_hw_cmd_t *cmd)
     if (useRigControl)
     {
       Log.traceln("BTC: extended_hw_set_frequency");
-      previousFrequency = 0;
+      previousSettings.frequency = 0;
 
       if (vfo != vfoUnknown)
       {
-        // At this point, we should always be in KISS mode. Exit KISS mode first so we don't have to wait for a timeout
-        thd7x.exitKISS();
-
-        // Just to be sure
-        if (thd7x.isKISSMode())
-        {
-          Log.warningln("BTC: still in KISS mode?");
-          thd7x.exitKISS();
-        }
-
-        Log.infoln("BTC: try to get baud rate");
-        if (thd7x.getBaudRate(&previousBaudRate))
-        {
-          Log.infoln("BTC: previous baud rate: %d", previousBaudRate);
-        }
-
-        if (desiredBaudRate != baudRateUnknown && previousBaudRate != desiredBaudRate)
-        {
-          Log.infoln("BTC: set baud rate");
-          thd7x.setBaudRate(desiredBaudRate);
-        }
-
-        Log.infoln("BTC: try to get mode");
-        if (thd7x.getMode(vfo, &previousMode))
-        {
-          Log.infoln("BTC: previous mode: %d", previousMode);
-          if (previousMode != modeFM)
-          {
-            thd7x.setMode(vfo, modeFM);
-          }
-        }
-        else
-        {
-          previousMode = modeUnknown;
-          Log.errorln("BTC: failed to get previous mode");
-        }
-
-        Log.infoln("BTC: try to set frequency: %d", cmd->data.uint32);
-
-        if (thd7x.getFrequency(vfo, &previousFrequency))
-        {
-          Log.infoln("BTC: previousFrequency: %l", previousFrequency);
-          thd7x.setFrequency(vfo, cmd->data.uint32);
-        }
-        else
-        {
-          previousFrequency = 0;
-          Log.errorln("BTC: failed to get previous frequency");
-        }
-
-        // Show time
-        thd7x.setTNC(vfo, tncKISS);
+        metrics.add(metricQsy);
+        thd7x.qsy(vfo, cmd->data.uint32, desiredBaudRate, &previousSettings);
       }
       else
       {
@@ -479,35 +802,13 @@ void Bridge::processExtendedHardwareCommand(extended_hw_cmd_t *cmd)
     {
       Log.traceln("BTC: extended_hw_restore_frequency");
 
-      if (vfo != vfoUnknown && previousFrequency > 0)
+      if (vfo != vfoUnknown && previousSettings.frequency > 0)
       {
-        // Always exit KISS mode first so we don't have to wait for a timeout
-        thd7x.exitKISS();
-
-        // Just to be sure
-        if (thd7x.isKISSMode())
-        {
-          Log.warningln("BTC: still in KISS mode?");
-          thd7x.exitKISS();
-        }
-
-        Log.infoln("BTC: try to restore frequency to %i", previousFrequency);
-        thd7x.setFrequency(vfo, previousFrequency);
-        previousFrequency = 0;
-
-        if (previousMode != modeUnknown && previousMode != modeFM)
-        {
-          thd7x.setMode(vfo, previousMode);
-        }
-
-        if (desiredBaudRate != baudRateUnknown && previousBaudRate != desiredBaudRate)
+        // Kept when the radio could not be reached, to try again
+        if (thd7x.restore(vfo, desiredBaudRate, &previousSettings))
         {
-          Log.infoln("BTC: restore baud rate");
-          thd7x.setBaudRate(previousBaudRate);
+          previousSettings.frequency = 0;
         }
-
-        // As long as BLE is connected, we want the radio to be in KISS mode
-        thd7x.setTNC(vfo, tncKISS);
       }
       else
       {
@@ -584,15 +885,16 @@ void Bridge::processExtendedHardwareCommand(extended_hw_cmd_t *cmd)
   {
     Log.traceln("BTC: extended_hw_firmware_version");
     // create period delimited version string
-    String version = String(FIRMWARE_VERSION_MAJOR) + "." + String(FIRMWARE_VERSION_MINOR) + "." + String(FIRMWARE_VERSION_PATCH);
-    reply(EXTENDED_HW_CMD_FIRMWARE_VERSION, (uint8_t *)version.c_str(), strlen(version.c_str()));
+    char version[16];
+    int length = snprintf(version, sizeof(version), "%d.%d.%d", FIRMWARE_VERSION_MAJOR, FIRMWARE_VERSION_MINOR, FIRMWARE_VERSION_PATCH);
+    reply(EXTENDED_HW_CMD_FIRMWARE_VERSION, (uint8_t *)version, length);
     break;
   }
   case extended_hw_capabilities:
   {
     Log.traceln("BTC: extended_hw_capabilities");
     uint16_t caps;
-    caps = useRigControl ? CAP_RIG_CTRL : 0 | CAP_FIRMWARE_VERSION;
+    caps = (useRigControl ? CAP_RIG_CTRL : 0) | CAP_FIRMWARE_VERSION | CAP_STATE_STATS | CAP_STATS | CAP_LATENCY | CAP_DUPLICATES | CAP_FRAME_FILTER | CAP_STORE_FORWARD | (journal.isEnabled() ? CAP_JOURNAL : 0) | CAP_SELF_TEST | extraCapabilities;
     reply16(EXTENDED_HW_CMD_CAPABILITIES, caps);
     break;
   }
@@ -630,8 +932,181 @@ void Bridge::processExtendedHardwareCommand(extended_hw_cmd_t *cmd)
     factoryReset();
     break;
   }
+  case extended_hw_get_stats:
+  {
+    Log.traceln("BTC: extended_hw_get_stats");
+    metrics.set(metricEventsDropped, events.getDropped());
+    metrics.set(metricStoredFramesDropped, frameStore.getDropped());
+    metrics.set(metricJournalDropped, journal.getDropped());
+    metrics.set(metricSteadyAllocations, HeapWatch::getAllocations());
+    metrics.set(metricCmdQueueHighWater, cmdQueue.getHighWater());
+    metrics.set(metricCmdQueueOverflows, cmdQueue.getOverflows());
+    metrics.set(metricSppQueueDepth, sppOutbound.getDepth());
+    metrics.set(metricSppQueueHighWater, sppOutbound.getHighWater());
+    metrics.set(metricSppWritesDropped, sppOutbound.getOverflows());
+    metrics.set(metricSppStalls, sppOutbound.getStalls());
+    metrics.set(metricSppStallTime, sppOutbound.getStallMillis((uint32_t)esp_timer_get_time()));
+    uint8_t stats[BridgeMetrics::maxSerializedSize()];
+    size_t size = metrics.serialize(stats);
+    reply(EXTENDED_HW_CMD_GET_STATS, stats, size);
+    break;
+  }
+  case extended_hw_get_latency:
+  {
+    Log.traceln("BTC: extended_hw_get_latency");
+    if (cmd->data.uint8 >= latencyStageCount)
+    {
+      Log.errorln("BTC: unknown latency stage %d", cmd->data.uint8);
+      break;
+    }
+    uint8_t histogram[1 + LatencyHistogram::maxSerializedSize()];
+    histogram[0] = cmd->data.uint8;
+    size_t size = latency[cmd->data.uint8].serialize(histogram + 1);
+    reply(EXTENDED_HW_CMD_GET_LATENCY, histogram, size + 1);
+    break;
+  }
+  case extended_hw_set_duplicate_window:
+  {
+    Log.traceln("BTC: extended_hw_set_duplicate_window");
+    Log.infoln("BTC: duplicate window %d s", cmd->data.uint8);
+    duplicates.setWindow(cmd->data.uint8 * 1000);
+    preferences.begin(PREFERENCES_NAMESPACE, false);
+    preferences.putUChar(PREF_DUPLICATE_WINDOW, cmd->data.uint8);
+    preferences.end();
+    break;
+  }
+  case extended_hw_set_frame_filter:
+  {
+    Log.traceln("BTC: extended_hw_set_frame_filter");
+    if (!frameFilter.add(cmd->data.bytes, FRAME_FILTER_RULE_SIZE))
+    {
+      Log.errorln("BTC: frame filter rule refused, kind %d", cmd->data.bytes[0]);
+    }
+    else
+    {
+      preferences.begin(PREFERENCES_NAMESPACE, false);
+      if (frameFilter.isEnabled())
+      {
+        preferences.putBytes(PREF_FRAME_FILTER, frameFilter.getRules(), frameFilter.getRuleCount() * sizeof(frame_filter_rule_t));
+      }
+      else
+      {
+        // Empty values are not stored
+        preferences.remove(PREF_FRAME_FILTER);
+      }
+      preferences.end();
+    }
+    // The app tells whether its rule made it by the count
+    reply8(EXTENDED_HW_CMD_SET_FRAME_FILTER, frameFilter.getRuleCount());
+    break;
+  }
+  case extended_hw_self_test:
+  {
+    Log.traceln("BTC: extended_hw_self_test");
+    uint32_t now = (uint32_t)esp_timer_get_time();
+    uint32_t bytes = ((uint32_t)cmd->data.bytes[1] << 24) | ((uint32_t)cmd->data.bytes[2] << 16) |
+                     (cmd->data.bytes[3] << 8) | cmd->data.bytes[4];
+    uint16_t frameSize = (cmd->data.bytes[5] << 8) | cmd->data.bytes[6];
+    switch (cmd->data.bytes[0])
+    {
+    case selfTestDownload:
+      // One frame per notification unless asked otherwise, FENDs aside
+      if (frameSize == 0 && connections.maxPayload() > 2)
+      {
+        frameSize = connections.maxPayload() - 2;
+      }
+      Log.infoln("BLE: self test, streaming %d bytes in frames of %d", bytes, frameSize);
+      selfTest.startDownload(bytes, frameSize, now);
+      break;
+    case selfTestUpload:
+      Log.infoln("BLE: self test, taking in %d bytes", bytes);
+      selfTest.startUpload(bytes, now);
+      break;
+    case selfTestStop:
+      selfTest.stop();
+      break;
+    case selfTestReport:
+      break;
+    default:
+      Log.errorln("BLE: unknown self test action %d", cmd->data.bytes[0]);
+      break;
+    }
+    replySelfTest();
+    break;
+  }
+  case extended_hw_set_journal:
+  {
+    Log.traceln("BTC: extended_hw_set_journal");
+    journal.setRecording(cmd->data.uint8 != 0x00);
+    preferences.begin(PREFERENCES_NAMESPACE, false);
+    preferences.putBool(PREF_JOURNAL, journal.isRecording());
+    preferences.end();
+    // Off when there is no partition for it
+    reply8(EXTENDED_HW_CMD_SET_JOURNAL, journal.isRecording());
+    break;
+  }
+  case extended_hw_get_journal:
+  {
+    Log.traceln("BTC: extended_hw_get_journal");
+    uint32_t from = ((uint32_t)cmd->data.bytes[1] << 24) | ((uint32_t)cmd->data.bytes[2] << 16) |
+                    (cmd->data.bytes[3] << 8) | cmd->data.bytes[4];
+    uint32_t cursor = cmd->data.bytes[0] == journalFromTime ? journal.seek(from) : from;
+    uint8_t page[JOURNAL_PAGE_SIZE];
+    size_t size = journal.read(cursor, page, sizeof(page));
+    reply(EXTENDED_HW_CMD_GET_JOURNAL, page, size);
+    break;
+  }
+  case extended_hw_set_store_forward:
+  {
+    Log.traceln("BTC: extended_hw_set_store_forward");
+    frame_store_policy_t policy = (frame_store_policy_t)cmd->data.bytes[0];
+    uint16_t retention = (cmd->data.bytes[1] << 8) | cmd->data.bytes[2];
+    if (!frameStore.configure(policy, retention * 60000UL))
+    {
+      Log.errorln("BTC: can't store frames with policy %d", policy);
+      break;
+    }
+    Log.infoln("BTC: store and forward %d, retention %d min", policy, retention);
+    preferences.begin(PREFERENCES_NAMESPACE, false);
+    preferences.putUChar(PREF_STORE_POLICY, policy);
+    preferences.putUShort(PREF_STORE_RETENTION, retention);
+    preferences.end();
+    break;
+  }
+  case extended_hw_get_state_stats:
+  {
+    Log.traceln("BTC: extended_hw_get_state_stats");
+    uint8_t stats[1 + BTCStateMachine::maxStatsSize()];
+    size_t size;
+    stats[0] = cmd->data.uint8;
+    if (cmd->data.uint8 == stateMachineBLE)
+    {
+      size = bleStateMachine.serializeStats(stats + 1);
+    }
+    else if (cmd->data.uint8 == stateMachineBTC)
+    {
+      size = btcStateMachine.serializeStats(stats + 1);
+    }
+    else if (cmd->data.uint8 == stateMachineAdapter && onHardwareCommandCallback != nullptr && onHardwareCommandCallback(cmd))
+    {
+      // Replied by the adapter
+      break;
+    }
+    else
+    {
+      // The id alone, no statistics, tells the app there is no such state machine
+      Log.errorln("BTC: unknown state machine %d", cmd->data.uint8);
+      size = 0;
+    }
+    reply(EXTENDED_HW_CMD_GET_STATE_STATS, stats, size + 1);
+    break;
+  }
   default:
-    Log.errorln("BTC: unknown extended hardware command");
+    // Commands that are not about the bridge itself, like battery status, are handled by the adapter
+    if (onHardwareCommandCallback == nullptr || !onHardwareCommandCallback(cmd))
+    {
+      Log.errorln("BTC: unknown extended hardware command");
+    }
     break;
   }
 }
@@ -665,9 +1140,12 @@ void Bridge::reply(uint8_t *response, size_t size)
 
   if (kissInterceptor.escape(response, size, buffer, &bufferSize))
   {
-    Log.infoln("BLE < (adapter): %i", bufferSize);
-    pRx->setValue(buffer, bufferSize);
-    pRx->notify();
+    BLOG_INFO(BRIDGE, "BLE < (adapter): %i", bufferSize);
+    if (!notifier.sendControl(buffer, bufferSize, millis()))
+    {
+      BLOG_WARNING(BRIDGE, "BLE: no room for reply");
+      metrics.add(metricRepliesDropped);
+    }
   }
   else
   {
@@ -675,12 +1153,93 @@ void Bridge::reply(uint8_t *response, size_t size)
   }
 }
 
+/*
+  Fan out to every subscribed central from the same buffer, split in as many
+  notifications as the MTU of each one needs
+*/
+void Bridge::notify(const uint8_t *data, size_t size)
+{
+  esp_gatt_if_t gattsIf = pBLEServer->getGattsIf();
+  uint16_t handle = pRx->getHandle();
+  connections.forEachSubscriber([this, gattsIf, handle, data, size](uint16_t connId, size_t payload)
+                                {
+    for (size_t sent = 0; sent < size; sent += payload)
+    {
+      size_t length = min(payload, size - sent);
+      if (esp_ble_gatts_send_indicate(gattsIf, connId, handle, length, (uint8_t *)data + sent, false) == ESP_OK)
+      {
+        metrics.add(metricNotifications);
+      }
+      else
+      {
+        metrics.add(metricNotificationsFailed);
+      }
+    } });
+}
+
+/*
+  Whole frames only, see BLEConnections::assemble(). They are written in one
+  go, the radio gets all of them or none: a frame cut short would go on air.
+*/
+void Bridge::writeToRadio(const uint8_t *data, size_t size, uint32_t writeStart)
+{
+  BLOG_TRACE(BRIDGE, "BLE > BTC: %i", size);
+
+  // Oldest bytes not handed over yet, the latency is recorded once they are
+  uint32_t none = 0;
+  bool oldest = outboundSince.compare_exchange_strong(none, writeStart | 1);
+  if (!sppOutbound.write(data, size))
+  {
+    BLOG_WARNING(BRIDGE, "BTC: radio link congested, frame dropped");
+    if (oldest)
+    {
+      uint32_t mine = writeStart | 1;
+      outboundSince.compare_exchange_strong(mine, 0);
+    }
+    return;
+  }
+  // What the radio gets, a frame dropped above never reached it
+  journal.append(journalToRadio, data, size);
+  pumpToRadio();
+  setTxLinger(BYTE_TRANSMIT_TIME * size);
+  metrics.add(metricBytesToRadio, size);
+  metrics.add(metricFramesToRadio, toRadioFrames.count(data, size));
+}
+
+/*
+  From the Bluedroid task writing to the radio or the loop task. Once all of
+  it is handed over to BluetoothSerial, the wait of the oldest bytes is
+  recorded, along with the hand over that emptied the buffer.
+*/
+void Bridge::pumpToRadio()
+{
+  uint32_t sppStart = LatencyHistogram::now();
+  sppOutbound.pump();
+  if (!sppOutbound.isEmpty())
+  {
+    return;
+  }
+  uint32_t since = outboundSince.exchange(0);
+  if (since != 0)
+  {
+    latency[latencyOutboundSpp].record(LatencyHistogram::elapsedMicros(sppStart));
+    latency[latencyOutboundTotal].record(LatencyHistogram::elapsedMicros(since));
+  }
+}
+
 /*
   BLEServerCallbacks
 */
 void Bridge::onConnect(BLEServer *pServer, esp_ble_gatts_cb_param_t *param)
 {
-  Log.traceln("BLE: onConnect");
+  uint16_t connId = param->connect.conn_id;
+  Log.traceln("BLE: onConnect %d", connId);
+  if (!connections.add(connId))
+  {
+    Log.warningln("BLE: no room for central %d", connId);
+    pServer->disconnect(connId);
+    return;
+  }
 
   esp_ble_conn_update_params_t conn_params = {};
   memcpy(conn_params.bda, param->connect.remote_bda, sizeof(esp_bd_addr_t));
@@ -691,52 +1250,85 @@ void Bridge::onConnect(BLEServer *pServer, esp_ble_gatts_cb_param_t *param)
   // Start the update process
   esp_ble_gap_update_conn_params(&conn_params);
 
-  bleStateMachine.transitionTo(bleConnectedState);
+  bridge_event_t event = {};
+  event.type = bleConnectEvent;
+  event.connId = connId;
+  event.centrals = connections.count();
+  postEvent(event);
 }
 
-void Bridge::onDisconnect(BLEServer *pServer)
+void Bridge::onDisconnect(BLEServer *pServer, esp_ble_gatts_cb_param_t *param)
 {
-  Log.traceln("BLE: onDisconnect");
-  bleStateMachine.transitionTo(bleDisconnectedState);
+  uint16_t connId = param->disconnect.conn_id;
+  Log.traceln("BLE: onDisconnect %d", connId);
+  if (!connections.remove(connId))
+  {
+    // Turned away in onConnect
+    return;
+  }
+  bridge_event_t event = {};
+  event.type = bleDisconnectEvent;
+  event.connId = connId;
+  event.centrals = connections.count();
+  postEvent(event);
 }
 
 void Bridge::onMtuChanged(BLEServer *pServer, esp_ble_gatts_cb_param_t *param)
 {
-  Log.traceln("BLE: onMtuChanged");
-  mtuSize = param->mtu.mtu;
-  Log.infoln("New MTU size: %d", mtuSize);
+  Log.infoln("BLE: central %d MTU: %d", param->mtu.conn_id, param->mtu.mtu);
+  connections.setMtu(param->mtu.conn_id, param->mtu.mtu);
 }
 
 /*
   BLECharacteristicCallbacks
 */
-void Bridge::onWrite(BLECharacteristic *pCharacteristic)
+void Bridge::onWrite(BLECharacteristic *pCharacteristic, esp_ble_gatts_cb_param_t *param)
 {
-  std::string txValue = pCharacteristic->getValue();
-
-  if (txValue.length() > 0)
+  uint32_t writeStart = LatencyHistogram::now();
+  HeapWatch::Scope steady;
+  uint16_t connId = param->write.conn_id;
+  // Straight from the GATT event, getValue() would copy it once more
+  uint8_t *txValue = param->write.value;
+  size_t txLength = param->write.len;
+
+  if (txLength > 0)
   {
-    Log.traceln("BLE Rx: %i", txValue.length());
+    BLOG_TRACE(BRIDGE, "BLE Rx: %i", txLength);
 
     extended_hw_cmd_t cmd;
-    if (kissInterceptor.extractExtendedHardwareCommand((uint8_t *)pCharacteristic->getData(), txValue.length(), &cmd))
+    if (kissInterceptor.extractExtendedHardwareCommand(txValue, txLength, &cmd))
     {
-      Log.traceln("BLE: queueing extended hardware command");
-      cmdQueue.enqueue(cmd);
+      BLOG_TRACE(BRIDGE, "BLE: queueing extended hardware command");
+      if (!cmdQueue.push(cmd))
+      {
+        BLOG_WARNING(BRIDGE, "BLE: hardware command queue full");
+        return;
+      }
+      metrics.add(metricHardwareCommands);
+      taskLayout.wake();
+    }
+    else if (selfTest.isUploading())
+    {
+      // Counted, the radio never sees it
+      selfTest.received(txLength, (uint32_t)esp_timer_get_time());
     }
     else if (btcStateMachine.isInState(btcConnectedState))
     {
       // Drop data if we're still processing cmds
       // This is to avoid sending data to the radio while it may not have changed frequency yet
-      if (processingCmdQueue || !cmdQueue.isEmpty())
+      if (processingCmdQueue.load() || !cmdQueue.isEmpty())
       {
-        Log.traceln("BLE: dropping data while still processing hw commands");
+        BLOG_TRACE(BRIDGE, "BLE: dropping data while still processing hw commands");
+        metrics.add(metricWritesDropped);
+        metrics.add(metricBytesDropped, txLength);
+        connections.discardPartialFrame(connId);
         return;
       }
 
-      Log.traceln("BLE > BTC: %i", txValue.length());
-      btSerial.write(pCharacteristic->getData(), txValue.length());
-      setTxLinger(BYTE_TRANSMIT_TIME * txValue.length());
+      // Writes of all centrals come in one at a time on the Bluedroid task, frames go out whole
+      connections.assemble(connId, txValue, txLength, [this, writeStart](const uint8_t *data, size_t size)
+                           {
+                             writeToRadio(data, size, writeStart); });
     }
   }
 }
@@ -787,13 +1379,13 @@ void Bridge::btcDisconnectedEnter()
     // The connect method in BT serial is blocking. Use a task to connect
     Log.infoln("BTC: attempt to connect to %s at %s", remoteName, BTAddress(remoteAddress).toString().c_str());
     btSerial.disconnect(); // Just in case. If radio is already connected, reconnecting could lead to crash
-    xTaskCreate(
-        connectToBluetooth,    // Task function
-        "connectBT",           // Task name
-        4096,                  // Stack size
-        (void *)remoteAddress, // Task input parameter
-        1,                     // Priority of the task
-        NULL                   // Task handle
+    metrics.add(metricBtcConnectAttempts);
+    taskLayout.start(
+        connectTask,                // Task function
+        "connectBT",                // Task name
+        BTC_CONNECT_TASK_STACK_SIZE, // Stack size
+        this,                       // Task input parameter
+        CONNECT_TASK_PRIORITY       // Priority of the task
     );
   }
 }
@@ -819,6 +1411,7 @@ void Bridge::btcDisconnectedExit()
 void Bridge::btcConnectedEnter()
 {
   Log.infoln("BTC: connected");
+  metrics.add(metricBtcConnects);
   clearAllPendingBTCData();
 }
 
@@ -832,6 +1425,10 @@ void Bridge::btcConnectedUpdate()
 
 void Bridge::btcConnectedExit()
 {
+  // The next link starts flowing
+  sppOutbound.clear();
+  outboundSince.store(0);
+  sppOutbound.setCongested(false, (uint32_t)esp_timer_get_time());
 }
 
 void Bridge::btcDiscoveryEnter()
@@ -851,13 +1448,15 @@ void Bridge::btcDiscoveryEnter()
     */
     // Filter list to known Kenwood handsets capabilities signature
     // https://www.ampedrftech.com/cod.htm?result=620204
+    // Runs on the BT task, the reply is sent from perform()
     if (pDevice->getCOD() == 0x620204)
     {
-      found_device_t found;
-      found.connected = 0x00;
-      memcpy(found.address, pDevice->getAddress().getNative(), sizeof(esp_bd_addr_t));
-      strcpy(found.name, pDevice->getName().c_str());
-      reply(EXTENDED_HW_CMD_FOUND_DEVICE, reinterpret_cast<uint8_t *>(&found), 1 + sizeof(esp_bd_addr_t) + strlen(found.name));
+      bridge_event_t event = {};
+      event.type = btcDeviceFoundEvent;
+      event.device.connected = 0x00;
+      memcpy(event.device.address, pDevice->getAddress().getNative(), sizeof(esp_bd_addr_t));
+      strncpy(event.device.name, pDevice->getName().c_str(), sizeof(event.device.name) - 1);
+      postEvent(event);
     } }))
   {
     Log.traceln("BTC: started scan");
@@ -902,12 +1501,21 @@ void Bridge::bleDisconnectedExit()
 void Bridge::bleConnectedEnter()
 {
   Log.infoln("BLE: connected");
+  if (frameStore.isEnabled())
+  {
+    storeFramesFromRadio();
+  }
   clearAllPendingBTCData();
 
   if (useRigControl)
   {
     vfo = vfoUnknown;
-    previousTNCMode = tncUnknown;
+    // Held in KISS while away, what it was before is still known
+    if (!heldInKISS)
+    {
+      previousTNCMode = tncUnknown;
+    }
+    heldInKISS = false;
 
     // Make sure there is a radio to talk to
     if (btcStateMachine.isInState(btcConnectedState))
@@ -916,12 +1524,20 @@ void Bridge::bleConnectedEnter()
       * We don't know what TNC mode the radio is in. If the KISS TNC is already on,
       * we can't send any commands to the radio, so we have to exit it first.
       */
-      if (thd7x.isKISSMode())
+      kiss_mode_t kissMode = thd7x.getKISSMode();
+      if (kissMode == kissOn)
       {
         Log.traceln("BLE: already in KISS mode");
-        previousTNCMode = tncKISS;
+        if (previousTNCMode == tncUnknown)
+        {
+          previousTNCMode = tncKISS;
+        }
         thd7x.exitKISS();
       }
+      else if (kissMode == kissUnknown)
+      {
+        Log.warningln("BLE: radio link congested, TNC mode unknown");
+      }
 
       // Figure out which VFO is active for KISS mode
       tnc_mode_t mode;
@@ -955,26 +1571,31 @@ void Bridge::bleConnectedUpdate()
 
 void Bridge::bleConnectedExit()
 {
+  notifier.reset();
+  selfTest.stop();
   if (useRigControl)
   {
     // Make sure there is a radio to talk to
     if (btcStateMachine.isInState(btcConnectedState))
     {
-      if (previousTNCMode != tncKISS && previousTNCMode != tncUnknown && vfo != vfoUnknown)
+      if (previousTNCMode != tncKISS && previousTNCMode != tncUnknown && vfo != vfoUnknown && frameStore.isEnabled())
+      {
+        Log.traceln("BLE: staying in KISS mode to store frames");
+        heldInKISS = true;
+      }
+      else if (previousTNCMode != tncKISS && previousTNCMode != tncUnknown && vfo != vfoUnknown)
       {
         Log.traceln("BLE: restoring initial KISS mode");
-
-        // Always exit KISS mode first so we don't have to wait for a timeout
-        thd7x.exitKISS();
-
-        // Just to be sure
-        if (thd7x.isKISSMode())
+        if (thd7x.leaveKISS())
         {
-          Log.warningln("BLE: still in KISS mode?");
-          thd7x.exitKISS();
+          thd7x.setTNC(vfo, previousTNCMode);
+        }
+        else
+        {
+          // Still in KISS, put back on the next disconnect
+          Log.warningln("BLE: radio not reached, left in KISS mode");
+          heldInKISS = true;
         }
-
-        thd7x.setTNC(vfo, previousTNCMode);
       }
     }
   }
@@ -2,19 +2,41 @@
 #ifndef BRIDGE_H
 #define BRIDGE_H
 
+#ifndef EPOXY_DUINO
 #include "BluetoothSerial.h"
 #include <BLEDevice.h>
 #include <BLEUtils.h>
 #include <BLEServer.h>
 #include <BLE2902.h>
 #include <Preferences.h>
-#include <ArduinoQueue.h>
+#else
+#include "MockBluetoothSerial.h"
+#include "MockBLEDevice.h"
+#include "MockPreferences.h"
+#include "MockEsp.h"
+#endif
 
 #include "THD7x.h"
-#include "FiniteStateMachine.h"
+#include "SppOutbound.h"
+#include "StateMachine.h"
+#include "EventInbox.h"
+#include "SpscRing.h"
+#include "BridgeMetrics.h"
+#include "LatencyHistogram.h"
+#include "BinaryLog.h"
 #include "KISSInterceptor.h"
+#include "BLEConnections.h"
+#include "AX25Frame.h"
+#include "DuplicateCache.h"
+#include "FrameFilter.h"
+#include "FrameStore.h"
+#include "TrafficJournal.h"
+#include "SelfTest.h"
+#include "NotifyScheduler.h"
+#include "HeapWatch.h"
+#include "TaskLayout.h"
 
-#if !defined(CONFIG_BT_ENABLED) || !defined(CONFIG_BLUEDROID_ENABLED)
+#if !defined(EPOXY_DUINO) && (!defined(CONFIG_BT_ENABLED) || !defined(CONFIG_BLUEDROID_ENABLED))
 #error Bluetooth is not enabled! Please run `make menuconfig` to and enable it
 #endif
 
@@ -22,13 +44,81 @@ const uint16_t API_VERSION = 0x0100; // Used to check compatibility between adap
 const char PREFERENCES_NAMESPACE[] = "bb-link";
 
 const uint16_t CAP_RIG_CTRL = 0x0010;
+const uint16_t CAP_BATTERY = 0x0020;
+const uint16_t CAP_STATE_STATS = 0x0040;
+const uint16_t CAP_STATS = 0x0080;
+const uint16_t CAP_LATENCY = 0x0100;
+const uint16_t CAP_DUPLICATES = 0x0400;
 const uint16_t CAP_FIRMWARE_VERSION = 0x0800;
+const uint16_t CAP_FRAME_FILTER = 0x1000;
+const uint16_t CAP_STORE_FORWARD = 0x2000;
+const uint16_t CAP_JOURNAL = 0x4000;
+const uint16_t CAP_SELF_TEST = 0x8000;
 
-DECLARE_STATE(BLEState);
-DECLARE_STATE(BTCState);
+enum journal_query_t : uint8_t
+{
+  journalFromTime = 0x00,
+  journalFromCursor = 0x01
+};
+
+enum ble_state_t : uint8_t
+{
+  bleDisconnectedState = 0x00,
+  bleConnectedState = 0x01,
+  bleStateCount = 0x02
+};
+
+enum btc_state_t : uint8_t
+{
+  btcDisconnectedState = 0x00,
+  btcConnectedState = 0x01,
+  btcDiscoveryState = 0x02,
+  btcStateCount = 0x03
+};
 
 #define PAIR_MAX_DEVICES 10
 #define MAX_BTC_DEVICE_NAME_LEN 248
+// State machine selector of EXTENDED_HW_CMD_GET_STATE_STATS
+enum state_machine_id_t : uint8_t
+{
+  stateMachineAdapter = 0x00,
+  stateMachineBLE = 0x01,
+  stateMachineBTC = 0x02
+};
+
+/*
+  Where a frame spends its time inside the adapter, selector of EXTENDED_HW_CMD_GET_LATENCY
+*/
+enum latency_stage_t : uint8_t
+{
+  latencyOutboundTotal = 0x00,  // GATT write callback to handed over to BluetoothSerial, congestion included
+  latencyOutboundSpp = 0x01,    // Handing the outbound buffer over to BluetoothSerial alone
+  latencyInboundQueue = 0x02,   // First SPP byte received to picked up by perform()
+  latencyInboundNotify = 0x03,  // Notification alone
+  latencyInboundTotal = 0x04,   // First SPP byte received to notification done
+  latencyStageCount = 0x05
+};
+
+#define BRIDGE_EVENT_INBOX_SIZE 8 // Events posted by the Bluedroid and BT tasks, power of two
+#define BRIDGE_CMD_QUEUE_SIZE 16  // Hardware commands written by the centrals, power of two
+
+/*
+  Posted from Bluetooth callbacks, handled by the task running perform()
+*/
+enum bridge_event_type_t : uint8_t
+{
+  bleConnectEvent = 0x00,
+  bleDisconnectEvent = 0x01,
+  btcDeviceFoundEvent = 0x02
+};
+
+struct bridge_event_t
+{
+  bridge_event_type_t type;
+  uint16_t connId;
+  uint8_t centrals; // Connected once the event happened
+  found_device_t device;
+};
 
 class Bridge : public BLECharacteristicCallbacks, public BLEServerCallbacks
 {
@@ -36,6 +126,7 @@ public:
   Bridge(String adapterName);
   bool init();
   void perform();
+  bool hasPendingWork();
   bool isReady();
   bool btcConnected();
   bool btcDiscovery();
@@ -46,6 +137,11 @@ public:
   void factoryReset();
   BLEServer * getBLEServer();
   String getAdapterName();
+  void addCapabilities(uint16_t caps);
+  void setOnHardwareCommandCallback(std::function<bool(extended_hw_cmd_t *cmd)> callback);
+  void reply(uint8_t cmd, uint8_t *data, size_t size);
+  void printStateStats(Print &out);
+  void printLatency(Print &out);
   
   BluetoothSerial btSerial;
 
@@ -56,25 +152,41 @@ private:
 
   BLECharacteristic *pTx;
   BLECharacteristic *pRx;
-  uint16_t mtuSize = 512;
+  BLEDescriptor *pRxCccd;
+  BLEConnections connections;
 
-  THD7x thd7x = THD7x(btSerial);
+  SppOutbound sppOutbound = SppOutbound(btSerial); // Everything written to the radio
+  THD7x thd7x = THD7x(btSerial, &sppOutbound);
   vfo_t vfo = vfoUnknown;
-  uint32_t previousFrequency = 0;
+  qsy_settings_t previousSettings = {0, modeUnknown, baudRateUnknown};
   tnc_mode_t previousTNCMode = tncUnknown;
-  baud_rate_t previousBaudRate = baudRateUnknown;
+  bool heldInKISS = false; // Left in KISS mode while no central was connected, for the frame store or as the radio could not be reached
   baud_rate_t desiredBaudRate = baudRateUnknown;
-  vfo_mode_t previousMode = modeUnknown;
 
   KISSInterceptor kissInterceptor = KISSInterceptor();
+  KISSFrameReader inboundFrame;
+  AX25Frame ax25;
+  DuplicateCache duplicates;
+  FrameFilter frameFilter;
+  FrameStore frameStore;
+  TrafficJournal journal;
+  SelfTest selfTest;
 
-  BLEState bleDisconnectedState;
-  BLEState bleConnectedState;
-  FSMT<BLEState> bleStateMachine;
-  BTCState btcDisconnectedState;
-  BTCState btcConnectedState;
-  BTCState btcDiscoveryState;
-  FSMT<BTCState> btcStateMachine;
+  typedef StateMachine<Bridge, ble_state_t, bleStateCount> BLEStateMachine;
+  typedef StateMachine<Bridge, btc_state_t, btcStateCount> BTCStateMachine;
+  static const BLEStateMachine::Table bleStates;
+  static const BTCStateMachine::Table btcStates;
+  BLEStateMachine bleStateMachine;
+  BTCStateMachine btcStateMachine;
+  EventInbox<bridge_event_t, BRIDGE_EVENT_INBOX_SIZE> events;
+
+  BridgeMetrics metrics;
+  KISSFrameCounter toRadioFrames;
+  KISSFrameCounter fromRadioFrames;
+
+  LatencyHistogram latency[latencyStageCount];
+  std::atomic<uint32_t> inboundSince{0}; // esp_timer time of the first byte not notified yet, SPP data comes in on the BT task
+  std::atomic<uint32_t> outboundSince{0}; // LatencyHistogram time of the oldest write not handed over yet
   unsigned int txLingerUntil = 0;
   unsigned int rxLingerUntil = 0;
   unsigned int lastDeviceLookup = 0;
@@ -84,10 +196,13 @@ private:
   char remoteName[MAX_BTC_DEVICE_NAME_LEN];
   bool connectToPairedDevice = false;
   bool useRigControl = true;
+  uint16_t extraCapabilities = 0;
+  std::function<bool(extended_hw_cmd_t *cmd)> onHardwareCommandCallback = nullptr;
 
   Preferences preferences;
-  ArduinoQueue<extended_hw_cmd_t> cmdQueue;
-  bool processingCmdQueue = false;
+  SpscRing<extended_hw_cmd_t, BRIDGE_CMD_QUEUE_SIZE> cmdQueue; // Bluedroid task to loop task
+  NotifyScheduler notifier;
+  std::atomic<bool> processingCmdQueue{false};
 
   bool initBTC();
   bool initBLE();
@@ -100,21 +215,34 @@ private:
   void processExtendedHardwareCommand(extended_hw_cmd_t *cmd);
   void clearStoredPairedDeviceInfo();
   void clearRemoteDeviceInfo();
+  void postEvent(const bridge_event_t &event);
+  static void onSppEvent(esp_spp_cb_event_t event, esp_spp_cb_param_t *param);
+  static void onGattsEvent(esp_gatts_cb_event_t event, esp_gatt_if_t gattsIf, esp_ble_gatts_cb_param_t *param);
+  static void connectTask(void *param);
+  void processEvents();
 
   void reply8(uint8_t cmd, uint8_t data);
   void reply16(uint8_t cmd, uint16_t data);
-  void reply(uint8_t cmd, uint8_t *data, size_t size);
   void reply(uint8_t *response, size_t size);
+  void notify(const uint8_t *data, size_t size);
+  void writeToRadio(const uint8_t *data, size_t size, uint32_t writeStart);
+  void pumpToRadio();
+  bool filteringInbound();
+  size_t readFramesFromRadio(uint8_t *buffer, size_t payload);
+  void storeFramesFromRadio();
+  void pumpSelfTest();
+  void replySelfTest();
+  bool keepInbound(const uint8_t *frame, size_t size);
 
   void onRead(BLECharacteristic *pCharacteristic);
-  void onWrite(BLECharacteristic *pCharacteristic);
+  void onWrite(BLECharacteristic *pCharacteristic, esp_ble_gatts_cb_param_t *param);
 
   void onBTConfirmRequestCallback(uint32_t numVal);
   void onBTAuthCompleteCallback(bool success);
 
   void onMtuChanged(BLEServer *pServer, esp_ble_gatts_cb_param_t *param);
   void onConnect(BLEServer *pServer, esp_ble_gatts_cb_param_t *param);
-  void onDisconnect(BLEServer *pServer);  
+  void onDisconnect(BLEServer *pServer, esp_ble_gatts_cb_param_t *param);
 
   void bleDisconnectedEnter();
   void bleDisconnectedUpdate();
@@ -0,0 +1,52 @@
+#include "BridgeMetrics.h"
+
+static const uint8_t FEND = 0xC0;
+
+BridgeMetrics::BridgeMetrics()
+{
+  for (int i = 0; i < metricCount; i++)
+  {
+    counters[i].store(0, std::memory_order_relaxed);
+  }
+}
+
+/*
+  Big endian: count[1] {value[4]} * count
+*/
+size_t BridgeMetrics::serialize(uint8_t *buffer)
+{
+  set(metricUptime, millis() / 1000);
+
+  uint8_t *p = buffer;
+  *p++ = metricCount;
+  for (int i = 0; i < metricCount; i++)
+  {
+    uint32_t value = get((bridge_metric_t)i);
+    *p++ = (value >> 24) & 0xFF;
+    *p++ = (value >> 16) & 0xFF;
+    *p++ = (value >> 8) & 0xFF;
+    *p++ = value & 0xFF;
+  }
+  return p - buffer;
+}
+
+uint32_t KISSFrameCounter::count(const uint8_t *data, size_t size)
+{
+  uint32_t frames = 0;
+  for (size_t i = 0; i < size; i++)
+  {
+    if (data[i] == FEND)
+    {
+      if (inFrame)
+      {
+        frames++;
+        inFrame = false;
+      }
+    }
+    else
+    {
+      inFrame = true;
+    }
+  }
+  return frames;
+}
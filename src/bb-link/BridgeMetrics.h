@@ -0,0 +1,103 @@
+#pragma once
+#ifndef BRIDGEMETRICS_H
+#define BRIDGEMETRICS_H
+
+#include "Arduino.h"
+#include <atomic>
+
+/*
+  Counters reported by EXTENDED_HW_CMD_GET_STATS, in reply order.
+  New counters go at the end so older apps keep parsing the ones they know.
+*/
+enum bridge_metric_t : uint8_t
+{
+  metricBytesToRadio = 0x00,
+  metricFramesToRadio = 0x01,
+  metricBytesFromRadio = 0x02,
+  metricFramesFromRadio = 0x03,
+  metricNotifications = 0x04,
+  metricWritesDropped = 0x05,   // Written while hardware commands were pending
+  metricBytesDropped = 0x06,
+  metricHardwareCommands = 0x07,
+  metricCmdQueueHighWater = 0x08,
+  metricQsy = 0x09,
+  metricBtcConnectAttempts = 0x0A,
+  metricBtcConnects = 0x0B,
+  metricBleConnects = 0x0C,
+  metricEventsDropped = 0x0D,
+  metricUptime = 0x0E,          // Seconds, filled in when serialized
+  metricBleCentralsHighWater = 0x0F,
+  metricDuplicatesDropped = 0x10,
+  metricFramesFiltered = 0x11,  // Matched no rule of the frame filter
+  metricFramesStored = 0x12,    // Heard while no central was listening
+  metricFramesReplayed = 0x13,
+  metricStoredFramesDropped = 0x14, // Store full or retention passed
+  metricJournalDropped = 0x15,  // Writer fell behind
+  metricRepliesDropped = 0x16,  // No room left while held back by a frame in progress
+  metricSteadyAllocations = 0x17, // Heap allocations of the data path, should stay 0
+  metricCmdQueueOverflows = 0x18, // Hardware commands dropped, queue full
+  metricNotificationsFailed = 0x19, // Refused by the stack, out of buffers
+  metricSppQueueDepth = 0x1A,   // Bytes waiting for the radio link, filled in when asked
+  metricSppQueueHighWater = 0x1B,
+  metricSppWritesDropped = 0x1C, // No room left while the link was congested
+  metricSppStalls = 0x1D,       // Times the radio link got congested
+  metricSppStallTime = 0x1E,    // ms spent congested
+  metricCount = 0x1F
+};
+
+/*
+  Lock-free counters, bumped from the BLE task and the loop task alike.
+  Relaxed atomics, a single S32C1I sequence on the ESP32.
+*/
+class BridgeMetrics
+{
+public:
+  BridgeMetrics();
+
+  inline void add(bridge_metric_t metric, uint32_t value = 1)
+  {
+    counters[metric].fetch_add(value, std::memory_order_relaxed);
+  }
+
+  inline void highWater(bridge_metric_t metric, uint32_t value)
+  {
+    uint32_t current = counters[metric].load(std::memory_order_relaxed);
+    while (value > current && !counters[metric].compare_exchange_weak(current, value, std::memory_order_relaxed))
+    {
+    }
+  }
+
+  inline void set(bridge_metric_t metric, uint32_t value)
+  {
+    counters[metric].store(value, std::memory_order_relaxed);
+  }
+
+  inline uint32_t get(bridge_metric_t metric) const
+  {
+    return counters[metric].load(std::memory_order_relaxed);
+  }
+
+  size_t serialize(uint8_t *buffer);
+  static constexpr size_t maxSerializedSize()
+  {
+    return 1 + metricCount * 4;
+  }
+
+private:
+  std::atomic<uint32_t> counters[metricCount];
+};
+
+/*
+  Counts KISS frames in a byte stream, a frame ends at a FEND following data.
+  One per direction, the stream can be split anywhere.
+*/
+class KISSFrameCounter
+{
+public:
+  uint32_t count(const uint8_t *data, size_t size);
+
+private:
+  bool inFrame = false;
+};
+
+#endif
@@ -0,0 +1,228 @@
+#include <ArduinoLog.h>
+#include "DeltaPatcher.h"
+
+DeltaPatcher::DeltaPatcher(BaseReader reader) : reader(reader)
+{
+  memset(baseId, 0, DELTA_BASE_ID_LEN);
+}
+
+void DeltaPatcher::reset(const uint8_t *id)
+{
+  memcpy(baseId, id, DELTA_BASE_ID_LEN);
+  headerLength = 0;
+  state = patchHeader;
+  error = deltaOk;
+  operation = deltaOpEnd;
+  varint = 0;
+  varintShift = 0;
+  offset = 0;
+  remaining = 0;
+  targetSize = 0;
+  outputCount = 0;
+}
+
+bool DeltaPatcher::isComplete()
+{
+  return state == patchDone && outputCount == targetSize;
+}
+
+uint32_t DeltaPatcher::getTargetSize()
+{
+  return targetSize;
+}
+
+uint32_t DeltaPatcher::getOutputCount()
+{
+  return outputCount;
+}
+
+delta_error_t DeltaPatcher::getError()
+{
+  return error;
+}
+
+bool DeltaPatcher::fail(delta_error_t reason)
+{
+  Log.errorln("Delta: failed, error %d", reason);
+  error = reason;
+  state = patchFailed;
+  return false;
+}
+
+bool DeltaPatcher::output(const uint8_t *data, size_t size, PatchSink &sink)
+{
+  if (!sink(data, size))
+  {
+    return fail(deltaErrorWrite);
+  }
+  outputCount += size;
+  return true;
+}
+
+bool DeltaPatcher::readVarint(uint8_t byte, uint32_t *value)
+{
+  varint |= (uint32_t)(byte & 0x7F) << varintShift;
+  varintShift += 7;
+  if (byte & 0x80)
+  {
+    return false;
+  }
+  *value = varint;
+  varint = 0;
+  varintShift = 0;
+  return true;
+}
+
+bool DeltaPatcher::copy(PatchSink &sink)
+{
+  while (remaining > 0)
+  {
+    size_t size = min(remaining, (uint32_t)DELTA_CHUNK_SIZE);
+    if (!reader(offset, chunk, size))
+    {
+      return fail(deltaErrorRead);
+    }
+    if (!output(chunk, size, sink))
+    {
+      return false;
+    }
+    offset += size;
+    remaining -= size;
+  }
+  state = patchOperation;
+  return true;
+}
+
+// Operation and its arguments are known
+bool DeltaPatcher::startOperation(PatchSink &sink)
+{
+  if (remaining == 0)
+  {
+    state = patchOperation;
+    return true;
+  }
+
+  switch (operation)
+  {
+  case deltaOpCopy:
+    return copy(sink);
+  case deltaOpInsert:
+    state = patchInsert;
+    return true;
+  case deltaOpAdd:
+    state = patchAdd;
+    return true;
+  default:
+    return fail(deltaErrorOperation);
+  }
+}
+
+bool DeltaPatcher::apply(const uint8_t *input, size_t size, PatchSink sink)
+{
+  size_t i = 0;
+  while (i < size)
+  {
+    switch (state)
+    {
+    case patchHeader:
+      header[headerLength++] = input[i++];
+      if (headerLength == DELTA_HEADER_SIZE)
+      {
+        if (memcmp(header, DELTA_MAGIC, sizeof(DELTA_MAGIC)) != 0)
+        {
+          return fail(deltaErrorMagic);
+        }
+        if (memcmp(&header[4], baseId, DELTA_BASE_ID_LEN) != 0)
+        {
+          return fail(deltaErrorBase);
+        }
+        targetSize = (header[12] << 24) | (header[13] << 16) | (header[14] << 8) | header[15];
+        Log.infoln("Delta: target size %d", targetSize);
+        state = patchOperation;
+      }
+      break;
+
+    case patchOperation:
+      operation = (delta_op_t)input[i++];
+      switch (operation)
+      {
+      case deltaOpEnd:
+        state = patchDone;
+        break;
+      case deltaOpCopy:
+      case deltaOpAdd:
+        state = patchOffset;
+        break;
+      case deltaOpInsert:
+        state = patchLength;
+        break;
+      default:
+        return fail(deltaErrorOperation);
+      }
+      break;
+
+    case patchOffset:
+      if (readVarint(input[i++], &offset))
+      {
+        state = patchLength;
+      }
+      break;
+
+    case patchLength:
+      if (readVarint(input[i++], &remaining) && !startOperation(sink))
+      {
+        return false;
+      }
+      break;
+
+    case patchInsert:
+    {
+      // New bytes go straight thru, no copy
+      size_t run = min(size - i, (size_t)remaining);
+      if (!output(&input[i], run, sink))
+      {
+        return false;
+      }
+      i += run;
+      remaining -= run;
+      if (remaining == 0)
+      {
+        state = patchOperation;
+      }
+      break;
+    }
+
+    case patchAdd:
+    {
+      size_t run = min(min(size - i, (size_t)remaining), (size_t)DELTA_CHUNK_SIZE);
+      if (!reader(offset, chunk, run))
+      {
+        return fail(deltaErrorRead);
+      }
+      for (size_t j = 0; j < run; j++)
+      {
+        chunk[j] += input[i + j];
+      }
+      if (!output(chunk, run, sink))
+      {
+        return false;
+      }
+      i += run;
+      offset += run;
+      remaining -= run;
+      if (remaining == 0)
+      {
+        state = patchOperation;
+      }
+      break;
+    }
+
+    case patchDone:
+      return fail(deltaErrorTrailingData);
+
+    case patchFailed:
+      return false;
+    }
+  }
+  return state != patchFailed;
+}
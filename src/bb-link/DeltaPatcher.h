@@ -0,0 +1,96 @@
+#pragma once
+#ifndef DELTAPATCHER_H
+#define DELTAPATCHER_H
+
+#include "Arduino.h"
+
+#define DELTA_BASE_ID_LEN 8   // Leading bytes of the base image ELF SHA-256
+#define DELTA_HEADER_SIZE 16  // Magic, base id and target size
+#define DELTA_CHUNK_SIZE 256  // Base image is read in chunks of this size, this is the only buffer
+
+/*
+  Streaming patcher rebuilding a firmware image from the running one and a delta.
+
+  Header
+    "BBD1" base_id[8] target_size[4]
+
+  Operations, offsets and lengths are LEB128 varints
+    0x00 END
+    0x01 COPY   offset length              copy length bytes of the base from offset
+    0x02 INSERT length data[length]         new bytes
+    0x03 ADD    offset length diff[length]  base byte + diff byte, modulo 256 (bsdiff style)
+
+  Offsets are absolute in the base image.
+*/
+static const uint8_t DELTA_MAGIC[4] = {'B', 'B', 'D', '1'};
+
+enum delta_op_t : uint8_t
+{
+  deltaOpEnd = 0x00,
+  deltaOpCopy = 0x01,
+  deltaOpInsert = 0x02,
+  deltaOpAdd = 0x03
+};
+
+enum delta_error_t : uint8_t
+{
+  deltaOk = 0x00,
+  deltaErrorMagic = 0x01,
+  deltaErrorBase = 0x02,
+  deltaErrorOperation = 0x03,
+  deltaErrorRead = 0x04,
+  deltaErrorWrite = 0x05,
+  deltaErrorTrailingData = 0x06
+};
+
+typedef std::function<bool(uint32_t offset, uint8_t *data, size_t size)> BaseReader;
+typedef std::function<bool(const uint8_t *data, size_t size)> PatchSink;
+
+class DeltaPatcher
+{
+public:
+  DeltaPatcher(BaseReader reader);
+  void reset(const uint8_t *baseId);
+  bool apply(const uint8_t *input, size_t size, PatchSink sink);
+  bool isComplete();
+  uint32_t getTargetSize();
+  uint32_t getOutputCount();
+  delta_error_t getError();
+
+private:
+  enum patch_state_t : uint8_t
+  {
+    patchHeader,
+    patchOperation,
+    patchOffset,
+    patchLength,
+    patchInsert,
+    patchAdd,
+    patchDone,
+    patchFailed
+  };
+
+  BaseReader reader;
+  uint8_t baseId[DELTA_BASE_ID_LEN];
+  uint8_t header[DELTA_HEADER_SIZE];
+  uint8_t headerLength = 0;
+  uint8_t chunk[DELTA_CHUNK_SIZE];
+
+  patch_state_t state = patchHeader;
+  delta_error_t error = deltaOk;
+  delta_op_t operation = deltaOpEnd;
+  uint32_t varint = 0;
+  uint8_t varintShift = 0;
+  uint32_t offset = 0;
+  uint32_t remaining = 0;
+  uint32_t targetSize = 0;
+  uint32_t outputCount = 0;
+
+  bool readVarint(uint8_t byte, uint32_t *value);
+  bool startOperation(PatchSink &sink);
+  bool copy(PatchSink &sink);
+  bool output(const uint8_t *data, size_t size, PatchSink &sink);
+  bool fail(delta_error_t reason);
+};
+
+#endif
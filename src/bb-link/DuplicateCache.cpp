@@ -0,0 +1,96 @@
+#include "DuplicateCache.h"
+
+static const uint32_t FNV_OFFSET_BASIS = 2166136261u;
+static const uint32_t FNV_PRIME = 16777619u;
+
+static inline uint32_t fnv1a(uint32_t hash, uint8_t byte)
+{
+  return (hash ^ byte) * FNV_PRIME;
+}
+
+DuplicateCache::DuplicateCache()
+{
+  clear();
+}
+
+void DuplicateCache::setWindow(uint32_t window)
+{
+  this->window = window;
+  clear();
+}
+
+uint32_t DuplicateCache::getWindow() const
+{
+  return window;
+}
+
+bool DuplicateCache::isEnabled() const
+{
+  return window > 0;
+}
+
+/*
+  True when the frame was seen less than a window ago, otherwise it is
+  remembered from now on. A copy does not extend the window of the original.
+*/
+bool DuplicateCache::seen(const AX25Frame &frame, uint32_t now)
+{
+  uint32_t key = hash(frame);
+  duplicate_entry_t *vacant = nullptr;
+  duplicate_entry_t *oldest = nullptr;
+
+  for (uint8_t probe = 0; probe < DUPLICATE_CACHE_PROBES; probe++)
+  {
+    duplicate_entry_t &entry = entries[(key + probe) & (DUPLICATE_CACHE_SIZE - 1)];
+    bool expired = !entry.used || now - entry.seenAt >= window;
+    if (!expired && entry.hash == key)
+    {
+      return true;
+    }
+    if (expired && vacant == nullptr)
+    {
+      vacant = &entry;
+    }
+    if (oldest == nullptr || now - entry.seenAt > now - oldest->seenAt)
+    {
+      oldest = &entry;
+    }
+  }
+
+  duplicate_entry_t *entry = vacant != nullptr ? vacant : oldest;
+  entry->hash = key;
+  entry->seenAt = now;
+  entry->used = true;
+  return false;
+}
+
+void DuplicateCache::clear()
+{
+  for (uint8_t i = 0; i < DUPLICATE_CACHE_SIZE; i++)
+  {
+    entries[i].used = false;
+  }
+}
+
+/*
+  FNV-1a over callsigns and SSIDs of destination and source, then the payload
+*/
+uint32_t DuplicateCache::hash(const AX25Frame &frame)
+{
+  uint32_t hash = FNV_OFFSET_BASIS;
+  const uint8_t *addresses[2] = {frame.destination(), frame.source()};
+  for (const uint8_t *address : addresses)
+  {
+    for (uint8_t i = 0; i < AX25_CALLSIGN_SIZE; i++)
+    {
+      hash = fnv1a(hash, address[i]);
+    }
+    hash = fnv1a(hash, AX25Frame::ssid(address));
+  }
+  const uint8_t *payload = frame.payload();
+  for (size_t i = 0; i < frame.payloadLength(); i++)
+  {
+    hash = fnv1a(hash, payload[i]);
+  }
+  return hash;
+}
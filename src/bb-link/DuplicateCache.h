@@ -0,0 +1,42 @@
+#pragma once
+#ifndef DUPLICATECACHE_H
+#define DUPLICATECACHE_H
+
+#include "Arduino.h"
+#include "AX25Frame.h"
+
+#define DUPLICATE_CACHE_SIZE 64  // Frames remembered, power of two
+#define DUPLICATE_CACHE_PROBES 4 // Slots looked at from the one the hash points to
+
+struct duplicate_entry_t
+{
+  uint32_t hash;
+  uint32_t seenAt; // millis()
+  bool used;
+};
+
+/*
+  Frames heard recently, to drop the copies of a packet repeated by several
+  digipeaters. A frame is known by its source, destination and payload, the
+  digipeater path is left out. Only the hash is kept: two different frames
+  taken for each other within the window is a risk worth the memory.
+
+  Off while the window is 0.
+*/
+class DuplicateCache
+{
+public:
+  DuplicateCache();
+  void setWindow(uint32_t window);
+  uint32_t getWindow() const;
+  bool isEnabled() const;
+  bool seen(const AX25Frame &frame, uint32_t now);
+  void clear();
+  static uint32_t hash(const AX25Frame &frame);
+
+private:
+  duplicate_entry_t entries[DUPLICATE_CACHE_SIZE];
+  uint32_t window = 0; // ms
+};
+
+#endif
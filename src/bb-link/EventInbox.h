@@ -0,0 +1,103 @@
+#pragma once
+#ifndef EVENTINBOX_H
+#define EVENTINBOX_H
+
+#include "Arduino.h"
+#include <atomic>
+
+/*
+  Bounded lock-free inbox, many producers and a single consumer.
+
+  Callbacks running on the Bluedroid or BT tasks post events, the task owning the
+  state machine drains them one at a time. Each slot carries a sequence number
+  telling whether it is free for the producer at that position or ready for the
+  consumer, so producers only compete on the write position and never block.
+  When full the event is dropped and counted.
+
+  Capacity must be a power of two.
+*/
+template <typename Event, uint32_t Capacity>
+class EventInbox
+{
+  static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+  EventInbox()
+  {
+    for (uint32_t i = 0; i < Capacity; i++)
+    {
+      slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  /*
+    Safe from any task or core, not from an ISR
+  */
+  bool post(const Event &event)
+  {
+    slot_t *slot;
+    uint32_t position = writePosition.load(std::memory_order_relaxed);
+    for (;;)
+    {
+      slot = &slots[position & (Capacity - 1)];
+      uint32_t sequence = slot->sequence.load(std::memory_order_acquire);
+      int32_t diff = (int32_t)(sequence - position);
+      if (diff == 0)
+      {
+        if (writePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+        {
+          break;
+        }
+      }
+      else if (diff < 0)
+      {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      }
+      else
+      {
+        // Another producer took this position
+        position = writePosition.load(std::memory_order_relaxed);
+      }
+    }
+    slot->event = event;
+    slot->sequence.store(position + 1, std::memory_order_release);
+    return true;
+  }
+
+  /*
+    Owning task only
+  */
+  bool receive(Event *event)
+  {
+    slot_t *slot = &slots[readPosition & (Capacity - 1)];
+    uint32_t sequence = slot->sequence.load(std::memory_order_acquire);
+    if ((int32_t)(sequence - (readPosition + 1)) < 0)
+    {
+      return false;
+    }
+    *event = slot->event;
+    slot->sequence.store(readPosition + Capacity, std::memory_order_release);
+    readPosition++;
+    return true;
+  }
+
+  uint32_t getDropped() const
+  {
+    return dropped.load(std::memory_order_relaxed);
+  }
+
+private:
+  struct slot_t
+  {
+    std::atomic<uint32_t> sequence;
+    Event event;
+  };
+
+  slot_t slots[Capacity];
+  std::atomic<uint32_t> writePosition{0};
+  uint32_t readPosition = 0;
+  std::atomic<uint32_t> dropped{0};
+};
+
+#endif
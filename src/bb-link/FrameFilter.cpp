@@ -0,0 +1,155 @@
+#include "FrameFilter.h"
+
+/*
+  False when the rule makes no sense or the table is full. A clear rule
+  empties the table.
+*/
+bool FrameFilter::add(const uint8_t *rule, size_t size)
+{
+  if (size == 0)
+  {
+    return false;
+  }
+  if (rule[0] == frameFilterClear)
+  {
+    clear();
+    return true;
+  }
+  if (count >= FRAME_FILTER_MAX_RULES || !compile(rule, size, &rules[count]))
+  {
+    return false;
+  }
+  kinds |= 1 << rules[count].kind;
+  count++;
+  return true;
+}
+
+void FrameFilter::clear()
+{
+  count = 0;
+  kinds = 0;
+}
+
+bool FrameFilter::isEnabled() const
+{
+  return count > 0;
+}
+
+uint8_t FrameFilter::getRuleCount() const
+{
+  return count;
+}
+
+bool FrameFilter::matches(const AX25Frame &frame) const
+{
+  uint8_t matched = 0;
+  for (uint8_t i = 0; i < count; i++)
+  {
+    uint8_t kind = 1 << rules[i].kind;
+    if ((matched & kind) == 0 && matches(rules[i], frame))
+    {
+      matched |= kind;
+    }
+  }
+  return matched == kinds;
+}
+
+const frame_filter_rule_t *FrameFilter::getRules() const
+{
+  return rules;
+}
+
+bool FrameFilter::restore(const frame_filter_rule_t *rules, uint8_t count)
+{
+  clear();
+  if (count > FRAME_FILTER_MAX_RULES)
+  {
+    return false;
+  }
+  for (uint8_t i = 0; i < count; i++)
+  {
+    const frame_filter_rule_t &rule = rules[i];
+    if (rule.kind == frameFilterClear || rule.kind >= frameFilterKindCount || rule.length > FRAME_FILTER_VALUE_SIZE)
+    {
+      clear();
+      return false;
+    }
+    this->rules[i] = rule;
+    kinds |= 1 << rule.kind;
+  }
+  this->count = count;
+  return true;
+}
+
+/*
+  Done once when the rule comes in, so matching is only comparing bytes
+*/
+bool FrameFilter::compile(const uint8_t *rule, size_t size, frame_filter_rule_t *compiled)
+{
+  uint8_t value[FRAME_FILTER_VALUE_SIZE] = {0};
+  memcpy(value, rule + 1, min(size - 1, (size_t)FRAME_FILTER_VALUE_SIZE));
+
+  compiled->kind = rule[0];
+  switch (rule[0])
+  {
+  case frameFilterSource:
+  case frameFilterDestination:
+  {
+    for (uint8_t i = 0; i < AX25_CALLSIGN_SIZE; i++)
+    {
+      char c = toupper(value[i] == 0 ? ' ' : value[i]);
+      if (!isalnum(c) && c != ' ')
+      {
+        return false;
+      }
+      compiled->value[i] = c << 1;
+    }
+    uint8_t ssid = value[AX25_CALLSIGN_SIZE];
+    if (ssid > 15 && ssid != FRAME_FILTER_ANY_SSID)
+    {
+      return false;
+    }
+    compiled->value[AX25_CALLSIGN_SIZE] = ssid;
+    compiled->length = AX25_CALLSIGN_SIZE + 1;
+    return true;
+  }
+  case frameFilterPid:
+    compiled->value[0] = value[0];
+    compiled->length = 1;
+    return true;
+  case frameFilterDataType:
+    compiled->length = 0;
+    while (compiled->length < FRAME_FILTER_VALUE_SIZE && value[compiled->length] != 0)
+    {
+      compiled->value[compiled->length] = value[compiled->length];
+      compiled->length++;
+    }
+    return compiled->length > 0;
+  default:
+    return false;
+  }
+}
+
+bool FrameFilter::matches(const frame_filter_rule_t &rule, const AX25Frame &frame)
+{
+  switch (rule.kind)
+  {
+  case frameFilterSource:
+    return matchesAddress(rule, frame.source());
+  case frameFilterDestination:
+    return matchesAddress(rule, frame.destination());
+  case frameFilterPid:
+    return frame.hasPid() && frame.pid() == rule.value[0];
+  case frameFilterDataType:
+    return frame.infoLength() >= rule.length && memcmp(frame.info(), rule.value, rule.length) == 0;
+  default:
+    return false;
+  }
+}
+
+bool FrameFilter::matchesAddress(const frame_filter_rule_t &rule, const uint8_t *address)
+{
+  uint8_t ssid = rule.value[AX25_CALLSIGN_SIZE];
+  return memcmp(address, rule.value, AX25_CALLSIGN_SIZE) == 0 &&
+         (ssid == FRAME_FILTER_ANY_SSID || ssid == AX25Frame::ssid(address));
+}
@@ -0,0 +1,63 @@
+#pragma once
+#ifndef FRAMEFILTER_H
+#define FRAMEFILTER_H
+
+#include "Arduino.h"
+#include "AX25Frame.h"
+
+#define FRAME_FILTER_MAX_RULES 16
+#define FRAME_FILTER_RULE_SIZE 8  // Kind and value, as sent by the app
+#define FRAME_FILTER_VALUE_SIZE 7
+#define FRAME_FILTER_ANY_SSID 0xFF
+
+enum frame_filter_kind_t : uint8_t
+{
+  frameFilterClear = 0x00,       // Removes every rule, the filter is off
+  frameFilterSource = 0x01,      // Callsign, space or NUL padded to 6, then SSID
+  frameFilterDestination = 0x02, // Same as source
+  frameFilterPid = 0x03,         // PID
+  frameFilterDataType = 0x04,    // APRS data type prefix, up to 7 bytes, NUL padded
+  frameFilterKindCount = 0x05
+};
+
+/*
+  A rule as matched, callsigns shifted left by one like on air
+*/
+struct frame_filter_rule_t
+{
+  uint8_t kind;
+  uint8_t length; // Of value
+  uint8_t value[FRAME_FILTER_VALUE_SIZE];
+};
+
+/*
+  Which frames from the radio are worth waking the phone for. A frame is kept
+  when it matches at least one rule of every kind there are rules for: two
+  source rules and a data type rule keep messages from either station.
+
+  Off while there are no rules.
+*/
+class FrameFilter
+{
+public:
+  bool add(const uint8_t *rule, size_t size);
+  void clear();
+  bool isEnabled() const;
+  uint8_t getRuleCount() const;
+  bool matches(const AX25Frame &frame) const;
+
+  // To persist the table as compiled
+  const frame_filter_rule_t *getRules() const;
+  bool restore(const frame_filter_rule_t *rules, uint8_t count);
+
+private:
+  static bool compile(const uint8_t *rule, size_t size, frame_filter_rule_t *compiled);
+  static bool matches(const frame_filter_rule_t &rule, const AX25Frame &frame);
+  static bool matchesAddress(const frame_filter_rule_t &rule, const uint8_t *address);
+
+  frame_filter_rule_t rules[FRAME_FILTER_MAX_RULES];
+  uint8_t count = 0;
+  uint8_t kinds = 0; // One bit per kind with rules
+};
+
+#endif
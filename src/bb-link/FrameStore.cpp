@@ -0,0 +1,201 @@
+#include "FrameStore.h"
+#include <ArduinoLog.h>
+
+FrameStore::~FrameStore()
+{
+  free(ring);
+}
+
+/*
+  Turning it off forgets what is stored
+*/
+bool FrameStore::configure(frame_store_policy_t policy, uint32_t retention)
+{
+  if (policy > frameStoreDropNewest)
+  {
+    return false;
+  }
+  if (policy != frameStoreOff && !allocate())
+  {
+    return false;
+  }
+  this->policy = policy;
+  this->retention = retention;
+  if (policy == frameStoreOff)
+  {
+    clear();
+  }
+  return true;
+}
+
+frame_store_policy_t FrameStore::getPolicy() const
+{
+  return policy;
+}
+
+uint32_t FrameStore::getRetention() const
+{
+  return retention;
+}
+
+bool FrameStore::isEnabled() const
+{
+  return policy != frameStoreOff;
+}
+
+/*
+  False when the frame could not be kept
+*/
+bool FrameStore::store(const uint8_t *frame, size_t size, uint32_t now)
+{
+  size_t needed = FRAME_STORE_HEADER_SIZE + size;
+  if (!isEnabled())
+  {
+    return false;
+  }
+  if (size > 0xFFFF || needed > capacity)
+  {
+    dropped++;
+    return false;
+  }
+
+  expire(now);
+  while (capacity - used < needed)
+  {
+    if (policy == frameStoreDropNewest)
+    {
+      dropped++;
+      return false;
+    }
+    dropOldest();
+  }
+
+  uint8_t header[FRAME_STORE_HEADER_SIZE] = {
+      (uint8_t)(now >> 24), (uint8_t)(now >> 16), (uint8_t)(now >> 8), (uint8_t)now,
+      (uint8_t)(size >> 8), (uint8_t)size};
+  write(header, sizeof(header));
+  write(frame, size);
+  count++;
+  return true;
+}
+
+/*
+  Whole frames, oldest first, as many as the buffer takes
+*/
+size_t FrameStore::replay(uint8_t *buffer, size_t size, uint32_t now)
+{
+  expire(now);
+  size_t length = 0;
+  while (count > 0)
+  {
+    uint8_t header[FRAME_STORE_HEADER_SIZE];
+    peek(0, header, sizeof(header));
+    size_t frameSize = (header[4] << 8) | header[5];
+    if (frameSize > size)
+    {
+      // Would never fit, don't let it hold the others back
+      dropOldest();
+      continue;
+    }
+    if (length + frameSize > size)
+    {
+      break;
+    }
+    peek(FRAME_STORE_HEADER_SIZE, buffer + length, frameSize);
+    length += frameSize;
+    head = (head + FRAME_STORE_HEADER_SIZE + frameSize) % capacity;
+    used -= FRAME_STORE_HEADER_SIZE + frameSize;
+    count--;
+  }
+  return length;
+}
+
+void FrameStore::expire(uint32_t now)
+{
+  while (retention > 0 && count > 0)
+  {
+    uint8_t header[FRAME_STORE_HEADER_SIZE];
+    peek(0, header, sizeof(header));
+    uint32_t storedAt = ((uint32_t)header[0] << 24) | ((uint32_t)header[1] << 16) | (header[2] << 8) | header[3];
+    if (now - storedAt < retention)
+    {
+      break;
+    }
+    dropOldest();
+  }
+}
+
+void FrameStore::clear()
+{
+  head = 0;
+  used = 0;
+  count = 0;
+}
+
+uint32_t FrameStore::getCount() const
+{
+  return count;
+}
+
+size_t FrameStore::getUsed() const
+{
+  return used;
+}
+
+uint32_t FrameStore::getDropped() const
+{
+  return dropped;
+}
+
+bool FrameStore::allocate()
+{
+  if (ring != nullptr)
+  {
+    return true;
+  }
+#if !defined(EPOXY_DUINO)
+  if (psramFound())
+  {
+    ring = (uint8_t *)ps_malloc(FRAME_STORE_SIZE);
+  }
+#endif
+  if (ring == nullptr)
+  {
+    ring = (uint8_t *)malloc(FRAME_STORE_SIZE);
+  }
+  if (ring == nullptr)
+  {
+    Log.errorln("Bridge: failed to allocate frame store");
+    return false;
+  }
+  capacity = FRAME_STORE_SIZE;
+  return true;
+}
+
+void FrameStore::dropOldest()
+{
+  uint8_t header[FRAME_STORE_HEADER_SIZE];
+  peek(0, header, sizeof(header));
+  size_t size = FRAME_STORE_HEADER_SIZE + ((header[4] << 8) | header[5]);
+  head = (head + size) % capacity;
+  used -= size;
+  count--;
+  dropped++;
+}
+
+void FrameStore::write(const uint8_t *data, size_t size)
+{
+  size_t tail = (head + used) % capacity;
+  size_t first = min(size, capacity - tail);
+  memcpy(ring + tail, data, first);
+  memcpy(ring, data + first, size - first);
+  used += size;
+}
+
+void FrameStore::peek(size_t offset, uint8_t *data, size_t size) const
+{
+  size_t from = (head + offset) % capacity;
+  size_t first = min(size, capacity - from);
+  memcpy(data, ring + from, first);
+  memcpy(data + first, ring, size - first);
+}
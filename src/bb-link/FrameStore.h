@@ -0,0 +1,62 @@
+#pragma once
+#ifndef FRAMESTORE_H
+#define FRAMESTORE_H
+
+#include "Arduino.h"
+
+#if defined(ARDUINO_TINYPICO)
+#define FRAME_STORE_SIZE (512 * 1024) // In PSRAM
+#else
+#define FRAME_STORE_SIZE (16 * 1024)
+#endif
+#define FRAME_STORE_HEADER_SIZE 6 // Time stored and length of each frame
+
+enum frame_store_policy_t : uint8_t
+{
+  frameStoreOff = 0x00,
+  frameStoreDropOldest = 0x01, // Full, the oldest frames make room
+  frameStoreDropNewest = 0x02  // Full, frames heard are not stored
+};
+
+/*
+  KISS frames heard while no central listens, replayed in the order they came
+  in once one does. Frames live in a byte ring, each behind the time it was
+  stored and its length, so nothing is wasted on short frames.
+
+  The ring is only allocated once turned on, in PSRAM when the board has some.
+*/
+class FrameStore
+{
+public:
+  ~FrameStore();
+  bool configure(frame_store_policy_t policy, uint32_t retention);
+  frame_store_policy_t getPolicy() const;
+  uint32_t getRetention() const;
+  bool isEnabled() const;
+
+  bool store(const uint8_t *frame, size_t size, uint32_t now);
+  size_t replay(uint8_t *buffer, size_t size, uint32_t now);
+  void expire(uint32_t now);
+  void clear();
+
+  uint32_t getCount() const;
+  size_t getUsed() const;
+  uint32_t getDropped() const;
+
+private:
+  bool allocate();
+  void dropOldest();
+  void write(const uint8_t *data, size_t size);
+  void peek(size_t offset, uint8_t *data, size_t size) const;
+
+  uint8_t *ring = nullptr;
+  size_t capacity = 0;
+  size_t head = 0; // Oldest frame
+  size_t used = 0;
+  uint32_t count = 0;
+  uint32_t dropped = 0;
+  frame_store_policy_t policy = frameStoreOff;
+  uint32_t retention = 0; // ms, 0 keeps frames until replayed
+};
+
+#endif
@@ -0,0 +1,27 @@
+#include "HeapWatch.h"
+#include <new>
+
+/*
+  Replacements of the global allocation functions, counting those made while
+  watched. The library's array forms end up here.
+*/
+void *operator new(size_t size)
+{
+  HeapWatch::recordAllocation();
+  void *p = malloc(size == 0 ? 1 : size);
+  if (p == nullptr)
+  {
+    abort();
+  }
+  return p;
+}
+
+void operator delete(void *p) noexcept
+{
+  free(p);
+}
+
+void operator delete(void *p, size_t size) noexcept
+{
+  free(p);
+}
@@ -0,0 +1,98 @@
+#pragma once
+#ifndef HEAPWATCH_H
+#define HEAPWATCH_H
+
+#include "Arduino.h"
+#include <assert.h>
+#include <atomic>
+
+#ifndef HEAP_WATCH_ASSERT
+#define HEAP_WATCH_ASSERT 0 // 1 to abort on the first allocation of the steady state, debug builds
+#endif
+
+/*
+  Catches the bridge allocating from the heap while it bridges. Adapters run
+  for days, each allocation of the data path is a chance to fragment the heap.
+
+  The code of the data path opens a Scope, HeapWatch.cpp replaces operator new
+  to count what the task does while one is open. Other tasks are not watched,
+  neither are malloc() calls of C code such as the Bluetooth stacks. What the
+  stacks do on our behalf, or the mocks standing in for them on the host, goes
+  in a Pause.
+*/
+class HeapWatch
+{
+public:
+  class Scope
+  {
+  public:
+    Scope(bool active = true) : active(active)
+    {
+      if (active)
+      {
+        depth()++;
+      }
+    }
+    ~Scope()
+    {
+      if (active)
+      {
+        depth()--;
+      }
+    }
+
+  private:
+    bool active;
+  };
+
+  class Pause
+  {
+  public:
+    Pause() : saved(depth())
+    {
+      depth() = 0;
+    }
+    ~Pause()
+    {
+      depth() = saved;
+    }
+
+  private:
+    uint8_t saved;
+  };
+
+  static bool isWatching()
+  {
+    return depth() > 0;
+  }
+
+  static void recordAllocation()
+  {
+    if (isWatching())
+    {
+      allocations().fetch_add(1, std::memory_order_relaxed);
+      assert(!HEAP_WATCH_ASSERT);
+    }
+  }
+
+  // Since boot
+  static uint32_t getAllocations()
+  {
+    return allocations().load(std::memory_order_relaxed);
+  }
+
+private:
+  static uint8_t &depth()
+  {
+    static thread_local uint8_t depth = 0;
+    return depth;
+  }
+
+  static std::atomic<uint32_t> &allocations()
+  {
+    static std::atomic<uint32_t> allocations{0};
+    return allocations;
+  }
+};
+
+#endif
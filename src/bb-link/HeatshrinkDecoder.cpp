@@ -0,0 +1,123 @@
+#include "HeatshrinkDecoder.h"
+
+static const uint16_t WINDOW_MASK = (1 << HEATSHRINK_WINDOW_BITS) - 1;
+
+HeatshrinkDecoder::HeatshrinkDecoder()
+{
+  reset();
+}
+
+void HeatshrinkDecoder::reset()
+{
+  // Back references reaching before the start of the stream read zeros
+  memset(window, 0, sizeof(window));
+  head = 0;
+  outputLength = 0;
+  outputCount = 0;
+  state = decoderTag;
+  bits = 0;
+  bitCount = 0;
+  backrefIndex = 0;
+}
+
+uint32_t HeatshrinkDecoder::getOutputCount()
+{
+  return outputCount;
+}
+
+bool HeatshrinkDecoder::emit(uint8_t c, DecoderSink &sink)
+{
+  window[head & WINDOW_MASK] = c;
+  head++;
+  output[outputLength++] = c;
+  outputCount++;
+  if (outputLength == HEATSHRINK_OUTPUT_SIZE)
+  {
+    return flush(sink);
+  }
+  return true;
+}
+
+bool HeatshrinkDecoder::flush(DecoderSink sink)
+{
+  if (outputLength == 0)
+  {
+    return true;
+  }
+  bool ok = sink(output, outputLength);
+  outputLength = 0;
+  return ok;
+}
+
+/*
+  Decoded data is passed to the sink as it fills up the output buffer. Call flush once the
+  whole stream went thru to get the tail end. Trailing padding bits are ignored.
+*/
+bool HeatshrinkDecoder::decode(const uint8_t *input, size_t size, DecoderSink sink)
+{
+  for (size_t i = 0; i < size; i++)
+  {
+    bits = (bits << 8) | input[i];
+    bitCount += 8;
+
+    bool progress = true;
+    while (progress)
+    {
+      progress = false;
+      switch (state)
+      {
+      case decoderTag:
+        if (bitCount >= 1)
+        {
+          bitCount -= 1;
+          state = ((bits >> bitCount) & 0x01) ? decoderLiteral : decoderIndex;
+          progress = true;
+        }
+        break;
+
+      case decoderLiteral:
+        if (bitCount >= 8)
+        {
+          bitCount -= 8;
+          if (!emit((bits >> bitCount) & 0xFF, sink))
+          {
+            return false;
+          }
+          state = decoderTag;
+          progress = true;
+        }
+        break;
+
+      case decoderIndex:
+        if (bitCount >= HEATSHRINK_WINDOW_BITS)
+        {
+          bitCount -= HEATSHRINK_WINDOW_BITS;
+          backrefIndex = ((bits >> bitCount) & WINDOW_MASK) + 1;
+          state = decoderCount;
+          progress = true;
+        }
+        break;
+
+      case decoderCount:
+        if (bitCount >= HEATSHRINK_LOOKAHEAD_BITS)
+        {
+          bitCount -= HEATSHRINK_LOOKAHEAD_BITS;
+          uint16_t count = ((bits >> bitCount) & ((1 << HEATSHRINK_LOOKAHEAD_BITS) - 1)) + 1;
+          for (uint16_t j = 0; j < count; j++)
+          {
+            if (!emit(window[(head - backrefIndex) & WINDOW_MASK], sink))
+            {
+              return false;
+            }
+          }
+          state = decoderTag;
+          progress = true;
+        }
+        break;
+      }
+    }
+    // Only keep the bits that have not been consumed yet
+    bits &= (1 << bitCount) - 1;
+  }
+  return true;
+}
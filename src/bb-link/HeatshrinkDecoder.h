@@ -0,0 +1,53 @@
+#pragma once
+#ifndef HEATSHRINKDECODER_H
+#define HEATSHRINKDECODER_H
+
+#include "Arduino.h"
+
+#define HEATSHRINK_WINDOW_BITS 10   // 2^10 bytes window, compress with `heatshrink -e -w 10 -l 4`
+#define HEATSHRINK_LOOKAHEAD_BITS 4 // Back references up to 2^4 bytes long
+#define HEATSHRINK_OUTPUT_SIZE 1024 // Decoded bytes are handed to the sink in chunks of this size
+
+/*
+  Streaming heatshrink (LZSS) decoder with a fixed window, no dynamic allocation.
+  https://github.com/atomicobject/heatshrink
+
+  Bit stream, MSB first:
+    1, 8 bits                           literal byte
+    0, window bits, lookahead bits      back reference, offset - 1 and length - 1
+*/
+typedef std::function<bool(const uint8_t *data, size_t size)> DecoderSink;
+
+class HeatshrinkDecoder
+{
+public:
+  HeatshrinkDecoder();
+  void reset();
+  bool decode(const uint8_t *input, size_t size, DecoderSink sink);
+  bool flush(DecoderSink sink);
+  uint32_t getOutputCount();
+
+private:
+  enum decoder_state_t : uint8_t
+  {
+    decoderTag,
+    decoderLiteral,
+    decoderIndex,
+    decoderCount
+  };
+
+  uint8_t window[1 << HEATSHRINK_WINDOW_BITS];
+  uint16_t head = 0;
+  uint8_t output[HEATSHRINK_OUTPUT_SIZE];
+  size_t outputLength = 0;
+  uint32_t outputCount = 0;
+
+  decoder_state_t state = decoderTag;
+  uint32_t bits = 0;
+  uint8_t bitCount = 0;
+  uint16_t backrefIndex = 0;
+
+  bool emit(uint8_t c, DecoderSink &sink);
+};
+
+#endif
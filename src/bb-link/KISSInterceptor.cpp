@@ -1,5 +1,7 @@
 #include <ArduinoLog.h>
 #include "KISSInterceptor.h"
+#include "BinaryLog.h"
+#include "FrameFilter.h"
 
 static const uint8_t FEND = 0xC0;
 static const uint8_t FESC = 0xDB;
@@ -10,6 +12,25 @@ KISSInterceptor::KISSInterceptor()
 {
 }
 
+/*
+  Value bytes a frame filter rule needs, after its kind. What is left out of a
+  data type is NUL padded, a callsign comes whole with its SSID.
+*/
+static int frameFilterValueSize(uint8_t kind)
+{
+  switch (kind)
+  {
+  case frameFilterSource:
+  case frameFilterDestination:
+    return AX25_CALLSIGN_SIZE + 1;
+  case frameFilterPid:
+  case frameFilterDataType:
+    return 1;
+  default:
+    return 0;
+  }
+}
+
 bool KISSInterceptor::extractExtendedHardwareCommand(uint8_t *buffer, size_t size, extended_hw_cmd_t *cmd)
 {
   // Look for frame start
@@ -23,114 +44,230 @@ bool KISSInterceptor::extractExtendedHardwareCommand(uint8_t *buffer, size_t siz
         break;
       }
 
-      Log.traceln("Found SET HW KISS frame start at index %d", i);
+      BLOG_TRACE(KISS, "Found SET HW KISS frame start at index %d", i);
       // Look for frame end
       for (int j = i + 1; j < size; j++)
       {
         if (buffer[j] == FEND)
         {
-          Log.traceln("Found frame end at index %d", j);
+          BLOG_TRACE(KISS, "Found frame end at index %d", j);
 
           // Copy frame to new buffer
           uint8_t frame[j - i + 1];
           memcpy(frame, &buffer[i], j - i + 1);
 
-          // Unescape frame
+          // Unescape frame, up to its closing FEND
           uint8_t unescapedBuffer[size];
           size_t unescapedSize;
-          if (!unescape(&buffer[i], size - i, unescapedBuffer, &unescapedSize))
+          if (!unescape(&buffer[i], j - i + 1, unescapedBuffer, &unescapedSize))
           {
             Log.errorln("Failed to unescape frame");
             return false;
           }
 
-          Log.traceln("Found valid hardware cmd");
+          BLOG_TRACE(KISS, "Found valid hardware cmd");
 
-          char hexString[3 * unescapedSize + 1];
-          for (int k = 0; k < unescapedSize; k++)
+          // Display hex content of buffer, formatted here so only when enabled
+          if (BLOG_ENABLED(KISS, LOG_LEVEL_VERBOSE))
           {
-            sprintf(&hexString[3 * k], "%02X ", unescapedBuffer[k]);
+            char hexString[3 * unescapedSize + 1];
+            for (int k = 0; k < unescapedSize; k++)
+            {
+              sprintf(&hexString[3 * k], "%02X ", unescapedBuffer[k]);
+            }
+            Log.verboseln("Frame: %s", hexString);
           }
 
-          // Display hex content of buffer
-          Log.traceln("Frame: %s", hexString);
+          // Unescaped bytes between the command and the closing FEND
+          int argsLength = (int)unescapedSize - 4;
 
-          switch (unescapedBuffer[i + 2])
+          switch (unescapedBuffer[2])
           {
           case EXTENDED_HW_CMD_SET_FREQUENCY:
           {
-            uint32_t frequency = (unescapedBuffer[i + 3] << 24) | (unescapedBuffer[i + 4] << 16) |
-                                 (unescapedBuffer[i + 5] << 8) | unescapedBuffer[i + 6];
-            Log.infoln("Set frequency cmd: %d", frequency);
+            uint32_t frequency = (unescapedBuffer[3] << 24) | (unescapedBuffer[4] << 16) |
+                                 (unescapedBuffer[5] << 8) | unescapedBuffer[6];
+            BLOG_INFO(KISS, "Set frequency cmd: %d", frequency);
             cmd->action = extended_hw_set_frequency;
             cmd->data.uint32 = frequency;
             return true;
           }
           case EXTENDED_HW_CMD_RESTORE_FREQUENCY:
-            Log.infoln("Restore frequency cmd");
+            BLOG_INFO(KISS, "Restore frequency cmd");
             cmd->action = extended_hw_restore_frequency;
             return true;
 
           case EXTENDED_HW_CMD_SET_BAUD_RATE:
           {
-            uint8_t baud_rate = unescapedBuffer[i + 3];
-            Log.infoln("Set baud rate cmd: %d", baud_rate);
+            uint8_t baud_rate = unescapedBuffer[3];
+            BLOG_INFO(KISS, "Set baud rate cmd: %d", baud_rate);
             cmd->action = extended_hw_set_baud_rate;
             cmd->data.uint8 = baud_rate;
             return true;
           }
           case EXTENDED_HW_CMD_START_SCAN:
-            Log.infoln("Start scan cmd");
+            BLOG_INFO(KISS, "Start scan cmd");
             cmd->action = extended_hw_start_scan;
             return true;
 
           case EXTENDED_HW_CMD_STOP_SCAN:
-            Log.infoln("Stop scan cmd");
+            BLOG_INFO(KISS, "Stop scan cmd");
             cmd->action = extended_hw_stop_scan;
             return true;
 
           case EXTENDED_HW_CMD_PAIR_WITH_DEVICE:
-            Log.infoln("Pair with device cmd");
+            BLOG_INFO(KISS, "Pair with device cmd");
             cmd->action = extended_hw_pair_with_device;
-            memcpy(cmd->data.bytes, &unescapedBuffer[i + 3], ESP_BD_ADDR_LEN);
+            memcpy(cmd->data.bytes, &unescapedBuffer[3], ESP_BD_ADDR_LEN);
             return true;
 
           case EXTENDED_HW_CMD_CLEAR_PAIRED_DEVICE:
-            Log.infoln("Clear paired device cmd");
+            BLOG_INFO(KISS, "Clear paired device cmd");
             cmd->action = extended_hw_clear_paired_device;
             return true;
 
           case EXTENDED_HW_CMD_FIRMWARE_VERSION:
-            Log.infoln("Firmware version cmd");
+            BLOG_INFO(KISS, "Firmware version cmd");
             cmd->action = extended_hw_firmware_version;
             return true;
 
           case EXTENDED_HW_CMD_CAPABILITIES:
-            Log.infoln("Capabilities cmd");
+            BLOG_INFO(KISS, "Capabilities cmd");
             cmd->action = extended_hw_capabilities;
             return true;
 
           case EXTENDED_HW_CMD_API_VERSION:
-            Log.infoln("API version cmd");
+            BLOG_INFO(KISS, "API version cmd");
             cmd->action = extended_hw_api_version;
             return true;
 
           case EXTENDED_HW_CMD_GET_PAIRED_DEVICE:
-            Log.infoln("Get paired device cmd");
+            BLOG_INFO(KISS, "Get paired device cmd");
             cmd->action = extended_hw_get_paired_device;
             return true;
 
           case EXTENDED_HW_CMD_SET_RIG_CTRL:
-            Log.infoln("Set rig control cmd");
+            BLOG_INFO(KISS, "Set rig control cmd");
             cmd->action = extended_hw_set_rig_ctrl;
-            cmd->data.uint8 = unescapedBuffer[i + 3];
+            cmd->data.uint8 = unescapedBuffer[3];
             return true;
 
           case EXTENDED_HW_CMD_FACTORY_RESET:
-            Log.infoln("Factory reset cmd");
+            BLOG_INFO(KISS, "Factory reset cmd");
             cmd->action = extended_hw_factory_reset;
             return true;
 
+          case EXTENDED_HW_CMD_GET_BATTERY:
+            BLOG_INFO(KISS, "Get battery cmd");
+            cmd->action = extended_hw_get_battery;
+            return true;
+
+          case EXTENDED_HW_CMD_GET_STATE_STATS:
+            if (argsLength < 1)
+            {
+              Log.errorln("Get state stats cmd too short");
+              return false;
+            }
+            BLOG_INFO(KISS, "Get state stats cmd");
+            cmd->action = extended_hw_get_state_stats;
+            cmd->data.uint8 = unescapedBuffer[3];
+            return true;
+
+          case EXTENDED_HW_CMD_GET_STATS:
+            BLOG_INFO(KISS, "Get stats cmd");
+            cmd->action = extended_hw_get_stats;
+            return true;
+
+          case EXTENDED_HW_CMD_GET_LATENCY:
+            if (argsLength < 1)
+            {
+              Log.errorln("Get latency cmd too short");
+              return false;
+            }
+            BLOG_INFO(KISS, "Get latency cmd");
+            cmd->action = extended_hw_get_latency;
+            cmd->data.uint8 = unescapedBuffer[3];
+            return true;
+
+          case EXTENDED_HW_CMD_SET_DUPLICATE_WINDOW:
+            if (argsLength < 1)
+            {
+              Log.errorln("Set duplicate window cmd too short");
+              return false;
+            }
+            BLOG_INFO(KISS, "Set duplicate window cmd: %d", unescapedBuffer[3]);
+            cmd->action = extended_hw_set_duplicate_window;
+            cmd->data.uint8 = unescapedBuffer[3];
+            return true;
+
+          case EXTENDED_HW_CMD_SET_FRAME_FILTER:
+          {
+            // A bare command would read as a clear, wiping every rule
+            if (argsLength < 1 || argsLength - 1 < frameFilterValueSize(unescapedBuffer[3]))
+            {
+              Log.errorln("Set frame filter cmd too short");
+              return false;
+            }
+            BLOG_INFO(KISS, "Set frame filter cmd: %d", unescapedBuffer[3]);
+            cmd->action = extended_hw_set_frame_filter;
+            // A rule is shorter than the union, what is left out is 0
+            memset(cmd->data.bytes, 0, sizeof(cmd->data.bytes));
+            for (int k = 0; k < sizeof(cmd->data.bytes) && k < argsLength; k++)
+            {
+              cmd->data.bytes[k] = unescapedBuffer[3 + k];
+            }
+            return true;
+          }
+
+          case EXTENDED_HW_CMD_SET_STORE_FORWARD:
+            if (argsLength < 3)
+            {
+              Log.errorln("Set store and forward cmd too short");
+              return false;
+            }
+            BLOG_INFO(KISS, "Set store and forward cmd: %d", unescapedBuffer[3]);
+            cmd->action = extended_hw_set_store_forward;
+            cmd->data.bytes[0] = unescapedBuffer[3]; // Policy
+            cmd->data.bytes[1] = unescapedBuffer[4]; // Retention in minutes, big endian
+            cmd->data.bytes[2] = unescapedBuffer[5];
+            return true;
+
+          case EXTENDED_HW_CMD_GET_JOURNAL:
+            if (argsLength < 5)
+            {
+              Log.errorln("Get journal cmd too short");
+              return false;
+            }
+            BLOG_INFO(KISS, "Get journal cmd: %d", unescapedBuffer[3]);
+            cmd->action = extended_hw_get_journal;
+            cmd->data.bytes[0] = unescapedBuffer[3]; // From a time or a cursor
+            for (int k = 1; k <= 4; k++)
+            {
+              cmd->data.bytes[k] = unescapedBuffer[3 + k]; // Big endian
+            }
+            return true;
+
+          case EXTENDED_HW_CMD_SET_JOURNAL:
+            if (argsLength < 1)
+            {
+              Log.errorln("Set journal cmd too short");
+              return false;
+            }
+            BLOG_INFO(KISS, "Set journal cmd: %d", unescapedBuffer[3]);
+            cmd->action = extended_hw_set_journal;
+            cmd->data.uint8 = unescapedBuffer[3];
+            return true;
+
+          case EXTENDED_HW_CMD_SELF_TEST:
+            BLOG_INFO(KISS, "Self test cmd: %d", unescapedBuffer[3]);
+            cmd->action = extended_hw_self_test;
+            // Action, then its arguments, big endian. Stop and report have none.
+            for (int k = 0; k <= 6; k++)
+            {
+              cmd->data.bytes[k] = k < argsLength ? unescapedBuffer[3 + k] : 0;
+            }
+            return true;
+
           default:
             Log.errorln("Unknown hardware cmd");
             return false;
@@ -219,4 +356,56 @@ bool KISSInterceptor::escape(uint8_t *buffer, size_t size, uint8_t *result, size
 
   *resultSize = dst - result;
   return true;
-}
\ No newline at end of file
+}
+
+/*
+  True when the byte completed a frame, take it before clear()
+*/
+bool KISSFrameReader::push(uint8_t byte)
+{
+  if (length == KISS_FRAME_READER_SIZE)
+  {
+    overflows++;
+    clear();
+  }
+
+  if (byte == FEND)
+  {
+    if (content)
+    {
+      buffer[length++] = byte;
+      return true;
+    }
+    // Back to back FENDs open the same frame
+    if (length == 0)
+    {
+      buffer[length++] = byte;
+    }
+    return false;
+  }
+
+  buffer[length++] = byte;
+  content = true;
+  return false;
+}
+
+const uint8_t *KISSFrameReader::data() const
+{
+  return buffer;
+}
+
+size_t KISSFrameReader::size() const
+{
+  return length;
+}
+
+void KISSFrameReader::clear()
+{
+  length = 0;
+  content = false;
+}
+
+uint32_t KISSFrameReader::getOverflows() const
+{
+  return overflows;
+}
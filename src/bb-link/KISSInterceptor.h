@@ -15,6 +15,7 @@ static const uint8_t EXTENDED_HW_CMD_FIRMWARE_VERSION = 0x28;
 static const uint8_t EXTENDED_HW_CMD_CAPABILITIES = 0x7E;
 static const uint8_t EXTENDED_HW_CMD_API_VERSION = 0x7B;
 
+static const uint8_t EXTENDED_HW_CMD_SET_JOURNAL = 0xE9;
 static const uint8_t EXTENDED_HW_CMD_SET_FREQUENCY = 0xEA;
 static const uint8_t EXTENDED_HW_CMD_RESTORE_FREQUENCY = 0xEB;
 
@@ -28,6 +29,15 @@ static const uint8_t EXTENDED_HW_CMD_SET_RIG_CTRL = 0xF2;
 static const uint8_t EXTENDED_HW_CMD_FACTORY_RESET = 0xF3;
 
 static const uint8_t EXTENDED_HW_CMD_SET_BAUD_RATE = 0xF4;
+static const uint8_t EXTENDED_HW_CMD_GET_BATTERY = 0xF5;
+static const uint8_t EXTENDED_HW_CMD_GET_STATE_STATS = 0xF6;
+static const uint8_t EXTENDED_HW_CMD_GET_STATS = 0xF7;
+static const uint8_t EXTENDED_HW_CMD_GET_LATENCY = 0xF8;
+static const uint8_t EXTENDED_HW_CMD_SET_DUPLICATE_WINDOW = 0xFA;
+static const uint8_t EXTENDED_HW_CMD_SET_FRAME_FILTER = 0xFB;
+static const uint8_t EXTENDED_HW_CMD_SET_STORE_FORWARD = 0xFC;
+static const uint8_t EXTENDED_HW_CMD_GET_JOURNAL = 0xFD;
+static const uint8_t EXTENDED_HW_CMD_SELF_TEST = 0xFE;
 
 enum extended_hw_action_t : uint8_t
 {
@@ -45,6 +55,16 @@ enum extended_hw_action_t : uint8_t
   extended_hw_set_rig_ctrl = 0x0B,
   extended_hw_factory_reset = 0x0C,
   extended_hw_set_baud_rate = 0x0D,
+  extended_hw_get_battery = 0x0E,
+  extended_hw_get_state_stats = 0x0F,
+  extended_hw_get_stats = 0x10,
+  extended_hw_get_latency = 0x11,
+  extended_hw_set_duplicate_window = 0x12,
+  extended_hw_set_frame_filter = 0x13,
+  extended_hw_set_store_forward = 0x14,
+  extended_hw_get_journal = 0x15,
+  extended_hw_self_test = 0x16,
+  extended_hw_set_journal = 0x17,
   extended_hw_unknown = 0xFF
 };
 
@@ -76,4 +96,27 @@ public:
 private:
 };
 
+#define KISS_FRAME_READER_SIZE 768 // Escaped AX.25 frame, with room to spare
+
+/*
+  Cuts a KISS byte stream into frames, one byte at a time. A frame is ready
+  once its closing FEND comes in, with the opening one when it had its own.
+  Longer frames than the buffer are dropped.
+*/
+class KISSFrameReader
+{
+public:
+  bool push(uint8_t byte);
+  const uint8_t *data() const;
+  size_t size() const;
+  void clear();
+  uint32_t getOverflows() const;
+
+private:
+  uint8_t buffer[KISS_FRAME_READER_SIZE];
+  size_t length = 0;
+  bool content = false;
+  uint32_t overflows = 0;
+};
+
 #endif
\ No newline at end of file
@@ -0,0 +1,127 @@
+#include "LatencyHistogram.h"
+
+uint32_t LatencyHistogram::cyclesPerMicro = 1;
+
+void LatencyHistogram::calibrate()
+{
+#if !defined(EPOXY_DUINO)
+  cyclesPerMicro = getCpuFrequencyMhz();
+#endif
+}
+
+uint8_t LatencyHistogram::bucketFor(uint32_t micros)
+{
+  if (micros < 2)
+  {
+    return 0;
+  }
+  uint8_t bucket = 31 - __builtin_clz(micros);
+  return bucket < LATENCY_BUCKETS ? bucket : LATENCY_BUCKETS - 1;
+}
+
+void LatencyHistogram::record(uint32_t micros)
+{
+  buckets[bucketFor(micros)]++;
+  count++;
+  if (micros < min)
+  {
+    min = micros;
+  }
+  if (micros > max)
+  {
+    max = micros;
+  }
+}
+
+void LatencyHistogram::reset()
+{
+  count = 0;
+  min = UINT32_MAX;
+  max = 0;
+  memset(buckets, 0, sizeof(buckets));
+}
+
+uint32_t LatencyHistogram::getCount()
+{
+  return count;
+}
+
+uint32_t LatencyHistogram::getMin()
+{
+  return count > 0 ? min : 0;
+}
+
+uint32_t LatencyHistogram::getMax()
+{
+  return max;
+}
+
+uint32_t LatencyHistogram::getBucket(uint8_t bucket)
+{
+  return buckets[bucket];
+}
+
+/*
+  Upper bound of the bucket holding the percentile, capped to the max seen
+*/
+uint32_t LatencyHistogram::getPercentile(uint8_t percent)
+{
+  if (count == 0)
+  {
+    return 0;
+  }
+  uint64_t target = ((uint64_t)count * percent + 99) / 100;
+  uint64_t seen = 0;
+  for (uint8_t i = 0; i < LATENCY_BUCKETS; i++)
+  {
+    seen += buckets[i];
+    if (seen >= target)
+    {
+      uint32_t bound = i < LATENCY_BUCKETS - 1 ? (2UL << i) - 1 : max;
+      return bound < max ? bound : max;
+    }
+  }
+  return max;
+}
+
+/*
+  Big endian: count[4] min[4] max[4] buckets[1] {bucket[2]} * buckets
+  Bucket counts saturate at 65535.
+*/
+size_t LatencyHistogram::serialize(uint8_t *buffer)
+{
+  uint32_t header[3] = {count, getMin(), max};
+  uint8_t *p = buffer;
+  for (int i = 0; i < 3; i++)
+  {
+    *p++ = (header[i] >> 24) & 0xFF;
+    *p++ = (header[i] >> 16) & 0xFF;
+    *p++ = (header[i] >> 8) & 0xFF;
+    *p++ = header[i] & 0xFF;
+  }
+  *p++ = LATENCY_BUCKETS;
+  for (int i = 0; i < LATENCY_BUCKETS; i++)
+  {
+    uint16_t value = buckets[i] < UINT16_MAX ? buckets[i] : UINT16_MAX;
+    *p++ = (value >> 8) & 0xFF;
+    *p++ = value & 0xFF;
+  }
+  return p - buffer;
+}
+
+void LatencyHistogram::print(Print &out, const char *name)
+{
+  out.printf("%-16s %6u frames, min %u us, p50 %u us, p99 %u us, max %u us\n",
+             name, count, getMin(), getPercentile(50), getPercentile(99), max);
+  for (int i = 0; i < LATENCY_BUCKETS; i++)
+  {
+    if (buckets[i] > 0 && i < LATENCY_BUCKETS - 1)
+    {
+      out.printf("  < %7lu us %6u\n", 2UL << i, buckets[i]);
+    }
+    else if (buckets[i] > 0)
+    {
+      out.printf("  >=%7lu us %6u\n", 1UL << i, buckets[i]);
+    }
+  }
+}
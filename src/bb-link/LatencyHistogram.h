@@ -0,0 +1,63 @@
+#pragma once
+#ifndef LATENCYHISTOGRAM_H
+#define LATENCYHISTOGRAM_H
+
+#include "Arduino.h"
+
+#define LATENCY_BUCKETS 20 // Bucket i counts latencies in [2^i, 2^(i+1)) us, the last one also everything above
+
+/*
+  Log bucketed latency histogram, in microseconds.
+
+  Timestamps come from the CPU cycle counter, cheap enough for every frame. The
+  counter is per core and wraps after 2^32 cycles, 53 s at 80 MHz, so both ends of
+  a measurement must be taken on the same task.
+
+  One writer per histogram, readers may see a sample half recorded.
+*/
+class LatencyHistogram
+{
+public:
+  void record(uint32_t micros);
+  void reset();
+
+  uint32_t getCount();
+  uint32_t getMin();
+  uint32_t getMax();
+  uint32_t getBucket(uint8_t bucket);
+  uint32_t getPercentile(uint8_t percent);
+
+  size_t serialize(uint8_t *buffer);
+  static constexpr size_t maxSerializedSize()
+  {
+    return 13 + LATENCY_BUCKETS * 2;
+  }
+  void print(Print &out, const char *name);
+
+  static uint8_t bucketFor(uint32_t micros);
+
+  // Cycle counter helpers, calibrate once the CPU frequency is set
+  static void calibrate();
+  static inline uint32_t now()
+  {
+#if defined(EPOXY_DUINO)
+    return micros();
+#else
+    return ESP.getCycleCount();
+#endif
+  }
+  static inline uint32_t elapsedMicros(uint32_t since)
+  {
+    return (now() - since) / cyclesPerMicro;
+  }
+
+private:
+  static uint32_t cyclesPerMicro;
+
+  uint32_t count = 0;
+  uint32_t min = UINT32_MAX;
+  uint32_t max = 0;
+  uint32_t buckets[LATENCY_BUCKETS] = {};
+};
+
+#endif
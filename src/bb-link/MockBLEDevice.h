@@ -1,4 +1,15 @@
 #ifdef EPOXY_DUINO
+#pragma once
+#ifndef MOCKBLEDEVICE_H
+#define MOCKBLEDEVICE_H
+
+#include <Arduino.h>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "HeapWatch.h"
 
 /// Bluetooth address length
 #define ESP_BD_ADDR_LEN     6
@@ -6,4 +17,661 @@
 /// Bluetooth device address
 typedef uint8_t esp_bd_addr_t[ESP_BD_ADDR_LEN];
 
-#endif
\ No newline at end of file
+/*
+  Host stand-ins for the parts of the Bluedroid GATT server the bridge uses.
+  Nothing goes over the air: MockBLECentrals connect to the server, write
+  characteristics and descriptors and collect notifications, all on the
+  calling thread. Like the real stack, esp_ble_gatts_send_indicate() reaches
+  the connection it names whatever its CCCD says.
+*/
+
+#define ESP_GATT_PERM_READ (1 << 0)
+#define ESP_GATT_PERM_WRITE (1 << 4)
+#define MOCK_BLE_DEFAULT_MTU 23
+
+typedef uint8_t esp_gatt_if_t;
+
+typedef enum
+{
+    ESP_GATTS_WRITE_EVT = 2,
+    ESP_GATTS_MTU_EVT = 4,
+    ESP_GATTS_CONNECT_EVT = 14,
+    ESP_GATTS_DISCONNECT_EVT = 15
+} esp_gatts_cb_event_t;
+
+typedef union
+{
+    struct
+    {
+        uint16_t conn_id;
+        esp_bd_addr_t remote_bda;
+    } connect;
+    struct
+    {
+        uint16_t conn_id;
+        esp_bd_addr_t remote_bda;
+        int reason;
+    } disconnect;
+    struct
+    {
+        uint16_t conn_id;
+        uint16_t mtu;
+    } mtu;
+    struct
+    {
+        uint16_t conn_id;
+        uint32_t trans_id;
+        esp_bd_addr_t bda;
+        uint16_t handle;
+        uint16_t offset;
+        bool need_rsp;
+        bool is_prep;
+        uint16_t len;
+        uint8_t *value;
+    } write;
+} esp_ble_gatts_cb_param_t;
+
+typedef void (*gatts_event_handler)(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if, esp_ble_gatts_cb_param_t *param);
+
+inline int esp_ble_gatts_send_indicate(esp_gatt_if_t gatts_if, uint16_t conn_id, uint16_t attr_handle, uint16_t value_len, uint8_t *value, bool need_confirm);
+
+typedef struct
+{
+    esp_bd_addr_t bda;
+    uint16_t min_int;
+    uint16_t max_int;
+    uint16_t latency;
+    uint16_t timeout;
+} esp_ble_conn_update_params_t;
+
+inline int esp_ble_gap_update_conn_params(esp_ble_conn_update_params_t * /*params*/)
+{
+    return 0;
+}
+
+class BLECharacteristic;
+class BLEServer;
+
+class BLECharacteristicCallbacks
+{
+public:
+    virtual ~BLECharacteristicCallbacks() {}
+    virtual void onRead(BLECharacteristic * /*pCharacteristic*/) {}
+    virtual void onWrite(BLECharacteristic * /*pCharacteristic*/) {}
+    virtual void onWrite(BLECharacteristic *pCharacteristic, esp_ble_gatts_cb_param_t * /*param*/)
+    {
+        onWrite(pCharacteristic);
+    }
+};
+
+class BLEServerCallbacks
+{
+public:
+    virtual ~BLEServerCallbacks() {}
+    virtual void onConnect(BLEServer * /*pServer*/) {}
+    virtual void onConnect(BLEServer * /*pServer*/, esp_ble_gatts_cb_param_t * /*param*/) {}
+    virtual void onDisconnect(BLEServer * /*pServer*/) {}
+    virtual void onDisconnect(BLEServer * /*pServer*/, esp_ble_gatts_cb_param_t * /*param*/) {}
+    virtual void onMtuChanged(BLEServer * /*pServer*/, esp_ble_gatts_cb_param_t * /*param*/) {}
+};
+
+/*
+  Gets the notifications of the characteristics it subscribed to
+*/
+class MockNotificationListener
+{
+public:
+    virtual ~MockNotificationListener() {}
+    virtual void onNotify(BLECharacteristic *pCharacteristic, const uint8_t *data, size_t length) = 0;
+};
+
+// Attribute handles, unique across the server like the real ones
+inline uint16_t mockNextHandle()
+{
+    static uint16_t handle = 0x0028;
+    return handle++;
+}
+
+class BLEDescriptor
+{
+private:
+    uint16_t handle = mockNextHandle();
+
+public:
+    virtual ~BLEDescriptor() {}
+
+    uint16_t getHandle()
+    {
+        return handle;
+    }
+};
+
+class BLE2902 : public BLEDescriptor
+{
+};
+
+class BLECharacteristic
+{
+private:
+    std::string uuid;
+    uint32_t properties;
+    std::string value;
+    uint16_t handle = mockNextHandle();
+    BLECharacteristicCallbacks *callbacks = nullptr;
+    std::map<uint16_t, MockNotificationListener *> subscribers;
+    std::vector<BLEDescriptor *> descriptors;
+
+public:
+    static const uint32_t PROPERTY_READ = 1 << 0;
+    static const uint32_t PROPERTY_WRITE = 1 << 1;
+    static const uint32_t PROPERTY_NOTIFY = 1 << 2;
+    static const uint32_t PROPERTY_INDICATE = 1 << 3;
+    static const uint32_t PROPERTY_WRITE_NR = 1 << 5;
+
+    BLECharacteristic(const char *uuid, uint32_t properties)
+        : uuid(uuid), properties(properties)
+    {
+    }
+
+    ~BLECharacteristic()
+    {
+        for (BLEDescriptor *descriptor : descriptors)
+        {
+            delete descriptor;
+        }
+    }
+
+    void addDescriptor(BLEDescriptor *descriptor)
+    {
+        descriptors.push_back(descriptor);
+    }
+
+    void setAccessPermissions(uint16_t /*permissions*/)
+    {
+    }
+
+    void setCallbacks(BLECharacteristicCallbacks *callbacks)
+    {
+        this->callbacks = callbacks;
+    }
+
+    void setValue(uint8_t *data, size_t length)
+    {
+        value.assign((const char *)data, length);
+    }
+
+    void setValue(std::string value)
+    {
+        this->value = value;
+    }
+
+    std::string getValue()
+    {
+        return value;
+    }
+
+    uint8_t *getData()
+    {
+        return (uint8_t *)value.data();
+    }
+
+    size_t getLength()
+    {
+        return value.size();
+    }
+
+    // Every subscribed central gets the value
+    void notify()
+    {
+        for (auto &subscriber : subscribers)
+        {
+            subscriber.second->onNotify(this, (const uint8_t *)value.data(), value.size());
+        }
+    }
+
+    const char *getUUID()
+    {
+        return uuid.c_str();
+    }
+
+    uint16_t getHandle()
+    {
+        return handle;
+    }
+
+    BLEDescriptor *mockFirstDescriptor()
+    {
+        return descriptors.empty() ? nullptr : descriptors.front();
+    }
+
+    // Central side
+
+    void mockSubscribe(uint16_t connId, MockNotificationListener *listener)
+    {
+        subscribers[connId] = listener;
+    }
+
+    void mockUnsubscribe(uint16_t connId)
+    {
+        subscribers.erase(connId);
+    }
+
+    void mockWrite(uint16_t connId, const uint8_t *data, size_t length)
+    {
+        value.assign((const char *)data, length);
+        esp_ble_gatts_cb_param_t param = {};
+        param.write.conn_id = connId;
+        param.write.handle = handle;
+        param.write.len = length;
+        param.write.value = (uint8_t *)value.data();
+        if (callbacks)
+        {
+            callbacks->onWrite(this, &param);
+        }
+    }
+};
+
+class BLEService
+{
+private:
+    std::string uuid;
+    std::vector<BLECharacteristic *> characteristics;
+
+public:
+    BLEService(const char *uuid)
+        : uuid(uuid)
+    {
+    }
+
+    ~BLEService()
+    {
+        for (BLECharacteristic *characteristic : characteristics)
+        {
+            delete characteristic;
+        }
+    }
+
+    BLECharacteristic *createCharacteristic(const char *uuid, uint32_t properties)
+    {
+        BLECharacteristic *characteristic = new BLECharacteristic(uuid, properties);
+        characteristics.push_back(characteristic);
+        return characteristic;
+    }
+
+    BLECharacteristic *getCharacteristic(const char *uuid)
+    {
+        for (BLECharacteristic *characteristic : characteristics)
+        {
+            if (strcmp(characteristic->getUUID(), uuid) == 0)
+            {
+                return characteristic;
+            }
+        }
+        return nullptr;
+    }
+
+    BLECharacteristic *mockFindCharacteristic(uint16_t handle)
+    {
+        for (BLECharacteristic *characteristic : characteristics)
+        {
+            if (characteristic->getHandle() == handle)
+            {
+                return characteristic;
+            }
+        }
+        return nullptr;
+    }
+
+    void start()
+    {
+    }
+
+    void mockUnsubscribe(uint16_t connId)
+    {
+        for (BLECharacteristic *characteristic : characteristics)
+        {
+            characteristic->mockUnsubscribe(connId);
+        }
+    }
+};
+
+class BLEAdvertising
+{
+private:
+    bool advertising = false;
+
+public:
+    void addServiceUUID(const char * /*uuid*/)
+    {
+    }
+
+    void setScanResponse(bool /*scanResponse*/)
+    {
+    }
+
+    void setMinPreferred(uint16_t /*interval*/)
+    {
+    }
+
+    void start()
+    {
+        advertising = true;
+    }
+
+    void stop()
+    {
+        advertising = false;
+    }
+
+    bool isAdvertising()
+    {
+        return advertising;
+    }
+};
+
+// Handler set with BLEDevice::setCustomGattsHandler()
+inline gatts_event_handler &mockGattsHandler()
+{
+    static gatts_event_handler handler = nullptr;
+    return handler;
+}
+
+class BLEServer
+{
+private:
+    BLEServerCallbacks *callbacks = nullptr;
+    std::vector<BLEService *> services;
+    std::map<uint16_t, MockNotificationListener *> centrals;
+
+public:
+    ~BLEServer()
+    {
+        for (BLEService *service : services)
+        {
+            delete service;
+        }
+    }
+
+    void setCallbacks(BLEServerCallbacks *callbacks)
+    {
+        this->callbacks = callbacks;
+    }
+
+    BLEService *createService(const char *uuid)
+    {
+        BLEService *service = new BLEService(uuid);
+        services.push_back(service);
+        return service;
+    }
+
+    uint32_t getConnectedCount()
+    {
+        return centrals.size();
+    }
+
+    esp_gatt_if_t getGattsIf()
+    {
+        return 3;
+    }
+
+    void disconnect(uint16_t connId)
+    {
+        mockDisconnect(connId);
+    }
+
+    BLECharacteristic *mockFindCharacteristic(const char *uuid)
+    {
+        for (BLEService *service : services)
+        {
+            BLECharacteristic *characteristic = service->getCharacteristic(uuid);
+            if (characteristic)
+            {
+                return characteristic;
+            }
+        }
+        return nullptr;
+    }
+
+    BLECharacteristic *mockFindCharacteristic(uint16_t handle)
+    {
+        for (BLEService *service : services)
+        {
+            BLECharacteristic *characteristic = service->mockFindCharacteristic(handle);
+            if (characteristic)
+            {
+                return characteristic;
+            }
+        }
+        return nullptr;
+    }
+
+    // Sent by esp_ble_gatts_send_indicate()
+    bool mockIndicate(uint16_t connId, uint16_t handle, const uint8_t *data, size_t length)
+    {
+        auto central = centrals.find(connId);
+        BLECharacteristic *characteristic = mockFindCharacteristic(handle);
+        if (central == centrals.end() || !characteristic)
+        {
+            return false;
+        }
+        central->second->onNotify(characteristic, data, length);
+        return true;
+    }
+
+    // Central side
+
+    void mockConnect(uint16_t connId, const esp_bd_addr_t address, MockNotificationListener *central)
+    {
+        centrals[connId] = central;
+        // The controller stops advertising once connected
+        advertising().stop();
+        esp_ble_gatts_cb_param_t param = {};
+        param.connect.conn_id = connId;
+        memcpy(param.connect.remote_bda, address, sizeof(esp_bd_addr_t));
+        if (callbacks)
+        {
+            callbacks->onConnect(this);
+            callbacks->onConnect(this, &param);
+        }
+    }
+
+    void mockMtuChanged(uint16_t connId, uint16_t mtu)
+    {
+        esp_ble_gatts_cb_param_t param = {};
+        param.mtu.conn_id = connId;
+        param.mtu.mtu = mtu;
+        if (callbacks)
+        {
+            callbacks->onMtuChanged(this, &param);
+        }
+    }
+
+    // A descriptor write goes to the custom handler, like a CCCD write would
+    void mockWriteDescriptor(uint16_t connId, BLEDescriptor *descriptor, const uint8_t *data, size_t length)
+    {
+        esp_ble_gatts_cb_param_t param = {};
+        param.write.conn_id = connId;
+        param.write.handle = descriptor->getHandle();
+        param.write.len = length;
+        param.write.value = (uint8_t *)data;
+        if (mockGattsHandler())
+        {
+            mockGattsHandler()(ESP_GATTS_WRITE_EVT, getGattsIf(), &param);
+        }
+    }
+
+    void mockDisconnect(uint16_t connId)
+    {
+        if (centrals.erase(connId) == 0)
+        {
+            return;
+        }
+        for (BLEService *service : services)
+        {
+            service->mockUnsubscribe(connId);
+        }
+        esp_ble_gatts_cb_param_t param = {};
+        param.disconnect.conn_id = connId;
+        if (callbacks)
+        {
+            callbacks->onDisconnect(this);
+            callbacks->onDisconnect(this, &param);
+        }
+    }
+
+private:
+    static BLEAdvertising &advertising();
+};
+
+class BLEDevice
+{
+private:
+    static BLEServer *&server()
+    {
+        static BLEServer *server = nullptr;
+        return server;
+    }
+
+public:
+    static BLEAdvertising *getAdvertising()
+    {
+        static BLEAdvertising advertising;
+        return &advertising;
+    }
+
+    static void init(std::string /*deviceName*/)
+    {
+    }
+
+    static BLEServer *createServer()
+    {
+        delete server();
+        server() = new BLEServer();
+        return server();
+    }
+
+    static BLEServer *getServer()
+    {
+        return server();
+    }
+
+    static void startAdvertising()
+    {
+        getAdvertising()->start();
+    }
+
+    static void stopAdvertising()
+    {
+        getAdvertising()->stop();
+    }
+
+    static void setCustomGattsHandler(gatts_event_handler handler)
+    {
+        mockGattsHandler() = handler;
+    }
+};
+
+inline BLEAdvertising &BLEServer::advertising()
+{
+    return *BLEDevice::getAdvertising();
+}
+
+inline int esp_ble_gatts_send_indicate(esp_gatt_if_t /*gatts_if*/, uint16_t conn_id, uint16_t attr_handle, uint16_t value_len, uint8_t *value, bool /*need_confirm*/)
+{
+    // The centrals keeping what they got is none of the bridge's doing
+    HeapWatch::Pause stack;
+    BLEServer *server = BLEDevice::getServer();
+    return server && server->mockIndicate(conn_id, attr_handle, value, value_len) ? 0 : -1;
+}
+
+/*
+  A phone running a BLE KISS app. Writes go straight to the characteristic
+  callbacks, notifications are kept with the time they arrived. Give each
+  central its own connection id when several are connected.
+*/
+class MockBLECentral : public MockNotificationListener
+{
+public:
+    struct notification_t
+    {
+        unsigned long at; // micros()
+        std::string value;
+    };
+
+    std::deque<notification_t> notifications;
+
+    MockBLECentral(uint16_t connId = 0)
+        : connId(connId)
+    {
+    }
+
+    void connect(BLEServer *server, uint16_t mtu = MOCK_BLE_DEFAULT_MTU)
+    {
+        const esp_bd_addr_t address = {0x02, 0x00, 0x00, 0x00, 0x00, (uint8_t)(connId + 1)};
+        this->server = server;
+        server->mockConnect(connId, address, this);
+        if (mtu != MOCK_BLE_DEFAULT_MTU)
+        {
+            server->mockMtuChanged(connId, mtu);
+        }
+    }
+
+    void disconnect()
+    {
+        if (server)
+        {
+            server->mockDisconnect(connId);
+            server = nullptr;
+        }
+    }
+
+    // Turns notifications on or off in the CCCD, the first descriptor of the characteristic
+    bool subscribe(const char *uuid, bool notifications = true)
+    {
+        BLECharacteristic *characteristic = server ? server->mockFindCharacteristic(uuid) : nullptr;
+        BLEDescriptor *cccd = characteristic ? characteristic->mockFirstDescriptor() : nullptr;
+        if (!cccd)
+        {
+            return false;
+        }
+        if (notifications)
+        {
+            characteristic->mockSubscribe(connId, this);
+        }
+        else
+        {
+            characteristic->mockUnsubscribe(connId);
+        }
+        const uint8_t value[2] = {(uint8_t)(notifications ? 0x01 : 0x00), 0x00};
+        server->mockWriteDescriptor(connId, cccd, value, sizeof(value));
+        return true;
+    }
+
+    bool write(const char *uuid, const uint8_t *data, size_t length)
+    {
+        BLECharacteristic *characteristic = server ? server->mockFindCharacteristic(uuid) : nullptr;
+        if (!characteristic)
+        {
+            return false;
+        }
+        characteristic->mockWrite(connId, data, length);
+        return true;
+    }
+
+    void onNotify(BLECharacteristic * /*pCharacteristic*/, const uint8_t *data, size_t length) override
+    {
+        notifications.push_back({micros(), std::string((const char *)data, length)});
+    }
+
+    uint16_t getConnId()
+    {
+        return connId;
+    }
+
+private:
+    uint16_t connId;
+    BLEServer *server = nullptr;
+};
+
+#endif
+#endif
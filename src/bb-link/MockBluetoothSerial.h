@@ -1,8 +1,233 @@
 #ifdef EPOXY_DUINO
+#pragma once
+#ifndef MOCKBLUETOOTHSERIAL_H
+#define MOCKBLUETOOTHSERIAL_H
+
+#include <Arduino.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "MockBLEDevice.h"
+
+#define ESP_BT_GAP_MAX_BDNAME_LEN 248
+#define MOCK_BT_MAX_BONDS 10
+
+#ifndef ESP_OK
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_FAIL -1
+#endif
+
+typedef enum
+{
+    ESP_SPP_INIT_EVT = 0,
+    ESP_SPP_OPEN_EVT = 26,
+    ESP_SPP_CLOSE_EVT = 27,
+    ESP_SPP_DATA_IND_EVT = 30,
+    ESP_SPP_CONG_EVT = 31,
+    ESP_SPP_WRITE_EVT = 33
+} esp_spp_cb_event_t;
+
+typedef union
+{
+    struct
+    {
+        uint32_t handle;
+        uint16_t len;
+        uint8_t *data;
+    } data_ind;
+    struct
+    {
+        uint32_t handle;
+        bool cong;
+    } cong;
+    struct
+    {
+        uint32_t handle;
+        int len;
+        bool cong;
+    } write;
+} esp_spp_cb_param_t;
+
+typedef void(esp_spp_cb_t)(esp_spp_cb_event_t event, esp_spp_cb_param_t *param);
+
+typedef uint8_t esp_spp_sec_t;
+typedef uint8_t esp_spp_role_t;
+#define ESP_SPP_SEC_NONE 0x0000
+#define ESP_SPP_ROLE_MASTER 0
+#define ESP_SPP_ROLE_SLAVE 1
+
+class BTAddress
+{
+private:
+    esp_bd_addr_t address;
+
+public:
+    BTAddress()
+    {
+        memset(address, 0, sizeof(address));
+    }
+
+    BTAddress(const uint8_t *address)
+    {
+        memcpy(this->address, address, sizeof(this->address));
+    }
+
+    bool equals(const BTAddress &other) const
+    {
+        return memcmp(address, other.address, sizeof(address)) == 0;
+    }
+
+    esp_bd_addr_t *getNative() const
+    {
+        return const_cast<esp_bd_addr_t *>(&address);
+    }
+
+    String toString() const
+    {
+        char text[18];
+        snprintf(text, sizeof(text), "%02x:%02x:%02x:%02x:%02x:%02x",
+                 address[0], address[1], address[2], address[3], address[4], address[5]);
+        return String(text);
+    }
+};
+
+class BTAdvertisedDevice
+{
+private:
+    std::string name;
+    BTAddress address;
+    uint32_t cod;
+
+public:
+    BTAdvertisedDevice(const char *name, const uint8_t *address, uint32_t cod)
+        : name(name), address(address), cod(cod)
+    {
+    }
+
+    const std::string getName() const
+    {
+        return name;
+    }
+
+    BTAddress getAddress() const
+    {
+        return address;
+    }
+
+    uint32_t getCOD() const
+    {
+        return cod;
+    }
+
+    std::string toString() const
+    {
+        char text[ESP_BT_GAP_MAX_BDNAME_LEN + 64];
+        snprintf(text, sizeof(text), "Name: %s, Address: %s, cod: 0x%06x", name.c_str(), address.toString().c_str(), (unsigned)cod);
+        return text;
+    }
+};
+
+class BTScanResults
+{
+private:
+    std::vector<BTAdvertisedDevice> devices;
+
+public:
+    int getCount()
+    {
+        return devices.size();
+    }
+
+    BTAdvertisedDevice *getDevice(int i)
+    {
+        return &devices[i];
+    }
+
+    void add(const BTAdvertisedDevice &device)
+    {
+        devices.push_back(device);
+    }
+
+    void clear()
+    {
+        devices.clear();
+    }
+};
+
+typedef std::function<void(BTAdvertisedDevice *pAdvertisedDevice)> BTAdvertisedDeviceCb;
+
+/*
+  Bonded devices, kept by the Bluetooth stack in NVS on the adapter
+*/
+struct MockBluetoothBonds
+{
+    static std::vector<BTAddress> &list()
+    {
+        static std::vector<BTAddress> bonds;
+        return bonds;
+    }
+};
+
+inline int esp_bt_gap_get_bond_device_num()
+{
+    return MockBluetoothBonds::list().size();
+}
+
+inline esp_err_t esp_bt_gap_get_bond_device_list(int *count, esp_bd_addr_t *devices)
+{
+    std::vector<BTAddress> &bonds = MockBluetoothBonds::list();
+    if ((size_t)*count > bonds.size())
+    {
+        *count = bonds.size();
+    }
+    for (int i = 0; i < *count; i++)
+    {
+        memcpy(devices[i], bonds[i].getNative(), sizeof(esp_bd_addr_t));
+    }
+    return ESP_OK;
+}
+
+inline esp_err_t esp_bt_gap_remove_bond_device(esp_bd_addr_t address)
+{
+    std::vector<BTAddress> &bonds = MockBluetoothBonds::list();
+    for (size_t i = 0; i < bonds.size(); i++)
+    {
+        if (bonds[i].equals(BTAddress(address)))
+        {
+            bonds.erase(bonds.begin() + i);
+            return ESP_OK;
+        }
+    }
+    return ESP_FAIL;
+}
+
+/*
+  Other end of the serial link, see RadioEmulator. Without one the mock
+  returns the canned read value.
+*/
+class MockSerialPeer
+{
+public:
+    virtual ~MockSerialPeer() {}
+    virtual void onReceive(uint8_t byte) = 0;
+    virtual int available() = 0;
+    virtual int read() = 0;
+};
 
 class MockBluetoothSerial
 {
 private:
+    MockSerialPeer *peer = nullptr;
+    bool linkUp = false;
+    bool dataPending = false;
+    esp_spp_cb_t *sppCallback = nullptr;
+    BTScanResults scanResults;
+    BTAdvertisedDeviceCb discoveryCallback = nullptr;
+    std::function<void(uint32_t)> confirmRequestCallback = nullptr;
+    std::function<void(bool)> authCompleteCallback = nullptr;
+    unsigned long timeout = 1000;
     char readBuffer[256];
     size_t readBufferLength = 0;
     char writeBuffer[256];
@@ -13,29 +238,195 @@ public:
     {
     }
 
+    void attach(MockSerialPeer *peer)
+    {
+        this->peer = peer;
+    }
+
     void begin(const char * /* name */)
     {
     }
 
+    bool begin(String /* name */, bool /* isMaster */)
+    {
+        return true;
+    }
+
+    void enableSSP()
+    {
+    }
+
+    void setPin(const char * /* pin */)
+    {
+    }
+
+    void onConfirmRequest(std::function<void(uint32_t)> callback)
+    {
+        confirmRequestCallback = callback;
+    }
+
+    void onAuthComplete(std::function<void(bool)> callback)
+    {
+        authCompleteCallback = callback;
+    }
+
+    void confirmReply(bool /* confirm */)
+    {
+    }
+
+    esp_err_t register_callback(esp_spp_cb_t *callback)
+    {
+        sppCallback = callback;
+        return ESP_OK;
+    }
+
+    // The attached peer is the radio, in range and paired
+    bool connect(uint8_t * /* address */, int /* channel */ = 0, esp_spp_sec_t /* security */ = ESP_SPP_SEC_NONE, esp_spp_role_t /* role */ = ESP_SPP_ROLE_MASTER)
+    {
+        linkUp = peer != nullptr;
+        return linkUp;
+    }
+
+    bool connected(int /* timeout */ = 0)
+    {
+        return linkUp;
+    }
+
+    bool disconnect()
+    {
+        linkUp = false;
+        return true;
+    }
+
+    BTScanResults *getScanResults()
+    {
+        return &scanResults;
+    }
+
+    bool discoverAsync(BTAdvertisedDeviceCb callback, int /* timeout */ = 0)
+    {
+        scanResults.clear();
+        discoveryCallback = callback;
+        return true;
+    }
+
+    void discoverAsyncStop()
+    {
+        discoveryCallback = nullptr;
+    }
+
+    // A device answers the inquiry
+    void mockDiscover(const char *name, const uint8_t *address, uint32_t cod)
+    {
+        if (discoveryCallback)
+        {
+            scanResults.add(BTAdvertisedDevice(name, address, cod));
+            discoveryCallback(scanResults.getDevice(scanResults.getCount() - 1));
+        }
+    }
+
+    // RFCOMM flow control, the radio out of range or busy
+    void mockCongestion(bool congested)
+    {
+        if (sppCallback)
+        {
+            esp_spp_cb_param_t param = {};
+            param.cong.cong = congested;
+            sppCallback(ESP_SPP_CONG_EVT, &param);
+        }
+    }
+
+    void mockAuthComplete(bool success)
+    {
+        if (authCompleteCallback)
+        {
+            authCompleteCallback(success);
+        }
+    }
+
     int available()
     {
+        if (peer)
+        {
+            int count = peer->available();
+            // The BT task would have seen this data come in
+            if (count > 0 && !dataPending && sppCallback)
+            {
+                esp_spp_cb_param_t param = {};
+                param.data_ind.len = count;
+                sppCallback(ESP_SPP_DATA_IND_EVT, &param);
+            }
+            dataPending = count > 0;
+            return count;
+        }
         return 0;
     }
 
     size_t write(uint8_t byte)
     {
+        if (peer)
+        {
+            // The radio taking it in is none of the bridge's doing either
+            HeapWatch::Pause stack;
+            peer->onReceive(byte);
+            return 1;
+        }
+        if (writeBufferLength >= sizeof(writeBuffer))
+        {
+            return 0;
+        }
         writeBuffer[writeBufferLength] = byte;
         writeBufferLength++;
         return 1;
     }
 
+    size_t write(const uint8_t *buffer, size_t size)
+    {
+        for (size_t i = 0; i < size; i++)
+        {
+            write(buffer[i]);
+        }
+        return size;
+    }
+
     int read()
     {
+        if (peer)
+        {
+            HeapWatch::Pause stack;
+            return peer->read();
+        }
         return -1; // Example value, -1 indicates no data
     }
 
-    int readBytesUntil(char /*terminator*/, char *buffer, size_t length)
+    int readBytesUntil(char terminator, char *buffer, size_t length)
     {
+        if (peer)
+        {
+            // Like Stream, wait up to the timeout for each byte
+            size_t count = 0;
+            unsigned long start = millis();
+            while (count < length)
+            {
+                int c = peer->read();
+                if (c < 0)
+                {
+                    if (millis() - start >= timeout)
+                    {
+                        break;
+                    }
+                    delay(1);
+                    continue;
+                }
+                if (c == terminator)
+                {
+                    break;
+                }
+                buffer[count++] = (char)c;
+                start = millis();
+            }
+            return count;
+        }
         if (readBufferLength > 0 && length > readBufferLength)
         {
             memcpy(buffer, readBuffer, readBufferLength);
@@ -53,12 +444,21 @@ public:
     {
     }
 
-    void setTimeout(unsigned long /*timeout*/)
+    void setTimeout(unsigned long timeout)
     {
+        this->timeout = timeout;
     }
 
     void print(const char *message)
     {
+        if (peer)
+        {
+            while (*message)
+            {
+                peer->onReceive(*message++);
+            }
+            return;
+        }
         memcpy(writeBuffer+writeBufferLength, message, strlen(message));
         writeBufferLength += strlen(message);
     }
@@ -89,4 +489,5 @@ public:
 
 #define BluetoothSerial MockBluetoothSerial
 
-#endif
\ No newline at end of file
+#endif
+#endif
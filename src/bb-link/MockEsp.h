@@ -0,0 +1,145 @@
+#ifdef EPOXY_DUINO
+#pragma once
+#ifndef MOCKESP_H
+#define MOCKESP_H
+
+#include <Arduino.h>
+
+/*
+  The few ESP-IDF and FreeRTOS calls the bridge makes outside of Bluetooth
+*/
+
+typedef void *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+typedef int BaseType_t;
+#define pdPASS 1
+
+inline int64_t esp_timer_get_time()
+{
+    return micros();
+}
+
+// Tests can't reboot, count the attempts instead
+inline int &mockRestartCount()
+{
+    static int count = 0;
+    return count;
+}
+
+inline void esp_restart()
+{
+    mockRestartCount()++;
+}
+
+/*
+  Runs the task to completion on the caller, so only for tasks that return
+*/
+inline BaseType_t xTaskCreate(TaskFunction_t task, const char * /* name */, uint32_t /* stackSize */, void *param, int /* priority */, TaskHandle_t *handle)
+{
+    if (handle)
+    {
+        *handle = nullptr;
+    }
+    task(param);
+    return pdPASS;
+}
+
+inline void vTaskDelete(TaskHandle_t /* task */)
+{
+}
+
+/*
+  A single data partition in memory, NOR flash like: writes only clear bits
+  and erasing works on whole sectors
+*/
+#ifndef ESP_OK
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_FAIL -1
+#endif
+#define ESP_ERR_INVALID_ARG 0x102
+#define ESP_ERR_INVALID_SIZE 0x104
+
+#define ESP_PARTITION_TYPE_DATA 0x01
+#define ESP_PARTITION_SUBTYPE_DATA_SPIFFS 0x82
+#define SPI_FLASH_SEC_SIZE 4096
+#define MOCK_PARTITION_SIZE (16 * SPI_FLASH_SEC_SIZE)
+
+typedef struct
+{
+    int type;
+    int subtype;
+    uint32_t address;
+    uint32_t size;
+    char label[17];
+} esp_partition_t;
+
+inline uint8_t *mockPartitionFlash()
+{
+    static uint8_t flash[MOCK_PARTITION_SIZE];
+    static bool erased = false;
+    if (!erased)
+    {
+        memset(flash, 0xFF, sizeof(flash));
+        erased = true;
+    }
+    return flash;
+}
+
+// Tests start from a blank partition, or none at all
+inline bool &mockPartitionPresent()
+{
+    static bool present = true;
+    return present;
+}
+
+inline void mockErasePartition()
+{
+    memset(mockPartitionFlash(), 0xFF, MOCK_PARTITION_SIZE);
+}
+
+inline const esp_partition_t *esp_partition_find_first(int type, int subtype, const char * /* label */)
+{
+    static const esp_partition_t partition = {ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_SPIFFS, 0x290000, MOCK_PARTITION_SIZE, "spiffs"};
+    return mockPartitionPresent() && type == partition.type && subtype == partition.subtype ? &partition : nullptr;
+}
+
+inline esp_err_t esp_partition_read(const esp_partition_t *partition, size_t offset, void *dst, size_t size)
+{
+    if (offset + size > partition->size)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(dst, mockPartitionFlash() + offset, size);
+    return ESP_OK;
+}
+
+inline esp_err_t esp_partition_write(const esp_partition_t *partition, size_t offset, const void *src, size_t size)
+{
+    if (offset + size > partition->size)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    for (size_t i = 0; i < size; i++)
+    {
+        mockPartitionFlash()[offset + i] &= ((const uint8_t *)src)[i];
+    }
+    return ESP_OK;
+}
+
+inline esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size)
+{
+    if (offset % SPI_FLASH_SEC_SIZE != 0 || size % SPI_FLASH_SEC_SIZE != 0)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (offset + size > partition->size)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memset(mockPartitionFlash() + offset, 0xFF, size);
+    return ESP_OK;
+}
+
+#endif
+#endif
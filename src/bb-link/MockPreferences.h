@@ -0,0 +1,151 @@
+#ifdef EPOXY_DUINO
+#pragma once
+#ifndef MOCKPREFERENCES_H
+#define MOCKPREFERENCES_H
+
+#include <Arduino.h>
+#include <map>
+#include <string>
+
+/*
+  NVS in memory, shared by every Preferences instance like the real partition
+*/
+class Preferences
+{
+private:
+    typedef std::map<std::string, std::string> Namespace;
+    std::string name;
+    bool open = false;
+
+    static std::map<std::string, Namespace> &storage()
+    {
+        static std::map<std::string, Namespace> storage;
+        return storage;
+    }
+
+    Namespace &values()
+    {
+        return storage()[name];
+    }
+
+    bool find(const char *key, std::string *value)
+    {
+        if (!open)
+        {
+            return false;
+        }
+        Namespace::iterator it = values().find(key);
+        if (it == values().end())
+        {
+            return false;
+        }
+        *value = it->second;
+        return true;
+    }
+
+public:
+    bool begin(const char *name, bool /* readOnly */ = false)
+    {
+        this->name = name;
+        open = true;
+        return true;
+    }
+
+    void end()
+    {
+        open = false;
+    }
+
+    bool clear()
+    {
+        values().clear();
+        return true;
+    }
+
+    bool remove(const char *key)
+    {
+        return values().erase(key) > 0;
+    }
+
+    bool isKey(const char *key)
+    {
+        std::string value;
+        return find(key, &value);
+    }
+
+    size_t putBool(const char *key, bool value)
+    {
+        return putBytes(key, &value, sizeof(value));
+    }
+
+    bool getBool(const char *key, bool defaultValue = false)
+    {
+        std::string value;
+        return find(key, &value) && value.size() == sizeof(bool) ? value[0] != 0 : defaultValue;
+    }
+
+    size_t putUChar(const char *key, uint8_t value)
+    {
+        return putBytes(key, &value, sizeof(value));
+    }
+
+    uint8_t getUChar(const char *key, uint8_t defaultValue = 0)
+    {
+        std::string value;
+        return find(key, &value) && value.size() == sizeof(uint8_t) ? (uint8_t)value[0] : defaultValue;
+    }
+
+    size_t putUShort(const char *key, uint16_t value)
+    {
+        return putBytes(key, &value, sizeof(value));
+    }
+
+    uint16_t getUShort(const char *key, uint16_t defaultValue = 0)
+    {
+        std::string value;
+        return find(key, &value) && value.size() == sizeof(uint16_t) ? *(const uint16_t *)value.data() : defaultValue;
+    }
+
+    size_t putString(const char *key, const char *value)
+    {
+        values()[key] = value;
+        return strlen(value);
+    }
+
+    String getString(const char *key, String defaultValue = String())
+    {
+        std::string value;
+        return find(key, &value) ? String(value.c_str()) : defaultValue;
+    }
+
+    size_t putBytes(const char *key, const void *value, size_t length)
+    {
+        values()[key] = std::string((const char *)value, length);
+        return length;
+    }
+
+    size_t getBytesLength(const char *key)
+    {
+        std::string value;
+        return find(key, &value) ? value.size() : 0;
+    }
+
+    size_t getBytes(const char *key, void *buffer, size_t length)
+    {
+        std::string value;
+        if (!find(key, &value) || value.size() > length)
+        {
+            return 0;
+        }
+        memcpy(buffer, value.data(), value.size());
+        return value.size();
+    }
+
+    static void mockClearAll()
+    {
+        storage().clear();
+    }
+};
+
+#endif
+#endif
@@ -0,0 +1,118 @@
+#include "NotifyScheduler.h"
+
+static const uint8_t FEND = 0xC0;
+
+NotifyScheduler::NotifyScheduler(const Sink &sink) : sink(sink)
+{
+}
+
+/*
+  Sent right away between two frames of data, queued otherwise. False when
+  there is no room left to queue it.
+*/
+bool NotifyScheduler::sendControl(const uint8_t *frame, size_t size, uint32_t now)
+{
+  if (!inFrame && controlLength == 0)
+  {
+    sink(frame, size);
+    return true;
+  }
+  if (controlLength + size > sizeof(control))
+  {
+    dropped++;
+    return false;
+  }
+  if (controlLength == 0)
+  {
+    controlSince = now;
+  }
+  memcpy(control + controlLength, frame, size);
+  controlLength += size;
+  return true;
+}
+
+/*
+  As much as it takes to close the frame in progress goes first, then the
+  replies waiting, then the rest
+*/
+void NotifyScheduler::sendData(const uint8_t *data, size_t size)
+{
+  size_t from = 0;
+  if (!inFrame)
+  {
+    flushControl();
+  }
+  while (controlLength > 0 && from < size)
+  {
+    const uint8_t *end = (const uint8_t *)memchr(data + from, FEND, size - from);
+    if (end == nullptr)
+    {
+      break;
+    }
+    size_t length = end - (data + from) + 1;
+    sendUpTo(data + from, length);
+    from += length;
+    flushControl();
+  }
+  if (from < size)
+  {
+    sendUpTo(data + from, size - from);
+  }
+}
+
+void NotifyScheduler::poll(uint32_t now)
+{
+  if (controlLength == 0)
+  {
+    return;
+  }
+  if (inFrame && now - controlSince >= NOTIFY_CONTROL_WAIT)
+  {
+    sink(&FEND, 1);
+    inFrame = false;
+  }
+  if (!inFrame)
+  {
+    flushControl();
+  }
+}
+
+/*
+  Nobody left listening, what was half sent does not matter anymore
+*/
+void NotifyScheduler::reset()
+{
+  inFrame = false;
+  controlLength = 0;
+}
+
+bool NotifyScheduler::isInFrame() const
+{
+  return inFrame;
+}
+
+size_t NotifyScheduler::getPendingControl() const
+{
+  return controlLength;
+}
+
+uint32_t NotifyScheduler::getDropped() const
+{
+  return dropped;
+}
+
+void NotifyScheduler::flushControl()
+{
+  if (controlLength > 0)
+  {
+    sink(control, controlLength);
+    controlLength = 0;
+  }
+}
+
+void NotifyScheduler::sendUpTo(const uint8_t *data, size_t size)
+{
+  sink(data, size);
+  // A frame is open once something else than a FEND follows a FEND
+  inFrame = data[size - 1] != FEND;
+}
@@ -0,0 +1,47 @@
+#pragma once
+#ifndef NOTIFYSCHEDULER_H
+#define NOTIFYSCHEDULER_H
+
+#include "Arduino.h"
+#include <functional>
+
+#define NOTIFY_CONTROL_SIZE 2048 // Escaped replies waiting for the radio data to reach a frame boundary
+#define NOTIFY_CONTROL_WAIT 500  // ms a reply waits for a frame cut short by the radio
+
+/*
+  Every notification to the centrals goes thru here, on the loop task. Radio
+  data comes in pieces that need not end on a frame boundary, replies are
+  whole KISS frames. A reply never lands inside a frame: it goes out as soon
+  as the data sent so far ends a frame, ahead of any more data.
+
+  Should the radio stop in the middle of a frame, the reply waits so long,
+  then a FEND closes the broken frame and the reply goes out.
+*/
+class NotifyScheduler
+{
+public:
+  typedef std::function<void(const uint8_t *data, size_t size)> Sink;
+
+  NotifyScheduler(const Sink &sink);
+  bool sendControl(const uint8_t *frame, size_t size, uint32_t now);
+  void sendData(const uint8_t *data, size_t size);
+  void poll(uint32_t now);
+  void reset();
+
+  bool isInFrame() const;
+  size_t getPendingControl() const;
+  uint32_t getDropped() const;
+
+private:
+  Sink sink;
+  bool inFrame = false; // Data sent so far stops in the middle of a frame
+  uint8_t control[NOTIFY_CONTROL_SIZE];
+  size_t controlLength = 0;
+  uint32_t controlSince = 0;
+  uint32_t dropped = 0;
+
+  void flushControl();
+  void sendUpTo(const uint8_t *data, size_t size);
+};
+
+#endif
@@ -0,0 +1,525 @@
+#include <ArduinoLog.h>
+#include "OtaUpdater.h"
+#include "BinaryLog.h"
+
+#if !defined(OTA_WITH_SEQUENTIAL_WRITES)
+#define OTA_WITH_SEQUENTIAL_WRITES OTA_SIZE_UNKNOWN
+#endif
+
+OtaUpdater::OtaUpdater()
+{
+}
+
+bool OtaUpdater::init(BLECharacteristic *pControl)
+{
+  this->pControl = pControl;
+  jobs = xQueueCreate(OTA_BUFFER_COUNT + 4, sizeof(ota_job_t));
+  freeBuffers = xQueueCreate(OTA_BUFFER_COUNT, sizeof(uint8_t));
+  return jobs != NULL && freeBuffers != NULL;
+}
+
+bool OtaUpdater::isActive()
+{
+  return state == otaReceiving || state == otaFinishing;
+}
+
+/*
+  Buffers and writer task are only allocated once an update starts,
+  no need to hold on to that memory during normal operation.
+*/
+bool OtaUpdater::startWriter()
+{
+  if (writerTaskHandle != NULL)
+  {
+    return true;
+  }
+
+  for (uint8_t i = 0; i < OTA_BUFFER_COUNT; i++)
+  {
+    buffers[i] = (uint8_t *)malloc(OTA_BUFFER_SIZE);
+    if (buffers[i] == nullptr)
+    {
+      Log.errorln("OTA: failed to allocate buffers");
+      return false;
+    }
+    xQueueSend(freeBuffers, &i, 0);
+  }
+
+  if (!taskLayout.start(
+          writerTask,           // Task function
+          "otaWriter",          // Task name
+          OTA_WRITER_STACK_SIZE, // Stack size
+          this,                 // Task input parameter
+          OTA_WRITER_PRIORITY,  // Priority of the task
+          &writerTaskHandle     // Task handle
+          ))
+  {
+    Log.errorln("OTA: failed to start writer task");
+    writerTaskHandle = NULL;
+    return false;
+  }
+  return true;
+}
+
+/*
+  Called from the BLE task
+*/
+void OtaUpdater::onControl(uint8_t *data, size_t size)
+{
+  if (size == 0)
+  {
+    return;
+  }
+  lastActivity = millis();
+
+  switch (data[0])
+  {
+  case OTA_CTRL_BEGIN:
+  {
+    if (size < 5 + OTA_SHA256_LEN)
+    {
+      Log.errorln("OTA: malformed begin");
+      return;
+    }
+    uint32_t length = (data[1] << 24) | (data[2] << 16) | (data[3] << 8) | data[4];
+    uint8_t *hash = &data[5];
+    ota_format_t requestedFormat = size > 5 + OTA_SHA256_LEN ? (ota_format_t)data[5 + OTA_SHA256_LEN] : otaFormatRaw;
+    if (requestedFormat & ~(otaFormatHeatshrink | otaFormatDelta))
+    {
+      Log.errorln("OTA: unsupported format %d", requestedFormat);
+      notifyDone(otaStatusUnsupportedFormat);
+      return;
+    }
+
+    if (state == otaReceiving && verify && length == imageSize && requestedFormat == format && memcmp(hash, imageHash, OTA_SHA256_LEN) == 0)
+    {
+      // Same image, the app lost the connection. Whatever was not handed to the
+      // writer yet is dropped, the app resends from the offset in READY.
+      received -= fillLength;
+      fillLength = 0;
+      Log.infoln("OTA: resume at %d", received);
+      post(otaJobResume);
+    }
+    else
+    {
+      if (isActive())
+      {
+        abort(otaStatusAborted);
+      }
+      begin(length, hash, requestedFormat);
+    }
+    break;
+  }
+  case OTA_CTRL_END:
+    if (state == otaReceiving)
+    {
+      finish();
+    }
+    break;
+
+  case OTA_CTRL_ABORT:
+    if (isActive())
+    {
+      abort(otaStatusAborted);
+    }
+    break;
+
+  default:
+    Log.errorln("OTA: unknown control 0x%x", data[0]);
+    break;
+  }
+}
+
+/*
+  Called from the BLE task
+*/
+void OtaUpdater::onData(uint8_t *data, size_t size)
+{
+  lastActivity = millis();
+
+  if (state == otaIdle)
+  {
+    Log.warningln("OTA: legacy update, image will not be verified");
+    begin(OTA_SIZE_UNKNOWN, nullptr, otaFormatRaw);
+  }
+
+  if (state != otaReceiving)
+  {
+    BLOG_TRACE(OTA, "OTA: dropping %d bytes", size);
+    return;
+  }
+
+  if (size == 0)
+  {
+    finish();
+    return;
+  }
+
+  received += size;
+  while (size > 0)
+  {
+    if (fillBuffer < 0)
+    {
+      // Only blocks when the app does not respect the window
+      uint8_t index;
+      if (xQueueReceive(freeBuffers, &index, pdMS_TO_TICKS(OTA_BUFFER_WAIT)) != pdTRUE)
+      {
+        Log.errorln("OTA: flash writer stalled");
+        abort(otaStatusWriteFailed);
+        return;
+      }
+      fillBuffer = index;
+      fillLength = 0;
+    }
+
+    size_t chunk = min(size, (size_t)(OTA_BUFFER_SIZE - fillLength));
+    memcpy(buffers[fillBuffer] + fillLength, data, chunk);
+    fillLength += chunk;
+    data += chunk;
+    size -= chunk;
+
+    if (fillLength == OTA_BUFFER_SIZE)
+    {
+      flushFillBuffer();
+    }
+  }
+  BLOG_TRACE(OTA, "OTA: received %d bytes", received);
+
+  if (imageSize != OTA_SIZE_UNKNOWN && received >= imageSize)
+  {
+    finish();
+  }
+}
+
+void OtaUpdater::checkTimeout()
+{
+  if (state != otaIdle && millis() - lastActivity > OTA_RESUME_TIMEOUT)
+  {
+    if (isActive())
+    {
+      Log.warningln("OTA: app did not come back, aborting");
+      abort(otaStatusTimeout);
+    }
+    else
+    {
+      state = otaIdle;
+    }
+  }
+}
+
+/*
+  Identifies the running firmware, deltas are made against it.
+  Leading bytes of the ELF hash embedded in the image, no need to hash the partition.
+*/
+void OtaUpdater::getBaseId(uint8_t *id)
+{
+  const esp_app_desc_t *app = esp_ota_get_app_description();
+  memcpy(id, app->app_elf_sha256, DELTA_BASE_ID_LEN);
+}
+
+void OtaUpdater::begin(uint32_t size, const uint8_t *hash, ota_format_t newFormat)
+{
+  if (!startWriter())
+  {
+    state = otaFailed;
+    notifyDone(otaStatusBeginFailed);
+    return;
+  }
+
+  verify = hash != nullptr;
+  format = newFormat;
+  imageSize = size;
+  if (verify)
+  {
+    memcpy(imageHash, hash, OTA_SHA256_LEN);
+  }
+  received = 0;
+  fillLength = 0;
+  state = otaReceiving;
+  Log.infoln("OTA: begin, size %d, format %d", size, format);
+  post(otaJobBegin);
+}
+
+void OtaUpdater::finish()
+{
+  flushFillBuffer();
+  state = otaFinishing;
+  Log.infoln("OTA: end, %d bytes received", received);
+  post(otaJobEnd);
+}
+
+void OtaUpdater::abort(ota_status_t status)
+{
+  if (fillBuffer >= 0)
+  {
+    uint8_t index = fillBuffer;
+    xQueueSend(freeBuffers, &index, 0);
+    fillBuffer = -1;
+    fillLength = 0;
+  }
+  // An explicit abort or a timeout means the app stopped sending
+  state = (status == otaStatusAborted || status == otaStatusTimeout) ? otaIdle : otaFailed;
+  post(otaJobAbort, 0, 0, status);
+}
+
+void OtaUpdater::flushFillBuffer()
+{
+  if (fillBuffer >= 0 && fillLength > 0)
+  {
+    post(otaJobWrite, fillBuffer, fillLength);
+    fillBuffer = -1;
+    fillLength = 0;
+  }
+}
+
+void OtaUpdater::post(ota_job_type_t type, uint8_t buffer, uint16_t length, ota_status_t status)
+{
+  ota_job_t job = {type, buffer, length, status};
+  xQueueSend(jobs, &job, portMAX_DELAY);
+}
+
+/*
+  Flash writer task
+*/
+void OtaUpdater::writerTask(void *param)
+{
+  OtaUpdater *updater = (OtaUpdater *)param;
+  ota_job_t job;
+  for (;;)
+  {
+    if (xQueueReceive(updater->jobs, &job, portMAX_DELAY) == pdTRUE)
+    {
+      updater->processJob(&job);
+    }
+  }
+}
+
+void OtaUpdater::processJob(ota_job_t *job)
+{
+  switch (job->type)
+  {
+  case otaJobBegin:
+  {
+    if (flashOpen)
+    {
+      esp_ota_abort(otaHandle);
+      flashOpen = false;
+    }
+    partition = esp_ota_get_next_update_partition(NULL);
+    // Sequential writes erase sector by sector instead of the whole partition up front
+    esp_err_t err = esp_ota_begin(partition, OTA_WITH_SEQUENTIAL_WRITES, &otaHandle);
+    if (err != ESP_OK)
+    {
+      Log.errorln("OTA: begin failed: %s", esp_err_to_name(err));
+      fail(otaStatusBeginFailed);
+      break;
+    }
+    if (format & otaFormatHeatshrink)
+    {
+      if (decoder == nullptr)
+      {
+        decoder = new HeatshrinkDecoder();
+      }
+      decoder->reset();
+    }
+    if (format & otaFormatDelta)
+    {
+      if (patcher == nullptr)
+      {
+        runningPartition = esp_ota_get_running_partition();
+        patcher = new DeltaPatcher([this](uint32_t offset, uint8_t *data, size_t size)
+                                   { return esp_partition_read(this->runningPartition, offset, data, size) == ESP_OK; });
+      }
+      uint8_t baseId[DELTA_BASE_ID_LEN];
+      getBaseId(baseId);
+      patcher->reset(baseId);
+    }
+    flashOpen = true;
+    committed = 0;
+    written = 0;
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts_ret(&sha, 0);
+    notifyReady(committed);
+    break;
+  }
+  case otaJobResume:
+    if (flashOpen)
+    {
+      notifyReady(committed);
+    }
+    break;
+
+  case otaJobWrite:
+    writeBlock(job);
+    xQueueSend(freeBuffers, &job->buffer, 0);
+    break;
+
+  case otaJobEnd:
+    if (flashOpen)
+    {
+      completeImage();
+    }
+    break;
+
+  case otaJobAbort:
+    if (flashOpen)
+    {
+      esp_ota_abort(otaHandle);
+      mbedtls_sha256_free(&sha);
+      flashOpen = false;
+    }
+    Log.warningln("OTA: aborted, status %d", job->status);
+    notifyDone(job->status);
+    break;
+  }
+}
+
+void OtaUpdater::writeBlock(ota_job_t *job)
+{
+  // Blocks queued before an abort are dropped
+  if (!flashOpen)
+  {
+    return;
+  }
+
+  bool ok;
+  if (format & otaFormatHeatshrink)
+  {
+    // Decoded straight into flash, the decoder only holds its window
+    ok = decoder->decode(buffers[job->buffer], job->length, [this](const uint8_t *data, size_t size)
+                         { return this->patchImage(data, size); });
+  }
+  else
+  {
+    ok = patchImage(buffers[job->buffer], job->length);
+  }
+
+  if (!ok)
+  {
+    bool wrongBase = (format & otaFormatDelta) && patcher->getError() == deltaErrorBase;
+    fail(wrongBase ? otaStatusBaseMismatch : otaStatusWriteFailed);
+    return;
+  }
+  committed += job->length;
+  BLOG_TRACE(OTA, "OTA: committed %d bytes, image %d bytes", committed, written);
+  notifyAck(committed);
+}
+
+bool OtaUpdater::patchImage(const uint8_t *data, size_t size)
+{
+  if (format & otaFormatDelta)
+  {
+    return patcher->apply(data, size, [this](const uint8_t *data, size_t size)
+                          { return this->writeImage(data, size); });
+  }
+  return writeImage(data, size);
+}
+
+bool OtaUpdater::writeImage(const uint8_t *data, size_t size)
+{
+  esp_err_t err = esp_ota_write(otaHandle, data, size);
+  if (err != ESP_OK)
+  {
+    Log.errorln("OTA: write failed: %s", esp_err_to_name(err));
+    return false;
+  }
+  mbedtls_sha256_update_ret(&sha, data, size);
+  written += size;
+  return true;
+}
+
+void OtaUpdater::completeImage()
+{
+  if (imageSize != OTA_SIZE_UNKNOWN && committed != imageSize)
+  {
+    Log.errorln("OTA: expected %d bytes, got %d", imageSize, committed);
+    fail(otaStatusSizeMismatch);
+    return;
+  }
+
+  if ((format & otaFormatHeatshrink) && !decoder->flush([this](const uint8_t *data, size_t size)
+                                                        { return this->patchImage(data, size); }))
+  {
+    fail(otaStatusWriteFailed);
+    return;
+  }
+  if ((format & otaFormatDelta) && !patcher->isComplete())
+  {
+    Log.errorln("OTA: delta incomplete, %d of %d bytes", patcher->getOutputCount(), patcher->getTargetSize());
+    fail(otaStatusSizeMismatch);
+    return;
+  }
+  Log.infoln("OTA: image is %d bytes", written);
+
+  uint8_t hash[OTA_SHA256_LEN];
+  mbedtls_sha256_finish_ret(&sha, hash);
+  mbedtls_sha256_free(&sha);
+  if (verify && memcmp(hash, imageHash, OTA_SHA256_LEN) != 0)
+  {
+    Log.errorln("OTA: image hash mismatch");
+    fail(otaStatusHashMismatch);
+    return;
+  }
+
+  // Also checks the image header and checksum
+  esp_err_t err = esp_ota_end(otaHandle);
+  flashOpen = false;
+  if (err != ESP_OK)
+  {
+    Log.errorln("OTA: invalid image: %s", esp_err_to_name(err));
+    state = otaFailed;
+    notifyDone(otaStatusImageInvalid);
+    return;
+  }
+
+  if (esp_ota_set_boot_partition(partition) != ESP_OK)
+  {
+    Log.errorln("OTA: failed");
+    state = otaFailed;
+    notifyDone(otaStatusBootFailed);
+    return;
+  }
+
+  Log.infoln("OTA: success, rebooting");
+  notifyDone(otaStatusOk);
+  delay(2000);
+  esp_restart();
+}
+
+void OtaUpdater::fail(ota_status_t status)
+{
+  if (flashOpen)
+  {
+    esp_ota_abort(otaHandle);
+    mbedtls_sha256_free(&sha);
+    flashOpen = false;
+  }
+  state = otaFailed;
+  notifyDone(status);
+}
+
+void OtaUpdater::notifyReady(uint32_t offset)
+{
+  uint8_t message[7] = {
+      OTA_NOTIFY_READY,
+      uint8_t((offset >> 24) & 0xFF), uint8_t((offset >> 16) & 0xFF), uint8_t((offset >> 8) & 0xFF), uint8_t(offset & 0xFF),
+      uint8_t((OTA_WINDOW_SIZE >> 8) & 0xFF), uint8_t(OTA_WINDOW_SIZE & 0xFF)};
+  pControl->setValue(message, sizeof(message));
+  pControl->notify();
+}
+
+void OtaUpdater::notifyAck(uint32_t offset)
+{
+  uint8_t message[5] = {
+      OTA_NOTIFY_ACK,
+      uint8_t((offset >> 24) & 0xFF), uint8_t((offset >> 16) & 0xFF), uint8_t((offset >> 8) & 0xFF), uint8_t(offset & 0xFF)};
+  pControl->setValue(message, sizeof(message));
+  pControl->notify();
+}
+
+void OtaUpdater::notifyDone(ota_status_t status)
+{
+  uint8_t message[2] = {OTA_NOTIFY_DONE, status};
+  pControl->setValue(message, sizeof(message));
+  pControl->notify();
+}
@@ -0,0 +1,167 @@
+#pragma once
+#ifndef OTAUPDATER_H
+#define OTAUPDATER_H
+
+#include "Arduino.h"
+#include <BLEDevice.h>
+#include <esp_ota_ops.h>
+#include <mbedtls/sha256.h>
+
+#include "HeatshrinkDecoder.h"
+#include "DeltaPatcher.h"
+#include "TaskLayout.h"
+
+#define OTA_BUFFER_SIZE 4096                                 // Size of a block handed to the flash writer
+#define OTA_BUFFER_COUNT 2                                   // One buffer filled by BLE while the other one is written to flash
+#define OTA_WINDOW_SIZE (OTA_BUFFER_SIZE * OTA_BUFFER_COUNT) // Max bytes the app can send ahead of the last ack
+#define OTA_BUFFER_WAIT 5000                                 // Max time to wait for a free buffer when the app ignores the window
+#define OTA_RESUME_TIMEOUT 2 * 60 * 1000                     // Time to wait for the app to come back and resume an interrupted update
+#define OTA_WRITER_STACK_SIZE 4096
+#define OTA_SHA256_LEN 32
+
+/*
+  Control characteristic protocol. All integers are big endian.
+
+  App > adapter
+    BEGIN  0x01 size[4] sha256[32] [format[1]]
+                                    Start, or resume if size and hash match the interrupted update.
+                                    Size is what goes over the air, the hash is the one of the
+                                    decoded image. Format defaults to raw, its bits can be combined:
+                                    a heatshrink compressed delta is 0x03.
+    END    0x02                     Finish early, not needed when size is known
+    ABORT  0x03
+
+  Adapter > app (notify)
+    READY  0x81 offset[4] window[2] Start streaming image from offset, keep at most window bytes un-acked
+    ACK    0x82 offset[4]           Bytes committed to flash
+    DONE   0x83 status[1]           0x00 image verified and adapter rebooting, anything else is an ota_status_t
+
+  Data is written to the flash characteristic, without response. Writing data without
+  BEGIN is the legacy protocol: image size unknown, no verification and a zero length
+  write ends the update.
+*/
+static const uint8_t OTA_CTRL_BEGIN = 0x01;
+static const uint8_t OTA_CTRL_END = 0x02;
+static const uint8_t OTA_CTRL_ABORT = 0x03;
+
+static const uint8_t OTA_NOTIFY_READY = 0x81;
+static const uint8_t OTA_NOTIFY_ACK = 0x82;
+static const uint8_t OTA_NOTIFY_DONE = 0x83;
+
+// Feature flags advertised in the identity characteristic
+static const uint8_t OTA_FEATURE_VERIFIED_STREAM = 0x01;
+static const uint8_t OTA_FEATURE_HEATSHRINK = 0x02;
+static const uint8_t OTA_FEATURE_DELTA = 0x04;
+
+// Heatshrink parameters advertised in the identity characteristic, window bits in the high nibble
+static const uint8_t OTA_HEATSHRINK_PARAMS = (HEATSHRINK_WINDOW_BITS << 4) | HEATSHRINK_LOOKAHEAD_BITS;
+
+enum ota_format_t : uint8_t
+{
+  otaFormatRaw = 0x00,
+  otaFormatHeatshrink = 0x01,
+  otaFormatDelta = 0x02 // Delta against the running firmware, see DeltaPatcher
+};
+
+enum ota_status_t : uint8_t
+{
+  otaStatusOk = 0x00,
+  otaStatusBeginFailed = 0x01,
+  otaStatusWriteFailed = 0x02,
+  otaStatusSizeMismatch = 0x03,
+  otaStatusHashMismatch = 0x04,
+  otaStatusImageInvalid = 0x05,
+  otaStatusBootFailed = 0x06,
+  otaStatusAborted = 0x07,
+  otaStatusTimeout = 0x08,
+  otaStatusUnsupportedFormat = 0x09,
+  otaStatusBaseMismatch = 0x0A // Delta was not made against the running firmware
+};
+
+enum ota_state_t : uint8_t
+{
+  otaIdle = 0x00,
+  otaReceiving = 0x01,
+  otaFinishing = 0x02,
+  otaFailed = 0x03 // Ignore data still in flight until the app begins again
+};
+
+enum ota_job_type_t : uint8_t
+{
+  otaJobBegin = 0x00,
+  otaJobResume = 0x01,
+  otaJobWrite = 0x02,
+  otaJobEnd = 0x03,
+  otaJobAbort = 0x04
+};
+
+struct ota_job_t
+{
+  ota_job_type_t type;
+  uint8_t buffer;
+  uint16_t length;
+  ota_status_t status;
+};
+
+class OtaUpdater
+{
+public:
+  OtaUpdater();
+  bool init(BLECharacteristic *pControl);
+  void onControl(uint8_t *data, size_t size);
+  void onData(uint8_t *data, size_t size);
+  bool isActive();
+  void checkTimeout();
+
+  static void getBaseId(uint8_t *id);
+
+private:
+  BLECharacteristic *pControl = nullptr;
+  TaskHandle_t writerTaskHandle = NULL;
+  QueueHandle_t jobs = NULL;
+  QueueHandle_t freeBuffers = NULL;
+  uint8_t *buffers[OTA_BUFFER_COUNT] = {};
+
+  volatile ota_state_t state = otaIdle;
+  volatile unsigned long lastActivity = 0;
+
+  // Owned by the BLE task
+  bool verify = false;
+  ota_format_t format = otaFormatRaw;
+  uint32_t imageSize = OTA_SIZE_UNKNOWN;
+  uint8_t imageHash[OTA_SHA256_LEN];
+  uint32_t received = 0;
+  int fillBuffer = -1;
+  size_t fillLength = 0;
+
+  // Owned by the writer task
+  const esp_partition_t *partition = nullptr;
+  esp_ota_handle_t otaHandle = 0;
+  bool flashOpen = false;
+  mbedtls_sha256_context sha;
+  HeatshrinkDecoder *decoder = nullptr;
+  DeltaPatcher *patcher = nullptr;
+  const esp_partition_t *runningPartition = nullptr;
+  uint32_t committed = 0;
+  uint32_t written = 0;
+
+  bool startWriter();
+  void begin(uint32_t size, const uint8_t *hash, ota_format_t format);
+  void finish();
+  void abort(ota_status_t status);
+  void flushFillBuffer();
+  void post(ota_job_type_t type, uint8_t buffer = 0, uint16_t length = 0, ota_status_t status = otaStatusOk);
+
+  static void writerTask(void *param);
+  void processJob(ota_job_t *job);
+  void writeBlock(ota_job_t *job);
+  bool patchImage(const uint8_t *data, size_t size);
+  bool writeImage(const uint8_t *data, size_t size);
+  void completeImage();
+  void fail(ota_status_t status);
+  void notifyReady(uint32_t offset);
+  void notifyAck(uint32_t offset);
+  void notifyDone(ota_status_t status);
+};
+
+#endif
@@ -0,0 +1,492 @@
+#ifdef EPOXY_DUINO
+#pragma once
+#ifndef RADIOEMULATOR_H
+#define RADIOEMULATOR_H
+
+#include <Arduino.h>
+#include <deque>
+#include <string>
+
+#include "THD7x.h"
+
+#define RADIO_EMULATOR_LATENCY 30    // ms for the radio to answer a CAT command
+#define RADIO_EMULATOR_TX_DELAY 300  // ms of KISS TXDELAY before a frame goes on air
+#define RADIO_EMULATOR_LINE_SIZE 64  // Longer CAT lines are answered with '?'
+#define RADIO_EMULATOR_FRAME_SIZE 1024
+
+#define RADIO_EMULATOR_FEND 0xC0
+#define RADIO_EMULATOR_KISS_DATA 0x00
+#define RADIO_EMULATOR_KISS_TXDELAY 0x01
+#define RADIO_EMULATOR_KISS_RETURN 0xFF
+
+enum radio_fault_t : uint8_t
+{
+    faultNone = 0x00,
+    faultReject = 0x01, // Answer '?' as if the command was bad
+    faultSilent = 0x02, // Don't answer at all
+    faultGarbled = 0x03 // Answer with a corrupted line
+};
+
+/*
+  Host side TH-D74/D75, attach it to a MockBluetoothSerial. In CAT mode it
+  answers FQ, MD, TN, AS, BT and ID like the radio does, '?' to anything else,
+  after the configured latency. TN 2,x switches the TNC to KISS mode, where
+  CAT commands are ignored, data frames are looped back once they would have
+  been on air, and C0 FF C0 gets back to CAT mode.
+
+  Commands: https://github.com/LA3QMA/TH-D74-Kenwood
+*/
+class RadioEmulator : public MockSerialPeer
+{
+private:
+    struct pending_byte_t
+    {
+        unsigned long at;
+        uint8_t byte;
+    };
+
+    std::string radioId;
+    uint32_t frequency[2] = {144390000, 446000000};
+    vfo_mode_t mode[2] = {modeFM, modeFM};
+    baud_rate_t baudRate = baudRate1200;
+    tnc_mode_t tncMode = tncOff;
+    vfo_t tncBand = vfoA;
+
+    unsigned long latency = RADIO_EMULATOR_LATENCY;
+    unsigned long txDelay = RADIO_EMULATOR_TX_DELAY;
+    bool loopback = true;
+    bool airtime = true;
+    radio_fault_t nextFault = faultNone;
+    int nextFaultCount = 0;
+    int errorRate = 0;
+    uint32_t seed = 0x2545F491;
+
+    std::string line;
+    bool inFrame = false;
+    std::string frame;
+    std::deque<pending_byte_t> output;
+    unsigned long releasedUntil = 0;
+    unsigned long channelFreeAt = 0;
+
+    int commandCount = 0;
+    int rejectedCount = 0;
+    int ignoredCount = 0;
+    int frameCount = 0;
+    std::string lastCommand;
+
+    void queue(const uint8_t *data, size_t length, unsigned long at)
+    {
+        // Bytes come out in order, whatever their scheduled time
+        if (at < releasedUntil)
+        {
+            at = releasedUntil;
+        }
+        releasedUntil = at;
+        for (size_t i = 0; i < length; i++)
+        {
+            output.push_back({at, data[i]});
+        }
+    }
+
+    void answer(const std::string &response)
+    {
+        std::string reply = response + "\r";
+        queue((const uint8_t *)reply.data(), reply.size(), millis() + latency);
+    }
+
+    radio_fault_t takeFault()
+    {
+        if (nextFaultCount > 0)
+        {
+            nextFaultCount--;
+            return nextFault;
+        }
+        if (errorRate > 0)
+        {
+            // xorshift, so runs are repeatable
+            seed ^= seed << 13;
+            seed ^= seed >> 17;
+            seed ^= seed << 5;
+            if ((int)(seed % 100) < errorRate)
+            {
+                return faultReject;
+            }
+        }
+        return faultNone;
+    }
+
+    static bool parseDigit(const std::string &args, size_t index, int max, int *value)
+    {
+        if (index >= args.size() || args[index] < '0' || args[index] - '0' > max)
+        {
+            return false;
+        }
+        *value = args[index] - '0';
+        return true;
+    }
+
+    void onCommand()
+    {
+        commandCount++;
+        lastCommand = line;
+
+        switch (takeFault())
+        {
+        case faultReject:
+            rejectedCount++;
+            answer("?");
+            return;
+        case faultSilent:
+            return;
+        case faultGarbled:
+            answer("\x7f" + line.substr(1));
+            return;
+        default:
+            break;
+        }
+
+        std::string response = execute();
+        if (response == "?")
+        {
+            rejectedCount++;
+        }
+        answer(response);
+    }
+
+    std::string execute()
+    {
+        std::string cmd = line.substr(0, 2);
+        std::string args = line.size() > 3 && line[2] == ' ' ? line.substr(3) : "";
+        if (line.size() > 2 && line[2] != ' ')
+        {
+            return "?";
+        }
+        char response[RADIO_EMULATOR_LINE_SIZE];
+        int band, value;
+
+        if (cmd == "FQ")
+        {
+            if (!parseDigit(args, 0, vfoB, &band))
+            {
+                return "?";
+            }
+            if (args.size() > 1)
+            {
+                if (args.size() != 12 || args[1] != ',' || args.find_first_not_of("0123456789", 2) != std::string::npos)
+                {
+                    return "?";
+                }
+                frequency[band] = strtoul(args.c_str() + 2, nullptr, 10);
+            }
+            snprintf(response, sizeof(response), "FQ %d,%010u", band, (unsigned)frequency[band]);
+            return response;
+        }
+        if (cmd == "MD")
+        {
+            if (!parseDigit(args, 0, vfoB, &band))
+            {
+                return "?";
+            }
+            if (args.size() > 1)
+            {
+                if (args.size() != 3 || args[1] != ',' || !parseDigit(args, 2, modeRCW, &value))
+                {
+                    return "?";
+                }
+                mode[band] = (vfo_mode_t)value;
+            }
+            snprintf(response, sizeof(response), "MD %d,%d", band, mode[band]);
+            return response;
+        }
+        if (cmd == "TN")
+        {
+            if (!args.empty())
+            {
+                if (args.size() != 3 || args[1] != ',' || !parseDigit(args, 0, tncKISS, &value) || !parseDigit(args, 2, vfoB, &band))
+                {
+                    return "?";
+                }
+                tncMode = (tnc_mode_t)value;
+                tncBand = (vfo_t)band;
+            }
+            snprintf(response, sizeof(response), "TN %d,%d", tncMode, tncBand);
+            return response;
+        }
+        if (cmd == "AS")
+        {
+            if (!args.empty())
+            {
+                if (args.size() != 1 || !parseDigit(args, 0, baudRate9600, &value))
+                {
+                    return "?";
+                }
+                baudRate = (baud_rate_t)value;
+            }
+            snprintf(response, sizeof(response), "AS %d", baudRate);
+            return response;
+        }
+        if (cmd == "BT" && args.empty())
+        {
+            // Always on, we are talking over it
+            return "BT 1";
+        }
+        if (cmd == "ID" && args.empty())
+        {
+            return "ID " + radioId;
+        }
+        return "?";
+    }
+
+    void onFrame()
+    {
+        if (frame.empty())
+        {
+            return;
+        }
+        uint8_t type = (uint8_t)frame[0];
+        if (type == RADIO_EMULATOR_KISS_RETURN)
+        {
+            tncMode = tncOff;
+            return;
+        }
+        if (type == RADIO_EMULATOR_KISS_TXDELAY && frame.size() == 2)
+        {
+            txDelay = (uint8_t)frame[1] * 10;
+            return;
+        }
+        if ((type & 0x0F) != RADIO_EMULATOR_KISS_DATA)
+        {
+            return;
+        }
+
+        frameCount++;
+        if (!loopback)
+        {
+            return;
+        }
+
+        // Heard back once it has been on air, one frame at a time
+        unsigned long bitsPerSecond = baudRate == baudRate9600 ? 9600 : 1200;
+        unsigned long start = max(millis(), channelFreeAt);
+        channelFreeAt = airtime ? start + txDelay + (frame.size() - 1) * 8 * 1000 / bitsPerSecond : start;
+        std::string kiss = std::string(1, (char)RADIO_EMULATOR_FEND) + frame + (char)RADIO_EMULATOR_FEND;
+        queue((const uint8_t *)kiss.data(), kiss.size(), channelFreeAt);
+    }
+
+public:
+    RadioEmulator(const char *radioId = "TH-D74")
+        : radioId(radioId)
+    {
+    }
+
+    // Scripting
+
+    void setLatency(unsigned long latency)
+    {
+        this->latency = latency;
+    }
+
+    void setTxDelay(unsigned long txDelay)
+    {
+        this->txDelay = txDelay;
+    }
+
+    void setLoopback(bool loopback)
+    {
+        this->loopback = loopback;
+    }
+
+    // Without airtime frames come back right away, to measure the adapter alone
+    void setAirtime(bool airtime)
+    {
+        this->airtime = airtime;
+    }
+
+    // The next count CAT commands fail this way
+    void failNext(radio_fault_t fault, int count = 1)
+    {
+        nextFault = fault;
+        nextFaultCount = count;
+    }
+
+    // Percentage of CAT commands answered with '?'
+    void setErrorRate(int percent, uint32_t seed = 0x2545F491)
+    {
+        errorRate = percent;
+        this->seed = seed;
+    }
+
+    void setFrequency(vfo_t vfo, uint32_t frequency)
+    {
+        this->frequency[vfo] = frequency;
+    }
+
+    void setMode(vfo_t vfo, vfo_mode_t mode)
+    {
+        this->mode[vfo] = mode;
+    }
+
+    void setBaudRate(baud_rate_t baudRate)
+    {
+        this->baudRate = baudRate;
+    }
+
+    void setTNC(vfo_t vfo, tnc_mode_t mode)
+    {
+        tncBand = vfo;
+        tncMode = mode;
+    }
+
+    // A KISS frame heard on air, passed on right away while the TNC is in KISS mode
+    void hear(const uint8_t *kissFrame, size_t length)
+    {
+        if (tncMode == tncKISS)
+        {
+            queue(kissFrame, length, millis());
+        }
+    }
+
+    // State
+
+    uint32_t getFrequency(vfo_t vfo)
+    {
+        return frequency[vfo];
+    }
+
+    vfo_mode_t getMode(vfo_t vfo)
+    {
+        return mode[vfo];
+    }
+
+    baud_rate_t getBaudRate()
+    {
+        return baudRate;
+    }
+
+    tnc_mode_t getTNCMode()
+    {
+        return tncMode;
+    }
+
+    vfo_t getTNCBand()
+    {
+        return tncBand;
+    }
+
+    bool isKISSMode()
+    {
+        return tncMode == tncKISS;
+    }
+
+    int getCommandCount()
+    {
+        return commandCount;
+    }
+
+    int getRejectedCount()
+    {
+        return rejectedCount;
+    }
+
+    int getIgnoredCount()
+    {
+        return ignoredCount;
+    }
+
+    int getFrameCount()
+    {
+        return frameCount;
+    }
+
+    const char *getLastCommand()
+    {
+        return lastCommand.c_str();
+    }
+
+    void resetCounters()
+    {
+        commandCount = 0;
+        rejectedCount = 0;
+        ignoredCount = 0;
+        frameCount = 0;
+    }
+
+    // MockSerialPeer
+
+    void onReceive(uint8_t byte) override
+    {
+        if (isKISSMode())
+        {
+            if (byte == RADIO_EMULATOR_FEND)
+            {
+                if (inFrame)
+                {
+                    onFrame();
+                }
+                // Back to back FENDs, the closing one opens the next frame
+                inFrame = isKISSMode();
+                frame.clear();
+            }
+            else if (inFrame)
+            {
+                if (frame.size() < RADIO_EMULATOR_FRAME_SIZE)
+                {
+                    frame += (char)byte;
+                }
+            }
+            else
+            {
+                // CAT commands are not understood by the TNC
+                ignoredCount++;
+            }
+            return;
+        }
+
+        inFrame = false;
+        if (byte == '\r')
+        {
+            if (!line.empty())
+            {
+                if (line.size() >= RADIO_EMULATOR_LINE_SIZE)
+                {
+                    line = "?";
+                }
+                onCommand();
+            }
+            line.clear();
+        }
+        else if (byte >= ' ' && byte < 0x7F && line.size() < RADIO_EMULATOR_LINE_SIZE)
+        {
+            line += (char)byte;
+        }
+    }
+
+    int available() override
+    {
+        unsigned long now = millis();
+        int count = 0;
+        for (const pending_byte_t &pending : output)
+        {
+            if (pending.at > now)
+            {
+                break;
+            }
+            count++;
+        }
+        return count;
+    }
+
+    int read() override
+    {
+        if (output.empty() || output.front().at > millis())
+        {
+            return -1;
+        }
+        uint8_t byte = output.front().byte;
+        output.pop_front();
+        return byte;
+    }
+};
+
+#endif
+#endif
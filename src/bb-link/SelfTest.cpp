@@ -0,0 +1,197 @@
+#include "SelfTest.h"
+
+static void put32(uint8_t *&p, uint32_t value)
+{
+  *p++ = (value >> 24) & 0xFF;
+  *p++ = (value >> 16) & 0xFF;
+  *p++ = (value >> 8) & 0xFF;
+  *p++ = value & 0xFF;
+}
+
+void SelfTest::startDownload(uint32_t bytes, uint16_t frameSize, uint32_t now)
+{
+  stop();
+  this->frameSize = frameSize < SELF_TEST_MIN_FRAME ? SELF_TEST_MIN_FRAME : frameSize > SELF_TEST_MAX_FRAME ? SELF_TEST_MAX_FRAME : frameSize;
+  downloadTarget = bytes;
+  downloadOffered = 0;
+  downloadBytes = 0;
+  downloadFrames = 0;
+  downloadLost = 0;
+  downloadMicros = 0;
+  sequence = 0;
+  pendingLength = 0;
+  intervals.reset();
+  startedAt = now;
+  finished.store(false);
+  state.store(selfTestDownloading);
+}
+
+void SelfTest::startUpload(uint32_t bytes, uint32_t now)
+{
+  stop();
+  uploadTarget = bytes;
+  uploadBytes.store(0);
+  uploadWrites.store(0);
+  uploadFirstAt.store(0);
+  uploadMicros.store(0);
+  startedAt = now;
+  finished.store(false);
+  state.store(selfTestUploading);
+}
+
+void SelfTest::stop()
+{
+  state.store(selfTestIdle);
+}
+
+bool SelfTest::isDownloading() const
+{
+  return state.load() == selfTestDownloading;
+}
+
+bool SelfTest::isUploading() const
+{
+  return state.load() == selfTestUploading;
+}
+
+/*
+  The next pattern frame, unescaped and without FENDs: hardware command, self
+  test, pattern, sequence number, then letters. 0 once all bytes are made.
+*/
+size_t SelfTest::nextFrame(uint8_t *buffer, uint32_t now)
+{
+  if (!isDownloading() || downloadOffered >= downloadTarget)
+  {
+    return 0;
+  }
+  size_t length = min((uint32_t)frameSize, downloadTarget - downloadOffered);
+  length = max(length, (size_t)SELF_TEST_PATTERN_HEADER + 1);
+  buffer[0] = CMD_HARDWARE;
+  buffer[1] = EXTENDED_HW_CMD_SELF_TEST;
+  buffer[2] = selfTestPattern;
+  buffer[3] = (sequence >> 8) & 0xFF;
+  buffer[4] = sequence & 0xFF;
+  for (size_t i = SELF_TEST_PATTERN_HEADER; i < length; i++)
+  {
+    buffer[i] = 'A' + i % 26;
+  }
+  sequence++;
+  downloadOffered += length;
+  pendingLength = length;
+  return length;
+}
+
+/*
+  Whether the stack took the frame nextFrame() made. A numbered frame refused
+  is one the app will miss.
+*/
+void SelfTest::sent(bool ok, uint32_t now)
+{
+  if (ok)
+  {
+    if (downloadFrames > 0)
+    {
+      intervals.record(now - lastSentAt);
+    }
+    lastSentAt = now;
+    downloadFrames++;
+    downloadBytes += pendingLength;
+  }
+  else
+  {
+    downloadLost++;
+  }
+  pendingLength = 0;
+
+  if (downloadOffered >= downloadTarget)
+  {
+    downloadMicros = now - startedAt;
+    finish();
+  }
+}
+
+/*
+  On the Bluedroid task, a write of the app
+*/
+void SelfTest::received(size_t size, uint32_t now)
+{
+  if (!isUploading())
+  {
+    return;
+  }
+  uint32_t none = 0;
+  uploadFirstAt.compare_exchange_strong(none, now | 1);
+  uint32_t bytes = uploadBytes.fetch_add(size) + size;
+  uploadWrites.fetch_add(1);
+  uploadMicros.store(now - uploadFirstAt.load());
+  if (bytes >= uploadTarget)
+  {
+    finish();
+  }
+}
+
+/*
+  True when the test just ran out of time
+*/
+bool SelfTest::expire(uint32_t now)
+{
+  uint8_t current = state.load();
+  if (current == selfTestIdle || now - startedAt < (uint32_t)SELF_TEST_TIMEOUT * 1000)
+  {
+    return false;
+  }
+  if (current == selfTestDownloading)
+  {
+    downloadMicros = now - startedAt;
+  }
+  finish();
+  return true;
+}
+
+/*
+  True once after a test ended by itself, the report is due
+*/
+bool SelfTest::takeFinished()
+{
+  return finished.exchange(false);
+}
+
+/*
+  Big endian: report[1] state[1]
+  download: bytes[4] frames[4] lost[4] micros[4] bytesPerSecond[4]
+  upload: bytes[4] writes[4] micros[4] bytesPerSecond[4]
+  then the histogram of the gaps between two notifications
+*/
+size_t SelfTest::report(uint8_t *buffer, uint32_t now)
+{
+  uint8_t current = state.load();
+  uint32_t downloadTime = current == selfTestDownloading ? now - startedAt : downloadMicros;
+  uint32_t uploaded = uploadBytes.load();
+  uint32_t uploadTime = uploadMicros.load();
+
+  uint8_t *p = buffer;
+  *p++ = selfTestReport;
+  *p++ = current;
+  put32(p, downloadBytes);
+  put32(p, downloadFrames);
+  put32(p, downloadLost);
+  put32(p, downloadTime);
+  put32(p, rate(downloadBytes, downloadTime));
+  put32(p, uploaded);
+  put32(p, uploadWrites.load());
+  put32(p, uploadTime);
+  put32(p, rate(uploaded, uploadTime));
+  p += intervals.serialize(p);
+  return p - buffer;
+}
+
+void SelfTest::finish()
+{
+  state.store(selfTestIdle);
+  finished.store(true);
+}
+
+uint32_t SelfTest::rate(uint32_t bytes, uint32_t micros)
+{
+  return micros == 0 ? 0 : (uint32_t)((uint64_t)bytes * 1000000 / micros);
+}
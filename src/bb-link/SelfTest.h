@@ -0,0 +1,94 @@
+#pragma once
+#ifndef SELFTEST_H
+#define SELFTEST_H
+
+#include "Arduino.h"
+#include <atomic>
+
+#include "KISSInterceptor.h"
+#include "LatencyHistogram.h"
+
+#define SELF_TEST_MIN_FRAME 16      // Pattern frame, unescaped, FENDs excluded
+#define SELF_TEST_MAX_FRAME 512
+#define SELF_TEST_FRAMES_PER_ROUND 4 // Sent per perform(), the loop task keeps going meanwhile
+#define SELF_TEST_TIMEOUT 30000      // ms a test runs at most
+#define SELF_TEST_PATTERN_HEADER 5   // Hardware command, self test, pattern, sequence
+#define SELF_TEST_REPORT_SIZE (1 + 1 + 5 * 4 + 4 * 4 + LatencyHistogram::maxSerializedSize())
+
+enum self_test_action_t : uint8_t
+{
+  selfTestStop = 0x00,
+  selfTestDownload = 0x01, // bytes[4] frameSize[2], big endian
+  selfTestUpload = 0x02,   // bytes[4], big endian
+  selfTestReport = 0x03,
+  selfTestPattern = 0x04   // Frames streamed by the adapter
+};
+
+enum self_test_state_t : uint8_t
+{
+  selfTestIdle = 0x00,
+  selfTestDownloading = 0x01,
+  selfTestUploading = 0x02
+};
+
+/*
+  Traffic generator measuring what the BLE link alone carries, no radio
+  needed.
+
+  Download: the adapter streams pattern frames as fast as notifications go
+  out, each one numbered so the app can tell what it missed. The adapter
+  counts those its stack refused, and times the gaps between notifications.
+
+  Upload: whatever the app writes is counted and thrown away instead of
+  going to the radio, until the announced number of bytes came in.
+
+  Either way the app gets a report once done, on a timeout or when asked.
+  Counting uploads happens on the Bluedroid task, everything else on the loop
+  task.
+*/
+class SelfTest
+{
+public:
+  void startDownload(uint32_t bytes, uint16_t frameSize, uint32_t now);
+  void startUpload(uint32_t bytes, uint32_t now);
+  void stop();
+
+  bool isDownloading() const;
+  bool isUploading() const;
+
+  size_t nextFrame(uint8_t *buffer, uint32_t now);
+  void sent(bool ok, uint32_t now);
+  void received(size_t size, uint32_t now);
+  bool expire(uint32_t now);
+  bool takeFinished();
+
+  size_t report(uint8_t *buffer, uint32_t now);
+
+private:
+  std::atomic<uint8_t> state{selfTestIdle};
+  std::atomic<bool> finished{false};
+  uint32_t startedAt = 0; // us, all times here are esp_timer_get_time()
+
+  uint32_t downloadTarget = 0;
+  uint16_t frameSize = 0;
+  uint32_t downloadOffered = 0; // Bytes of the frames made so far
+  uint32_t downloadBytes = 0;   // Of those the stack took
+  uint32_t downloadFrames = 0;
+  uint32_t downloadLost = 0;
+  uint32_t downloadMicros = 0;
+  uint32_t lastSentAt = 0;
+  uint16_t sequence = 0;
+  size_t pendingLength = 0; // Frame made, not sent yet
+  LatencyHistogram intervals;
+
+  uint32_t uploadTarget = 0;
+  std::atomic<uint32_t> uploadBytes{0};
+  std::atomic<uint32_t> uploadWrites{0};
+  std::atomic<uint32_t> uploadFirstAt{0};
+  std::atomic<uint32_t> uploadMicros{0};
+
+  void finish();
+  static uint32_t rate(uint32_t bytes, uint32_t micros);
+};
+
+#endif
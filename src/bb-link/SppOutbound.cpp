@@ -0,0 +1,167 @@
+#include "SppOutbound.h"
+
+SppOutbound::SppOutbound(BluetoothSerial &btSerial) : btSerial(btSerial)
+{
+}
+
+/*
+  Any task, never waits on the link. False when there is no room for all of
+  it, nothing is kept then. end tells isSent() when these bytes are gone.
+*/
+bool SppOutbound::write(const uint8_t *data, size_t size, uint32_t *end)
+{
+#if !defined(EPOXY_DUINO)
+  portENTER_CRITICAL(&lock);
+#endif
+  uint32_t write = writeIndex.load(std::memory_order_relaxed);
+  uint32_t used = write - readIndex.load(std::memory_order_acquire);
+  bool fits = used + size <= SPP_OUTBOUND_SIZE;
+  if (fits)
+  {
+    size_t offset = write & (SPP_OUTBOUND_SIZE - 1);
+    size_t first = min(size, (size_t)SPP_OUTBOUND_SIZE - offset);
+    memcpy(buffer + offset, data, first);
+    memcpy(buffer, data + first, size - first);
+    writeIndex.store(write + size, std::memory_order_release);
+    if (end != nullptr)
+    {
+      *end = write + size;
+    }
+  }
+#if !defined(EPOXY_DUINO)
+  portEXIT_CRITICAL(&lock);
+#endif
+
+  if (!fits)
+  {
+    overflows.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  uint32_t depth = used + size;
+  uint32_t current = highWater.load(std::memory_order_relaxed);
+  while (depth > current && !highWater.compare_exchange_weak(current, depth, std::memory_order_relaxed))
+  {
+  }
+  return true;
+}
+
+bool SppOutbound::print(const char *text)
+{
+  return write((const uint8_t *)text, strlen(text));
+}
+
+/*
+  Hands over what is waiting until the link gets congested. The bytes
+  being sent are left in place and only given back once BluetoothSerial has
+  taken them, writers never touch them.
+*/
+void SppOutbound::pump()
+{
+  bool idle = false;
+  if (!draining.compare_exchange_strong(idle, true, std::memory_order_acquire))
+  {
+    return;
+  }
+  while (!congested.load(std::memory_order_relaxed))
+  {
+    uint32_t read = readIndex.load(std::memory_order_relaxed);
+    uint32_t used = writeIndex.load(std::memory_order_acquire) - read;
+    if (used == 0)
+    {
+      break;
+    }
+    size_t offset = read & (SPP_OUTBOUND_SIZE - 1);
+    size_t size = min(min((size_t)used, (size_t)SPP_OUTBOUND_SIZE - offset), (size_t)SPP_OUTBOUND_CHUNK);
+    size_t sent = btSerial.write(buffer + offset, size);
+    if (sent == 0)
+    {
+      // Link gone, clear() follows
+      break;
+    }
+    readIndex.store(read + sent, std::memory_order_release);
+  }
+  draining.store(false, std::memory_order_release);
+}
+
+/*
+  The link went down, what was waiting is for a radio that is not there anymore
+*/
+void SppOutbound::clear()
+{
+#if !defined(EPOXY_DUINO)
+  portENTER_CRITICAL(&lock);
+#endif
+  readIndex.store(writeIndex.load(std::memory_order_relaxed), std::memory_order_release);
+#if !defined(EPOXY_DUINO)
+  portEXIT_CRITICAL(&lock);
+#endif
+}
+
+/*
+  From the SPP callback, on the BT task. A stall lasts from the first event
+  telling the link is congested to the first telling it is not.
+*/
+void SppOutbound::setCongested(bool congested, uint32_t now)
+{
+  bool was = this->congested.exchange(congested, std::memory_order_relaxed);
+  if (congested && !was)
+  {
+    stalledSince.store(now, std::memory_order_relaxed);
+    stalls.fetch_add(1, std::memory_order_relaxed);
+  }
+  else if (!congested && was)
+  {
+    stalledMillis.fetch_add((now - stalledSince.load(std::memory_order_relaxed)) / 1000, std::memory_order_relaxed);
+  }
+}
+
+bool SppOutbound::isCongested() const
+{
+  return congested.load(std::memory_order_relaxed);
+}
+
+bool SppOutbound::isEmpty() const
+{
+  return getDepth() == 0;
+}
+
+/*
+  Everything written up to end was handed to BluetoothSerial, or cleared
+*/
+bool SppOutbound::isSent(uint32_t end) const
+{
+  return (int32_t)(readIndex.load(std::memory_order_acquire) - end) >= 0;
+}
+
+size_t SppOutbound::getDepth() const
+{
+  return writeIndex.load(std::memory_order_relaxed) - readIndex.load(std::memory_order_relaxed);
+}
+
+size_t SppOutbound::getHighWater() const
+{
+  return highWater.load(std::memory_order_relaxed);
+}
+
+uint32_t SppOutbound::getOverflows() const
+{
+  return overflows.load(std::memory_order_relaxed);
+}
+
+uint32_t SppOutbound::getStalls() const
+{
+  return stalls.load(std::memory_order_relaxed);
+}
+
+/*
+  Time spent congested, the current stall included
+*/
+uint32_t SppOutbound::getStallMillis(uint32_t now) const
+{
+  uint32_t stalled = stalledMillis.load(std::memory_order_relaxed);
+  if (isCongested())
+  {
+    stalled += (now - stalledSince.load(std::memory_order_relaxed)) / 1000;
+  }
+  return stalled;
+}
@@ -0,0 +1,72 @@
+#pragma once
+#ifndef SPPOUTBOUND_H
+#define SPPOUTBOUND_H
+
+#include "Arduino.h"
+#include <atomic>
+#ifndef EPOXY_DUINO
+#include "BluetoothSerial.h"
+#else
+#include "MockBluetoothSerial.h"
+#include "MockEsp.h"
+#endif
+
+#define SPP_OUTBOUND_SIZE 4096 // Bytes waiting for the radio link, power of two
+#define SPP_OUTBOUND_CHUNK 512 // Bytes handed to BluetoothSerial at once
+
+/*
+  Bytes on their way to the radio over SPP.
+
+  BluetoothSerial blocks the writer while RFCOMM is congested, and flush()
+  waits until the link catches up, for ever if the radio is out of range.
+  Writes land here instead and return right away, whole or not at all, so a
+  frame written at once never goes out cut. They go on to BluetoothSerial only while the
+  link is not congested, as reported by ESP_SPP_CONG_EVT and ESP_SPP_WRITE_EVT.
+
+  Writers are the Bluedroid task, bridging the centrals, and the loop task,
+  talking to the radio. They take turns on a spinlock around the copy.
+  pump() may be called by any of them, one drains while the others leave
+  the bytes to it, in the order they were written.
+*/
+class SppOutbound
+{
+public:
+  SppOutbound(BluetoothSerial &btSerial);
+
+  bool write(const uint8_t *data, size_t size, uint32_t *end = nullptr);
+  bool print(const char *text);
+  void pump();
+  void clear();
+
+  void setCongested(bool congested, uint32_t now);
+  bool isCongested() const;
+  bool isEmpty() const;
+  bool isSent(uint32_t end) const;
+
+  size_t getDepth() const;
+  size_t getHighWater() const;
+  uint32_t getOverflows() const;
+  uint32_t getStalls() const;
+  uint32_t getStallMillis(uint32_t now) const;
+
+private:
+  BluetoothSerial &btSerial;
+  uint8_t buffer[SPP_OUTBOUND_SIZE];
+  std::atomic<uint32_t> writeIndex{0}; // Moved by writers holding the lock
+  std::atomic<uint32_t> readIndex{0};  // Moved by whoever drains
+  std::atomic<bool> draining{false};
+  std::atomic<bool> congested{false};
+  std::atomic<uint32_t> highWater{0};
+  std::atomic<uint32_t> overflows{0};  // Writes dropped, no room left
+
+  // esp_timer time, in the SPP callback on the BT task
+  std::atomic<uint32_t> stalledSince{0}; // Start of the current stall
+  std::atomic<uint32_t> stalls{0};
+  std::atomic<uint32_t> stalledMillis{0}; // Stalls over, the current one excluded
+
+#if !defined(EPOXY_DUINO)
+  portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+#endif
+};
+
+#endif
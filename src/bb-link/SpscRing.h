@@ -0,0 +1,96 @@
+#pragma once
+#ifndef SPSCRING_H
+#define SPSCRING_H
+
+#include "Arduino.h"
+#include <atomic>
+
+/*
+  Bounded lock-free ring, one producer task and one consumer task, possibly on
+  different cores.
+
+  Each side owns its index and only reads the other's. The producer fills the
+  slot before publishing the write index with release, the consumer acquires it
+  before reading the slot, and the same goes for the read index handing the slot
+  back. No CAS, no sequence per slot, which is all EventInbox needs more for
+  several producers. When full the item is dropped and counted.
+
+  Capacity must be a power of two.
+*/
+template <typename Item, uint32_t Capacity>
+class SpscRing
+{
+  static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+  /*
+    Producer task only
+  */
+  bool push(const Item &item)
+  {
+    uint32_t write = writeIndex.load(std::memory_order_relaxed);
+    uint32_t used = write - readIndex.load(std::memory_order_acquire);
+    if (used >= Capacity)
+    {
+      overflows.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    items[write & (Capacity - 1)] = item;
+    writeIndex.store(write + 1, std::memory_order_release);
+
+    // Only the producer raises it
+    if (used + 1 > highWater.load(std::memory_order_relaxed))
+    {
+      highWater.store(used + 1, std::memory_order_relaxed);
+    }
+    return true;
+  }
+
+  /*
+    Consumer task only
+  */
+  bool pop(Item *item)
+  {
+    uint32_t read = readIndex.load(std::memory_order_relaxed);
+    if (read == writeIndex.load(std::memory_order_acquire))
+    {
+      return false;
+    }
+    *item = items[read & (Capacity - 1)];
+    readIndex.store(read + 1, std::memory_order_release);
+    return true;
+  }
+
+  /*
+    From any task, a snapshot
+  */
+  uint32_t count() const
+  {
+    uint32_t read = readIndex.load(std::memory_order_acquire);
+    return writeIndex.load(std::memory_order_acquire) - read;
+  }
+
+  bool isEmpty() const
+  {
+    return count() == 0;
+  }
+
+  uint32_t getOverflows() const
+  {
+    return overflows.load(std::memory_order_relaxed);
+  }
+
+  uint32_t getHighWater() const
+  {
+    return highWater.load(std::memory_order_relaxed);
+  }
+
+private:
+  Item items[Capacity];
+  std::atomic<uint32_t> writeIndex{0}; // Written by the producer only
+  std::atomic<uint32_t> readIndex{0};  // Written by the consumer only
+  std::atomic<uint32_t> overflows{0};
+  std::atomic<uint32_t> highWater{0};
+};
+
+#endif
@@ -0,0 +1,269 @@
+#pragma once
+#ifndef STATEMACHINE_H
+#define STATEMACHINE_H
+
+#include "Arduino.h"
+
+#define STATE_HISTORY_SIZE 8 // Recent transitions kept per state machine
+
+struct state_transition_t
+{
+  unsigned long time;
+  uint8_t from;
+  uint8_t to;
+};
+
+/*
+  Table driven state machine.
+
+  States are an enum. Their enter, update and exit handlers are member functions of the
+  owner, listed in a constant table indexed by state. The table is constant initialized
+  so it stays in flash, dispatch is an indexed call thru a member function pointer and
+  nothing is allocated.
+
+  Same semantics as the FiniteStateMachine it replaces:
+  - the first update enters the initial state
+  - transitionTo is applied on the next update: exit, then enter, no update that round
+  - immediateTransitionTo is applied right away, even to the current state
+  - requesting any transition restarts timeInCurrentState(), right away and again
+    once the new state has been entered
+
+  Only the owning task drives the machine. Other tasks post events to the owner's
+  EventInbox, which applies the resulting transition before handling the next one.
+  A request replacing another one still pending is counted as coalesced.
+
+  Each machine also keeps the time spent in and the number of entries into every
+  state, and a ring of its last transitions.
+*/
+template <class Owner, typename StateId, size_t StateCount>
+class StateMachine
+{
+public:
+  typedef void (Owner::*Handler)();
+
+  struct state_t
+  {
+    Handler enter;
+    Handler update;
+    Handler exit;
+  };
+
+  typedef state_t Table[StateCount];
+
+  StateMachine(Owner *owner, const Table &table, StateId initial)
+      : owner(owner), table(table), currentState(initial), nextState(initial)
+  {
+  }
+
+  void update()
+  {
+    if (needToTriggerEnter)
+    {
+      needToTriggerEnter = false;
+      stateChangeTime = enteredAt = millis();
+      entries[currentState]++;
+      call(table[currentState].enter);
+    }
+    else if (currentState != nextState)
+    {
+      immediateTransitionTo(nextState);
+    }
+    else
+    {
+      call(table[currentState].update);
+    }
+  }
+
+  void transitionTo(StateId state)
+  {
+    if (nextState != currentState && nextState != state)
+    {
+      coalesced++;
+    }
+    nextState = state;
+    stateChangeTime = millis();
+  }
+
+  void immediateTransitionTo(StateId state)
+  {
+    call(table[currentState].exit);
+    unsigned long now = millis();
+    record(currentState, state, now);
+    currentState = nextState = state;
+    call(table[currentState].enter);
+    // A slow enter, like connecting, is not counted in the time in the state
+    stateChangeTime = millis();
+  }
+
+  /*
+    Run to completion: apply a pending transition now instead of on the next update
+  */
+  void applyPendingTransition()
+  {
+    if (!needToTriggerEnter && currentState != nextState)
+    {
+      immediateTransitionTo(nextState);
+    }
+  }
+
+  StateId getCurrentState() const
+  {
+    return currentState;
+  }
+
+  bool isInState(StateId state) const
+  {
+    return currentState == state;
+  }
+
+  unsigned long timeInCurrentState() const
+  {
+    return millis() - stateChangeTime;
+  }
+
+  uint32_t getCoalescedTransitions() const
+  {
+    return coalesced;
+  }
+
+  // Total time spent in a state, including the ongoing visit
+  unsigned long getDwellTime(StateId state) const
+  {
+    unsigned long time = dwell[state];
+    if (state == currentState && !needToTriggerEnter)
+    {
+      time += millis() - enteredAt;
+    }
+    return time;
+  }
+
+  uint32_t getEntries(StateId state) const
+  {
+    return entries[state];
+  }
+
+  uint8_t getHistoryCount() const
+  {
+    return historyCount;
+  }
+
+  // Most recent first
+  const state_transition_t &getTransition(uint8_t index) const
+  {
+    return history[(historyHead + STATE_HISTORY_SIZE - 1 - index) % STATE_HISTORY_SIZE];
+  }
+
+  /*
+    Big endian, ages are relative to now
+
+    current[1] count[1] {dwell_ms[4] entries[2]} * count
+    history[1] {age_ms[4] from[1] to[1]} * history
+  */
+  size_t serializeStats(uint8_t *buffer) const
+  {
+    unsigned long now = millis();
+    uint8_t *p = buffer;
+    *p++ = currentState;
+    *p++ = StateCount;
+    for (size_t i = 0; i < StateCount; i++)
+    {
+      p = put32(p, getDwellTime((StateId)i));
+      uint16_t count = entries[i] < UINT16_MAX ? entries[i] : UINT16_MAX;
+      *p++ = (count >> 8) & 0xFF;
+      *p++ = count & 0xFF;
+    }
+    *p++ = historyCount;
+    for (uint8_t i = 0; i < historyCount; i++)
+    {
+      const state_transition_t &transition = getTransition(i);
+      p = put32(p, now - transition.time);
+      *p++ = transition.from;
+      *p++ = transition.to;
+    }
+    return p - buffer;
+  }
+
+  static constexpr size_t maxStatsSize()
+  {
+    return 3 + StateCount * 6 + STATE_HISTORY_SIZE * 6;
+  }
+
+  void printStats(Print &out, const char *const names[]) const
+  {
+    unsigned long now = millis();
+    out.printf("  in %s for %lu s, %u coalesced\n", names[currentState], timeInCurrentState() / 1000, coalesced);
+    for (size_t i = 0; i < StateCount; i++)
+    {
+      out.printf("  %-16s %8lu s %6u entries\n", names[i], getDwellTime((StateId)i) / 1000, entries[i]);
+    }
+    for (uint8_t i = 0; i < historyCount; i++)
+    {
+      const state_transition_t &transition = getTransition(i);
+      out.printf("  %8lu s ago %s > %s\n", (now - transition.time) / 1000, names[transition.from], names[transition.to]);
+    }
+  }
+
+  /*
+    RAM saved compared to the std::function based machine: three of them per state,
+    plus its own current, next, change time and enter flag. Against what dispatch
+    takes here only, the statistics kept on top are not part of the comparison.
+  */
+  static constexpr size_t savedMemory()
+  {
+    return StateCount * 3 * sizeof(std::function<void()>) + 2 * sizeof(void *) + sizeof(unsigned long) + sizeof(bool) - dispatchMemory();
+  }
+
+  // Owner, table, change time, current and next state, enter flag
+  static constexpr size_t dispatchMemory()
+  {
+    return sizeof(Owner *) + sizeof(const state_t *) + sizeof(unsigned long) + 2 * sizeof(StateId) + sizeof(bool);
+  }
+
+private:
+  Owner *owner;
+  const state_t *table;
+  unsigned long stateChangeTime = 0;
+  volatile StateId currentState;
+  volatile StateId nextState;
+  bool needToTriggerEnter = true;
+  uint32_t coalesced = 0;
+
+  unsigned long enteredAt = 0;
+  unsigned long dwell[StateCount] = {};
+  uint32_t entries[StateCount] = {};
+  state_transition_t history[STATE_HISTORY_SIZE];
+  uint8_t historyHead = 0;
+  uint8_t historyCount = 0;
+
+  void record(StateId from, StateId to, unsigned long now)
+  {
+    dwell[from] += now - enteredAt;
+    enteredAt = now;
+    entries[to]++;
+    history[historyHead] = {now, (uint8_t)from, (uint8_t)to};
+    historyHead = (historyHead + 1) % STATE_HISTORY_SIZE;
+    if (historyCount < STATE_HISTORY_SIZE)
+    {
+      historyCount++;
+    }
+  }
+
+  static uint8_t *put32(uint8_t *p, uint32_t value)
+  {
+    *p++ = (value >> 24) & 0xFF;
+    *p++ = (value >> 16) & 0xFF;
+    *p++ = (value >> 8) & 0xFF;
+    *p++ = value & 0xFF;
+    return p;
+  }
+
+  inline void call(Handler handler)
+  {
+    if (handler != nullptr)
+    {
+      (owner->*handler)();
+    }
+  }
+};
+
+#endif
@@ -5,9 +5,10 @@
   Commands: https://github.com/LA3QMA/TH-D74-Kenwood
 */
 #define CMD_BUFFER_SIZE 32
+#define CMD_SEND_TIMEOUT 1000 // ms a command waits on a congested link
 
-THD7x::THD7x(BluetoothSerial &btSerial)
-  : btSerial(btSerial) {
+THD7x::THD7x(BluetoothSerial &btSerial, SppOutbound *outbound)
+  : btSerial(btSerial), outbound(outbound) {
 }
 
 /*
@@ -112,47 +113,205 @@ bool THD7x::getRadioId(char *radioId, int len) {
   return false;
 }
 
-void THD7x::exitKISS() {
+bool THD7x::exitKISS() {
   // https://www.ax25.net/kiss.aspx
   const unsigned char exitKISSSequence[] = { 0xC0, 0xFF, 0xC0 };
   Log.traceln("(adapter) > BTC: KISS exit sequence");
-  for (unsigned char byte : exitKISSSequence) {
-    btSerial.write(byte);
+  if (!transmit(exitKISSSequence, sizeof(exitKISSSequence))) {
+    Log.warningln("BTC: KISS exit sequence not sent");
+    return false;
   }
-  btSerial.flush();
+  return true;
 }
 
-bool THD7x::isKISSMode() {
+/*
+  The KISS TNC ignores CAT commands, a radio that does not answer is taken to
+  be in KISS mode. A question that never got out tells nothing.
+*/
+kiss_mode_t THD7x::getKISSMode() {
   // Send a simple command to see if we get a response. BT queries the
   // bluetooth mode, which should always be on since we're connected.
   char response[CMD_BUFFER_SIZE];
-  return !sendCmd("BT", response, CMD_BUFFER_SIZE);
+  switch (request("BT", response, CMD_BUFFER_SIZE, 3)) {
+    case cmdAnswered:
+      return kissOff;
+    case cmdNotSent:
+      return kissUnknown;
+    default:
+      return kissOn;
+  }
+}
+
+/*
+  Back to CAT commands, whatever the TNC was doing. False when the radio
+  could not be told or still does not answer.
+*/
+bool THD7x::leaveKISS() {
+  // Exit KISS mode first so we don't have to wait for a timeout
+  if (!exitKISS()) {
+    return false;
+  }
+
+  // Just to be sure
+  kiss_mode_t mode = getKISSMode();
+  if (mode == kissOn) {
+    Log.warningln("BTC: still in KISS mode?");
+    if (exitKISS()) {
+      mode = getKISSMode();
+    }
+  }
+  return mode == kissOff;
+}
+
+/*
+  Tune the KISS band to a packet frequency, FM at the given baud rate. The
+  settings it replaces are saved in previous, frequency is 0 if the radio
+  could not be tuned. The TNC is back in KISS mode when done, or was never
+  taken out of it.
+*/
+bool THD7x::qsy(vfo_t vfo, uint32_t frequency, baud_rate_t baudRate, qsy_settings_t *previous) {
+  if (!leaveKISS()) {
+    Log.errorln("BTC: could not leave KISS mode, not tuning");
+    previous->frequency = 0;
+    previous->mode = modeUnknown;
+    previous->baudRate = baudRateUnknown;
+    return false;
+  }
+
+  Log.infoln("BTC: try to get baud rate");
+  if (getBaudRate(&previous->baudRate)) {
+    Log.infoln("BTC: previous baud rate: %d", previous->baudRate);
+  } else {
+    previous->baudRate = baudRateUnknown;
+  }
+
+  if (baudRate != baudRateUnknown && previous->baudRate != baudRate) {
+    Log.infoln("BTC: set baud rate");
+    setBaudRate(baudRate);
+  }
+
+  Log.infoln("BTC: try to get mode");
+  if (getMode(vfo, &previous->mode)) {
+    Log.infoln("BTC: previous mode: %d", previous->mode);
+    if (previous->mode != modeFM) {
+      setMode(vfo, modeFM);
+    }
+  } else {
+    previous->mode = modeUnknown;
+    Log.errorln("BTC: failed to get previous mode");
+  }
+
+  Log.infoln("BTC: try to set frequency: %d", frequency);
+  if (getFrequency(vfo, &previous->frequency)) {
+    Log.infoln("BTC: previousFrequency: %l", previous->frequency);
+    setFrequency(vfo, frequency);
+  } else {
+    previous->frequency = 0;
+    Log.errorln("BTC: failed to get previous frequency");
+  }
+
+  // Show time
+  setTNC(vfo, tncKISS);
+  return previous->frequency > 0;
+}
+
+/*
+  Undo a qsy(), baudRate is the one that was asked for. False when the radio
+  was left as it was, to try again later.
+*/
+bool THD7x::restore(vfo_t vfo, baud_rate_t baudRate, const qsy_settings_t *previous) {
+  if (!leaveKISS()) {
+    Log.errorln("BTC: could not leave KISS mode, not restoring");
+    return false;
+  }
+
+  Log.infoln("BTC: try to restore frequency to %i", previous->frequency);
+  setFrequency(vfo, previous->frequency);
+
+  if (previous->mode != modeUnknown && previous->mode != modeFM) {
+    setMode(vfo, previous->mode);
+  }
+
+  if (baudRate != baudRateUnknown && previous->baudRate != baudRateUnknown && previous->baudRate != baudRate) {
+    Log.infoln("BTC: restore baud rate");
+    setBaudRate(previous->baudRate);
+  }
+
+  // As long as BLE is connected, we want the radio to be in KISS mode
+  setTNC(vfo, tncKISS);
+  return true;
 }
 
 bool THD7x::sendCmd(const char *cmd, char *response, size_t responseLen, int retry) {
+  return request(cmd, response, responseLen, retry) == cmdAnswered;
+}
+
+cmd_result_t THD7x::request(const char *cmd, char *response, size_t responseLen, int retry) {
   Log.traceln("(adapter) > BTC: %s", cmd);
-  btSerial.flush();
-  btSerial.print(cmd);
-  btSerial.print("\r");
-  btSerial.flush();
+  // Whatever is left of an earlier reply would be read as this one
+  while (btSerial.available()) {
+    btSerial.read();
+  }
+  // In one go, no frame gets in between
+  char line[CMD_BUFFER_SIZE + 1];
+  snprintf(line, sizeof(line), "%s\r", cmd);
+  if (!transmit((const uint8_t *)line, strlen(line))) {
+    Log.infoln("Could not send command %s", cmd);
+    return cmdNotSent;
+  }
   btSerial.setTimeout(1000);
   size_t lenRead = btSerial.readBytesUntil('\r', response, responseLen - 1);
   if (lenRead == 0) {
     Log.infoln("No response from command %s", cmd);
-    return false;
+    return cmdNoAnswer;
   }
   if (response[0] == '?') {
     Log.warningln("Error response from command %s", cmd);
     if (retry--) {
       Log.infoln("Retry attempt left %i", retry);
       delay(200);
-      return sendCmd(cmd, response, responseLen, retry);
+      return request(cmd, response, responseLen, retry);
     } else {
       Log.warningln("No more retries");
-      return false;
+      return cmdRejected;
     }
   }
   response[lenRead] = '\0';
   Log.traceln("(adapter) < BTC: %s", response);
-  return (response[0] == cmd[0] && response[1] == cmd[1]);
+  return (response[0] == cmd[0] && response[1] == cmd[1]) ? cmdAnswered : cmdRejected;
+}
+
+/*
+  With an outbound buffer a congested link holds up the caller for at most
+  CMD_SEND_TIMEOUT, the command waits for the link to move before it is
+  queued and for the bytes ahead of it to leave. Given up on before it is
+  queued, it never goes out late to have its reply taken for the next one's.
+  The reply timeout only starts once this returns true. Without an outbound
+  buffer, the link is drained before and after.
+*/
+bool THD7x::transmit(const uint8_t *data, size_t size) {
+  if (outbound != nullptr) {
+    unsigned long start = millis();
+    uint32_t end;
+    while (outbound->isCongested() || !outbound->write(data, size, &end)) {
+      if (millis() - start >= CMD_SEND_TIMEOUT) {
+        return false;
+      }
+      delay(1);
+      outbound->pump();
+    }
+    outbound->pump();
+    while (!outbound->isSent(end)) {
+      if (millis() - start >= CMD_SEND_TIMEOUT) {
+        return false;
+      }
+      delay(1);
+      outbound->pump();
+    }
+    return true;
+  }
+  btSerial.flush();
+  btSerial.write(data, size);
+  btSerial.flush();
+  return true;
 }
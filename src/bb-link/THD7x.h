@@ -8,6 +8,8 @@
 #include "MockBluetoothSerial.h"
 #endif
 
+#include "SppOutbound.h"
+
 enum vfo_t : int
 {
   vfoA = 0x00,
@@ -23,6 +25,13 @@ enum tnc_mode_t : int
   tncUnknown = 0xFF
 };
 
+enum kiss_mode_t : int
+{
+  kissOff = 0x00,
+  kissOn = 0x01,
+  kissUnknown = 0xFF // The question never reached the radio
+};
+
 enum baud_rate_t : int
 {
   baudRate1200 = 0x00,
@@ -45,10 +54,28 @@ enum vfo_mode_t : int
   modeUnknown = 0xFF
 };
 
+enum cmd_result_t : int
+{
+  cmdAnswered = 0x00,
+  cmdRejected = 0x01, // '?' or a reply to some other command
+  cmdNoAnswer = 0x02,
+  cmdNotSent = 0x03
+};
+
+/*
+  Radio settings changed by a QSY, to put them back afterwards
+*/
+struct qsy_settings_t
+{
+  uint32_t frequency;
+  vfo_mode_t mode;
+  baud_rate_t baudRate;
+};
+
 class THD7x
 {
   public:
-    THD7x(BluetoothSerial &btSerial);
+    THD7x(BluetoothSerial &btSerial, SppOutbound *outbound = nullptr);
 
     void setFrequency(vfo_t vfo, uint32_t frequency);
     bool getFrequency(vfo_t vfo, uint32_t *frequency);
@@ -64,13 +91,21 @@ class THD7x
 
     bool getRadioId(char *radioId, int len);
 
-    void exitKISS();
-    bool isKISSMode();
+    bool exitKISS();
+    kiss_mode_t getKISSMode();
+    bool leaveKISS();
+
+    bool qsy(vfo_t vfo, uint32_t frequency, baud_rate_t baudRate, qsy_settings_t *previous);
+    bool restore(vfo_t vfo, baud_rate_t baudRate, const qsy_settings_t *previous);
 
     bool sendCmd(const char *command, char *response, size_t len, int retry=3);
 
   private:
     BluetoothSerial &btSerial;
+    SppOutbound *outbound;
+
+    cmd_result_t request(const char *command, char *response, size_t len, int retry);
+    bool transmit(const uint8_t *data, size_t size);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,173 @@
+#include "TaskLayout.h"
+#include <ArduinoLog.h>
+
+TaskLayout taskLayout;
+
+#if !defined(EPOXY_DUINO)
+static portMUX_TYPE tasksMux = portMUX_INITIALIZER_UNLOCKED;
+
+// Created by the BT controller and Bluedroid, looked up by name
+static const char *const PROTOCOL_TASKS[] = {"btController", "hciT", "BTU_TASK", "BTC_T"};
+#endif
+
+/*
+  Called once from setup(), on the loop task
+*/
+void TaskLayout::adoptLoopTask()
+{
+#if !defined(EPOXY_DUINO)
+  loopTask = xTaskGetCurrentTaskHandle();
+  if (xPortGetCoreID() != APP_CORE)
+  {
+    Log.errorln("Tasks: loop task on core %d instead of %d", xPortGetCoreID(), APP_CORE);
+  }
+  vTaskPrioritySet(NULL, BRIDGE_TASK_PRIORITY);
+  portENTER_CRITICAL(&tasksMux);
+  tasks[taskCount++] = {pcTaskGetTaskName(NULL), loopTask, (uint32_t)getArduinoLoopTaskStackSize(), 0};
+  portEXIT_CRITICAL(&tasksMux);
+#endif
+}
+
+/*
+  A task started again under the same name, such as the connect helper on
+  every retry, takes over the entry of the previous one. Tasks run below the
+  loop task starting them, none gets to exit() before its entry is filled in.
+*/
+bool TaskLayout::start(TaskFunction_t task, const char *name, uint32_t stackSize, void *param, uint8_t priority, TaskHandle_t *handle)
+{
+#if !defined(EPOXY_DUINO)
+  TaskHandle_t created = NULL;
+  portENTER_CRITICAL(&tasksMux);
+  task_entry_t *entry = entryFor(name);
+  if (entry != nullptr)
+  {
+    entry->stackSize = stackSize;
+  }
+  portEXIT_CRITICAL(&tasksMux);
+
+  if (xTaskCreatePinnedToCore(task, name, stackSize, param, priority, &created, APP_CORE) != pdPASS)
+  {
+    return false;
+  }
+  portENTER_CRITICAL(&tasksMux);
+  if (entry != nullptr)
+  {
+    entry->handle = created;
+  }
+  portEXIT_CRITICAL(&tasksMux);
+  if (handle != nullptr)
+  {
+    *handle = created;
+  }
+  return true;
+#else
+  // The mock runs it to completion right away
+  return xTaskCreate(task, name, stackSize, param, priority, handle) == pdPASS;
+#endif
+}
+
+/*
+  Last call of a task that ends: keeps how much stack it never used, then
+  deletes it
+*/
+void TaskLayout::exit()
+{
+#if !defined(EPOXY_DUINO)
+  TaskHandle_t self = xTaskGetCurrentTaskHandle();
+  uint32_t highWater = uxTaskGetStackHighWaterMark(NULL);
+  portENTER_CRITICAL(&tasksMux);
+  for (uint8_t i = 0; i < taskCount; i++)
+  {
+    if (tasks[i].handle == self)
+    {
+      tasks[i].handle = NULL;
+      tasks[i].highWater = highWater;
+    }
+  }
+  portEXIT_CRITICAL(&tasksMux);
+  vTaskDelete(NULL);
+#endif
+}
+
+/*
+  From Bluetooth callbacks, there is data to bridge
+*/
+void TaskLayout::wake()
+{
+#if !defined(EPOXY_DUINO)
+  if (loopTask != NULL)
+  {
+    xTaskNotifyGive(loopTask);
+  }
+#endif
+}
+
+/*
+  On the loop task, between two rounds
+*/
+void TaskLayout::waitForWork(uint32_t ms)
+{
+#if !defined(EPOXY_DUINO)
+  if (loopTask != NULL && ms > 0)
+  {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(ms));
+  }
+#endif
+}
+
+/*
+  Bytes of stack each task never used since it started, the smallest it gets
+  the closer to an overflow
+*/
+void TaskLayout::print(Print &out)
+{
+#if !defined(EPOXY_DUINO)
+  out.println("Tasks, stack never used:");
+  task_entry_t snapshot[TASK_LAYOUT_MAX_TASKS];
+  portENTER_CRITICAL(&tasksMux);
+  uint8_t count = taskCount;
+  memcpy(snapshot, tasks, sizeof(task_entry_t) * count);
+  portEXIT_CRITICAL(&tasksMux);
+
+  for (uint8_t i = 0; i < count; i++)
+  {
+    task_entry_t &task = snapshot[i];
+    if (task.handle != NULL)
+    {
+      out.printf("  %-14s core %d prio %2d stack %5d free %5d\n", task.name, APP_CORE, uxTaskPriorityGet(task.handle), task.stackSize, uxTaskGetStackHighWaterMark(task.handle));
+    }
+    else
+    {
+      out.printf("  %-14s ended         stack %5d free %5d\n", task.name, task.stackSize, task.highWater);
+    }
+  }
+  for (const char *name : PROTOCOL_TASKS)
+  {
+    TaskHandle_t handle = xTaskGetHandle(name);
+    if (handle != NULL)
+    {
+      out.printf("  %-14s core %d prio %2d             free %5d\n", name, PROTOCOL_CORE, uxTaskPriorityGet(handle), uxTaskGetStackHighWaterMark(handle));
+    }
+  }
+#endif
+}
+
+/*
+  Under tasksMux. A new entry unless the name is known, nullptr when full.
+*/
+task_entry_t *TaskLayout::entryFor(const char *name)
+{
+  for (uint8_t i = 0; i < taskCount; i++)
+  {
+    if (strcmp(tasks[i].name, name) == 0)
+    {
+      return &tasks[i];
+    }
+  }
+  if (taskCount >= TASK_LAYOUT_MAX_TASKS)
+  {
+    return nullptr;
+  }
+  tasks[taskCount] = {name, NULL, 0, 0};
+  return &tasks[taskCount++];
+}
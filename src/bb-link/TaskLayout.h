@@ -0,0 +1,86 @@
+#pragma once
+#ifndef TASKLAYOUT_H
+#define TASKLAYOUT_H
+
+#include "Arduino.h"
+#if defined(EPOXY_DUINO)
+#include "MockEsp.h"
+#endif
+
+/*
+  Which task runs where, and before what.
+
+  Core 0 belongs to the protocol stacks: BT controller, Bluedroid BTU and BTC
+  tasks, pinned there by the sdkconfig of the core. Core 1 runs our own work,
+  every task of ours is started thru TaskLayout::start() and lands there.
+
+  On core 1, highest first:
+    3  loop task: bridge pump, hardware commands, rig control, then LED and
+       button polling once the data has moved
+    2  OTA flash writer, only while an update runs
+    1  BTC connect helper, waits on the stack most of the time
+    1  journal writer and console log drain, whenever nothing above has work
+
+  The loop task sleeps between rounds until a Bluetooth callback wakes it, or
+  BRIDGE_PUMP_IDLE_WAIT passes, which lets the tasks below it run.
+*/
+
+#define PROTOCOL_CORE 0
+#define APP_CORE 1
+
+#define BRIDGE_TASK_PRIORITY 3
+#define OTA_WRITER_PRIORITY 2
+#define CONNECT_TASK_PRIORITY 1
+#define JOURNAL_TASK_PRIORITY 1
+#define BINARY_LOG_TASK_PRIORITY 1
+
+#define BRIDGE_PUMP_IDLE_WAIT 1 // ms the loop task sleeps with nothing to bridge
+#define TASK_LAYOUT_MAX_TASKS 8
+
+#if !defined(EPOXY_DUINO)
+#if ARDUINO_RUNNING_CORE != APP_CORE
+#error "The loop task must run on APP_CORE"
+#endif
+#if defined(CONFIG_BT_BLUEDROID_PINNED_TO_CORE) && CONFIG_BT_BLUEDROID_PINNED_TO_CORE != PROTOCOL_CORE
+#error "Bluedroid must run on PROTOCOL_CORE"
+#endif
+#if defined(CONFIG_BTDM_CTRL_PINNED_TO_CORE) && CONFIG_BTDM_CTRL_PINNED_TO_CORE != PROTOCOL_CORE
+#error "The BT controller must run on PROTOCOL_CORE"
+#endif
+#endif
+
+struct task_entry_t
+{
+  const char *name;
+  TaskHandle_t handle; // NULL once the task ended
+  uint32_t stackSize;  // Bytes
+  uint32_t highWater;  // Bytes never used, as of when the task ended
+};
+
+/*
+  Starts the tasks of the application on APP_CORE and keeps track of them, to
+  report how much of their stack they never used. Sizes are tuned from that.
+*/
+class TaskLayout
+{
+public:
+  void adoptLoopTask();
+  bool start(TaskFunction_t task, const char *name, uint32_t stackSize, void *param, uint8_t priority, TaskHandle_t *handle = nullptr);
+  void exit();
+
+  void wake();
+  void waitForWork(uint32_t ms);
+
+  void print(Print &out);
+
+private:
+  task_entry_t tasks[TASK_LAYOUT_MAX_TASKS];
+  uint8_t taskCount = 0;
+  TaskHandle_t loopTask = NULL;
+
+  task_entry_t *entryFor(const char *name);
+};
+
+extern TaskLayout taskLayout;
+
+#endif
@@ -0,0 +1,441 @@
+#include "TrafficJournal.h"
+#include <ArduinoLog.h>
+
+static const uint16_t ERASED_LENGTH = 0xFFFF;
+
+static inline void putUInt32(uint8_t *buffer, uint32_t value)
+{
+  // Big endian
+  buffer[0] = value >> 24;
+  buffer[1] = value >> 16;
+  buffer[2] = value >> 8;
+  buffer[3] = value;
+}
+
+/*
+  Builds the index from the sector headers and finds where the last session
+  stopped writing
+*/
+bool TrafficJournal::init()
+{
+  partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_SPIFFS, NULL);
+  if (partition == nullptr)
+  {
+    Log.warningln("Journal: no data partition, traffic is not journaled");
+    return false;
+  }
+  sectorCount = min(partition->size / JOURNAL_SECTOR_SIZE, (uint32_t)JOURNAL_MAX_SECTORS);
+
+  bool found = false;
+  used = 0;
+  for (uint16_t sector = 0; sector < sectorCount; sector++)
+  {
+    sector_header_t header;
+    firstTimes[sector] = JOURNAL_NO_TIME;
+    if (!readSectorHeader(sector, &header))
+    {
+      continue;
+    }
+    firstTimes[sector] = header.firstTime;
+    used++;
+    if (!found || (int32_t)(header.sequence - headSequence) > 0)
+    {
+      head = sector;
+      headSequence = header.sequence;
+      found = true;
+    }
+  }
+
+  uint32_t lastTime = JOURNAL_NO_TIME;
+  if (found)
+  {
+    writeOffset = endOf(head, &lastTime);
+    if (lastTime == JOURNAL_NO_TIME)
+    {
+      lastTime = firstTimes[head];
+    }
+  }
+  else
+  {
+    // The first record opens sector 0
+    head = sectorCount - 1;
+    headSequence = 0;
+    writeOffset = JOURNAL_SECTOR_SIZE;
+  }
+  clockBase = (lastTime == JOURNAL_NO_TIME ? 0 : lastTime + 1) - millis() / 1000;
+
+#if !defined(EPOXY_DUINO)
+  lock = xSemaphoreCreateMutex();
+#endif
+  Log.infoln("Journal: %d of %d sectors used, time %d", used, sectorCount, now());
+  return true;
+}
+
+void TrafficJournal::begin()
+{
+  if (partition == nullptr || async)
+  {
+    return;
+  }
+#if !defined(EPOXY_DUINO)
+  if (!taskLayout.start(
+          writerTask,               // Task function
+          "journalWriter",          // Task name
+          JOURNAL_TASK_STACK_SIZE,  // Stack size
+          this,                     // Task input parameter
+          JOURNAL_TASK_PRIORITY,    // Priority of the task
+          &writerTaskHandle         // Task handle
+          ))
+  {
+    Log.errorln("Journal: failed to start writer task, writing synchronously");
+    return;
+  }
+  async = true;
+#endif
+}
+
+#if !defined(EPOXY_DUINO)
+void TrafficJournal::writerTask(void *param)
+{
+  TrafficJournal *journal = (TrafficJournal *)param;
+  for (;;)
+  {
+    journal->drain();
+    vTaskDelay(pdMS_TO_TICKS(JOURNAL_DRAIN_INTERVAL));
+  }
+}
+#endif
+
+/*
+  There is a partition to journal to, recording or not
+*/
+bool TrafficJournal::isEnabled() const
+{
+  return partition != nullptr;
+}
+
+void TrafficJournal::setRecording(bool recording)
+{
+  this->recording = recording && partition != nullptr;
+  if (this->recording)
+  {
+    begin();
+  }
+  Log.infoln("Journal: %s", this->recording ? "recording" : "not recording");
+}
+
+bool TrafficJournal::isRecording() const
+{
+  return recording;
+}
+
+/*
+  From any task, costs a copy into the inbox
+*/
+void TrafficJournal::append(journal_direction_t direction, const uint8_t *data, size_t size)
+{
+  if (!recording)
+  {
+    return;
+  }
+  journal_chunk_t chunk;
+  chunk.time = now();
+  chunk.direction = direction;
+  for (size_t offset = 0; offset < size; offset += chunk.length)
+  {
+    chunk.length = min(size - offset, (size_t)JOURNAL_CHUNK_SIZE);
+    memcpy(chunk.data, data + offset, chunk.length);
+    chunks.post(chunk);
+  }
+  if (!async)
+  {
+    drain();
+  }
+}
+
+/*
+  Writer task, or whoever holds the lock. A partial batch goes to flash once
+  it is old enough, or when asked to.
+*/
+void TrafficJournal::drain(bool flush)
+{
+  take();
+  journal_chunk_t chunk;
+  while (chunks.receive(&chunk))
+  {
+    write(chunk);
+  }
+  if (batchLength > 0 && (flush || millis() - batchSince >= JOURNAL_FLUSH_INTERVAL))
+  {
+    flushBatch();
+  }
+  give();
+}
+
+uint32_t TrafficJournal::now() const
+{
+  return clockBase + millis() / 1000;
+}
+
+/*
+  Cursor of the first record at or after the time, past the last record when
+  there is none
+*/
+uint32_t TrafficJournal::seek(uint32_t time)
+{
+  if (!async)
+  {
+    drain(true);
+  }
+  take();
+
+  // Last sector starting before the time, the index is in time order. Records
+  // of that very time may begin at the end of it.
+  uint32_t first = oldestSequence();
+  uint32_t low = 0;
+  uint32_t high = used;
+  while (high - low > 1)
+  {
+    uint32_t middle = (low + high) / 2;
+    if ((int32_t)(firstTimes[sectorOf(first + middle)] - time) < 0)
+    {
+      low = middle;
+    }
+    else
+    {
+      high = middle;
+    }
+  }
+
+  uint32_t cursor = headSequence * JOURNAL_SECTOR_SIZE + writeOffset;
+  for (uint32_t sequence = first + low; used > 0 && (int32_t)(sequence - headSequence) <= 0; sequence++)
+  {
+    uint16_t sector = sectorOf(sequence);
+    size_t end = sequence == headSequence ? writeOffset : endOf(sector);
+    size_t offset = JOURNAL_SECTOR_HEADER_SIZE;
+    record_header_t header;
+    while (offset < end && readRecordHeader(sector, offset, &header))
+    {
+      if ((int32_t)(header.time - time) >= 0)
+      {
+        give();
+        return sequence * JOURNAL_SECTOR_SIZE + offset;
+      }
+      offset += JOURNAL_RECORD_HEADER_SIZE + header.length;
+    }
+  }
+  give();
+  return cursor;
+}
+
+/*
+  A page of records from the cursor on, behind the journal time and the cursor
+  to ask for the next page. Each record is its time, direction, length and
+  data, big endian. A cursor to a sector reused since goes on from the oldest
+  record.
+*/
+size_t TrafficJournal::read(uint32_t cursor, uint8_t *page, size_t size)
+{
+  if (size < JOURNAL_PAGE_HEADER_SIZE)
+  {
+    return 0;
+  }
+  if (!async)
+  {
+    drain(true);
+  }
+  take();
+
+  uint32_t sequence = cursor / JOURNAL_SECTOR_SIZE;
+  size_t offset = max(cursor % JOURNAL_SECTOR_SIZE, (uint32_t)JOURNAL_SECTOR_HEADER_SIZE);
+  if (used > 0 && (int32_t)(sequence - oldestSequence()) < 0)
+  {
+    sequence = oldestSequence();
+    offset = JOURNAL_SECTOR_HEADER_SIZE;
+  }
+
+  size_t length = JOURNAL_PAGE_HEADER_SIZE;
+  while (used > 0 && (int32_t)(sequence - headSequence) <= 0)
+  {
+    uint16_t sector = sectorOf(sequence);
+    size_t end = sequence == headSequence ? writeOffset : endOf(sector);
+    record_header_t header;
+    if (offset >= end || !readRecordHeader(sector, offset, &header))
+    {
+      if (sequence == headSequence)
+      {
+        break;
+      }
+      sequence++;
+      offset = JOURNAL_SECTOR_HEADER_SIZE;
+      continue;
+    }
+
+    size_t entrySize = 7 + header.length;
+    if (length + entrySize > size)
+    {
+      break;
+    }
+    putUInt32(page + length, header.time);
+    page[length + 4] = header.direction;
+    page[length + 5] = header.length >> 8;
+    page[length + 6] = header.length;
+    esp_partition_read(partition, sector * JOURNAL_SECTOR_SIZE + offset + JOURNAL_RECORD_HEADER_SIZE, page + length + 7, header.length);
+    length += entrySize;
+    offset += JOURNAL_RECORD_HEADER_SIZE + header.length;
+  }
+
+  putUInt32(page, now());
+  putUInt32(page + 4, sequence * JOURNAL_SECTOR_SIZE + offset);
+  give();
+  return length;
+}
+
+uint32_t TrafficJournal::getDropped() const
+{
+  return chunks.getDropped();
+}
+
+void TrafficJournal::take()
+{
+#if !defined(EPOXY_DUINO)
+  if (lock != NULL)
+  {
+    xSemaphoreTake(lock, portMAX_DELAY);
+  }
+#endif
+}
+
+void TrafficJournal::give()
+{
+#if !defined(EPOXY_DUINO)
+  if (lock != NULL)
+  {
+    xSemaphoreGive(lock);
+  }
+#endif
+}
+
+void TrafficJournal::write(const journal_chunk_t &chunk)
+{
+  size_t recordSize = JOURNAL_RECORD_HEADER_SIZE + chunk.length;
+  if (writeOffset + batchLength + recordSize > JOURNAL_SECTOR_SIZE)
+  {
+    flushBatch();
+    if (!openSector(chunk.time))
+    {
+      return;
+    }
+  }
+  if (batchLength + recordSize > JOURNAL_BATCH_SIZE)
+  {
+    flushBatch();
+  }
+  if (batchLength == 0)
+  {
+    batchSince = millis();
+  }
+  record_header_t header = {chunk.time, chunk.length, chunk.direction, 0x00};
+  memcpy(batch + batchLength, &header, JOURNAL_RECORD_HEADER_SIZE);
+  memcpy(batch + batchLength + JOURNAL_RECORD_HEADER_SIZE, chunk.data, chunk.length);
+  batchLength += recordSize;
+}
+
+void TrafficJournal::flushBatch()
+{
+  if (batchLength == 0)
+  {
+    return;
+  }
+  if (esp_partition_write(partition, head * JOURNAL_SECTOR_SIZE + writeOffset, batch, batchLength) != ESP_OK)
+  {
+    Log.errorln("Journal: failed to write sector %d", head);
+  }
+  writeOffset += batchLength;
+  batchLength = 0;
+}
+
+/*
+  The next sector in the ring, erased whatever it held
+*/
+bool TrafficJournal::openSector(uint32_t time)
+{
+  uint16_t next = (head + 1) % sectorCount;
+  if (esp_partition_erase_range(partition, next * JOURNAL_SECTOR_SIZE, JOURNAL_SECTOR_SIZE) != ESP_OK)
+  {
+    Log.errorln("Journal: failed to erase sector %d", next);
+    return false;
+  }
+  if (firstTimes[next] == JOURNAL_NO_TIME)
+  {
+    used++;
+  }
+
+  sector_header_t header = {JOURNAL_MAGIC, headSequence + 1, time, 0xFFFFFFFF};
+  if (esp_partition_write(partition, next * JOURNAL_SECTOR_SIZE, &header, sizeof(header)) != ESP_OK)
+  {
+    Log.errorln("Journal: failed to write sector %d", next);
+  }
+  head = next;
+  headSequence++;
+  firstTimes[head] = time;
+  writeOffset = JOURNAL_SECTOR_HEADER_SIZE;
+  return true;
+}
+
+bool TrafficJournal::readSectorHeader(uint16_t sector, sector_header_t *header)
+{
+  return esp_partition_read(partition, sector * JOURNAL_SECTOR_SIZE, header, sizeof(*header)) == ESP_OK &&
+         header->magic == JOURNAL_MAGIC;
+}
+
+/*
+  False past the last record of the sector
+*/
+bool TrafficJournal::readRecordHeader(uint16_t sector, size_t offset, record_header_t *header)
+{
+  if (offset + JOURNAL_RECORD_HEADER_SIZE > JOURNAL_SECTOR_SIZE ||
+      esp_partition_read(partition, sector * JOURNAL_SECTOR_SIZE + offset, header, sizeof(*header)) != ESP_OK)
+  {
+    return false;
+  }
+  return header->length != ERASED_LENGTH && offset + JOURNAL_RECORD_HEADER_SIZE + header->length <= JOURNAL_SECTOR_SIZE;
+}
+
+/*
+  Offset after the last record. A record cut short by a power loss closes the
+  sector, nothing can be written over it.
+*/
+size_t TrafficJournal::endOf(uint16_t sector, uint32_t *lastTime)
+{
+  size_t offset = JOURNAL_SECTOR_HEADER_SIZE;
+  record_header_t header;
+  while (readRecordHeader(sector, offset, &header))
+  {
+    if (lastTime != nullptr)
+    {
+      *lastTime = header.time;
+    }
+    offset += JOURNAL_RECORD_HEADER_SIZE + header.length;
+  }
+  if (offset + JOURNAL_RECORD_HEADER_SIZE <= JOURNAL_SECTOR_SIZE && header.length != ERASED_LENGTH)
+  {
+    return JOURNAL_SECTOR_SIZE;
+  }
+  return offset;
+}
+
+int32_t TrafficJournal::sectorOf(uint32_t sequence) const
+{
+  uint32_t age = headSequence - sequence;
+  if (age >= used)
+  {
+    return -1;
+  }
+  return (head + sectorCount - age) % sectorCount;
+}
+
+uint32_t TrafficJournal::oldestSequence() const
+{
+  return headSequence - used + 1;
+}
@@ -0,0 +1,134 @@
+#pragma once
+#ifndef TRAFFICJOURNAL_H
+#define TRAFFICJOURNAL_H
+
+#include "Arduino.h"
+#if !defined(EPOXY_DUINO)
+#include <esp_partition.h>
+#else
+#include "MockEsp.h"
+#endif
+
+#include "EventInbox.h"
+#include "TaskLayout.h"
+
+#define JOURNAL_SECTOR_SIZE 4096
+#define JOURNAL_SECTOR_HEADER_SIZE 16
+#define JOURNAL_RECORD_HEADER_SIZE 8
+#define JOURNAL_MAX_SECTORS 512     // Entries of the index, 2 MB of flash
+#define JOURNAL_CHUNK_SIZE 256      // Longer traffic takes several records
+#define JOURNAL_INBOX_SIZE 16       // Chunks waiting for the writer, power of two
+#define JOURNAL_BATCH_SIZE 1024     // Bytes written to flash at once
+#define JOURNAL_FLUSH_INTERVAL 5000 // ms a partial batch waits at most
+#define JOURNAL_DRAIN_INTERVAL 100  // ms between two drains of the inbox
+#define JOURNAL_PAGE_HEADER_SIZE 8  // Journal time and next cursor
+#define JOURNAL_TASK_STACK_SIZE 3072
+#define JOURNAL_MAGIC 0x42424A31 // "BBJ1"
+#define JOURNAL_NO_TIME 0xFFFFFFFF
+
+enum journal_direction_t : uint8_t
+{
+  journalFromRadio = 0x01,
+  journalToRadio = 0x02
+};
+
+struct journal_chunk_t
+{
+  uint32_t time;
+  uint16_t length;
+  uint8_t direction;
+  uint8_t data[JOURNAL_CHUNK_SIZE];
+};
+
+/*
+  Bridged traffic kept in flash across power cycles, for the app to look back
+  at what went wrong.
+
+  The partition is a ring of sectors, written in turn so they all wear the
+  same. A sector starts with a header holding its sequence number and the
+  time of its first record, which is all the index kept in RAM is made of.
+  Records follow, each behind its time, length and direction, until the next
+  one doesn't fit.
+
+  Time is the journal clock: seconds, going on from the last record after a
+  power cycle. A cursor is the sector sequence number times the sector size
+  plus the offset of a record, it stays valid until the sector is reused.
+
+  Appending copies the chunk into a lock-free inbox. A low priority task
+  writes them to flash in batches, so no caller blocks on a write. Erasing and
+  writing still turn the flash cache off on both cores, stalling Bluetooth
+  and the bridge for as long: nothing is journaled until recording is turned
+  on. Until begin() is called, and on the host, chunks are written right away
+  and reading flushes them first. Otherwise reading leaves the writer alone,
+  what is still batched shows up once it is flushed.
+*/
+class TrafficJournal
+{
+public:
+  bool init();
+  void begin();
+  bool isEnabled() const;
+  void setRecording(bool recording);
+  bool isRecording() const;
+
+  void append(journal_direction_t direction, const uint8_t *data, size_t size);
+  void drain(bool flush = false);
+
+  uint32_t now() const;
+  uint32_t seek(uint32_t time);
+  size_t read(uint32_t cursor, uint8_t *page, size_t size);
+
+  uint32_t getDropped() const;
+
+private:
+  struct sector_header_t
+  {
+    uint32_t magic;
+    uint32_t sequence;
+    uint32_t firstTime;
+    uint32_t reserved;
+  };
+
+  struct record_header_t
+  {
+    uint32_t time;
+    uint16_t length;
+    uint8_t direction;
+    uint8_t reserved;
+  };
+
+  const esp_partition_t *partition = nullptr;
+  uint16_t sectorCount = 0;
+  uint32_t firstTimes[JOURNAL_MAX_SECTORS]; // The index, JOURNAL_NO_TIME for blank sectors
+  uint16_t head = 0;                        // Sector written to
+  uint16_t used = 0;                        // Sectors with records
+  uint32_t headSequence = 0;
+  size_t writeOffset = JOURNAL_SECTOR_SIZE; // In the head sector, batch excluded
+  uint32_t clockBase = 0;
+
+  EventInbox<journal_chunk_t, JOURNAL_INBOX_SIZE> chunks;
+  uint8_t batch[JOURNAL_BATCH_SIZE];
+  size_t batchLength = 0;
+  unsigned long batchSince = 0;
+  bool async = false;
+  bool recording = false;
+
+#if !defined(EPOXY_DUINO)
+  SemaphoreHandle_t lock = NULL;
+  TaskHandle_t writerTaskHandle = NULL;
+  static void writerTask(void *param);
+#endif
+
+  void take();
+  void give();
+  void write(const journal_chunk_t &chunk);
+  void flushBatch();
+  bool openSector(uint32_t time);
+  bool readSectorHeader(uint16_t sector, sector_header_t *header);
+  bool readRecordHeader(uint16_t sector, size_t offset, record_header_t *header);
+  size_t endOf(uint16_t sector, uint32_t *lastTime = nullptr);
+  int32_t sectorOf(uint32_t sequence) const;
+  uint32_t oldestSequence() const;
+};
+
+#endif
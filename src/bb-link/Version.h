@@ -0,0 +1,9 @@
+#pragma once
+#ifndef VERSION_H
+#define VERSION_H
+
+#define FIRMWARE_VERSION_MAJOR 0
+#define FIRMWARE_VERSION_MINOR 7
+#define FIRMWARE_VERSION_PATCH 8
+
+#endif
@@ -29,6 +29,8 @@ void setup()
   // LOG_LEVEL_FATAL, LOG_LEVEL_ERROR, LOG_LEVEL_WARNING, LOG_LEVEL_INFO, LOG_LEVEL_TRACE, LOG_LEVEL_VERBOSE
   Log.begin(LOG_LEVEL_INFO, &Serial);
   Log.setPrefix(logPrintPrefix);
+  taskLayout.adoptLoopTask();
+  binaryLog.begin();
 
   adapter = new Adapter();
 
@@ -86,7 +88,7 @@ void logPrintTimestamp(Print* _logOutput)
   const unsigned long SECS_PER_MIN        = 60;
   const unsigned long SECS_PER_HOUR       = 3600;
   const unsigned long SECS_PER_DAY        = 86400;
-  const unsigned long msecs               =  millis();
+  const unsigned long msecs               =  binaryLog.timestamp();
   const unsigned long secs                =  msecs / MSECS_PER_SEC;
   const unsigned long milliseconds        =  msecs % MSECS_PER_SEC;
   const unsigned long seconds             =  secs  % SECS_PER_MIN ;
@@ -0,0 +1,84 @@
+#line 2 "AX25FrameTest.ino"
+
+#include <AUnit.h>
+#include <ArduinoLog.h>
+#include "../../src/bb-link/AX25Frame.h"
+
+using aunit::TestRunner;
+
+// N0CALL>APRS:>Test
+static const uint8_t uiFrame[] = {
+    0xC0, 0x00, 0x82, 0xA0, 0xA4, 0xA6, 0x40, 0x40, 0x60, 0x9C, 0x60, 0x86,
+    0x82, 0x98, 0x98, 0x61, 0x03, 0xF0, 0x3E, 0x54, 0x65, 0x73, 0x74, 0xC0};
+
+// N0CALL-7>APRS,WIDE1-1*:>T<FEND>
+static const uint8_t digipeatedFrame[] = {
+    0xC0, 0x00, 0x82, 0xA0, 0xA4, 0xA6, 0x40, 0x40, 0xE0, 0x9C, 0x60, 0x86,
+    0x82, 0x98, 0x98, 0x6E, 0xAE, 0x92, 0x88, 0x8A, 0x62, 0x40, 0xE3, 0x03,
+    0xF0, 0x3E, 0x54, 0xDB, 0xDC, 0xC0};
+
+test(parsesUIFrame)
+{
+  AX25Frame frame;
+  assertTrue(frame.parse(uiFrame, sizeof(uiFrame)));
+  assertEqual(0, memcmp(frame.destination(), uiFrame + 2, AX25_ADDRESS_SIZE));
+  assertEqual(0, memcmp(frame.source(), uiFrame + 9, AX25_ADDRESS_SIZE));
+  assertEqual(0, frame.digipeaterCount());
+  assertEqual(AX25_CONTROL_UI, frame.control());
+  assertTrue(frame.hasPid());
+  assertEqual(0xF0, frame.pid());
+  assertEqual((size_t)5, frame.infoLength());
+  assertEqual(0, memcmp(">Test", frame.info(), 5));
+  assertEqual((size_t)7, frame.payloadLength());
+}
+
+test(parsesDigipeatersAndEscapes)
+{
+  AX25Frame frame;
+  assertTrue(frame.parse(digipeatedFrame, sizeof(digipeatedFrame)));
+  assertEqual(1, frame.digipeaterCount());
+  assertEqual(7, AX25Frame::ssid(frame.source()));
+  assertEqual((size_t)3, frame.infoLength());
+  assertEqual(0xC0, frame.info()[2]);
+}
+
+test(sameStationIgnoresFlags)
+{
+  AX25Frame frame;
+  AX25Frame other;
+  frame.parse(uiFrame, sizeof(uiFrame));
+  other.parse(digipeatedFrame, sizeof(digipeatedFrame));
+  // Destinations differ only by the command bit
+  assertTrue(AX25Frame::sameStation(frame.destination(), other.destination()));
+  assertFalse(AX25Frame::sameStation(frame.source(), other.source()));
+}
+
+test(refusesWhatIsNotAX25)
+{
+  AX25Frame frame;
+  const uint8_t txDelay[] = {0xC0, 0x01, 0x32, 0xC0};
+  assertFalse(frame.parse(txDelay, sizeof(txDelay)));
+
+  // Addresses never end
+  const uint8_t truncated[] = {0xC0, 0x00, 0x82, 0xA0, 0xA4, 0xA6, 0x40, 0x40, 0x60, 0x9C, 0x60, 0xC0};
+  assertFalse(frame.parse(truncated, sizeof(truncated)));
+
+  // No control byte
+  assertFalse(frame.parse(uiFrame, 16));
+
+  const uint8_t badEscape[] = {0xC0, 0x00, 0xDB, 0x01, 0xC0};
+  assertFalse(frame.parse(badEscape, sizeof(badEscape)));
+}
+
+void setup()
+{
+  Serial.begin(115200);
+  while (!Serial);
+  delay(1000);
+  Log.begin(LOG_LEVEL_SILENT, &Serial);
+}
+
+void loop()
+{
+  TestRunner::run();
+}
@@ -0,0 +1,164 @@
+#line 2 "BLEConnectionsTest.ino"
+
+#include <AUnit.h>
+#include <ArduinoLog.h>
+#include <string>
+#include <vector>
+#include "../../src/bb-link/BLEConnections.h"
+
+using aunit::TestRunner;
+
+// What reached the radio, one entry per sink call
+struct Sunk
+{
+  std::vector<std::string> writes;
+  std::vector<const uint8_t *> pointers;
+
+  BLEConnections::FrameSink sink()
+  {
+    return [this](const uint8_t *data, size_t size)
+    {
+      writes.push_back(std::string((const char *)data, size));
+      pointers.push_back(data);
+    };
+  }
+
+  std::string all()
+  {
+    std::string joined;
+    for (const std::string &write : writes)
+    {
+      joined += write;
+    }
+    return joined;
+  }
+};
+
+test(tracksCentrals)
+{
+  BLEConnections connections;
+  for (uint16_t connId = 0; connId < BLE_MAX_CONNECTIONS; connId++)
+  {
+    assertTrue(connections.add(connId));
+  }
+  assertFalse(connections.add(BLE_MAX_CONNECTIONS));
+  assertEqual(BLE_MAX_CONNECTIONS, connections.count());
+
+  assertTrue(connections.remove(1));
+  assertFalse(connections.remove(1));
+  assertEqual(BLE_MAX_CONNECTIONS - 1, connections.count());
+  assertTrue(connections.add(7));
+}
+
+test(subscribersAndPayload)
+{
+  BLEConnections connections;
+  connections.add(0);
+  connections.add(1);
+  assertEqual(0, connections.subscriberCount());
+  assertEqual((size_t)0, connections.maxPayload());
+
+  connections.setSubscribed(0, true);
+  assertEqual((size_t)BLE_DEFAULT_MTU - BLE_ATT_HEADER_SIZE, connections.maxPayload());
+
+  // Only subscribers count
+  connections.setMtu(1, 517);
+  assertEqual((size_t)BLE_DEFAULT_MTU - BLE_ATT_HEADER_SIZE, connections.maxPayload());
+  connections.setSubscribed(1, true);
+  assertEqual((size_t)514, connections.maxPayload());
+  assertEqual(2, connections.subscriberCount());
+
+  connections.remove(1);
+  assertEqual(1, connections.subscriberCount());
+}
+
+test(passesCompleteFramesFromTheWrite)
+{
+  BLEConnections connections;
+  connections.add(0);
+  Sunk sunk;
+  const uint8_t frames[] = {0xC0, 0x00, 0x01, 0xC0, 0xC0, 0x00, 0x02, 0xC0};
+  connections.assemble(0, frames, sizeof(frames), sunk.sink());
+  assertEqual((size_t)1, sunk.writes.size());
+  assertTrue(sunk.pointers[0] == frames);
+  assertEqual(sizeof(frames), sunk.writes[0].size());
+}
+
+test(holdsPartialFrameBack)
+{
+  BLEConnections connections;
+  connections.add(0);
+  Sunk sunk;
+  const uint8_t first[] = {0xC0, 0x00, 0x01, 0xC0, 0xC0, 0x00, 0x02};
+  const uint8_t second[] = {0x03};
+  const uint8_t third[] = {0x04, 0xC0};
+
+  connections.assemble(0, first, sizeof(first), sunk.sink());
+  assertTrue(sunk.all() == std::string("\xC0\x00\x01\xC0\xC0", 5));
+  connections.assemble(0, second, sizeof(second), sunk.sink());
+  assertEqual((size_t)1, sunk.writes.size());
+  connections.assemble(0, third, sizeof(third), sunk.sink());
+  assertTrue(sunk.all() == std::string((const char *)first, sizeof(first)) + "\x03\x04\xC0");
+  // Held back and closing bytes in one go
+  assertEqual((size_t)2, sunk.writes.size());
+  assertTrue(sunk.writes[1] == std::string("\x00\x02\x03\x04\xC0", 5));
+}
+
+test(discardsPartialFrame)
+{
+  BLEConnections connections;
+  connections.add(0);
+  Sunk sunk;
+  const uint8_t first[] = {0xC0, 0x00, 0x01};
+  const uint8_t frame[] = {0xC0, 0x00, 0x02, 0xC0};
+  connections.assemble(0, first, sizeof(first), sunk.sink());
+  connections.discardPartialFrame(0);
+  connections.assemble(0, frame, sizeof(frame), sunk.sink());
+  assertTrue(sunk.all() == "\xC0" + std::string((const char *)frame, sizeof(frame)));
+}
+
+test(passesUnframedAndUnknown)
+{
+  BLEConnections connections;
+  connections.add(0);
+  Sunk sunk;
+  const uint8_t text[] = {'T', 'N', ' ', '2', ',', '0', '\r'};
+  connections.assemble(0, text, sizeof(text), sunk.sink());
+  connections.assemble(5, text, sizeof(text), sunk.sink());
+  assertEqual((size_t)2, sunk.writes.size());
+  assertTrue(sunk.pointers[0] == text && sunk.pointers[1] == text);
+}
+
+test(dropsOversizeFrame)
+{
+  BLEConnections connections;
+  connections.add(0);
+  Sunk sunk;
+  uint8_t chunk[BLE_FRAME_ASSEMBLY_SIZE / 2];
+  memset(chunk, 0x55, sizeof(chunk));
+  chunk[0] = 0xC0;
+  connections.assemble(0, chunk, sizeof(chunk), sunk.sink());
+  chunk[0] = 0x55;
+  connections.assemble(0, chunk, sizeof(chunk), sunk.sink());
+  connections.assemble(0, chunk, sizeof(chunk), sunk.sink());
+  // Only the FEND, the rest can't go out whole
+  assertEqual((size_t)1, sunk.writes.size());
+
+  // Dropped up to its closing FEND, the next frame goes on
+  const uint8_t end[] = {0x55, 0xC0, 0x00, 0x01, 0xC0};
+  connections.assemble(0, end, sizeof(end), sunk.sink());
+  assertTrue(sunk.all() == std::string("\xC0\x00\x01\xC0", 4));
+}
+
+void setup()
+{
+  Serial.begin(115200);
+  while (!Serial);
+  delay(1000);
+  Log.begin(LOG_LEVEL_SILENT, &Serial);
+}
+
+void loop()
+{
+  TestRunner::run();
+}
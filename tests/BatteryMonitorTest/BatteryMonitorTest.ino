@@ -0,0 +1,107 @@
+#line 2 "BatteryMonitorTest.ino"
+
+#include <AUnit.h>
+#include <ArduinoLog.h>
+#include "../../src/bb-link/BatteryMonitor.h"
+
+using aunit::TestRunner;
+
+test(stateOfChargeForVoltage)
+{
+  assertEqual(100, (int)BatteryMonitor::stateOfChargeForVoltage(4.25));
+  assertEqual(50, (int)BatteryMonitor::stateOfChargeForVoltage(3.84));
+  assertEqual(0, (int)BatteryMonitor::stateOfChargeForVoltage(3.0));
+  // Halfway between 3.75 V (25 %) and 3.77 V (30 %)
+  assertEqual(27, (int)BatteryMonitor::stateOfChargeForVoltage(3.76));
+}
+
+test(noReading)
+{
+  BatteryMonitor monitor(600, 3.5);
+  assertFalse(monitor.hasReading());
+  assertEqual(UINT16_MAX, monitor.estimateRuntimeMinutes());
+}
+
+test(firstSamplePrimesFilter)
+{
+  BatteryMonitor monitor(600, 3.5);
+  monitor.addSample(3.9, 0);
+  assertTrue(monitor.hasReading());
+  assertEqual(3900, (int)(monitor.getVoltage() * 1000 + 0.5));
+}
+
+test(sagIsFiltered)
+{
+  BatteryMonitor monitor(600, 3.5);
+  monitor.addSample(3.9, 0);
+  // Transmit burst pulls the voltage way down for one sample
+  monitor.addSample(3.3, 5000);
+  assertMore(monitor.getVoltage(), 3.89f);
+  assertFalse(monitor.isCritical());
+}
+
+test(criticalNeedsConfirmation)
+{
+  BatteryMonitor monitor(600, 3.5);
+  monitor.addSample(3.45, 0);
+  for (int i = 1; i < BATTERY_CRITICAL_CONFIRMATIONS; i++)
+  {
+    assertFalse(monitor.isCritical());
+    monitor.addSample(3.45, i * 5000);
+  }
+  assertTrue(monitor.isCritical());
+}
+
+test(criticalIgnoredOnExternalPower)
+{
+  BatteryMonitor monitor(600, 3.5);
+  monitor.setExternalPower(true, 0);
+  for (int i = 0; i < BATTERY_CRITICAL_CONFIRMATIONS * 2; i++)
+  {
+    monitor.addSample(3.45, i * 5000);
+  }
+  assertFalse(monitor.isCritical());
+  assertEqual(UINT16_MAX, monitor.estimateRuntimeMinutes());
+}
+
+test(runtimeDependsOnProfile)
+{
+  BatteryMonitor monitor(600, 3.5);
+  monitor.addSample(3.84, 0); // 50 %, 300 mAh left
+  uint16_t idle = monitor.estimateRuntimeMinutes();
+  monitor.setPowerProfile(powerProfileInUse, 0);
+  uint16_t inUse = monitor.estimateRuntimeMinutes();
+  assertEqual(300 * 60 / monitor.getCurrentDraw(powerProfileIdle), (int)idle);
+  assertLess(inUse, idle);
+}
+
+test(learnCurrentDraw)
+{
+  BatteryMonitor monitor(600, 3.5);
+  monitor.setPowerProfile(powerProfileInUse, 0);
+  monitor.addSample(3.84, 0); // 50 %
+  // Discharge to 40 % in 30 min, 60 mAh in half an hour is 120 mA
+  unsigned long now = 0;
+  while (monitor.getVoltage() > 3.8005)
+  {
+    now += 5000;
+    monitor.addSample(3.80, now);
+  }
+  monitor.addSample(3.80, 30 * 60 * 1000UL);
+  uint16_t draw = monitor.getCurrentDraw(powerProfileInUse);
+  assertLess(draw, 140);
+  assertMore(draw, 100);
+}
+
+void setup()
+{
+  Serial.begin(115200);
+  while (!Serial);
+  delay(1000);
+  Log.begin(LOG_LEVEL_SILENT, &Serial);
+}
+
+void loop()
+{
+  TestRunner::run();
+}
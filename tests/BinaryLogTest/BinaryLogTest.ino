@@ -0,0 +1,107 @@
+#line 2 "BinaryLogTest.ino"
+
+// Bridge call sites stripped at compile time, KISS ones kept
+#define BLOG_LEVEL_BRIDGE LOG_LEVEL_ERROR
+#define BLOG_LEVEL_KISS LOG_LEVEL_TRACE
+
+#include <AUnit.h>
+#include <ArduinoLog.h>
+#include "../../src/bb-link/BinaryLog.h"
+
+using aunit::TestRunner;
+
+class Capture : public Print
+{
+public:
+  String text;
+
+  size_t write(uint8_t c) override
+  {
+    text += (char)c;
+    return 1;
+  }
+};
+
+static Capture capture;
+static int evaluated = 0;
+
+static int sideEffect()
+{
+  return ++evaluated;
+}
+
+test(printedOnlyWhenDrained)
+{
+  capture.text = "";
+  BLOG_TRACE(KISS, "Frame of %d bytes", 42);
+  assertEqual((size_t)0, capture.text.length());
+  binaryLog.drain();
+  assertTrue(capture.text.indexOf("Frame of 42 bytes") >= 0);
+}
+
+test(strippedAtCompileTime)
+{
+  capture.text = "";
+  evaluated = 0;
+  BLOG_TRACE(BRIDGE, "BLE Rx: %i", sideEffect());
+  BLOG_VERBOSE(KISS, "Verbose %i", sideEffect());
+  binaryLog.drain();
+  assertEqual(0, evaluated);
+  assertEqual((size_t)0, capture.text.length());
+}
+
+test(filteredByRuntimeLevel)
+{
+  capture.text = "";
+  Log.setLevel(LOG_LEVEL_INFO);
+  BLOG_TRACE(KISS, "Hidden");
+  BLOG_INFO(KISS, "Shown %s", "literal");
+  Log.setLevel(LOG_LEVEL_VERBOSE);
+  binaryLog.drain();
+  assertTrue(capture.text.indexOf("Hidden") < 0);
+  assertTrue(capture.text.indexOf("Shown literal") >= 0);
+}
+
+test(countsDroppedRecords)
+{
+  uint32_t dropped = binaryLog.getDropped();
+  for (int i = 0; i < BINARY_LOG_SIZE + 2; i++)
+  {
+    BLOG_TRACE(KISS, "Record %d", i);
+  }
+  assertEqual(dropped + 2, binaryLog.getDropped());
+
+  capture.text = "";
+  binaryLog.drain();
+  assertTrue(capture.text.indexOf("Record 0") >= 0);
+  assertTrue(capture.text.indexOf("2 records dropped") >= 0);
+}
+
+test(timestampOfPostedRecord)
+{
+  unsigned long posted = millis();
+  BLOG_TRACE(KISS, "Late");
+  delay(50);
+  // Prefix shows when the record was posted
+  Log.setPrefix([](Print *out, int level)
+                { out->printf("%lu ", binaryLog.timestamp()); });
+  capture.text = "";
+  binaryLog.drain();
+  Log.setPrefix(nullptr);
+  unsigned long printed = atol(capture.text.c_str());
+  assertLess(printed - posted, (unsigned long)50);
+}
+
+void setup()
+{
+  Serial.begin(115200);
+  while (!Serial);
+  delay(1000);
+  Log.begin(LOG_LEVEL_VERBOSE, &capture);
+  binaryLog.begin();
+}
+
+void loop()
+{
+  TestRunner::run();
+}
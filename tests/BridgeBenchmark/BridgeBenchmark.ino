@@ -0,0 +1,238 @@
+#line 2 "BridgeBenchmark.ino"
+
+/*
+  End to end cost of the bridge on the host: a simulated central writes KISS
+  frames, the radio emulator loops them back without airtime and the bridge
+  notifies them. Reports throughput, write to notification latency and heap
+  use per frame as JSON. Heap figures include what the stand-ins and the
+  emulator allocate, bridge_allocations_per_frame only what HeapWatch sees the
+  bridge allocate. Timings are host timings, compare runs on the same
+  machine only.
+*/
+
+#include <ArduinoLog.h>
+#include <algorithm>
+#include <vector>
+#include "../../src/bb-link/Bridge.h"
+#include "../../src/bb-link/RadioEmulator.h"
+
+#define TX_UUID "00000002-ba2a-46c9-ae49-01b0961f68bb"
+#define RX_UUID "00000003-ba2a-46c9-ae49-01b0961f68bb"
+#define BENCH_MTU 247
+#define BENCH_FRAMES 2000        // Frames per case
+#define BENCH_BURST 8            // Frames written before the bridge gets to run
+#define BENCH_TIMEOUT_MS 1000    // Give up on a notification after this long
+#define BENCH_HEAP_HEADER 16     // Allocation size is kept in front of each block
+
+static const uint8_t radioAddress[ESP_BD_ADDR_LEN] = {0x04, 0xee, 0x03, 0x61, 0x2d, 0xb0};
+
+/*
+  Heap use, counted by the global allocation operators
+*/
+static uint32_t allocations = 0;
+static size_t allocatedBytes = 0;
+static size_t liveBytes = 0;
+static size_t peakLiveBytes = 0;
+
+void *operator new(size_t size)
+{
+  uint8_t *block = (uint8_t *)malloc(size + BENCH_HEAP_HEADER);
+  if (!block)
+  {
+    abort();
+  }
+  *(size_t *)block = size;
+  HeapWatch::recordAllocation();
+  allocations++;
+  allocatedBytes += size;
+  liveBytes += size;
+  peakLiveBytes = std::max(peakLiveBytes, liveBytes);
+  return block + BENCH_HEAP_HEADER;
+}
+
+void *operator new[](size_t size)
+{
+  return operator new(size);
+}
+
+void operator delete(void *p) noexcept
+{
+  if (p)
+  {
+    uint8_t *block = (uint8_t *)p - BENCH_HEAP_HEADER;
+    liveBytes -= *(size_t *)block;
+    free(block);
+  }
+}
+
+void operator delete[](void *p) noexcept
+{
+  operator delete(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+  operator delete(p);
+}
+
+void operator delete[](void *p, size_t) noexcept
+{
+  operator delete(p);
+}
+
+struct bench_case_t
+{
+  const char *name;
+  size_t frameSize; // KISS frame, FENDs included
+  int burst;
+};
+
+static const bench_case_t cases[] = {
+    {"roundtrip_32", 32, 1},
+    {"roundtrip_128", 128, 1},
+    {"roundtrip_mtu", BENCH_MTU - 3, 1},
+    {"burst_128", 128, BENCH_BURST},
+};
+
+static const size_t caseCount = sizeof(cases) / sizeof(cases[0]);
+
+static Bridge *bridge;
+static RadioEmulator radio;
+static MockBLECentral central;
+
+static void buildFrame(uint8_t *frame, size_t size)
+{
+  static const uint8_t header[] = {
+      0xC0, 0x00, 0x82, 0xA0, 0xA4, 0xA6, 0x40, 0x40, 0x60, 0x9C, 0x60, 0x86,
+      0x82, 0x98, 0x98, 0x61, 0x03, 0xF0};
+  memcpy(frame, header, sizeof(header));
+  for (size_t i = sizeof(header); i < size - 1; i++)
+  {
+    frame[i] = 'A' + i % 26;
+  }
+  frame[size - 1] = 0xC0;
+}
+
+static bool startBridge()
+{
+  Preferences preferences;
+  preferences.begin(PREFERENCES_NAMESPACE, false);
+  preferences.putString("radioName", "TH-D74");
+  preferences.putBytes("radioAddress", radioAddress, ESP_BD_ADDR_LEN);
+  preferences.end();
+  MockBluetoothBonds::list().push_back(BTAddress(radioAddress));
+
+  radio.setLatency(0);
+  radio.setAirtime(false);
+  bridge = new Bridge("B.B. Link");
+  bridge->btSerial.attach(&radio);
+  if (!bridge->init())
+  {
+    return false;
+  }
+  for (int i = 0; i < 10; i++)
+  {
+    bridge->perform();
+  }
+  central.connect(BLEDevice::getServer(), BENCH_MTU);
+  central.subscribe(RX_UUID);
+  for (int i = 0; i < 10; i++)
+  {
+    bridge->perform();
+  }
+  return bridge->isReady();
+}
+
+static void run(const bench_case_t *benchCase, char *json, size_t length)
+{
+  uint8_t frame[BENCH_MTU];
+  buildFrame(frame, benchCase->frameSize);
+  std::vector<uint32_t> latencies;
+  latencies.reserve(BENCH_FRAMES);
+  std::vector<unsigned long> writtenAt(benchCase->burst);
+
+  central.notifications.clear();
+  uint32_t startAllocations = allocations;
+  uint32_t startBridgeAllocations = HeapWatch::getAllocations();
+  size_t startBytes = allocatedBytes;
+  peakLiveBytes = liveBytes;
+  size_t startLive = liveBytes;
+  int lost = 0;
+
+  unsigned long start = micros();
+  for (int sent = 0; sent < BENCH_FRAMES; sent += benchCase->burst)
+  {
+    for (int i = 0; i < benchCase->burst; i++)
+    {
+      writtenAt[i] = micros();
+      central.write(TX_UUID, frame, benchCase->frameSize);
+    }
+
+    // Frames come back in order, possibly several per notification
+    size_t expected = benchCase->burst * benchCase->frameSize;
+    size_t received = 0;
+    int next = 0;
+    unsigned long waitStart = millis();
+    while (received < expected && millis() - waitStart < BENCH_TIMEOUT_MS)
+    {
+      bridge->perform();
+      while (!central.notifications.empty())
+      {
+        MockBLECentral::notification_t &notification = central.notifications.front();
+        received += notification.value.size();
+        while (next < benchCase->burst && received >= (next + 1) * benchCase->frameSize)
+        {
+          latencies.push_back(notification.at - writtenAt[next]);
+          next++;
+        }
+        central.notifications.pop_front();
+      }
+    }
+    lost += benchCase->burst - next;
+  }
+  unsigned long elapsed = micros() - start;
+
+  std::sort(latencies.begin(), latencies.end());
+  uint32_t p50 = latencies.empty() ? 0 : latencies[latencies.size() / 2];
+  uint32_t p99 = latencies.empty() ? 0 : latencies[latencies.size() * 99 / 100];
+  uint32_t max = latencies.empty() ? 0 : latencies.back();
+  double seconds = elapsed / 1e6;
+
+  snprintf(json, length,
+           "    {\"name\": \"%s\", \"frame_size\": %u, \"frames_per_s\": %.0f, \"bytes_per_s\": %.0f, "
+           "\"latency_us\": {\"p50\": %u, \"p99\": %u, \"max\": %u}, "
+           "\"allocations_per_frame\": %.2f, \"bridge_allocations_per_frame\": %.2f, \"heap_bytes_per_frame\": %.1f, \"peak_heap\": %u, \"lost\": %d}",
+           benchCase->name, (unsigned)benchCase->frameSize, BENCH_FRAMES / seconds, BENCH_FRAMES * benchCase->frameSize / seconds,
+           (unsigned)p50, (unsigned)p99, (unsigned)max,
+           (double)(allocations - startAllocations) / BENCH_FRAMES, (double)(HeapWatch::getAllocations() - startBridgeAllocations) / BENCH_FRAMES,
+           (double)(allocatedBytes - startBytes) / BENCH_FRAMES,
+           (unsigned)(peakLiveBytes - startLive), lost);
+}
+
+void setup()
+{
+  Serial.begin(115200);
+  Log.begin(LOG_LEVEL_SILENT, &Serial);
+
+  if (!startBridge())
+  {
+    Serial.print("{\"error\": \"bridge did not get ready\"}\n");
+    exit(1);
+  }
+
+  char json[512];
+  Serial.print("{\n  \"benchmarks\": [\n");
+  for (size_t i = 0; i < caseCount; i++)
+  {
+    run(&cases[i], json, sizeof(json));
+    Serial.print(json);
+    Serial.print(i + 1 < caseCount ? ",\n" : "\n");
+  }
+  Serial.print("  ]\n}\n");
+  Serial.flush();
+  exit(0);
+}
+
+void loop()
+{
+}
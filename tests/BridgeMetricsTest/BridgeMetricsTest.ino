@@ -0,0 +1,62 @@
+#line 2 "BridgeMetricsTest.ino"
+
+#include <AUnit.h>
+#include <ArduinoLog.h>
+#include "../../src/bb-link/BridgeMetrics.h"
+
+using aunit::TestRunner;
+
+test(countFrames)
+{
+  KISSFrameCounter counter;
+  uint8_t frames[] = {0xC0, 0x00, 0x01, 0x02, 0xC0, 0xC0, 0x00, 0x03, 0xC0};
+  assertEqual((uint32_t)2, counter.count(frames, sizeof(frames)));
+}
+
+test(countFramesSplitAcrossWrites)
+{
+  KISSFrameCounter counter;
+  uint8_t first[] = {0xC0, 0x00, 0x01};
+  uint8_t second[] = {0x02, 0xC0};
+  assertEqual((uint32_t)0, counter.count(first, sizeof(first)));
+  assertEqual((uint32_t)1, counter.count(second, sizeof(second)));
+  // Back to back FENDs are not frames
+  uint8_t empty[] = {0xC0, 0xC0};
+  assertEqual((uint32_t)0, counter.count(empty, sizeof(empty)));
+}
+
+test(highWater)
+{
+  BridgeMetrics metrics;
+  metrics.highWater(metricCmdQueueHighWater, 3);
+  metrics.highWater(metricCmdQueueHighWater, 1);
+  assertEqual((uint32_t)3, metrics.get(metricCmdQueueHighWater));
+}
+
+test(serialize)
+{
+  BridgeMetrics metrics;
+  metrics.add(metricBytesToRadio, 0x01020304);
+  metrics.add(metricQsy);
+  metrics.add(metricQsy);
+
+  uint8_t buffer[BridgeMetrics::maxSerializedSize()];
+  assertEqual(sizeof(buffer), metrics.serialize(buffer));
+  assertEqual(metricCount, buffer[0]);
+  assertEqual(0x01, buffer[1]);
+  assertEqual(0x04, buffer[4]);
+  assertEqual(2, buffer[1 + metricQsy * 4 + 3]);
+}
+
+void setup()
+{
+  Serial.begin(115200);
+  while (!Serial);
+  delay(1000);
+  Log.begin(LOG_LEVEL_SILENT, &Serial);
+}
+
+void loop()
+{
+  TestRunner::run();
+}
@@ -0,0 +1,681 @@
+#line 2 "BridgeTest.ino"
+
+#include <AUnit.h>
+#include <ArduinoLog.h>
+#include "../../src/bb-link/Bridge.h"
+#include "../../src/bb-link/RadioEmulator.h"
+
+using aunit::TestRunner;
+
+#define TX_UUID "00000002-ba2a-46c9-ae49-01b0961f68bb"
+#define RX_UUID "00000003-ba2a-46c9-ae49-01b0961f68bb"
+#define TEST_MTU 247
+
+static const uint8_t radioAddress[ESP_BD_ADDR_LEN] = {0x04, 0xee, 0x03, 0x61, 0x2d, 0xb0};
+
+static const uint8_t dataFrame[] = {
+    0xC0, 0x00, 0x82, 0xA0, 0xA4, 0xA6, 0x40, 0x40, 0x60, 0x9C, 0x60, 0x86,
+    0x82, 0x98, 0x98, 0x61, 0x03, 0xF0, 0x3E, 0x54, 0x65, 0x73, 0x74, 0xC0};
+
+static uint32_t get32(const uint8_t *p)
+{
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+// What the radio remembers from a previous session
+static void pairRadio()
+{
+  Preferences::mockClearAll();
+  MockBluetoothBonds::list().clear();
+  MockBluetoothBonds::list().push_back(BTAddress(radioAddress));
+
+  Preferences preferences;
+  preferences.begin(PREFERENCES_NAMESPACE, false);
+  preferences.putString("radioName", "TH-D74");
+  preferences.putBytes("radioAddress", radioAddress, ESP_BD_ADDR_LEN);
+  preferences.end();
+}
+
+static void performFor(Bridge &bridge, unsigned long ms)
+{
+  unsigned long start = millis();
+  do
+  {
+    bridge.perform();
+  } while (millis() - start < ms);
+}
+
+static bool waitForNotification(Bridge &bridge, MockBLECentral &central, size_t count)
+{
+  unsigned long start = millis();
+  while (central.notifications.size() < count && millis() - start < 1000)
+  {
+    bridge.perform();
+  }
+  return central.notifications.size() >= count;
+}
+
+// The journal is off until the app turns it on
+static bool recordJournal(Bridge &bridge, MockBLECentral &central)
+{
+  central.notifications.clear();
+  const uint8_t setJournal[] = {0xC0, CMD_HARDWARE, EXTENDED_HW_CMD_SET_JOURNAL, 0x01, 0xC0};
+  central.write(TX_UUID, setJournal, sizeof(setJournal));
+  bool on = waitForNotification(bridge, central, 1) && central.notifications[0].value[3] == 0x01;
+  central.notifications.clear();
+  return on;
+}
+
+// Records of a direction from the cursor on, moved past them
+static int countJournaled(Bridge &bridge, MockBLECentral &central, journal_direction_t direction, uint32_t *cursor)
+{
+  int count = 0;
+  for (;;)
+  {
+    central.notifications.clear();
+    const uint8_t getJournal[] = {0xC0, CMD_HARDWARE, EXTENDED_HW_CMD_GET_JOURNAL, journalFromCursor,
+                                  (uint8_t)(*cursor >> 24), (uint8_t)(*cursor >> 16), (uint8_t)(*cursor >> 8), (uint8_t)*cursor, 0xC0};
+    central.write(TX_UUID, getJournal, sizeof(getJournal));
+    waitForNotification(bridge, central, 1);
+    performFor(bridge, 5);
+    std::string received;
+    for (const MockBLECentral::notification_t &notification : central.notifications)
+    {
+      received += notification.value;
+    }
+    KISSInterceptor kiss;
+    uint8_t reply[received.size()];
+    size_t size = 0;
+    kiss.unescape((uint8_t *)received.data(), received.size(), reply, &size);
+
+    // FEND, hardware command, page header, records and FEND
+    if (size <= 3 + JOURNAL_PAGE_HEADER_SIZE + 1)
+    {
+      return count;
+    }
+    *cursor = get32(reply + 3 + 4);
+    for (size_t offset = 3 + JOURNAL_PAGE_HEADER_SIZE; offset + 1 < size;)
+    {
+      count += reply[offset + 4] == direction;
+      offset += 7 + ((reply[offset + 5] << 8) | reply[offset + 6]);
+    }
+  }
+}
+
+static void connect(Bridge &bridge, RadioEmulator &radio, MockBLECentral &central)
+{
+  pairRadio();
+  radio.setLatency(2);
+  radio.setAirtime(false);
+  bridge.btSerial.attach(&radio);
+  bridge.init();
+  performFor(bridge, 5);
+  central.connect(BLEDevice::getServer(), TEST_MTU);
+  central.subscribe(RX_UUID);
+  performFor(bridge, 5);
+}
+
+test(connectsToPairedRadio)
+{
+  Bridge bridge("B.B. Link");
+  RadioEmulator radio;
+  MockBLECentral central;
+  pairRadio();
+  bridge.btSerial.attach(&radio);
+  assertTrue(bridge.init());
+  performFor(bridge, 5);
+  assertTrue(bridge.btcConnected());
+  assertFalse(bridge.isReady());
+  assertTrue(BLEDevice::getAdvertising()->isAdvertising());
+}
+
+test(putsRadioInKISSWhileConnected)
+{
+  Bridge bridge("B.B. Link");
+  RadioEmulator radio;
+  MockBLECentral central;
+  connect(bridge, radio, central);
+  assertTrue(bridge.isReady());
+  assertTrue(radio.isKISSMode());
+  // Room for more centrals
+  assertTrue(BLEDevice::getAdvertising()->isAdvertising());
+
+  // TNC was off before the app connected
+  central.disconnect();
+  performFor(bridge, 5);
+  assertFalse(radio.isKISSMode());
+  assertEqual(tncOff, radio.getTNCMode());
+}
+
+test(waitsWhenNothingReadsTheRadio)
+{
+  Bridge bridge("B.B. Link");
+  RadioEmulator radio;
+  MockBLECentral central;
+  pairRadio();
+  bridge.btSerial.attach(&radio);
+  bridge.init();
+  performFor(bridge, 5);
+  assertTrue(bridge.btcConnected());
+
+  // Left in KISS, what it hears with no central and no frame store stays with it
+  radio.setTNC(vfoA, tncKISS);
+  radio.hear(dataFrame, sizeof(dataFrame));
+  performFor(bridge, 5);
+  assertTrue(bridge.btSerial.available() > 0);
+  assertFalse(bridge.hasPendingWork());
+
+  central.connect(BLEDevice::getServer(), TEST_MTU);
+  central.subscribe(RX_UUID);
+  performFor(bridge, 5);
+  radio.hear(dataFrame, sizeof(dataFrame));
+  assertTrue(bridge.hasPendingWork());
+}
+
+test(bridgesFramesBothWays)
+{
+  Bridge bridge("B.B. Link");
+  RadioEmulator radio;
+  MockBLECentral central;
+  connect(bridge, radio, central);
+
+  assertTrue(central.write(TX_UUID, dataFrame, sizeof(dataFrame)));
+  assertEqual(1, radio.getFrameCount());
+  assertTrue(waitForNotification(bridge, central, 1));
+  assertEqual(sizeof(dataFrame), central.notifications[0].value.size());
+  assertEqual(0, memcmp(dataFrame, central.notifications[0].value.data(), sizeof(dataFrame)));
+}
+
+test(answersHardwareCommands)
+{
+  Bridge bridge("B.B. Link");
+  RadioEmulator radio;
+  MockBLECentral central;
+  connect(bridge, radio, central);
+
+  const uint8_t apiVersion[] = {0xC0, CMD_HARDWARE, EXTENDED_HW_CMD_API_VERSION, 0xC0};
+  central.write(TX_UUID, apiVersion, sizeof(apiVersion));
+  assertEqual(0, radio.getFrameCount());
+  assertTrue(waitForNotification(bridge, central, 1));
+
+  const uint8_t expected[] = {0xC0, CMD_HARDWARE, EXTENDED_HW_CMD_API_VERSION, 0x01, 0x00, 0xC0};
+  assertEqual(sizeof(expected), central.notifications[0].value.size());
+  assertEqual(0, memcmp(expected, central.notifications[0].value.data(), sizeof(expected)));
+
+  // No such state machine, its id comes back alone
+  central.notifications.clear();
+  const uint8_t stateStats[] = {0xC0, CMD_HARDWARE, EXTENDED_HW_CMD_GET_STATE_STATS, 0x07, 0xC0};
+  central.write(TX_UUID, stateStats, sizeof(stateStats));
+  assertTrue(waitForNotification(bridge, central, 1));
+  assertEqual(sizeof(stateStats), central.notifications[0].value.size());
+  assertEqual(0, memcmp(stateStats, central.notifications[0].value.data(), sizeof(stateStats)));
+}
+
+test(qsyThruHardwareCommands)
+{
+  Bridge bridge("B.B. Link");
+  RadioEmulator radio;
+  MockBLECentral central;
+  connect(bridge, radio, central);
+
+  // 145.010 MHz
+  const uint8_t setFrequency[] = {0xC0, CMD_HARDWARE, EXTENDED_HW_CMD_SET_FREQUENCY, 0x08, 0xA4, 0xAD, 0x50, 0xC0};
+  central.write(TX_UUID, setFrequency, sizeof(setFrequency));
+  bridge.perform();
+  assertEqual((uint32_t)145010000, radio.getFrequency(vfoA));
+  assertTrue(radio.isKISSMode());
+
+  const uint8_t restoreFrequency[] = {0xC0, CMD_HARDWARE, EXTENDED_HW_CMD_RESTORE_FREQUENCY, 0xC0};
+  central.write(TX_UUID, restoreFrequency, sizeof(restoreFrequency));
+  bridge.perform();
+  assertEqual((uint32_t)144390000, radio.getFrequency(vfoA));
+  assertTrue(radio.isKISSMode());
+}
+
+test(factoryReset)
+{
+  Bridge bridge("B.B. Link");
+  RadioEmulator radio;
+  MockBLECentral central;
+  connect(bridge, radio, central);
+
+  int restarts = mockRestartCount();
+  const uint8_t reset[] = {0xC0, CMD_HARDWARE, EXTENDED_HW_CMD_FACTORY_RESET, 0xC0};
+  central.write(TX_UUID, reset, sizeof(reset));
+  bridge.perform();
+  assertEqual(restarts + 1, mockRestartCount());
+  assertEqual(0, esp_bt_gap_get_bond_device_num());
+  assertFalse(bridge.btSerial.connected());
+}
+
+test(fansOutToEveryCentral)
+{
+  Bridge bridge("B.B. Link");
+  RadioEmulator radio;
+  MockBLECentral central(0);
+  MockBLECentral smallMtu(1);
+  MockBLECentral notSubscribed(2);
+  connect(bridge, radio, central);
+  smallMtu.connect(BLEDevice::getServer());
+  smallMtu.subscribe(RX_UUID);
+  notSubscribed.connect(BLEDevice::getServer(), TEST_MTU);
+  performFor(bridge, 5);
+
+  central.write(TX_UUID, dataFrame, sizeof(dataFrame));
+  assertTrue(waitForNotification(bridge, central, 1));
+  assertTrue(waitForNotification(bridge, smallMtu, 2));
+  assertEqual(sizeof(dataFrame), central.notifications[0].value.size());
+
+  // 20 bytes fit in a notification at the default MTU
+  assertEqual((size_t)MOCK_BLE_DEFAULT_MTU - 3, smallMtu.notifications[0].value.size());
+  std::string received = smallMtu.notifications[0].value + smallMtu.notifications[1].value;
+  assertEqual(sizeof(dataFrame), received.size());
+  assertEqual(0, memcmp(dataFrame, received.data(), sizeof(dataFrame)));
+  assertEqual((size_t)0, notSubscribed.notifications.size());
+
+  // Unsubscribing stops them
+  smallMtu.subscribe(RX_UUID, false);
+  central.write(TX_UUID, dataFrame, sizeof(dataFrame));
+  assertTrue(waitForNotification(bridge, central, 2));
+  assertEqual((size_t)2, smallMtu.notifications.size());
+}
+
+test(staysConnectedUntilLastCentralLeaves)
+{
+  Bridge bridge("B.B. Link");
+  RadioEmulator radio;
+  MockBLECentral first(0);
+  MockBLECentral second(1);
+  MockBLECentral third(2);
+  connect(bridge, radio, first);
+  second.connect(BLEDevice::getServer(), TEST_MTU);
+  third.connect(BLEDevice::getServer(), TEST_MTU);
+  performFor(bridge, 5);
+  assertEqual(BLE_MAX_CONNECTIONS, (int)BLEDevice::getServer()->getConnectedCount());
+  assertFalse(BLEDevice::getAdvertising()->isAdvertising());
+
+  first.disconnect();
+  performFor(bridge, 5);
+  assertTrue(BLEDevice::getAdvertising()->isAdvertising());
+  assertTrue(bridge.isReady());
+  assertTrue(radio.isKISSMode());
+
+  second.disconnect();
+  third.disconnect();
+  performFor(bridge, 5);
+  assertFalse(bridge.isReady());
+  assertFalse(radio.isKISSMode());
+}
+
+test(keepsFramesWholeAcrossCentrals)
+{
+  Bridge bridge("B.B. Link");
+  RadioEmulator radio;
+  MockBLECentral central(0);
+  MockBLECentral other(1);
+  connect(bridge, radio, central);
+  other.connect(BLEDevice::getServer(), TEST_MTU);
+  performFor(bridge, 5);
+
+  // A frame split over two writes, another central writing in between
+  central.write(TX_UUID, dataFrame, 10);
+  other.write(TX_UUID, dataFrame, sizeof(dataFrame));
+  central.write(TX_UUID, dataFrame + 10, sizeof(dataFrame) - 10);
+  assertEqual(2, radio.getFrameCount());
+
+  assertTrue(waitForNotification(bridge, central, 1));
+  performFor(bridge, 5);
+  std::string received;
+  for (const MockBLECentral::notification_t &notification : central.notifications)
+  {
+    received += notification.value;
+  }
+  std::string expected((const char *)dataFrame, sizeof(dataFrame));
+  assertTrue(received == expected + expected);
+}
+
+test(passesKISSCommandsToRadio)
+{
+  Bridge bridge("B.B. Link");
+  RadioEmulator radio;
+  MockBLECentral central;
+  connect(bridge, radio, central);
+  assertTrue(radio.isKISSMode());
+
+  // Not a data frame, whatever its high nibble
+  const uint8_t kissReturn[] = {0xC0, 0xFF, 0xC0};
+  central.write(TX_UUID, kissReturn, sizeof(kissReturn));
+  bridge.perform();
+  assertFalse(radio.isKISSMode());
+}
+
+test(dropsDuplicateFrames)
+{
+  Bridge bridge("B.B. Link");
+  RadioEmulator radio;
+  MockBLECentral central;
+  connect(bridge, radio, central);
+
+  const uint8_t setWindow[] = {0xC0, CMD_HARDWARE, EXTENDED_HW_CMD_SET_DUPLICATE_WINDOW, 30, 0xC0};
+  central.write(TX_UUID, setWindow, sizeof(setWindow));
+  bridge.perform();
+
+  // The same packet heard direct and thru a digipeater
+  static const uint8_t digipeated[] = {
+      0xC0, 0x00, 0x82, 0xA0, 0xA4, 0xA6, 0x40, 0x40, 0x60, 0x9C, 0x60, 0x86,
+      0x82, 0x98, 0x98, 0x60, 0xAE, 0x92, 0x88, 0x8A, 0x62, 0x40, 0xE3, 0x03,
+      0xF0, 0x3E, 0x54, 0x65, 0x73, 0x74, 0xC0};
+  central.write(TX_UUID, dataFrame, sizeof(dataFrame));
+  central.write(TX_UUID, digipeated, sizeof(digipeated));
+  central.write(TX_UUID, dataFrame, sizeof(dataFrame));
+  assertEqual(3, radio.getFrameCount());
+
+  assertTrue(waitForNotification(bridge, central, 1));
+  performFor(bridge, 20);
+  std::string received;
+  for (const MockBLECentral::notification_t &notification : central.notifications)
+  {
+    received += notification.value;
+  }
+  assertTrue(received == std::string((const char *)dataFrame, sizeof(dataFrame)));
+
+  Preferences preferences;
+  preferences.begin(PREFERENCES_NAMESPACE, false);
+  assertEqual(30, preferences.getUChar("dupWindow"));
+  preferences.end();
+}
+
+test(filtersFrames)
+{
+  Bridge bridge("B.B. Link");
+  RadioEmulator radio;
+  MockBLECentral central;
+  connect(bridge, radio, central);
+
+  // APRS messages only
+  const uint8_t addRule[] = {0xC0, CMD_HARDWARE, EXTENDED_HW_CMD_SET_FRAME_FILTER, frameFilterDataType, ':', 0xC0};
+  central.write(TX_UUID, addRule, sizeof(addRule));
+  assertTrue(waitForNotification(bridge, central, 1));
+  const uint8_t ruleCount[] = {0xC0, CMD_HARDWARE, EXTENDED_HW_CMD_SET_FRAME_FILTER, 0x01, 0xC0};
+  assertEqual(sizeof(ruleCount), central.notifications[0].value.size());
+  assertEqual(0, memcmp(ruleCount, central.notifications[0].value.data(), sizeof(ruleCount)));
+
+  // K1ABC>APRS::N0CALL   :Hi
+  static const uint8_t message[] = {
+      0xC0, 0x00, 0x82, 0xA0, 0xA4, 0xA6, 0x40, 0x40, 0x60, 0x96, 0x62, 0x82,
+      0x84, 0x86, 0x40, 0x61, 0x03, 0xF0, 0x3A, 0x4E, 0x30, 0x43, 0x41, 0x4C,
+      0x4C, 0x20, 0x20, 0x20, 0x3A, 0x48, 0x69, 0xC0};
+  central.write(TX_UUID, dataFrame, sizeof(dataFrame));
+  central.write(TX_UUID, message, sizeof(message));
+  assertTrue(waitForNotification(bridge, central, 2));
+  performFor(bridge, 20);
+  std::string received;
+  for (size_t i = 1; i < central.notifications.size(); i++)
+  {
+    received += central.notifications[i].value;
+  }
+  assertTrue(received == std::string((const char *)message, sizeof(message)));
+
+  // Remembered
+  Preferences preferences;
+  preferences.begin(PREFERENCES_NAMESPACE, false);
+  assertEqual(sizeof(frame_filter_rule_t), preferences.getBytesLength("frameFilter"));
+  preferences.end();
+}
+
+test(storesFramesWhileAway)
+{
+  Bridge bridge("B.B. Link");
+  RadioEmulator radio;
+  MockBLECentral central;
+  connect(bridge, radio, central);
+
+  // Oldest dropped when full, kept until replayed
+  const uint8_t storeForward[] = {0xC0, CMD_HARDWARE, EXTENDED_HW_CMD_SET_STORE_FORWARD, 0x01, 0x00, 0x00, 0xC0};
+  central.write(TX_UUID, storeForward, sizeof(storeForward));
+  bridge.perform();
+
+  central.disconnect();
+  performFor(bridge, 20);
+  assertTrue(radio.isKISSMode());
+
+  uint8_t later[sizeof(dataFrame)];
+  memcpy(later, dataFrame, sizeof(dataFrame));
+  later[sizeof(later) - 2] = 'x';
+  radio.hear(dataFrame, sizeof(dataFrame));
+  radio.hear(later, sizeof(later));
+  performFor(bridge, 20);
+
+  central.notifications.clear();
+  central.connect(BLEDevice::getServer(), TEST_MTU);
+  performFor(bridge, 20);
+  assertEqual((size_t)0, central.notifications.size());
+  central.subscribe(RX_UUID);
+  assertTrue(waitForNotification(bridge, central, 1));
+  performFor(bridge, 20);
+  std::string received;
+  for (const MockBLECentral::notification_t &notification : central.notifications)
+  {
+    received += notification.value;
+  }
+  assertTrue(received == std::string((const char *)dataFrame, sizeof(dataFrame)) + std::string((const char *)later, sizeof(later)));
+
+  // Turned off, the radio gets its TNC mode back once the central leaves
+  const uint8_t off[] = {0xC0, CMD_HARDWARE, EXTENDED_HW_CMD_SET_STORE_FORWARD, 0x00, 0x00, 0x00, 0xC0};
+  central.write(TX_UUID, off, sizeof(off));
+  bridge.perform();
+  central.disconnect();
+  performFor(bridge, 20);
+  assertFalse(radio.isKISSMode());
+}
+
+test(journalsTraffic)
+{
+  mockErasePartition();
+  Bridge bridge("B.B. Link");
+  RadioEmulator radio;
+  MockBLECentral central;
+  connect(bridge, radio, central);
+
+  // Not journaled, the journal is off
+  central.write(TX_UUID, dataFrame, sizeof(dataFrame));
+  assertTrue(waitForNotification(bridge, central, 1));
+  performFor(bridge, 20);
+  assertTrue(recordJournal(bridge, central));
+
+  central.write(TX_UUID, dataFrame, sizeof(dataFrame));
+  assertTrue(waitForNotification(bridge, central, 1));
+  performFor(bridge, 20);
+  central.notifications.clear();
+
+  // Everything since the journal began
+  const uint8_t getJournal[] = {0xC0, CMD_HARDWARE, EXTENDED_HW_CMD_GET_JOURNAL, journalFromTime, 0x00, 0x00, 0x00, 0x00, 0xC0};
+  central.write(TX_UUID, getJournal, sizeof(getJournal));
+  assertTrue(waitForNotification(bridge, central, 1));
+  performFor(bridge, 20);
+  std::string received;
+  for (const MockBLECentral::notification_t &notification : central.notifications)
+  {
+    received += notification.value;
+  }
+
+  KISSInterceptor kiss;
+  uint8_t reply[received.size()];
+  size_t size;
+  assertTrue(kiss.unescape((uint8_t *)received.data(), received.size(), reply, &size));
+  // FEND, hardware command, page header, two records and FEND
+  assertEqual(3 + JOURNAL_PAGE_HEADER_SIZE + 2 * (7 + sizeof(dataFrame)) + 1, size);
+  assertEqual(EXTENDED_HW_CMD_GET_JOURNAL, reply[2]);
+  const uint8_t *record = reply + 3 + JOURNAL_PAGE_HEADER_SIZE;
+  assertEqual(journalToRadio, record[4]);
+  assertEqual(0, memcmp(dataFrame, record + 7, sizeof(dataFrame)));
+  record += 7 + sizeof(dataFrame);
+  assertEqual(journalFromRadio, record[4]);
+  assertEqual(0, memcmp(dataFrame, record + 7, sizeof(dataFrame)));
+}
+
+test(journalsOnlyWhatReachesRadio)
+{
+  mockErasePartition();
+  Bridge bridge("B.B. Link");
+  RadioEmulator radio;
+  MockBLECentral central;
+  connect(bridge, radio, central);
+  assertTrue(recordJournal(bridge, central));
+
+  // The frames past what the outbound buffer holds are dropped
+  bridge.btSerial.mockCongestion(true);
+  int fitting = SPP_OUTBOUND_SIZE / sizeof(dataFrame);
+  int journaled = 0;
+  uint32_t cursor = 0;
+  for (int i = 0; i < fitting + 2; i++)
+  {
+    central.write(TX_UUID, dataFrame, sizeof(dataFrame));
+    // Reading has the journal written before its inbox fills up
+    if (i % 8 == 7 || i == fitting + 1)
+    {
+      journaled += countJournaled(bridge, central, journalToRadio, &cursor);
+    }
+  }
+  assertEqual(fitting, journaled);
+}
+
+test(runsSelfTest)
+{
+  Bridge bridge("B.B. Link");
+  RadioEmulator radio;
+  MockBLECentral central;
+  connect(bridge, radio, central);
+
+  // 300 bytes in frames of 100
+  const uint8_t download[] = {0xC0, CMD_HARDWARE, EXTENDED_HW_CMD_SELF_TEST, selfTestDownload, 0x00, 0x00, 0x01, 0x2C, 0x00, 0x64, 0xC0};
+  central.write(TX_UUID, download, sizeof(download));
+  // Started, three frames and finished
+  assertTrue(waitForNotification(bridge, central, 5));
+  performFor(bridge, 20);
+  assertEqual((size_t)5, central.notifications.size());
+  assertEqual(0, radio.getFrameCount());
+
+  KISSInterceptor kiss;
+  uint8_t frame[SELF_TEST_MAX_FRAME + 2];
+  size_t size;
+  for (size_t i = 1; i <= 3; i++)
+  {
+    const std::string &value = central.notifications[i].value;
+    assertTrue(kiss.unescape((uint8_t *)value.data(), value.size(), frame, &size));
+    assertEqual((size_t)100 + 2, size);
+    assertEqual(selfTestPattern, frame[3]);
+    assertEqual((uint8_t)(i - 1), frame[5]);
+  }
+
+  const std::string &value = central.notifications[4].value;
+  assertTrue(kiss.unescape((uint8_t *)value.data(), value.size(), frame, &size));
+  assertEqual((size_t)SELF_TEST_REPORT_SIZE + 4, size);
+  assertEqual(selfTestReport, frame[3]);
+  assertEqual(selfTestIdle, frame[4]);
+  // Bytes and frames sent
+  assertEqual(0x2C, frame[8]);
+  assertEqual(0x03, frame[12]);
+}
+
+test(holdsFramesWhileRadioLinkCongested)
+{
+  Bridge bridge("B.B. Link");
+  RadioEmulator radio;
+  MockBLECentral central;
+  connect(bridge, radio, central);
+
+  bridge.btSerial.mockCongestion(true);
+  central.write(TX_UUID, dataFrame, sizeof(dataFrame));
+  performFor(bridge, 5);
+  assertEqual(0, radio.getFrameCount());
+
+  // Still answering meanwhile
+  const uint8_t apiVersion[] = {0xC0, CMD_HARDWARE, EXTENDED_HW_CMD_API_VERSION, 0xC0};
+  central.write(TX_UUID, apiVersion, sizeof(apiVersion));
+  assertTrue(waitForNotification(bridge, central, 1));
+
+  bridge.btSerial.mockCongestion(false);
+  performFor(bridge, 5);
+  assertEqual(1, radio.getFrameCount());
+
+  central.notifications.clear();
+  const uint8_t getStats[] = {0xC0, CMD_HARDWARE, EXTENDED_HW_CMD_GET_STATS, 0xC0};
+  central.write(TX_UUID, getStats, sizeof(getStats));
+  assertTrue(waitForNotification(bridge, central, 1));
+  performFor(bridge, 20);
+  std::string received;
+  for (const MockBLECentral::notification_t &notification : central.notifications)
+  {
+    received += notification.value;
+  }
+  KISSInterceptor kiss;
+  uint8_t reply[received.size()];
+  size_t size;
+  assertTrue(kiss.unescape((uint8_t *)received.data(), received.size(), reply, &size));
+  // FEND, hardware command, count, then 4 bytes per metric
+  const uint8_t *stats = reply + 4;
+  assertEqual((uint32_t)0, get32(stats + 4 * metricSppQueueDepth));
+  assertEqual((uint32_t)sizeof(dataFrame), get32(stats + 4 * metricSppQueueHighWater));
+  assertEqual((uint32_t)1, get32(stats + 4 * metricSppStalls));
+}
+
+test(dropsWholeFramesOverflowingRadioLink)
+{
+  Bridge bridge("B.B. Link");
+  RadioEmulator radio;
+  MockBLECentral central;
+  connect(bridge, radio, central);
+
+  bridge.btSerial.mockCongestion(true);
+  int fitting = SPP_OUTBOUND_SIZE / sizeof(dataFrame);
+  for (int i = 0; i < fitting; i++)
+  {
+    central.write(TX_UUID, dataFrame, sizeof(dataFrame));
+  }
+
+  // Its opening FEND fits, the rest of it does not
+  central.write(TX_UUID, dataFrame, 10);
+  central.write(TX_UUID, dataFrame + 10, sizeof(dataFrame) - 10);
+  bridge.btSerial.mockCongestion(false);
+  performFor(bridge, 5);
+  central.write(TX_UUID, dataFrame, sizeof(dataFrame));
+  performFor(bridge, 5);
+
+  // Nothing cut short went on air
+  assertEqual(fitting + 1, radio.getFrameCount());
+}
+
+test(allocatesNothingWhileBridging)
+{
+  Bridge bridge("B.B. Link");
+  RadioEmulator radio;
+  MockBLECentral central;
+  connect(bridge, radio, central);
+  // Settle in first, connecting may take from the heap
+  performFor(bridge, 20);
+
+  uint32_t before = HeapWatch::getAllocations();
+  for (size_t i = 1; i <= 5; i++)
+  {
+    central.write(TX_UUID, dataFrame, 10);
+    central.write(TX_UUID, dataFrame + 10, sizeof(dataFrame) - 10);
+    assertTrue(waitForNotification(bridge, central, i));
+  }
+  performFor(bridge, 20);
+  assertEqual((size_t)5, central.notifications.size());
+  assertEqual(before, HeapWatch::getAllocations());
+}
+
+void setup()
+{
+  Serial.begin(115200);
+  while (!Serial);
+  delay(1000);
+  Log.begin(LOG_LEVEL_SILENT, &Serial);
+}
+
+void loop()
+{
+  TestRunner::run();
+}
@@ -0,0 +1,241 @@
+#line 2 "DeltaPatcherTest.ino"
+
+#include <AUnit.h>
+#include <ArduinoLog.h>
+#include "../../src/bb-link/DeltaPatcher.h"
+
+using aunit::TestRunner;
+
+static const uint8_t BASE_ID[DELTA_BASE_ID_LEN] = {0xDE, 0xAD, 0xBE, 0xEF, 0x01, 0x02, 0x03, 0x04};
+
+static uint8_t base[4096];
+
+static bool readBase(uint32_t offset, uint8_t *data, size_t size)
+{
+  if (offset + size > sizeof(base))
+  {
+    return false;
+  }
+  memcpy(data, base + offset, size);
+  return true;
+}
+
+/*
+  Builds delta streams by hand
+*/
+class DeltaWriter
+{
+public:
+  uint8_t buffer[8192];
+  size_t length = 0;
+
+  void header(uint32_t targetSize, const uint8_t *baseId = BASE_ID)
+  {
+    append(DELTA_MAGIC, sizeof(DELTA_MAGIC));
+    append(baseId, DELTA_BASE_ID_LEN);
+    buffer[length++] = (targetSize >> 24) & 0xFF;
+    buffer[length++] = (targetSize >> 16) & 0xFF;
+    buffer[length++] = (targetSize >> 8) & 0xFF;
+    buffer[length++] = targetSize & 0xFF;
+  }
+
+  void copy(uint32_t offset, uint32_t count)
+  {
+    buffer[length++] = deltaOpCopy;
+    varint(offset);
+    varint(count);
+  }
+
+  void insert(const uint8_t *data, uint32_t count)
+  {
+    buffer[length++] = deltaOpInsert;
+    varint(count);
+    append(data, count);
+  }
+
+  void add(uint32_t offset, const uint8_t *diff, uint32_t count)
+  {
+    buffer[length++] = deltaOpAdd;
+    varint(offset);
+    varint(count);
+    append(diff, count);
+  }
+
+  void end()
+  {
+    buffer[length++] = deltaOpEnd;
+  }
+
+private:
+  void append(const uint8_t *data, size_t count)
+  {
+    memcpy(buffer + length, data, count);
+    length += count;
+  }
+
+  void varint(uint32_t value)
+  {
+    do
+    {
+      uint8_t byte = value & 0x7F;
+      value >>= 7;
+      buffer[length++] = value ? byte | 0x80 : byte;
+    } while (value);
+  }
+};
+
+static uint8_t patched[8192];
+static size_t patchedLength = 0;
+
+static bool collect(const uint8_t *data, size_t size)
+{
+  memcpy(patched + patchedLength, data, size);
+  patchedLength += size;
+  return true;
+}
+
+static void fillBase()
+{
+  for (size_t i = 0; i < sizeof(base); i++)
+  {
+    base[i] = (i * 13) & 0xFF;
+  }
+}
+
+test(copyInsertAdd)
+{
+  fillBase();
+  const uint8_t inserted[] = {'K', 'I', 'S', 'S'};
+  const uint8_t diff[] = {1, 0, 0xFF};
+
+  static DeltaWriter writer;
+  writer.length = 0;
+  writer.header(600 + 4 + 3);
+  writer.copy(1000, 600);
+  writer.insert(inserted, sizeof(inserted));
+  writer.add(10, diff, sizeof(diff));
+  writer.end();
+
+  DeltaPatcher patcher(readBase);
+  patcher.reset(BASE_ID);
+  patchedLength = 0;
+  assertTrue(patcher.apply(writer.buffer, writer.length, collect));
+  assertTrue(patcher.isComplete());
+  assertEqual((size_t)607, patchedLength);
+  assertEqual(0, memcmp(base + 1000, patched, 600));
+  assertEqual(0, memcmp(inserted, patched + 600, 4));
+  assertEqual((uint8_t)(base[10] + 1), patched[604]);
+  assertEqual(base[11], patched[605]);
+  assertEqual((uint8_t)(base[12] - 1), patched[606]);
+}
+
+test(byteByByte)
+{
+  fillBase();
+  static uint8_t target[3000];
+  memcpy(target, base + 500, sizeof(target));
+  // Small changes spread over the image, like a rebuilt firmware
+  uint8_t diff[300];
+  for (size_t i = 0; i < sizeof(diff); i++)
+  {
+    diff[i] = i % 5 == 0 ? 3 : 0;
+    target[1000 + i] += diff[i];
+  }
+
+  static DeltaWriter writer;
+  writer.length = 0;
+  writer.header(sizeof(target));
+  writer.copy(500, 1000);
+  writer.add(1500, diff, sizeof(diff));
+  writer.copy(1800, 1700);
+  writer.end();
+
+  DeltaPatcher patcher(readBase);
+  patcher.reset(BASE_ID);
+  patchedLength = 0;
+  for (size_t i = 0; i < writer.length; i++)
+  {
+    assertTrue(patcher.apply(&writer.buffer[i], 1, collect));
+  }
+  assertTrue(patcher.isComplete());
+  assertEqual(sizeof(target), patchedLength);
+  assertEqual(0, memcmp(target, patched, sizeof(target)));
+}
+
+test(wrongBaseIsRejected)
+{
+  const uint8_t otherBase[DELTA_BASE_ID_LEN] = {0};
+  static DeltaWriter writer;
+  writer.length = 0;
+  writer.header(10, otherBase);
+  writer.copy(0, 10);
+  writer.end();
+
+  DeltaPatcher patcher(readBase);
+  patcher.reset(BASE_ID);
+  patchedLength = 0;
+  assertFalse(patcher.apply(writer.buffer, writer.length, collect));
+  assertEqual(deltaErrorBase, patcher.getError());
+  assertEqual((size_t)0, patchedLength);
+}
+
+test(readPastBaseFails)
+{
+  static DeltaWriter writer;
+  writer.length = 0;
+  writer.header(100);
+  writer.copy(sizeof(base) - 50, 100);
+  writer.end();
+
+  DeltaPatcher patcher(readBase);
+  patcher.reset(BASE_ID);
+  patchedLength = 0;
+  assertFalse(patcher.apply(writer.buffer, writer.length, collect));
+  assertEqual(deltaErrorRead, patcher.getError());
+}
+
+test(incompleteDelta)
+{
+  static DeltaWriter writer;
+  writer.length = 0;
+  writer.header(100);
+  writer.copy(0, 50);
+
+  DeltaPatcher patcher(readBase);
+  patcher.reset(BASE_ID);
+  patchedLength = 0;
+  assertTrue(patcher.apply(writer.buffer, writer.length, collect));
+  assertFalse(patcher.isComplete());
+
+  // Size in the header does not match what the operations produce
+  writer.end();
+  assertTrue(patcher.apply(&writer.buffer[writer.length - 1], 1, collect));
+  assertFalse(patcher.isComplete());
+}
+
+test(trailingDataFails)
+{
+  static DeltaWriter writer;
+  writer.length = 0;
+  writer.header(0);
+  writer.end();
+  writer.end();
+
+  DeltaPatcher patcher(readBase);
+  patcher.reset(BASE_ID);
+  assertFalse(patcher.apply(writer.buffer, writer.length, collect));
+  assertEqual(deltaErrorTrailingData, patcher.getError());
+}
+
+void setup()
+{
+  Serial.begin(115200);
+  while (!Serial);
+  delay(1000);
+  Log.begin(LOG_LEVEL_SILENT, &Serial);
+}
+
+void loop()
+{
+  TestRunner::run();
+}
@@ -0,0 +1,102 @@
+#line 2 "DuplicateCacheTest.ino"
+
+#include <AUnit.h>
+#include <ArduinoLog.h>
+#include "../../src/bb-link/DuplicateCache.h"
+
+using aunit::TestRunner;
+
+#define WINDOW 30000
+
+// N0CALL>APRS:>Test, heard direct
+static const uint8_t direct[] = {
+    0xC0, 0x00, 0x82, 0xA0, 0xA4, 0xA6, 0x40, 0x40, 0x60, 0x9C, 0x60, 0x86,
+    0x82, 0x98, 0x98, 0x61, 0x03, 0xF0, 0x3E, 0x54, 0x65, 0x73, 0x74, 0xC0};
+
+// N0CALL>APRS,WIDE1-1*:>Test, the same packet thru a digipeater
+static const uint8_t digipeated[] = {
+    0xC0, 0x00, 0x82, 0xA0, 0xA4, 0xA6, 0x40, 0x40, 0x60, 0x9C, 0x60, 0x86,
+    0x82, 0x98, 0x98, 0x60, 0xAE, 0x92, 0x88, 0x8A, 0x62, 0x40, 0xE3, 0x03,
+    0xF0, 0x3E, 0x54, 0x65, 0x73, 0x74, 0xC0};
+
+static AX25Frame parse(const uint8_t *kissFrame, size_t size)
+{
+  AX25Frame frame;
+  frame.parse(kissFrame, size);
+  return frame;
+}
+
+test(offUntilWindowSet)
+{
+  DuplicateCache cache;
+  assertFalse(cache.isEnabled());
+  cache.setWindow(WINDOW);
+  assertTrue(cache.isEnabled());
+  assertEqual((uint32_t)WINDOW, cache.getWindow());
+}
+
+test(ignoresDigipeaterPath)
+{
+  AX25Frame first = parse(direct, sizeof(direct));
+  AX25Frame copy = parse(digipeated, sizeof(digipeated));
+  assertEqual(DuplicateCache::hash(first), DuplicateCache::hash(copy));
+
+  DuplicateCache cache;
+  cache.setWindow(WINDOW);
+  assertFalse(cache.seen(first, 1000));
+  assertTrue(cache.seen(copy, 2000));
+}
+
+test(forgetsAfterWindow)
+{
+  AX25Frame frame = parse(direct, sizeof(direct));
+  DuplicateCache cache;
+  cache.setWindow(WINDOW);
+  assertFalse(cache.seen(frame, 1000));
+  // Copies don't extend the window
+  assertTrue(cache.seen(frame, 1000 + WINDOW - 1));
+  assertFalse(cache.seen(frame, 1000 + WINDOW));
+  assertTrue(cache.seen(frame, 1000 + WINDOW + 1));
+}
+
+test(tellsPayloadsApart)
+{
+  uint8_t other[sizeof(direct)];
+  memcpy(other, direct, sizeof(direct));
+  other[sizeof(other) - 2] = 0x75;
+
+  DuplicateCache cache;
+  cache.setWindow(WINDOW);
+  assertFalse(cache.seen(parse(direct, sizeof(direct)), 1000));
+  assertFalse(cache.seen(parse(other, sizeof(other)), 1000));
+}
+
+test(evictsOldestWhenFull)
+{
+  DuplicateCache cache;
+  cache.setWindow(WINDOW);
+  uint8_t frame[sizeof(direct)];
+  memcpy(frame, direct, sizeof(direct));
+  // More frames than the cache holds, all within the window
+  for (int i = 0; i < 4 * DUPLICATE_CACHE_SIZE; i++)
+  {
+    frame[sizeof(frame) - 3] = i & 0xFF;
+    frame[sizeof(frame) - 2] = i >> 8;
+    assertFalse(cache.seen(parse(frame, sizeof(frame)), 1000 + i));
+  }
+  // The latest is still known
+  assertTrue(cache.seen(parse(frame, sizeof(frame)), 1000 + 4 * DUPLICATE_CACHE_SIZE));
+}
+
+void setup()
+{
+  Serial.begin(115200);
+  while (!Serial);
+  delay(1000);
+  Log.begin(LOG_LEVEL_SILENT, &Serial);
+}
+
+void loop()
+{
+  TestRunner::run();
+}
@@ -0,0 +1,128 @@
+#line 2 "EventInboxTest.ino"
+
+#include <AUnit.h>
+#include <ArduinoLog.h>
+#include <thread>
+#include "../../src/bb-link/EventInbox.h"
+
+using aunit::TestRunner;
+
+struct test_event_t
+{
+  uint8_t producer;
+  uint32_t sequence;
+};
+
+test(fifoOrder)
+{
+  EventInbox<test_event_t, 4> inbox;
+  for (uint32_t i = 0; i < 3; i++)
+  {
+    assertTrue(inbox.post({0, i}));
+  }
+  test_event_t event;
+  for (uint32_t i = 0; i < 3; i++)
+  {
+    assertTrue(inbox.receive(&event));
+    assertEqual(i, event.sequence);
+  }
+  assertFalse(inbox.receive(&event));
+}
+
+test(dropsWhenFull)
+{
+  EventInbox<test_event_t, 4> inbox;
+  for (uint32_t i = 0; i < 4; i++)
+  {
+    assertTrue(inbox.post({0, i}));
+  }
+  assertFalse(inbox.post({0, 4}));
+  assertEqual((uint32_t)1, inbox.getDropped());
+
+  // Room again once drained, wrapping around the slots
+  test_event_t event;
+  assertTrue(inbox.receive(&event));
+  assertTrue(inbox.post({0, 5}));
+  uint32_t expected[] = {1, 2, 3, 5};
+  for (uint32_t i = 0; i < 4; i++)
+  {
+    assertTrue(inbox.receive(&event));
+    assertEqual(expected[i], event.sequence);
+  }
+}
+
+/*
+  Producers on other threads, like the Bluedroid and BT tasks. Every event posted
+  is received exactly once, in order per producer.
+*/
+test(concurrentProducers)
+{
+  const uint8_t producers = 3;
+  const uint32_t perProducer = 100000;
+  static EventInbox<test_event_t, 8> inbox;
+  uint32_t posted[producers] = {};
+
+  std::thread threads[producers];
+  for (uint8_t p = 0; p < producers; p++)
+  {
+    threads[p] = std::thread([p, &posted]()
+                             {
+      for (uint32_t i = 0; i < perProducer; i++)
+      {
+        if (inbox.post({p, i}))
+        {
+          posted[p]++;
+        }
+        else
+        {
+          std::this_thread::yield();
+        }
+      } });
+  }
+
+  uint32_t received[producers] = {};
+  int64_t last[producers] = {-1, -1, -1};
+  bool ordered = true;
+  test_event_t event;
+  auto drain = [&]()
+  {
+    while (inbox.receive(&event))
+    {
+      ordered = ordered && (int64_t)event.sequence > last[event.producer];
+      last[event.producer] = event.sequence;
+      received[event.producer]++;
+    }
+  };
+
+  uint32_t total = 0;
+  while (total < producers * perProducer)
+  {
+    drain();
+    total = received[0] + received[1] + received[2] + inbox.getDropped();
+  }
+  for (uint8_t p = 0; p < producers; p++)
+  {
+    threads[p].join();
+  }
+  drain();
+
+  assertTrue(ordered);
+  for (uint8_t p = 0; p < producers; p++)
+  {
+    assertEqual(posted[p], received[p]);
+  }
+  assertEqual(producers * perProducer, received[0] + received[1] + received[2] + inbox.getDropped());
+}
+
+void setup()
+{
+  Serial.begin(115200);
+  while (!Serial);
+  delay(1000);
+  Log.begin(LOG_LEVEL_SILENT, &Serial);
+}
+
+void loop()
+{
+  TestRunner::run();
+}
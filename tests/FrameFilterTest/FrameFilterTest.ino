@@ -0,0 +1,125 @@
+#line 2 "FrameFilterTest.ino"
+
+#include <AUnit.h>
+#include <ArduinoLog.h>
+#include "../../src/bb-link/FrameFilter.h"
+
+using aunit::TestRunner;
+
+// N0CALL-1>APRS:>Test
+static const uint8_t status[] = {
+    0xC0, 0x00, 0x82, 0xA0, 0xA4, 0xA6, 0x40, 0x40, 0x60, 0x9C, 0x60, 0x86,
+    0x82, 0x98, 0x98, 0x63, 0x03, 0xF0, 0x3E, 0x54, 0x65, 0x73, 0x74, 0xC0};
+
+// K1ABC>APRS::N0CALL   :Hi
+static const uint8_t message[] = {
+    0xC0, 0x00, 0x82, 0xA0, 0xA4, 0xA6, 0x40, 0x40, 0x60, 0x96, 0x62, 0x82,
+    0x84, 0x86, 0x40, 0x61, 0x03, 0xF0, 0x3A, 0x4E, 0x30, 0x43, 0x41, 0x4C,
+    0x4C, 0x20, 0x20, 0x20, 0x3A, 0x48, 0x69, 0xC0};
+
+static AX25Frame parse(const uint8_t *kissFrame, size_t size)
+{
+  AX25Frame frame;
+  frame.parse(kissFrame, size);
+  return frame;
+}
+
+test(offWithoutRules)
+{
+  FrameFilter filter;
+  assertFalse(filter.isEnabled());
+  assertTrue(filter.matches(parse(status, sizeof(status))));
+}
+
+test(matchesCallsignAndSsid)
+{
+  const uint8_t source[] = {frameFilterSource, 'n', '0', 'c', 'a', 'l', 'l', 1};
+  const uint8_t otherSsid[] = {frameFilterSource, 'N', '0', 'C', 'A', 'L', 'L', 2};
+  const uint8_t anySsid[] = {frameFilterSource, 'N', '0', 'C', 'A', 'L', 'L', FRAME_FILTER_ANY_SSID};
+  const uint8_t shortCall[] = {frameFilterSource, 'K', '1', 'A', 'B', 'C', 0, 0};
+
+  FrameFilter filter;
+  assertTrue(filter.add(otherSsid, sizeof(otherSsid)));
+  assertFalse(filter.matches(parse(status, sizeof(status))));
+  assertTrue(filter.add(source, sizeof(source)));
+  assertTrue(filter.matches(parse(status, sizeof(status))));
+
+  filter.clear();
+  assertTrue(filter.add(anySsid, sizeof(anySsid)));
+  assertTrue(filter.matches(parse(status, sizeof(status))));
+  assertFalse(filter.matches(parse(message, sizeof(message))));
+
+  filter.clear();
+  assertTrue(filter.add(shortCall, sizeof(shortCall)));
+  assertTrue(filter.matches(parse(message, sizeof(message))));
+}
+
+test(needsEveryKind)
+{
+  const uint8_t destination[] = {frameFilterDestination, 'A', 'P', 'R', 'S', ' ', ' ', 0};
+  const uint8_t pid[] = {frameFilterPid, 0xF0};
+  const uint8_t messages[] = {frameFilterDataType, ':', 'N', '0', 'C', 'A', 'L', 'L'};
+
+  FrameFilter filter;
+  assertTrue(filter.add(destination, sizeof(destination)));
+  assertTrue(filter.add(pid, sizeof(pid)));
+  assertTrue(filter.matches(parse(status, sizeof(status))));
+  assertTrue(filter.add(messages, sizeof(messages)));
+  assertEqual(3, filter.getRuleCount());
+  assertFalse(filter.matches(parse(status, sizeof(status))));
+  assertTrue(filter.matches(parse(message, sizeof(message))));
+}
+
+test(refusesBadRules)
+{
+  const uint8_t unknown[] = {0x7F, 0x01};
+  const uint8_t badCallsign[] = {frameFilterSource, 'N', '0', '-', '1', 0, 0, 0};
+  const uint8_t badSsid[] = {frameFilterSource, 'N', '0', 'C', 'A', 'L', 'L', 16};
+  const uint8_t emptyPrefix[] = {frameFilterDataType, 0};
+  const uint8_t pid[] = {frameFilterPid, 0xF0};
+  const uint8_t clear[] = {frameFilterClear};
+
+  FrameFilter filter;
+  assertFalse(filter.add(unknown, sizeof(unknown)));
+  assertFalse(filter.add(badCallsign, sizeof(badCallsign)));
+  assertFalse(filter.add(badSsid, sizeof(badSsid)));
+  assertFalse(filter.add(emptyPrefix, sizeof(emptyPrefix)));
+  assertFalse(filter.isEnabled());
+
+  for (int i = 0; i < FRAME_FILTER_MAX_RULES; i++)
+  {
+    assertTrue(filter.add(pid, sizeof(pid)));
+  }
+  assertFalse(filter.add(pid, sizeof(pid)));
+  assertTrue(filter.add(clear, sizeof(clear)));
+  assertFalse(filter.isEnabled());
+}
+
+test(restoresCompiledRules)
+{
+  const uint8_t messages[] = {frameFilterDataType, ':'};
+  FrameFilter filter;
+  filter.add(messages, sizeof(messages));
+
+  FrameFilter restored;
+  assertTrue(restored.restore(filter.getRules(), filter.getRuleCount()));
+  assertFalse(restored.matches(parse(status, sizeof(status))));
+  assertTrue(restored.matches(parse(message, sizeof(message))));
+
+  frame_filter_rule_t corrupt = {0x7F, 1, {0}};
+  assertFalse(restored.restore(&corrupt, 1));
+  assertFalse(restored.isEnabled());
+}
+
+void setup()
+{
+  Serial.begin(115200);
+  while (!Serial);
+  delay(1000);
+  Log.begin(LOG_LEVEL_SILENT, &Serial);
+}
+
+void loop()
+{
+  TestRunner::run();
+}
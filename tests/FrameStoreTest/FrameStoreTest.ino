@@ -0,0 +1,141 @@
+#line 2 "FrameStoreTest.ino"
+
+#include <AUnit.h>
+#include <ArduinoLog.h>
+#include "../../src/bb-link/FrameStore.h"
+
+using aunit::TestRunner;
+
+#define FRAME_SIZE 100
+#define FRAMES_IN_STORE (FRAME_STORE_SIZE / (FRAME_STORE_HEADER_SIZE + FRAME_SIZE))
+
+static void makeFrame(uint8_t *frame, uint16_t number)
+{
+  memset(frame, 0x55, FRAME_SIZE);
+  frame[0] = 0xC0;
+  frame[1] = number >> 8;
+  frame[2] = number & 0xFF;
+  frame[FRAME_SIZE - 1] = 0xC0;
+}
+
+static uint16_t frameNumber(const uint8_t *frame)
+{
+  return (frame[1] << 8) | frame[2];
+}
+
+test(offUntilConfigured)
+{
+  FrameStore store;
+  uint8_t frame[FRAME_SIZE];
+  makeFrame(frame, 0);
+  assertFalse(store.isEnabled());
+  assertFalse(store.store(frame, sizeof(frame), 0));
+  assertFalse(store.configure((frame_store_policy_t)0x03, 0));
+  assertTrue(store.configure(frameStoreDropOldest, 0));
+  assertTrue(store.isEnabled());
+}
+
+test(replaysWholeFramesInOrder)
+{
+  FrameStore store;
+  store.configure(frameStoreDropOldest, 0);
+  uint8_t frame[FRAME_SIZE];
+  for (int i = 0; i < 5; i++)
+  {
+    makeFrame(frame, i);
+    assertTrue(store.store(frame, sizeof(frame), i));
+  }
+  assertEqual((uint32_t)5, store.getCount());
+
+  // Two and a half frames worth, only two come out
+  uint8_t buffer[FRAME_SIZE * 5 / 2];
+  assertEqual((size_t)(2 * FRAME_SIZE), store.replay(buffer, sizeof(buffer), 10));
+  assertEqual(0, frameNumber(buffer));
+  assertEqual(1, frameNumber(buffer + FRAME_SIZE));
+  assertEqual((size_t)(2 * FRAME_SIZE), store.replay(buffer, sizeof(buffer), 10));
+  assertEqual(2, frameNumber(buffer));
+  assertEqual((size_t)FRAME_SIZE, store.replay(buffer, sizeof(buffer), 10));
+  assertEqual(4, frameNumber(buffer));
+  assertEqual((uint32_t)0, store.getCount());
+  assertEqual((size_t)0, store.getUsed());
+}
+
+test(dropsOldestWhenFull)
+{
+  FrameStore store;
+  store.configure(frameStoreDropOldest, 0);
+  uint8_t frame[FRAME_SIZE];
+  // Goes round the ring more than once
+  for (int i = 0; i < 3 * FRAMES_IN_STORE; i++)
+  {
+    makeFrame(frame, i);
+    assertTrue(store.store(frame, sizeof(frame), i));
+  }
+  assertEqual((uint32_t)FRAMES_IN_STORE, store.getCount());
+  assertEqual((uint32_t)(2 * FRAMES_IN_STORE), store.getDropped());
+
+  uint8_t buffer[FRAME_SIZE];
+  for (int i = 2 * FRAMES_IN_STORE; i < 3 * FRAMES_IN_STORE; i++)
+  {
+    assertEqual((size_t)FRAME_SIZE, store.replay(buffer, sizeof(buffer), 0));
+    assertEqual(i, frameNumber(buffer));
+    assertEqual(0xC0, buffer[FRAME_SIZE - 1]);
+  }
+}
+
+test(dropsNewestWhenFull)
+{
+  FrameStore store;
+  store.configure(frameStoreDropNewest, 0);
+  uint8_t frame[FRAME_SIZE];
+  for (int i = 0; i < FRAMES_IN_STORE + 10; i++)
+  {
+    makeFrame(frame, i);
+    assertEqual(i < FRAMES_IN_STORE, store.store(frame, sizeof(frame), i));
+  }
+  assertEqual((uint32_t)10, store.getDropped());
+
+  uint8_t buffer[FRAME_SIZE];
+  store.replay(buffer, sizeof(buffer), 0);
+  assertEqual(0, frameNumber(buffer));
+}
+
+test(forgetsAfterRetention)
+{
+  FrameStore store;
+  store.configure(frameStoreDropOldest, 1000);
+  uint8_t frame[FRAME_SIZE];
+  makeFrame(frame, 0);
+  store.store(frame, sizeof(frame), 0);
+  makeFrame(frame, 1);
+  store.store(frame, sizeof(frame), 500);
+
+  uint8_t buffer[2 * FRAME_SIZE];
+  assertEqual((size_t)FRAME_SIZE, store.replay(buffer, sizeof(buffer), 1200));
+  assertEqual(1, frameNumber(buffer));
+  assertEqual((uint32_t)1, store.getDropped());
+}
+
+test(forgetsWhenTurnedOff)
+{
+  FrameStore store;
+  store.configure(frameStoreDropOldest, 0);
+  uint8_t frame[FRAME_SIZE];
+  makeFrame(frame, 0);
+  store.store(frame, sizeof(frame), 0);
+  store.configure(frameStoreOff, 0);
+  assertEqual((uint32_t)0, store.getCount());
+}
+
+void setup()
+{
+  Serial.begin(115200);
+  while (!Serial);
+  delay(1000);
+  Log.begin(LOG_LEVEL_SILENT, &Serial);
+}
+
+void loop()
+{
+  TestRunner::run();
+}
@@ -0,0 +1,193 @@
+#line 2 "HeatshrinkDecoderTest.ino"
+
+#include <AUnit.h>
+#include <ArduinoLog.h>
+#include "../../src/bb-link/HeatshrinkDecoder.h"
+
+using aunit::TestRunner;
+
+/*
+  Minimal bit writer to build heatshrink streams by hand
+*/
+class BitWriter
+{
+public:
+  uint8_t buffer[4096];
+  size_t length = 0;
+
+  void push(uint32_t value, uint8_t count)
+  {
+    while (count--)
+    {
+      if (bitIndex == 0)
+      {
+        buffer[length++] = 0;
+        bitIndex = 0x80;
+      }
+      if ((value >> count) & 0x01)
+      {
+        buffer[length - 1] |= bitIndex;
+      }
+      bitIndex >>= 1;
+    }
+  }
+
+  void literal(uint8_t c)
+  {
+    push(1, 1);
+    push(c, 8);
+  }
+
+  void backref(uint16_t offset, uint8_t count)
+  {
+    push(0, 1);
+    push(offset - 1, HEATSHRINK_WINDOW_BITS);
+    push(count - 1, HEATSHRINK_LOOKAHEAD_BITS);
+  }
+
+private:
+  uint8_t bitIndex = 0;
+};
+
+// Greedy encoder, good enough to round trip data thru the decoder
+static void encode(const uint8_t *data, size_t size, BitWriter &writer)
+{
+  const size_t window = 1 << HEATSHRINK_WINDOW_BITS;
+  const size_t maxCount = 1 << HEATSHRINK_LOOKAHEAD_BITS;
+  size_t i = 0;
+  while (i < size)
+  {
+    size_t bestOffset = 0;
+    size_t bestCount = 0;
+    for (size_t offset = 1; offset <= window && offset <= i; offset++)
+    {
+      size_t count = 0;
+      while (count < maxCount && i + count < size && data[i + count - offset] == data[i + count])
+      {
+        count++;
+      }
+      if (count > bestCount)
+      {
+        bestCount = count;
+        bestOffset = offset;
+      }
+    }
+    if (bestCount >= 2)
+    {
+      writer.backref(bestOffset, bestCount);
+      i += bestCount;
+    }
+    else
+    {
+      writer.literal(data[i++]);
+    }
+  }
+}
+
+static uint8_t decoded[8192];
+static size_t decodedLength = 0;
+
+static bool collect(const uint8_t *data, size_t size)
+{
+  memcpy(decoded + decodedLength, data, size);
+  decodedLength += size;
+  return true;
+}
+
+test(literals)
+{
+  BitWriter writer;
+  writer.literal('K');
+  writer.literal('I');
+  writer.literal('S');
+  writer.literal('S');
+
+  HeatshrinkDecoder decoder;
+  decodedLength = 0;
+  assertTrue(decoder.decode(writer.buffer, writer.length, collect));
+  assertTrue(decoder.flush(collect));
+  assertEqual((size_t)4, decodedLength);
+  assertEqual(0, memcmp("KISS", decoded, 4));
+}
+
+test(backReference)
+{
+  BitWriter writer;
+  writer.literal('a');
+  writer.literal('b');
+  // Overlapping copy, repeats "ab" three times
+  writer.backref(2, 6);
+
+  HeatshrinkDecoder decoder;
+  decodedLength = 0;
+  assertTrue(decoder.decode(writer.buffer, writer.length, collect));
+  assertTrue(decoder.flush(collect));
+  assertEqual((size_t)8, decodedLength);
+  assertEqual(0, memcmp("abababab", decoded, 8));
+}
+
+test(backReferenceBeforeStartIsZero)
+{
+  BitWriter writer;
+  writer.backref(4, 2);
+
+  HeatshrinkDecoder decoder;
+  decodedLength = 0;
+  assertTrue(decoder.decode(writer.buffer, writer.length, collect));
+  assertTrue(decoder.flush(collect));
+  assertEqual((size_t)2, decodedLength);
+  assertEqual(0, decoded[0]);
+  assertEqual(0, decoded[1]);
+}
+
+test(roundTripByteByByte)
+{
+  uint8_t data[6000];
+  for (size_t i = 0; i < sizeof(data); i++)
+  {
+    // Compressible, but not trivially
+    data[i] = (i % 97) < 40 ? (i * 7) & 0xFF : "firmware"[i % 8];
+  }
+  static BitWriter writer;
+  writer.length = 0;
+  encode(data, sizeof(data), writer);
+  assertLess(writer.length, sizeof(data));
+
+  HeatshrinkDecoder decoder;
+  decodedLength = 0;
+  // Feed one byte at a time, like tiny BLE writes would
+  for (size_t i = 0; i < writer.length; i++)
+  {
+    assertTrue(decoder.decode(&writer.buffer[i], 1, collect));
+  }
+  assertTrue(decoder.flush(collect));
+  assertEqual(sizeof(data), decodedLength);
+  assertEqual((uint32_t)sizeof(data), decoder.getOutputCount());
+  assertEqual(0, memcmp(data, decoded, sizeof(data)));
+}
+
+test(sinkFailureStopsDecoding)
+{
+  uint8_t data[2048];
+  memset(data, 0x55, sizeof(data));
+  static BitWriter writer;
+  writer.length = 0;
+  encode(data, sizeof(data), writer);
+
+  HeatshrinkDecoder decoder;
+  assertFalse(decoder.decode(writer.buffer, writer.length, [](const uint8_t *data, size_t size)
+                             { return false; }));
+}
+
+void setup()
+{
+  Serial.begin(115200);
+  while (!Serial);
+  delay(1000);
+  Log.begin(LOG_LEVEL_SILENT, &Serial);
+}
+
+void loop()
+{
+  TestRunner::run();
+}
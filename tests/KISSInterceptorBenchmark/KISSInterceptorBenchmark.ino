@@ -0,0 +1,471 @@
+#line 2 "KISSInterceptorBenchmark.ino"
+
+/*
+  Throughput and stack use of the KISS codec on the host. Results go to
+  stdout as JSON. With KISS_BENCH_BASELINE pointing to a previous run, any
+  case slower than the baseline by more than KISS_BENCH_TOLERANCE percent,
+  or using more stack, is reported on stderr and the exit code is 1.
+*/
+
+#include <ArduinoLog.h>
+#include <chrono>
+#include <new>
+#include "../../src/bb-link/KISSInterceptor.h"
+
+#define BENCH_ROUNDS 5         // Best round is kept, the others are noise
+#define BENCH_MIN_TIME_MS 50   // Each round repeats the case for at least this long
+#define BENCH_MTU 512          // Largest BLE write
+#define BENCH_CORPUS_SIZE 64   // Frames in the AX.25 corpus
+#define BENCH_FRAME_SIZE 256   // Largest AX.25 frame in the corpus
+#define BENCH_STACK_PAINT 16384
+#define BENCH_STACK_PATTERN 0xA5
+
+static const uint8_t FEND = 0xC0;
+static const uint8_t FESC = 0xDB;
+
+typedef void (*bench_fn_t)();
+
+struct bench_result_t
+{
+  const char *name;
+  uint64_t bytes;
+  uint64_t frames;
+  double nsPerByte;
+  double framesPerSecond;
+  size_t peakStack;
+  uint32_t allocations;
+};
+
+/*
+  Heap use by the codec shows up as allocations
+*/
+static uint32_t allocations = 0;
+
+void *operator new(size_t size)
+{
+  allocations++;
+  void *p = malloc(size);
+  if (!p)
+  {
+    abort();
+  }
+  return p;
+}
+
+void *operator new[](size_t size)
+{
+  return operator new(size);
+}
+
+void operator delete(void *p) noexcept
+{
+  free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+  free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+  free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept
+{
+  free(p);
+}
+
+static KISSInterceptor kissInterceptor;
+
+// Unescaped AX.25 frames, with the KISS data command byte
+static uint8_t corpus[BENCH_CORPUS_SIZE][BENCH_FRAME_SIZE];
+static size_t corpusSize[BENCH_CORPUS_SIZE];
+
+// Same frames escaped and framed
+static uint8_t escaped[BENCH_CORPUS_SIZE][BENCH_FRAME_SIZE * 2 + 2];
+static size_t escapedSize[BENCH_CORPUS_SIZE];
+
+// Escaped frames packed back to back into MTU sized writes
+static uint8_t writes[BENCH_CORPUS_SIZE][BENCH_MTU];
+static size_t writeSize[BENCH_CORPUS_SIZE];
+static int writeCount = 0;
+static int writeFrames = 0;
+
+// Every byte needs escaping
+static uint8_t pathological[BENCH_FRAME_SIZE];
+static uint8_t pathologicalEscaped[BENCH_FRAME_SIZE * 2 + 2];
+static size_t pathologicalEscapedSize;
+
+// Hardware commands, alone and at the start of a full write
+static uint8_t hwCmd[] = {FEND, CMD_HARDWARE, EXTENDED_HW_CMD_SET_FREQUENCY, 0x08, 0xA4, 0x6C, 0xC0, FEND};
+static uint8_t hwCmdWrite[BENCH_MTU];
+
+static uint8_t output[BENCH_MTU * 2 + 2];
+static volatile uint32_t sink;
+
+static size_t encodeAddress(uint8_t *out, const char *call, uint8_t ssid, bool last)
+{
+  for (int i = 0; i < 6; i++)
+  {
+    char c = *call ? *call++ : ' ';
+    out[i] = c << 1;
+  }
+  out[6] = 0x60 | (ssid << 1) | (last ? 0x01 : 0x00);
+  return 7;
+}
+
+/*
+  APRS traffic as heard on 144.390: positions, messages, telemetry and
+  Mic-E, with 0 to 2 digipeaters. Mic-E and telemetry carry binary bytes,
+  some of them need escaping.
+*/
+static void buildCorpus()
+{
+  static const char *infos[] = {
+      "!4903.50N/07201.75W-Test 001234",
+      "=4740.12N/12220.31W_000/000g005t052r000p000P000h85b10132.DsVP",
+      ":N0CALL-9 :Meet at the trailhead at 10{042",
+      "T#123,199,000,255,073,123,01101001",
+      "`c51l\x1c\x1c>/'\"4T}146.520MHz|!R&Q|!wH1!|3",
+      ">Portable ops, 5W into a roll-up J-pole",
+      "@092345z4903.50N/07201.75W>088/036/A=001234 Mobile on I-5",
+      ";LEADVILLE*092345z3903.50N/10618.50W-Field day station"};
+  static const char *digis[] = {"WIDE1", "WIDE2", "N0DIGI"};
+
+  for (int n = 0; n < BENCH_CORPUS_SIZE; n++)
+  {
+    uint8_t *frame = corpus[n];
+    size_t size = 0;
+    int digiCount = n % 3;
+    frame[size++] = 0x00; // KISS data, port 0
+    size += encodeAddress(&frame[size], "APRS", 0, false);
+    size += encodeAddress(&frame[size], "N0CALL", n % 16, digiCount == 0);
+    for (int d = 0; d < digiCount; d++)
+    {
+      size += encodeAddress(&frame[size], digis[d], 1, d == digiCount - 1);
+    }
+    frame[size++] = 0x03; // UI
+    frame[size++] = 0xF0; // No layer 3
+    const char *info = infos[n % (sizeof(infos) / sizeof(infos[0]))];
+    size_t length = strlen(info);
+    memcpy(&frame[size], info, length);
+    size += length;
+    if (n % 5 == 0)
+    {
+      // Binary trailer, as found in compressed and Mic-E telemetry
+      frame[size++] = FEND;
+      frame[size++] = FESC;
+      frame[size++] = 0xDC;
+    }
+    corpusSize[n] = size;
+
+    escapedSize[n] = sizeof(escaped[n]);
+    kissInterceptor.escape(corpus[n], corpusSize[n], escaped[n], &escapedSize[n]);
+  }
+
+  writeCount = 0;
+  writeSize[0] = 0;
+  for (int n = 0; n < BENCH_CORPUS_SIZE && writeCount < BENCH_CORPUS_SIZE; n++)
+  {
+    if (writeSize[writeCount] + escapedSize[n] > BENCH_MTU)
+    {
+      writeCount++;
+      writeSize[writeCount] = 0;
+    }
+    memcpy(&writes[writeCount][writeSize[writeCount]], escaped[n], escapedSize[n]);
+    writeSize[writeCount] += escapedSize[n];
+    writeFrames++;
+  }
+  writeCount++;
+
+  for (size_t i = 0; i < sizeof(pathological); i++)
+  {
+    pathological[i] = i % 2 ? FEND : FESC;
+  }
+  pathologicalEscapedSize = sizeof(pathologicalEscaped);
+  kissInterceptor.escape(pathological, sizeof(pathological), pathologicalEscaped, &pathologicalEscapedSize);
+
+  memset(hwCmdWrite, 0x41, sizeof(hwCmdWrite));
+  memcpy(hwCmdWrite, hwCmd, sizeof(hwCmd));
+}
+
+// One pass over each case's input, returns bytes and frames through the codec
+
+static void escapeCorpus(uint64_t *bytes, uint64_t *frames)
+{
+  for (int n = 0; n < BENCH_CORPUS_SIZE; n++)
+  {
+    size_t size = sizeof(output);
+    kissInterceptor.escape(corpus[n], corpusSize[n], output, &size);
+    sink += size;
+    *bytes += corpusSize[n];
+  }
+  *frames += BENCH_CORPUS_SIZE;
+}
+
+static void unescapeCorpus(uint64_t *bytes, uint64_t *frames)
+{
+  for (int n = 0; n < BENCH_CORPUS_SIZE; n++)
+  {
+    size_t size;
+    kissInterceptor.unescape(escaped[n], escapedSize[n], output, &size);
+    sink += size;
+    *bytes += escapedSize[n];
+  }
+  *frames += BENCH_CORPUS_SIZE;
+}
+
+static void escapePathological(uint64_t *bytes, uint64_t *frames)
+{
+  size_t size = sizeof(output);
+  kissInterceptor.escape(pathological, sizeof(pathological), output, &size);
+  sink += size;
+  *bytes += sizeof(pathological);
+  *frames += 1;
+}
+
+static void unescapePathological(uint64_t *bytes, uint64_t *frames)
+{
+  size_t size;
+  kissInterceptor.unescape(pathologicalEscaped, pathologicalEscapedSize, output, &size);
+  sink += size;
+  *bytes += pathologicalEscapedSize;
+  *frames += 1;
+}
+
+// Data frames, what the bridge sees for almost every write
+static void extractDataWrites(uint64_t *bytes, uint64_t *frames)
+{
+  extended_hw_cmd_t cmd;
+  for (int n = 0; n < writeCount; n++)
+  {
+    sink += kissInterceptor.extractExtendedHardwareCommand(writes[n], writeSize[n], &cmd);
+    *bytes += writeSize[n];
+  }
+  *frames += writeFrames;
+}
+
+static void extractHardwareCommand(uint64_t *bytes, uint64_t *frames)
+{
+  extended_hw_cmd_t cmd;
+  sink += kissInterceptor.extractExtendedHardwareCommand(hwCmd, sizeof(hwCmd), &cmd);
+  *bytes += sizeof(hwCmd);
+  *frames += 1;
+}
+
+static void extractHardwareCommandWrite(uint64_t *bytes, uint64_t *frames)
+{
+  extended_hw_cmd_t cmd;
+  sink += kissInterceptor.extractExtendedHardwareCommand(hwCmdWrite, sizeof(hwCmdWrite), &cmd);
+  *bytes += sizeof(hwCmdWrite);
+  *frames += 1;
+}
+
+typedef void (*bench_pass_t)(uint64_t *bytes, uint64_t *frames);
+
+struct bench_case_t
+{
+  const char *name;
+  bench_pass_t pass;
+};
+
+static const bench_case_t cases[] = {
+    {"escape_aprs", escapeCorpus},
+    {"unescape_aprs", unescapeCorpus},
+    {"escape_pathological", escapePathological},
+    {"unescape_pathological", unescapePathological},
+    {"extract_data_mtu", extractDataWrites},
+    {"extract_hw_cmd", extractHardwareCommand},
+    {"extract_hw_cmd_mtu", extractHardwareCommandWrite},
+};
+
+static const size_t caseCount = sizeof(cases) / sizeof(cases[0]);
+
+/*
+  Stack painting: fill a region below the caller with a pattern, run one
+  pass from the same depth, and count how deep the pattern was overwritten.
+*/
+static void __attribute__((noinline)) paintStack()
+{
+  volatile uint8_t region[BENCH_STACK_PAINT];
+  for (size_t i = 0; i < sizeof(region); i++)
+  {
+    region[i] = BENCH_STACK_PATTERN;
+  }
+}
+
+static size_t __attribute__((noinline)) stackUsed()
+{
+  volatile uint8_t region[BENCH_STACK_PAINT];
+  size_t untouched = 0;
+  while (untouched < sizeof(region) && region[untouched] == BENCH_STACK_PATTERN)
+  {
+    untouched++;
+  }
+  return sizeof(region) - untouched;
+}
+
+static size_t __attribute__((noinline)) measureStack(bench_pass_t pass)
+{
+  uint64_t bytes = 0, frames = 0;
+  paintStack();
+  pass(&bytes, &frames);
+  return stackUsed();
+}
+
+static void run(const bench_case_t *benchCase, bench_result_t *result)
+{
+  uint64_t bytes = 0, frames = 0;
+
+  // Warm up caches
+  benchCase->pass(&bytes, &frames);
+
+  result->name = benchCase->name;
+  result->nsPerByte = 0;
+  allocations = 0;
+  for (int round = 0; round < BENCH_ROUNDS; round++)
+  {
+    bytes = 0;
+    frames = 0;
+    auto start = std::chrono::steady_clock::now();
+    auto elapsed = std::chrono::nanoseconds(0);
+    while (elapsed < std::chrono::milliseconds(BENCH_MIN_TIME_MS))
+    {
+      for (int i = 0; i < 64; i++)
+      {
+        benchCase->pass(&bytes, &frames);
+      }
+      elapsed = std::chrono::steady_clock::now() - start;
+    }
+
+    double ns = (double)elapsed.count();
+    if (round == 0 || ns / bytes < result->nsPerByte)
+    {
+      result->bytes = bytes;
+      result->frames = frames;
+      result->nsPerByte = ns / bytes;
+      result->framesPerSecond = frames * 1e9 / ns;
+    }
+  }
+  result->allocations = allocations;
+  result->peakStack = measureStack(benchCase->pass);
+}
+
+static void printResults(const bench_result_t *results, size_t count)
+{
+  char line[256];
+  Serial.print("{\n  \"benchmarks\": [\n");
+  for (size_t i = 0; i < count; i++)
+  {
+    const bench_result_t *r = &results[i];
+    snprintf(line, sizeof(line),
+             "    {\"name\": \"%s\", \"ns_per_byte\": %.3f, \"frames_per_s\": %.0f, \"peak_stack\": %u, \"allocations\": %u, \"bytes\": %llu, \"frames\": %llu}%s\n",
+             r->name, r->nsPerByte, r->framesPerSecond, (unsigned)r->peakStack, (unsigned)r->allocations,
+             (unsigned long long)r->bytes, (unsigned long long)r->frames, i + 1 < count ? "," : "");
+    Serial.print(line);
+  }
+  Serial.print("  ]\n}\n");
+}
+
+/*
+  Finds a number after "key": in the object of the named case. Good enough
+  for files written by printResults.
+*/
+static bool baselineValue(const char *json, const char *name, const char *key, double *value)
+{
+  char pattern[64];
+  snprintf(pattern, sizeof(pattern), "\"name\": \"%s\"", name);
+  const char *object = strstr(json, pattern);
+  if (!object)
+  {
+    return false;
+  }
+  const char *end = strchr(object, '}');
+  snprintf(pattern, sizeof(pattern), "\"%s\": ", key);
+  const char *found = strstr(object, pattern);
+  if (!found || (end && found > end))
+  {
+    return false;
+  }
+  *value = atof(found + strlen(pattern));
+  return true;
+}
+
+static int compare(const char *path, const bench_result_t *results, size_t count, double tolerance)
+{
+  FILE *file = fopen(path, "r");
+  if (!file)
+  {
+    fprintf(stderr, "Cannot read baseline %s\n", path);
+    return 1;
+  }
+  static char json[16384];
+  size_t length = fread(json, 1, sizeof(json) - 1, file);
+  json[length] = '\0';
+  fclose(file);
+
+  int regressions = 0;
+  for (size_t i = 0; i < count; i++)
+  {
+    const bench_result_t *r = &results[i];
+    double nsPerByte, peakStack;
+    if (!baselineValue(json, r->name, "ns_per_byte", &nsPerByte) ||
+        !baselineValue(json, r->name, "peak_stack", &peakStack))
+    {
+      fprintf(stderr, "%s: not in baseline\n", r->name);
+      continue;
+    }
+    double change = (r->nsPerByte - nsPerByte) * 100.0 / nsPerByte;
+    if (change > tolerance)
+    {
+      fprintf(stderr, "REGRESSION %s: %.3f ns/byte, baseline %.3f (+%.1f%%)\n", r->name, r->nsPerByte, nsPerByte, change);
+      regressions++;
+    }
+    if (r->peakStack > peakStack)
+    {
+      fprintf(stderr, "REGRESSION %s: %u bytes of stack, baseline %.0f\n", r->name, (unsigned)r->peakStack, peakStack);
+      regressions++;
+    }
+    if (r->allocations > 0)
+    {
+      fprintf(stderr, "REGRESSION %s: %u allocations\n", r->name, (unsigned)r->allocations);
+      regressions++;
+    }
+  }
+  if (regressions == 0)
+  {
+    fprintf(stderr, "No regression against %s (tolerance %.0f%%)\n", path, tolerance);
+  }
+  return regressions ? 1 : 0;
+}
+
+void setup()
+{
+  Serial.begin(115200);
+  Log.begin(LOG_LEVEL_SILENT, &Serial);
+
+  buildCorpus();
+
+  bench_result_t results[caseCount];
+  for (size_t i = 0; i < caseCount; i++)
+  {
+    run(&cases[i], &results[i]);
+  }
+  printResults(results, caseCount);
+
+  int status = 0;
+  const char *baseline = getenv("KISS_BENCH_BASELINE");
+  if (baseline)
+  {
+    const char *tolerance = getenv("KISS_BENCH_TOLERANCE");
+    status = compare(baseline, results, caseCount, tolerance ? atof(tolerance) : 10.0);
+  }
+  Serial.flush();
+  exit(status);
+}
+
+void loop()
+{
+}
@@ -132,6 +132,215 @@ test(extractExtendedHardwareCommandFactoryReset)
   assertEqual(extended_hw_factory_reset, cmd.action);
 }
 
+test(extractExtendedHardwareCommandGetBattery)
+{
+  KISSInterceptor kissInterceptor;
+  uint8_t frame[] = {0xC0, 0x06, 0xF5, 0xC0};  
+  extended_hw_cmd_t cmd;
+  assertTrue(kissInterceptor.extractExtendedHardwareCommand(frame, sizeof(frame), &cmd));
+  assertEqual(extended_hw_get_battery, cmd.action);
+}
+
+test(extractExtendedHardwareCommandGetStateStats)
+{
+  KISSInterceptor kissInterceptor;
+  uint8_t frame[] = {0xC0, 0x06, 0xF6, 0x02, 0xC0};  
+  extended_hw_cmd_t cmd;
+  assertTrue(kissInterceptor.extractExtendedHardwareCommand(frame, sizeof(frame), &cmd));
+  assertEqual(extended_hw_get_state_stats, cmd.action);
+  assertEqual(0x02, cmd.data.uint8);
+
+  // The closing FEND is not a state machine
+  uint8_t empty[] = {0xC0, 0x06, 0xF6, 0xC0};
+  assertFalse(kissInterceptor.extractExtendedHardwareCommand(empty, sizeof(empty), &cmd));
+}
+
+test(extractExtendedHardwareCommandGetStats)
+{
+  KISSInterceptor kissInterceptor;
+  uint8_t frame[] = {0xC0, 0x06, 0xF7, 0xC0};  
+  extended_hw_cmd_t cmd;
+  assertTrue(kissInterceptor.extractExtendedHardwareCommand(frame, sizeof(frame), &cmd));
+  assertEqual(extended_hw_get_stats, cmd.action);
+}
+
+test(extractExtendedHardwareCommandGetLatency)
+{
+  KISSInterceptor kissInterceptor;
+  uint8_t frame[] = {0xC0, 0x06, 0xF8, 0x04, 0xC0};  
+  extended_hw_cmd_t cmd;
+  assertTrue(kissInterceptor.extractExtendedHardwareCommand(frame, sizeof(frame), &cmd));
+  assertEqual(extended_hw_get_latency, cmd.action);
+  assertEqual(0x04, cmd.data.uint8);
+
+  // The closing FEND is not a stage
+  uint8_t empty[] = {0xC0, 0x06, 0xF8, 0xC0};
+  assertFalse(kissInterceptor.extractExtendedHardwareCommand(empty, sizeof(empty), &cmd));
+}
+
+test(extractExtendedHardwareCommandSetDuplicateWindow)
+{
+  KISSInterceptor kissInterceptor;
+  uint8_t frame[] = {0xC0, 0x06, 0xFA, 0x1E, 0xC0};
+  extended_hw_cmd_t cmd;
+  assertTrue(kissInterceptor.extractExtendedHardwareCommand(frame, sizeof(frame), &cmd));
+  assertEqual(extended_hw_set_duplicate_window, cmd.action);
+  assertEqual(30, cmd.data.uint8);
+
+  // The closing FEND is not a window
+  uint8_t empty[] = {0xC0, 0x06, 0xFA, 0xC0};
+  assertFalse(kissInterceptor.extractExtendedHardwareCommand(empty, sizeof(empty), &cmd));
+}
+
+test(extractExtendedHardwareCommandSetFrameFilter)
+{
+  KISSInterceptor kissInterceptor;
+  // Destination N0CALL, any SSID
+  uint8_t frame[] = {0xC0, 0x06, 0xFB, 0x02, 'N', '0', 'C', 'A', 'L', 'L', 0xFF, 0xC0};
+  extended_hw_cmd_t cmd;
+  assertTrue(kissInterceptor.extractExtendedHardwareCommand(frame, sizeof(frame), &cmd));
+  assertEqual(extended_hw_set_frame_filter, cmd.action);
+  assertEqual(0, memcmp(frame + 3, cmd.data.bytes, 8));
+
+  // Shorter rules are padded
+  uint8_t dataType[] = {0xC0, 0x06, 0xFB, 0x04, ':', 0xC0};
+  assertTrue(kissInterceptor.extractExtendedHardwareCommand(dataType, sizeof(dataType), &cmd));
+  assertEqual(':', cmd.data.bytes[1]);
+  assertEqual(0, cmd.data.bytes[2]);
+
+  // An escaped FEND is part of the value
+  uint8_t escaped[] = {0xC0, 0x06, 0xFB, 0x04, 0xDB, 0xDC, ':', 0xC0};
+  assertTrue(kissInterceptor.extractExtendedHardwareCommand(escaped, sizeof(escaped), &cmd));
+  assertEqual(0xC0, cmd.data.bytes[1]);
+  assertEqual(':', cmd.data.bytes[2]);
+
+  // Clearing takes the kind alone
+  uint8_t clear[] = {0xC0, 0x06, 0xFB, 0x00, 0xC0};
+  assertTrue(kissInterceptor.extractExtendedHardwareCommand(clear, sizeof(clear), &cmd));
+  assertEqual(0, cmd.data.bytes[0]);
+}
+
+test(extractExtendedHardwareCommandSetFrameFilterTooShort)
+{
+  KISSInterceptor kissInterceptor;
+  extended_hw_cmd_t cmd;
+  // Not a clear
+  uint8_t empty[] = {0xC0, 0x06, 0xFB, 0xC0};
+  assertFalse(kissInterceptor.extractExtendedHardwareCommand(empty, sizeof(empty), &cmd));
+  // No SSID
+  uint8_t source[] = {0xC0, 0x06, 0xFB, 0x01, 'N', '0', 'C', 'A', 'L', 'L', 0xC0};
+  assertFalse(kissInterceptor.extractExtendedHardwareCommand(source, sizeof(source), &cmd));
+  uint8_t dataType[] = {0xC0, 0x06, 0xFB, 0x04, 0xC0};
+  assertFalse(kissInterceptor.extractExtendedHardwareCommand(dataType, sizeof(dataType), &cmd));
+}
+
+test(extractExtendedHardwareCommandSetStoreForward)
+{
+  KISSInterceptor kissInterceptor;
+  uint8_t frame[] = {0xC0, 0x06, 0xFC, 0x01, 0x01, 0x68, 0xC0};
+  extended_hw_cmd_t cmd;
+  assertTrue(kissInterceptor.extractExtendedHardwareCommand(frame, sizeof(frame), &cmd));
+  assertEqual(extended_hw_set_store_forward, cmd.action);
+  assertEqual(0x01, cmd.data.bytes[0]);
+  assertEqual(0x01, cmd.data.bytes[1]);
+  assertEqual(0x68, cmd.data.bytes[2]);
+
+  // Retention cut short
+  uint8_t truncated[] = {0xC0, 0x06, 0xFC, 0x01, 0x01, 0xC0};
+  assertFalse(kissInterceptor.extractExtendedHardwareCommand(truncated, sizeof(truncated), &cmd));
+  uint8_t empty[] = {0xC0, 0x06, 0xFC, 0xC0};
+  assertFalse(kissInterceptor.extractExtendedHardwareCommand(empty, sizeof(empty), &cmd));
+}
+
+test(extractExtendedHardwareCommandGetJournal)
+{
+  KISSInterceptor kissInterceptor;
+  uint8_t frame[] = {0xC0, 0x06, 0xFD, 0x01, 0x00, 0x01, 0x20, 0x10, 0xC0};
+  extended_hw_cmd_t cmd;
+  assertTrue(kissInterceptor.extractExtendedHardwareCommand(frame, sizeof(frame), &cmd));
+  assertEqual(extended_hw_get_journal, cmd.action);
+  assertEqual(0, memcmp(frame + 3, cmd.data.bytes, 5));
+}
+
+test(extractExtendedHardwareCommandGetJournalTooShort)
+{
+  KISSInterceptor kissInterceptor;
+  extended_hw_cmd_t cmd;
+  uint8_t empty[] = {0xC0, 0x06, 0xFD, 0xC0};
+  assertFalse(kissInterceptor.extractExtendedHardwareCommand(empty, sizeof(empty), &cmd));
+  uint8_t truncated[] = {0xC0, 0x06, 0xFD, 0x01, 0x00, 0x01, 0x20, 0xC0};
+  assertFalse(kissInterceptor.extractExtendedHardwareCommand(truncated, sizeof(truncated), &cmd));
+}
+
+test(extractExtendedHardwareCommandSetJournal)
+{
+  KISSInterceptor kissInterceptor;
+  uint8_t frame[] = {0xC0, 0x06, 0xE9, 0x01, 0xC0};
+  extended_hw_cmd_t cmd;
+  assertTrue(kissInterceptor.extractExtendedHardwareCommand(frame, sizeof(frame), &cmd));
+  assertEqual(extended_hw_set_journal, cmd.action);
+  assertEqual(0x01, cmd.data.uint8);
+
+  // The closing FEND is not a setting
+  uint8_t empty[] = {0xC0, 0x06, 0xE9, 0xC0};
+  assertFalse(kissInterceptor.extractExtendedHardwareCommand(empty, sizeof(empty), &cmd));
+}
+
+test(extractExtendedHardwareCommandSelfTest)
+{
+  KISSInterceptor kissInterceptor;
+  uint8_t frame[] = {0xC0, 0x06, 0xFE, 0x01, 0x00, 0x01, 0x00, 0x00, 0x00, 0xF4, 0xC0};
+  extended_hw_cmd_t cmd;
+  assertTrue(kissInterceptor.extractExtendedHardwareCommand(frame, sizeof(frame), &cmd));
+  assertEqual(extended_hw_self_test, cmd.action);
+  assertEqual(0, memcmp(frame + 3, cmd.data.bytes, 7));
+
+  uint8_t report[] = {0xC0, 0x06, 0xFE, 0x03, 0xC0};
+  assertTrue(kissInterceptor.extractExtendedHardwareCommand(report, sizeof(report), &cmd));
+  assertEqual(0x03, cmd.data.bytes[0]);
+  assertEqual(0, cmd.data.bytes[1]);
+
+  // An escaped FEND is one argument, the closing FEND is none
+  uint8_t escaped[] = {0xC0, 0x06, 0xFE, 0x02, 0xDB, 0xDC, 0xC0};
+  assertTrue(kissInterceptor.extractExtendedHardwareCommand(escaped, sizeof(escaped), &cmd));
+  assertEqual(0x02, cmd.data.bytes[0]);
+  assertEqual(0xC0, cmd.data.bytes[1]);
+  assertEqual(0, cmd.data.bytes[2]);
+}
+
+test(frameReader)
+{
+  KISSFrameReader reader;
+  const uint8_t stream[] = {0xC0, 0xC0, 0x00, 0x01, 0xC0, 0x00, 0x02, 0xC0};
+  size_t frames[2];
+  int count = 0;
+  for (size_t i = 0; i < sizeof(stream); i++)
+  {
+    if (reader.push(stream[i]))
+    {
+      frames[count++] = reader.size();
+      reader.clear();
+    }
+  }
+  assertEqual(2, count);
+  // Back to back FENDs count once, a shared FEND belongs to the first frame
+  assertEqual((size_t)4, frames[0]);
+  assertEqual((size_t)3, frames[1]);
+}
+
+test(frameReaderDropsLongFrames)
+{
+  KISSFrameReader reader;
+  reader.push(0xC0);
+  for (size_t i = 0; i < KISS_FRAME_READER_SIZE; i++)
+  {
+    reader.push(0x55);
+  }
+  assertEqual((uint32_t)1, reader.getOverflows());
+  reader.push(0xC0);
+  assertTrue(reader.push(0x00) == false);
+}
+
 test(escape)
 {
   KISSInterceptor kissInterceptor;
@@ -0,0 +1,79 @@
+#line 2 "LatencyHistogramTest.ino"
+
+#include <AUnit.h>
+#include <ArduinoLog.h>
+#include "../../src/bb-link/LatencyHistogram.h"
+
+using aunit::TestRunner;
+
+test(bucketFor)
+{
+  assertEqual(0, LatencyHistogram::bucketFor(0));
+  assertEqual(0, LatencyHistogram::bucketFor(1));
+  assertEqual(1, LatencyHistogram::bucketFor(2));
+  assertEqual(1, LatencyHistogram::bucketFor(3));
+  assertEqual(10, LatencyHistogram::bucketFor(1024));
+  assertEqual(LATENCY_BUCKETS - 1, LatencyHistogram::bucketFor(UINT32_MAX));
+}
+
+test(minMaxAndPercentiles)
+{
+  LatencyHistogram histogram;
+  assertEqual((uint32_t)0, histogram.getMin());
+  assertEqual((uint32_t)0, histogram.getPercentile(50));
+
+  for (int i = 0; i < 98; i++)
+  {
+    histogram.record(100);
+  }
+  histogram.record(5000);
+  histogram.record(40);
+
+  assertEqual((uint32_t)100, histogram.getCount());
+  assertEqual((uint32_t)40, histogram.getMin());
+  assertEqual((uint32_t)5000, histogram.getMax());
+  assertEqual((uint32_t)98, histogram.getBucket(6));
+  // Upper bound of the 64..127 us bucket
+  assertEqual((uint32_t)127, histogram.getPercentile(50));
+  assertEqual((uint32_t)127, histogram.getPercentile(99));
+  assertEqual((uint32_t)5000, histogram.getPercentile(100));
+}
+
+test(serialize)
+{
+  LatencyHistogram histogram;
+  histogram.record(300);
+  histogram.record(70000);
+
+  uint8_t buffer[LatencyHistogram::maxSerializedSize()];
+  assertEqual(sizeof(buffer), histogram.serialize(buffer));
+  assertEqual(2, buffer[3]);
+  // Min 300
+  assertEqual(0x01, buffer[6]);
+  assertEqual(0x2C, buffer[7]);
+  assertEqual(LATENCY_BUCKETS, buffer[12]);
+  // 300 us lands in bucket 8
+  assertEqual(1, buffer[13 + 8 * 2 + 1]);
+}
+
+test(reset)
+{
+  LatencyHistogram histogram;
+  histogram.record(10);
+  histogram.reset();
+  assertEqual((uint32_t)0, histogram.getCount());
+  assertEqual((uint32_t)0, histogram.getBucket(3));
+}
+
+void setup()
+{
+  Serial.begin(115200);
+  while (!Serial);
+  delay(1000);
+  Log.begin(LOG_LEVEL_SILENT, &Serial);
+}
+
+void loop()
+{
+  TestRunner::run();
+}
@@ -0,0 +1,89 @@
+#line 2 "NotifySchedulerTest.ino"
+
+#include <AUnit.h>
+#include <ArduinoLog.h>
+#include <string>
+#include "../../src/bb-link/NotifyScheduler.h"
+
+using aunit::TestRunner;
+
+static const uint8_t dataFrame[] = {0xC0, 0x00, 0x01, 0x02, 0x03, 0xC0};
+static const uint8_t reply[] = {0xC0, 0x06, 0x7E, 0x00, 0x80, 0xC0};
+
+static std::string str(const uint8_t *data, size_t size)
+{
+  return std::string((const char *)data, size);
+}
+
+test(sendsRightAwayBetweenFrames)
+{
+  std::string sent;
+  NotifyScheduler scheduler([&sent](const uint8_t *data, size_t size)
+                            { sent += str(data, size); });
+  assertTrue(scheduler.sendControl(reply, sizeof(reply), 0));
+  scheduler.sendData(dataFrame, sizeof(dataFrame));
+  assertTrue(scheduler.sendControl(reply, sizeof(reply), 0));
+  assertTrue(sent == str(reply, sizeof(reply)) + str(dataFrame, sizeof(dataFrame)) + str(reply, sizeof(reply)));
+}
+
+test(waitsForTheFrameToEnd)
+{
+  std::string sent;
+  NotifyScheduler scheduler([&sent](const uint8_t *data, size_t size)
+                            { sent += str(data, size); });
+  scheduler.sendData(dataFrame, 3);
+  assertTrue(scheduler.isInFrame());
+  scheduler.sendControl(reply, sizeof(reply), 0);
+  scheduler.poll(10);
+  assertEqual((size_t)3, sent.size());
+
+  // The end of the frame, then the reply ahead of the next frame
+  uint8_t rest[sizeof(dataFrame) - 3 + sizeof(dataFrame)];
+  memcpy(rest, dataFrame + 3, sizeof(dataFrame) - 3);
+  memcpy(rest + sizeof(dataFrame) - 3, dataFrame, sizeof(dataFrame));
+  scheduler.sendData(rest, sizeof(rest));
+  std::string frame = str(dataFrame, sizeof(dataFrame));
+  assertTrue(sent == frame + str(reply, sizeof(reply)) + frame);
+  assertEqual((size_t)0, scheduler.getPendingControl());
+}
+
+test(givesUpOnAStalledFrame)
+{
+  std::string sent;
+  NotifyScheduler scheduler([&sent](const uint8_t *data, size_t size)
+                            { sent += str(data, size); });
+  scheduler.sendData(dataFrame, 3);
+  scheduler.sendControl(reply, sizeof(reply), 100);
+  scheduler.poll(100 + NOTIFY_CONTROL_WAIT - 1);
+  assertEqual((size_t)3, sent.size());
+  scheduler.poll(100 + NOTIFY_CONTROL_WAIT);
+  assertTrue(sent == str(dataFrame, 3) + "\xC0" + str(reply, sizeof(reply)));
+  assertFalse(scheduler.isInFrame());
+}
+
+test(dropsRepliesWhenFull)
+{
+  NotifyScheduler scheduler([](const uint8_t *data, size_t size) {});
+  scheduler.sendData(dataFrame, 3);
+  uint8_t big[NOTIFY_CONTROL_SIZE / 2 + 1] = {0xC0};
+  assertTrue(scheduler.sendControl(big, sizeof(big), 0));
+  assertFalse(scheduler.sendControl(big, sizeof(big), 0));
+  assertEqual((uint32_t)1, scheduler.getDropped());
+
+  scheduler.reset();
+  assertFalse(scheduler.isInFrame());
+  assertEqual((size_t)0, scheduler.getPendingControl());
+}
+
+void setup()
+{
+  Serial.begin(115200);
+  while (!Serial);
+  delay(1000);
+  Log.begin(LOG_LEVEL_SILENT, &Serial);
+}
+
+void loop()
+{
+  TestRunner::run();
+}
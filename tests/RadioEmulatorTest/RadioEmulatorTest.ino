@@ -0,0 +1,273 @@
+#line 2 "RadioEmulatorTest.ino"
+
+#include <AUnit.h>
+#include <ArduinoLog.h>
+#include <thread>
+#include "../../src/bb-link/THD7x.h"
+#include "../../src/bb-link/RadioEmulator.h"
+
+using aunit::TestRunner;
+
+#define TEST_LATENCY 5
+
+// A KISS data frame, APRS position from N0CALL
+static const uint8_t testFrame[] = {
+    0xC0, 0x00, 0x82, 0xA0, 0xA4, 0xA6, 0x40, 0x40, 0x60, 0x9C, 0x60, 0x86,
+    0x82, 0x98, 0x98, 0x61, 0x03, 0xF0, 0x21, 0x34, 0x39, 0x30, 0x33, 0x2E,
+    0x35, 0x30, 0x4E, 0x2F, 0x30, 0x37, 0x32, 0x30, 0x31, 0x2E, 0x37, 0x35,
+    0x57, 0x2D, 0xC0};
+
+static void sendFrame(BluetoothSerial &btSerial)
+{
+  for (uint8_t byte : testFrame)
+  {
+    btSerial.write(byte);
+  }
+}
+
+test(answersQueries)
+{
+  BluetoothSerial btSerial;
+  RadioEmulator radio;
+  radio.setLatency(TEST_LATENCY);
+  btSerial.attach(&radio);
+  THD7x thd7x = THD7x(btSerial);
+  char radioId[32];
+  assertTrue(thd7x.getRadioId(radioId, 32));
+  assertEqual("TH-D74", radioId);
+
+  uint32_t frequency;
+  assertTrue(thd7x.getFrequency(vfoA, &frequency));
+  assertEqual((uint32_t)144390000, frequency);
+
+  baud_rate_t baudRate;
+  assertTrue(thd7x.getBaudRate(&baudRate));
+  assertEqual(baudRate1200, baudRate);
+}
+
+test(sendsThroughOutboundBuffer)
+{
+  BluetoothSerial btSerial;
+  RadioEmulator radio;
+  radio.setLatency(TEST_LATENCY);
+  btSerial.attach(&radio);
+  btSerial.connect(nullptr);
+  SppOutbound outbound(btSerial);
+  THD7x thd7x = THD7x(btSerial, &outbound);
+  uint32_t frequency;
+  assertTrue(thd7x.getFrequency(vfoA, &frequency));
+  assertEqual((uint32_t)144390000, frequency);
+
+  // Waits for a congested link to move, like the BT task reporting it clear
+  outbound.setCongested(true, 0);
+  std::thread bt([&outbound]()
+                 {
+                   delay(50);
+                   outbound.setCongested(false, 0);
+                 });
+  assertTrue(thd7x.getFrequency(vfoA, &frequency));
+  bt.join();
+  assertEqual((uint32_t)144390000, frequency);
+
+  // Given up on a link that stays congested, nothing left to go out late
+  outbound.setCongested(true, 0);
+  unsigned long start = millis();
+  assertFalse(thd7x.getFrequency(vfoA, &frequency));
+  assertLess(millis() - start, (unsigned long)1100);
+  assertTrue(outbound.isEmpty());
+
+  // A question that never got out tells nothing of the TNC
+  assertEqual(kissUnknown, thd7x.getKISSMode());
+  assertFalse(thd7x.leaveKISS());
+  outbound.setCongested(false, 0);
+
+  // The reply of a command nobody waited for is not taken for the next one's
+  btSerial.print("ID\r");
+  delay(TEST_LATENCY + 1);
+  assertTrue(btSerial.available() > 0);
+  assertTrue(thd7x.getFrequency(vfoA, &frequency));
+  assertEqual((uint32_t)144390000, frequency);
+}
+
+test(keepsSettings)
+{
+  BluetoothSerial btSerial;
+  RadioEmulator radio;
+  radio.setLatency(TEST_LATENCY);
+  btSerial.attach(&radio);
+  THD7x thd7x = THD7x(btSerial);
+  thd7x.setFrequency(vfoB, 145010000);
+  thd7x.setMode(vfoB, modeCW);
+  thd7x.setBaudRate(baudRate9600);
+  assertEqual((uint32_t)145010000, radio.getFrequency(vfoB));
+  assertEqual(modeCW, radio.getMode(vfoB));
+  assertEqual(baudRate9600, radio.getBaudRate());
+
+  vfo_mode_t mode;
+  assertTrue(thd7x.getMode(vfoB, &mode));
+  assertEqual(modeCW, mode);
+  assertEqual(0, radio.getRejectedCount());
+}
+
+test(rejectsBadCommands)
+{
+  BluetoothSerial btSerial;
+  RadioEmulator radio;
+  radio.setLatency(TEST_LATENCY);
+  btSerial.attach(&radio);
+  THD7x thd7x = THD7x(btSerial);
+  char response[32];
+  assertFalse(thd7x.sendCmd("XX", response, 32, 1));
+  assertFalse(thd7x.sendCmd("FQ 2", response, 32, 0));
+  assertFalse(thd7x.sendCmd("MD 0,A", response, 32, 0));
+  assertEqual(4, radio.getCommandCount());
+  assertEqual(4, radio.getRejectedCount());
+}
+
+test(entersAndLeavesKISS)
+{
+  BluetoothSerial btSerial;
+  RadioEmulator radio;
+  radio.setLatency(TEST_LATENCY);
+  btSerial.attach(&radio);
+  THD7x thd7x = THD7x(btSerial);
+  thd7x.setTNC(vfoB, tncKISS);
+  assertTrue(radio.isKISSMode());
+  assertEqual(vfoB, radio.getTNCBand());
+
+  // CAT is ignored by the TNC, the query times out
+  assertEqual(kissOn, thd7x.getKISSMode());
+  assertEqual(3, radio.getIgnoredCount());
+
+  assertTrue(thd7x.leaveKISS());
+  assertFalse(radio.isKISSMode());
+  assertEqual(kissOff, thd7x.getKISSMode());
+}
+
+test(loopsBackFramesAfterAirtime)
+{
+  BluetoothSerial btSerial;
+  RadioEmulator radio;
+  radio.setLatency(TEST_LATENCY);
+  btSerial.attach(&radio);
+  THD7x thd7x = THD7x(btSerial);
+  radio.setTNC(vfoA, tncKISS);
+  radio.setTxDelay(50);
+  unsigned long start = millis();
+  sendFrame(btSerial);
+  assertEqual(1, radio.getFrameCount());
+  assertEqual(0, btSerial.available());
+
+  while (btSerial.available() < (int)sizeof(testFrame) && millis() - start < 1000)
+  {
+    delay(1);
+  }
+  // TXDELAY plus 36 bytes at 1200 bps
+  assertMore(millis() - start, (unsigned long)(50 + 36 * 8 * 1000 / 1200 - 1));
+  for (uint8_t byte : testFrame)
+  {
+    assertEqual(byte, btSerial.read());
+  }
+}
+
+test(answersAfterLatency)
+{
+  BluetoothSerial btSerial;
+  RadioEmulator radio;
+  radio.setLatency(TEST_LATENCY);
+  btSerial.attach(&radio);
+  THD7x thd7x = THD7x(btSerial);
+  radio.setLatency(40);
+  uint32_t frequency;
+  unsigned long start = millis();
+  assertTrue(thd7x.getFrequency(vfoA, &frequency));
+  assertMore(millis() - start, (unsigned long)39);
+}
+
+test(retriesRejectedCommands)
+{
+  BluetoothSerial btSerial;
+  RadioEmulator radio;
+  radio.setLatency(TEST_LATENCY);
+  btSerial.attach(&radio);
+  THD7x thd7x = THD7x(btSerial);
+  radio.failNext(faultReject);
+  uint32_t frequency;
+  assertTrue(thd7x.getFrequency(vfoA, &frequency));
+  assertEqual(2, radio.getCommandCount());
+
+  radio.failNext(faultSilent);
+  assertFalse(thd7x.getFrequency(vfoA, &frequency));
+
+  radio.failNext(faultGarbled);
+  assertFalse(thd7x.getFrequency(vfoA, &frequency));
+}
+
+test(qsyAndRestore)
+{
+  BluetoothSerial btSerial;
+  RadioEmulator radio;
+  radio.setLatency(TEST_LATENCY);
+  btSerial.attach(&radio);
+  THD7x thd7x = THD7x(btSerial);
+  radio.setTNC(vfoA, tncKISS);
+  radio.setMode(vfoA, modeDV);
+  qsy_settings_t previous;
+
+  unsigned long start = millis();
+  assertTrue(thd7x.qsy(vfoA, 145010000, baudRate9600, &previous));
+  unsigned long elapsed = millis() - start;
+
+  assertEqual((uint32_t)145010000, radio.getFrequency(vfoA));
+  assertEqual(modeFM, radio.getMode(vfoA));
+  assertEqual(baudRate9600, radio.getBaudRate());
+  assertTrue(radio.isKISSMode());
+  assertEqual((uint32_t)144390000, previous.frequency);
+  assertEqual(modeDV, previous.mode);
+  assertEqual(baudRate1200, previous.baudRate);
+
+  // BT, AS, AS 1, MD, MD 0,0, FQ, FQ 0,x, TN. More round trips is a regression.
+  assertEqual(8, radio.getCommandCount());
+  assertLess(elapsed, (unsigned long)(8 * (TEST_LATENCY + 10)));
+
+  radio.resetCounters();
+  assertTrue(thd7x.restore(vfoA, baudRate9600, &previous));
+  assertEqual((uint32_t)144390000, radio.getFrequency(vfoA));
+  assertEqual(modeDV, radio.getMode(vfoA));
+  assertEqual(baudRate1200, radio.getBaudRate());
+  assertTrue(radio.isKISSMode());
+  assertEqual(5, radio.getCommandCount());
+}
+
+test(qsyWithFlakyRadio)
+{
+  BluetoothSerial btSerial;
+  RadioEmulator radio;
+  radio.setLatency(TEST_LATENCY);
+  btSerial.attach(&radio);
+  THD7x thd7x = THD7x(btSerial);
+  radio.setTNC(vfoA, tncKISS);
+  radio.setErrorRate(20);
+  qsy_settings_t previous;
+
+  for (int i = 0; i < 5; i++)
+  {
+    assertTrue(thd7x.qsy(vfoA, 145010000 + i * 10000, baudRate1200, &previous));
+    assertEqual((uint32_t)(145010000 + i * 10000), radio.getFrequency(vfoA));
+    assertTrue(radio.isKISSMode());
+  }
+  assertMore(radio.getRejectedCount(), 0);
+}
+
+void setup()
+{
+  Serial.begin(115200);
+  while (!Serial);
+  delay(1000);
+  Log.begin(LOG_LEVEL_SILENT, &Serial);
+}
+
+void loop()
+{
+  TestRunner::run();
+}
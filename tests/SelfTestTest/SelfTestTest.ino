@@ -0,0 +1,136 @@
+#line 2 "SelfTestTest.ino"
+
+#include <AUnit.h>
+#include <ArduinoLog.h>
+#include "../../src/bb-link/SelfTest.h"
+
+using aunit::TestRunner;
+
+static uint32_t get32(const uint8_t *p)
+{
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+// Offsets in the report
+#define DOWNLOAD_BYTES 2
+#define DOWNLOAD_FRAMES 6
+#define DOWNLOAD_LOST 10
+#define DOWNLOAD_MICROS 14
+#define DOWNLOAD_RATE 18
+#define UPLOAD_BYTES 22
+#define UPLOAD_WRITES 26
+#define UPLOAD_MICROS 30
+#define UPLOAD_RATE 34
+#define INTERVALS 38
+
+test(streamsNumberedFrames)
+{
+  SelfTest test;
+  uint8_t frame[SELF_TEST_MAX_FRAME];
+  test.startDownload(100, 40, 0);
+  assertTrue(test.isDownloading());
+
+  size_t lengths[] = {40, 40, 20};
+  for (uint16_t i = 0; i < 3; i++)
+  {
+    assertEqual(lengths[i], test.nextFrame(frame, 0));
+    assertEqual(CMD_HARDWARE, frame[0]);
+    assertEqual(EXTENDED_HW_CMD_SELF_TEST, frame[1]);
+    assertEqual(selfTestPattern, frame[2]);
+    assertEqual(i, (uint16_t)((frame[3] << 8) | frame[4]));
+    assertFalse(memchr(frame + SELF_TEST_PATTERN_HEADER, 0xC0, lengths[i] - SELF_TEST_PATTERN_HEADER) != nullptr);
+    test.sent(true, 1000 * (i + 1));
+  }
+  assertEqual((size_t)0, test.nextFrame(frame, 3000));
+  assertFalse(test.isDownloading());
+  assertTrue(test.takeFinished());
+  assertFalse(test.takeFinished());
+
+  uint8_t report[SELF_TEST_REPORT_SIZE];
+  assertEqual((size_t)SELF_TEST_REPORT_SIZE, test.report(report, 5000));
+  assertEqual(selfTestReport, report[0]);
+  assertEqual(selfTestIdle, report[1]);
+  assertEqual((uint32_t)100, get32(report + DOWNLOAD_BYTES));
+  assertEqual((uint32_t)3, get32(report + DOWNLOAD_FRAMES));
+  assertEqual((uint32_t)0, get32(report + DOWNLOAD_LOST));
+  assertEqual((uint32_t)3000, get32(report + DOWNLOAD_MICROS));
+  assertEqual((uint32_t)33333, get32(report + DOWNLOAD_RATE));
+  // Two gaps of 1 ms between three notifications
+  assertEqual((uint32_t)2, get32(report + INTERVALS));
+  assertEqual((uint32_t)1000, get32(report + INTERVALS + 4));
+}
+
+test(countsRefusedFrames)
+{
+  SelfTest test;
+  uint8_t frame[SELF_TEST_MAX_FRAME];
+  test.startDownload(64, 32, 0);
+  test.nextFrame(frame, 0);
+  test.sent(false, 10);
+  test.nextFrame(frame, 10);
+  test.sent(true, 20);
+
+  uint8_t report[SELF_TEST_REPORT_SIZE];
+  test.report(report, 20);
+  assertEqual((uint32_t)32, get32(report + DOWNLOAD_BYTES));
+  assertEqual((uint32_t)1, get32(report + DOWNLOAD_FRAMES));
+  assertEqual((uint32_t)1, get32(report + DOWNLOAD_LOST));
+}
+
+test(keepsFrameSizeInBounds)
+{
+  SelfTest test;
+  uint8_t frame[SELF_TEST_MAX_FRAME];
+  test.startDownload(10000, 1, 0);
+  assertEqual((size_t)SELF_TEST_MIN_FRAME, test.nextFrame(frame, 0));
+  test.startDownload(10000, 60000, 0);
+  assertEqual((size_t)SELF_TEST_MAX_FRAME, test.nextFrame(frame, 0));
+}
+
+test(sinksUploads)
+{
+  SelfTest test;
+  test.received(10, 0);
+  test.startUpload(100, 0);
+  assertTrue(test.isUploading());
+  test.received(60, 1001);
+  assertTrue(test.isUploading());
+  test.received(40, 3001);
+  assertFalse(test.isUploading());
+  assertTrue(test.takeFinished());
+
+  uint8_t report[SELF_TEST_REPORT_SIZE];
+  test.report(report, 3001);
+  assertEqual((uint32_t)100, get32(report + UPLOAD_BYTES));
+  assertEqual((uint32_t)2, get32(report + UPLOAD_WRITES));
+  assertEqual((uint32_t)2000, get32(report + UPLOAD_MICROS));
+  assertEqual((uint32_t)50000, get32(report + UPLOAD_RATE));
+}
+
+test(givesUpAfterTimeout)
+{
+  SelfTest test;
+  test.startUpload(100, 0);
+  assertFalse(test.expire(SELF_TEST_TIMEOUT * 1000 - 1));
+  assertTrue(test.expire(SELF_TEST_TIMEOUT * 1000));
+  assertFalse(test.isUploading());
+  assertFalse(test.expire(SELF_TEST_TIMEOUT * 2000));
+
+  test.startDownload(100, 40, 0);
+  test.stop();
+  assertFalse(test.isDownloading());
+  assertFalse(test.takeFinished());
+}
+
+void setup()
+{
+  Serial.begin(115200);
+  while (!Serial);
+  delay(1000);
+  Log.begin(LOG_LEVEL_SILENT, &Serial);
+}
+
+void loop()
+{
+  TestRunner::run();
+}
@@ -0,0 +1,165 @@
+#line 2 "SppOutboundTest.ino"
+
+#include <AUnit.h>
+#include <ArduinoLog.h>
+#include <string>
+#include "../../src/bb-link/SppOutbound.h"
+
+using aunit::TestRunner;
+
+// The radio end of the link, keeps what it gets
+class Receiver : public MockSerialPeer
+{
+public:
+  std::string received;
+
+  void onReceive(uint8_t byte) override
+  {
+    received += (char)byte;
+  }
+
+  int available() override
+  {
+    return 0;
+  }
+
+  int read() override
+  {
+    return -1;
+  }
+};
+
+static void connect(BluetoothSerial &btSerial, Receiver &radio)
+{
+  btSerial.attach(&radio);
+  btSerial.connect(nullptr);
+}
+
+test(passesWritesThroughInOrder)
+{
+  BluetoothSerial btSerial;
+  Receiver radio;
+  connect(btSerial, radio);
+  SppOutbound outbound(btSerial);
+
+  assertTrue(outbound.write((const uint8_t *)"FQ 0\r", 5));
+  assertTrue(outbound.print("ID\r"));
+  assertEqual((size_t)8, outbound.getDepth());
+  outbound.pump();
+  assertTrue(radio.received == "FQ 0\rID\r");
+  assertTrue(outbound.isEmpty());
+  assertEqual((size_t)8, outbound.getHighWater());
+}
+
+test(holdsWritesWhileCongested)
+{
+  BluetoothSerial btSerial;
+  Receiver radio;
+  connect(btSerial, radio);
+  SppOutbound outbound(btSerial);
+
+  outbound.setCongested(true, 1000);
+  assertTrue(outbound.print("ID\r"));
+  outbound.pump();
+  assertTrue(radio.received.empty());
+  assertEqual((size_t)3, outbound.getDepth());
+
+  outbound.setCongested(false, 251000);
+  outbound.pump();
+  assertTrue(radio.received == "ID\r");
+  assertEqual((uint32_t)1, outbound.getStalls());
+  assertEqual((uint32_t)250, outbound.getStallMillis(400000));
+}
+
+test(tellsWhenWriteIsSent)
+{
+  BluetoothSerial btSerial;
+  Receiver radio;
+  connect(btSerial, radio);
+  SppOutbound outbound(btSerial);
+  outbound.setCongested(true, 0);
+
+  uint32_t end;
+  assertTrue(outbound.print("FQ 0\r"));
+  assertTrue(outbound.write((const uint8_t *)"ID\r", 3, &end));
+  assertFalse(outbound.isSent(end));
+
+  outbound.setCongested(false, 0);
+  outbound.pump();
+  assertTrue(outbound.isSent(end));
+}
+
+test(countsTheStallInProgress)
+{
+  BluetoothSerial btSerial;
+  SppOutbound outbound(btSerial);
+
+  outbound.setCongested(true, 1000);
+  // Told more than once, still the same stall
+  outbound.setCongested(true, 2000);
+  assertTrue(outbound.isCongested());
+  assertEqual((uint32_t)1, outbound.getStalls());
+  assertEqual((uint32_t)50, outbound.getStallMillis(51000));
+  outbound.setCongested(false, 101000);
+  outbound.setCongested(false, 900000);
+  assertEqual((uint32_t)100, outbound.getStallMillis(900000));
+}
+
+test(keepsWritesWhole)
+{
+  BluetoothSerial btSerial;
+  Receiver radio;
+  connect(btSerial, radio);
+  SppOutbound outbound(btSerial);
+  outbound.setCongested(true, 0);
+
+  static uint8_t frame[1000];
+  for (size_t i = 0; i < sizeof(frame); i++)
+  {
+    frame[i] = 'a' + i % 26;
+  }
+  for (size_t i = 0; i < SPP_OUTBOUND_SIZE / sizeof(frame); i++)
+  {
+    assertTrue(outbound.write(frame, sizeof(frame)));
+  }
+  assertFalse(outbound.write(frame, sizeof(frame)));
+  assertEqual((uint32_t)1, outbound.getOverflows());
+
+  // Across the end of the buffer
+  outbound.setCongested(false, 0);
+  outbound.pump();
+  assertTrue(outbound.write(frame, sizeof(frame)));
+  outbound.pump();
+  assertEqual((size_t)(SPP_OUTBOUND_SIZE / sizeof(frame) + 1) * sizeof(frame), radio.received.size());
+  std::string expected((const char *)frame, sizeof(frame));
+  assertTrue(radio.received.substr(radio.received.size() - sizeof(frame)) == expected);
+}
+
+test(dropsWhatIsLeftOnClear)
+{
+  BluetoothSerial btSerial;
+  Receiver radio;
+  connect(btSerial, radio);
+  SppOutbound outbound(btSerial);
+
+  outbound.setCongested(true, 0);
+  outbound.print("ID\r");
+  outbound.clear();
+  outbound.setCongested(false, 0);
+  outbound.pump();
+  assertTrue(outbound.isEmpty());
+  assertTrue(radio.received.empty());
+}
+
+void setup()
+{
+  Serial.begin(115200);
+  while (!Serial);
+  delay(1000);
+  Log.begin(LOG_LEVEL_SILENT, &Serial);
+}
+
+void loop()
+{
+  TestRunner::run();
+}
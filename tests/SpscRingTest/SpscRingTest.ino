@@ -0,0 +1,169 @@
+#line 2 "SpscRingTest.ino"
+
+#include <AUnit.h>
+#include <ArduinoLog.h>
+#include <thread>
+#include "../../src/bb-link/SpscRing.h"
+
+using aunit::TestRunner;
+
+struct test_item_t
+{
+  uint32_t sequence;
+  uint32_t check; // Derived from the sequence, a torn or stale slot shows
+};
+
+static test_item_t itemFor(uint32_t sequence)
+{
+  return {sequence, sequence * 2654435761u};
+}
+
+test(fifoOrder)
+{
+  SpscRing<test_item_t, 4> ring;
+  assertTrue(ring.isEmpty());
+  for (uint32_t i = 0; i < 3; i++)
+  {
+    assertTrue(ring.push(itemFor(i)));
+  }
+  assertEqual((uint32_t)3, ring.count());
+  test_item_t item;
+  for (uint32_t i = 0; i < 3; i++)
+  {
+    assertTrue(ring.pop(&item));
+    assertEqual(i, item.sequence);
+  }
+  assertFalse(ring.pop(&item));
+  assertTrue(ring.isEmpty());
+}
+
+test(overflowsWhenFull)
+{
+  SpscRing<test_item_t, 4> ring;
+  for (uint32_t i = 0; i < 4; i++)
+  {
+    assertTrue(ring.push(itemFor(i)));
+  }
+  assertFalse(ring.push(itemFor(4)));
+  assertEqual((uint32_t)1, ring.getOverflows());
+  assertEqual((uint32_t)4, ring.getHighWater());
+
+  // Room again once drained, wrapping around the slots
+  test_item_t item;
+  assertTrue(ring.pop(&item));
+  assertTrue(ring.push(itemFor(5)));
+  uint32_t expected[] = {1, 2, 3, 5};
+  for (uint32_t i = 0; i < 4; i++)
+  {
+    assertTrue(ring.pop(&item));
+    assertEqual(expected[i], item.sequence);
+  }
+  assertEqual((uint32_t)4, ring.getHighWater());
+}
+
+/*
+  Like the Bluedroid task and the loop task. The producer retries until there
+  is room: every item arrives once, in order and whole.
+*/
+test(producerAndConsumerThreads)
+{
+  const uint32_t total = 200000;
+  static SpscRing<test_item_t, 16> ring;
+
+  std::thread producer([]()
+                       {
+    for (uint32_t i = 0; i < total; i++)
+    {
+      while (!ring.push(itemFor(i)))
+      {
+        std::this_thread::yield();
+      }
+    } });
+
+  uint32_t received = 0;
+  bool intact = true;
+  bool bounded = true;
+  test_item_t item;
+  while (received < total)
+  {
+    bounded = bounded && ring.count() <= 16;
+    if (ring.pop(&item))
+    {
+      intact = intact && item.sequence == received && item.check == itemFor(received).check;
+      received++;
+    }
+    else
+    {
+      std::this_thread::yield();
+    }
+  }
+  producer.join();
+
+  assertTrue(intact);
+  assertTrue(bounded);
+  assertTrue(ring.isEmpty());
+  assertEqual(total, received);
+  assertTrue(ring.getHighWater() <= 16);
+}
+
+/*
+  A producer that never waits, the consumer on a thread of its own: what is
+  not dropped arrives in order, and everything is either received or counted.
+*/
+test(overflowsUnderLoad)
+{
+  const uint32_t total = 200000;
+  static SpscRing<test_item_t, 8> ring;
+  static std::atomic<bool> done{false};
+  static uint32_t received = 0;
+  static bool intact = true;
+
+  std::thread consumer([]()
+                       {
+    test_item_t item;
+    int64_t last = -1;
+    for (;;)
+    {
+      bool finished = done.load();
+      while (ring.pop(&item))
+      {
+        intact = intact && (int64_t)item.sequence > last && item.check == itemFor(item.sequence).check;
+        last = item.sequence;
+        received++;
+      }
+      if (finished)
+      {
+        break;
+      }
+      std::this_thread::yield();
+    } });
+
+  uint32_t pushed = 0;
+  for (uint32_t i = 0; i < total; i++)
+  {
+    if (ring.push(itemFor(i)))
+    {
+      pushed++;
+    }
+  }
+  done.store(true);
+  consumer.join();
+
+  assertTrue(intact);
+  assertEqual(pushed, received);
+  assertEqual(total, received + ring.getOverflows());
+  assertEqual((uint32_t)8, ring.getHighWater());
+}
+
+void setup()
+{
+  Serial.begin(115200);
+  while (!Serial);
+  delay(1000);
+  Log.begin(LOG_LEVEL_SILENT, &Serial);
+}
+
+void loop()
+{
+  TestRunner::run();
+}
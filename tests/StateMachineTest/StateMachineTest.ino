@@ -0,0 +1,202 @@
+#line 2 "StateMachineTest.ino"
+
+#include <AUnit.h>
+#include <ArduinoLog.h>
+#include "../../src/bb-link/StateMachine.h"
+
+using aunit::TestRunner;
+
+enum light_state_t : uint8_t
+{
+  offState = 0x00,
+  onState = 0x01,
+  lightStateCount = 0x02
+};
+
+/*
+  Records handler calls, one letter per call: E enter, U update, X exit,
+  lower case for the off state.
+*/
+class Light
+{
+public:
+  typedef StateMachine<Light, light_state_t, lightStateCount> LightStateMachine;
+  static const LightStateMachine::Table states;
+  LightStateMachine stateMachine;
+  String trace;
+  unsigned long enterDelay = 0;
+
+  Light() : stateMachine(this, states, offState) {}
+
+  void offEnter() { trace += "e"; }
+  void offUpdate() { trace += "u"; }
+  void onEnter()
+  {
+    trace += "E";
+    delay(enterDelay);
+  }
+  void onUpdate() { trace += "U"; }
+  void onExit() { trace += "X"; }
+};
+
+// Off state has no exit handler
+const Light::LightStateMachine::Table Light::states = {
+    {&Light::offEnter, &Light::offUpdate, nullptr},
+    {&Light::onEnter, &Light::onUpdate, &Light::onExit}};
+
+test(firstUpdateEntersInitialState)
+{
+  Light light;
+  assertTrue(light.stateMachine.isInState(offState));
+  light.stateMachine.update();
+  light.stateMachine.update();
+  assertEqual("eu", light.trace.c_str());
+}
+
+test(transitionAppliedOnNextUpdate)
+{
+  Light light;
+  light.stateMachine.update();
+  light.stateMachine.transitionTo(onState);
+  assertTrue(light.stateMachine.isInState(offState));
+  light.stateMachine.update();
+  assertTrue(light.stateMachine.isInState(onState));
+  light.stateMachine.update();
+  light.stateMachine.transitionTo(offState);
+  light.stateMachine.update();
+  assertEqual("eEUXe", light.trace.c_str());
+  assertEqual(offState, light.stateMachine.getCurrentState());
+}
+
+test(immediateTransitionToSameStateReenters)
+{
+  Light light;
+  light.stateMachine.update();
+  light.stateMachine.immediateTransitionTo(onState);
+  light.stateMachine.immediateTransitionTo(onState);
+  assertEqual("eEXE", light.trace.c_str());
+}
+
+test(transitionToCurrentStateRestartsTimer)
+{
+  Light light;
+  light.stateMachine.update();
+  delay(20);
+  assertMoreOrEqual(light.stateMachine.timeInCurrentState(), (unsigned long)20);
+  light.stateMachine.transitionTo(offState);
+  assertLess(light.stateMachine.timeInCurrentState(), (unsigned long)20);
+  light.stateMachine.update();
+  // Not a transition, no exit nor enter
+  assertEqual("eu", light.trace.c_str());
+}
+
+test(transitionToOtherStateRestartsTimer)
+{
+  Light light;
+  light.stateMachine.update();
+  delay(20);
+  // Callers test the timer right after requesting, before the next update
+  light.stateMachine.transitionTo(onState);
+  assertLess(light.stateMachine.timeInCurrentState(), (unsigned long)20);
+}
+
+test(timerStartsOnceEntered)
+{
+  Light light;
+  light.stateMachine.update();
+  light.enterDelay = 20;
+  light.stateMachine.immediateTransitionTo(onState);
+  assertLess(light.stateMachine.timeInCurrentState(), (unsigned long)20);
+}
+
+test(applyPendingTransitionRunsToCompletion)
+{
+  Light light;
+  light.stateMachine.update();
+  light.stateMachine.transitionTo(onState);
+  light.stateMachine.applyPendingTransition();
+  light.stateMachine.transitionTo(offState);
+  light.stateMachine.applyPendingTransition();
+  assertEqual("eEXe", light.trace.c_str());
+  assertEqual((uint32_t)0, light.stateMachine.getCoalescedTransitions());
+}
+
+test(replacedRequestIsCoalesced)
+{
+  Light light;
+  light.stateMachine.update();
+  light.stateMachine.transitionTo(onState);
+  light.stateMachine.transitionTo(offState);
+  light.stateMachine.update();
+  assertEqual((uint32_t)1, light.stateMachine.getCoalescedTransitions());
+  assertEqual("eu", light.trace.c_str());
+}
+
+test(countsEntriesAndDwellTime)
+{
+  Light light;
+  light.stateMachine.update();
+  delay(20);
+  light.stateMachine.immediateTransitionTo(onState);
+  light.stateMachine.immediateTransitionTo(offState);
+  light.stateMachine.immediateTransitionTo(onState);
+
+  assertEqual((uint32_t)2, light.stateMachine.getEntries(offState));
+  assertEqual((uint32_t)2, light.stateMachine.getEntries(onState));
+  assertMoreOrEqual(light.stateMachine.getDwellTime(offState), (unsigned long)20);
+  assertLess(light.stateMachine.getDwellTime(onState), (unsigned long)20);
+}
+
+test(keepsRecentTransitions)
+{
+  Light light;
+  light.stateMachine.update();
+  assertEqual(0, light.stateMachine.getHistoryCount());
+  for (int i = 0; i < STATE_HISTORY_SIZE + 3; i++)
+  {
+    light.stateMachine.immediateTransitionTo(i % 2 == 0 ? onState : offState);
+  }
+  assertEqual(STATE_HISTORY_SIZE, light.stateMachine.getHistoryCount());
+  // Last one was the 11th, off to on
+  assertEqual(offState, light.stateMachine.getTransition(0).from);
+  assertEqual(onState, light.stateMachine.getTransition(0).to);
+  assertEqual(onState, light.stateMachine.getTransition(1).from);
+}
+
+test(serializeStats)
+{
+  Light light;
+  light.stateMachine.update();
+  light.stateMachine.immediateTransitionTo(onState);
+
+  uint8_t buffer[Light::LightStateMachine::maxStatsSize()];
+  size_t size = light.stateMachine.serializeStats(buffer);
+  assertEqual((size_t)(2 + 2 * 6 + 1 + 6), size);
+  assertEqual(onState, buffer[0]);
+  assertEqual(2, buffer[1]);
+  // Entries of the on state
+  assertEqual(0, buffer[2 + 6 + 4]);
+  assertEqual(1, buffer[2 + 6 + 5]);
+  // One transition, off to on
+  assertEqual(1, buffer[14]);
+  assertEqual(offState, buffer[19]);
+  assertEqual(onState, buffer[20]);
+}
+
+test(savesMemory)
+{
+  assertMore(Light::LightStateMachine::savedMemory(), (size_t)0);
+}
+
+void setup()
+{
+  Serial.begin(115200);
+  while (!Serial);
+  delay(1000);
+  Log.begin(LOG_LEVEL_SILENT, &Serial);
+}
+
+void loop()
+{
+  TestRunner::run();
+}
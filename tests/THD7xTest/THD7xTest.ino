@@ -122,7 +122,7 @@ test(isKISSMode)
   BluetoothSerial mockBluetoothSerial;
   THD7x thd7x = THD7x(mockBluetoothSerial);
   mockBluetoothSerial.setMockReadValue("?");
-  assertTrue(thd7x.isKISSMode());
+  assertEqual(kissOn, thd7x.getKISSMode());
 }
 
 test(sendCmdSuccess)
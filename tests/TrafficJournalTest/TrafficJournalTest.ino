@@ -0,0 +1,180 @@
+#line 2 "TrafficJournalTest.ino"
+
+#include <AUnit.h>
+#include <ArduinoLog.h>
+#include "../../src/bb-link/TrafficJournal.h"
+
+using aunit::TestRunner;
+
+#define PAGE_SIZE 512
+
+static const uint8_t frame[] = {0xC0, 0x00, 0x82, 0xA0, 0xA4, 0xA6, 0xC0};
+
+static uint32_t getUInt32(const uint8_t *buffer)
+{
+  return ((uint32_t)buffer[0] << 24) | ((uint32_t)buffer[1] << 16) | (buffer[2] << 8) | buffer[3];
+}
+
+static size_t recordLength(const uint8_t *record)
+{
+  return (record[5] << 8) | record[6];
+}
+
+test(offWithoutPartition)
+{
+  mockPartitionPresent() = false;
+  TrafficJournal journal;
+  assertFalse(journal.init());
+  assertFalse(journal.isEnabled());
+  journal.setRecording(true);
+  assertFalse(journal.isRecording());
+  mockPartitionPresent() = true;
+}
+
+test(recordsOnlyOnceTurnedOn)
+{
+  mockErasePartition();
+  TrafficJournal journal;
+  assertTrue(journal.init());
+  assertFalse(journal.isRecording());
+  journal.append(journalToRadio, frame, sizeof(frame));
+
+  uint8_t page[PAGE_SIZE];
+  assertEqual((size_t)JOURNAL_PAGE_HEADER_SIZE, journal.read(journal.seek(0), page, sizeof(page)));
+
+  journal.setRecording(true);
+  journal.append(journalToRadio, frame, sizeof(frame));
+  journal.setRecording(false);
+  journal.append(journalToRadio, frame, sizeof(frame));
+  assertEqual((size_t)(JOURNAL_PAGE_HEADER_SIZE + 7 + sizeof(frame)), journal.read(journal.seek(0), page, sizeof(page)));
+}
+
+test(readsBackWhatWasAppended)
+{
+  mockErasePartition();
+  TrafficJournal journal;
+  assertTrue(journal.init());
+  journal.setRecording(true);
+  journal.append(journalToRadio, frame, sizeof(frame));
+  journal.append(journalFromRadio, frame, 3);
+
+  uint8_t page[PAGE_SIZE];
+  size_t size = journal.read(journal.seek(0), page, sizeof(page));
+  assertEqual((size_t)(JOURNAL_PAGE_HEADER_SIZE + 7 + sizeof(frame) + 7 + 3), size);
+  const uint8_t *record = page + JOURNAL_PAGE_HEADER_SIZE;
+  assertEqual(journalToRadio, record[4]);
+  assertEqual(sizeof(frame), recordLength(record));
+  assertEqual(0, memcmp(frame, record + 7, sizeof(frame)));
+  record += 7 + sizeof(frame);
+  assertEqual(journalFromRadio, record[4]);
+  assertEqual((size_t)3, recordLength(record));
+
+  // Nothing more from the next cursor
+  assertEqual((size_t)JOURNAL_PAGE_HEADER_SIZE, journal.read(getUInt32(page + 4), page, sizeof(page)));
+}
+
+test(survivesPowerCycles)
+{
+  mockErasePartition();
+  uint32_t times[3];
+  for (int i = 0; i < 3; i++)
+  {
+    TrafficJournal journal;
+    journal.init();
+    journal.setRecording(true);
+    times[i] = journal.now();
+    uint8_t data[] = {(uint8_t)i};
+    journal.append(journalFromRadio, data, sizeof(data));
+    journal.drain(true);
+  }
+  // The clock goes on from the last record
+  assertTrue(times[1] > times[0]);
+  assertTrue(times[2] > times[1]);
+
+  TrafficJournal journal;
+  journal.init();
+  uint8_t page[PAGE_SIZE];
+  size_t size = journal.read(journal.seek(times[1]), page, sizeof(page));
+  assertEqual((size_t)(JOURNAL_PAGE_HEADER_SIZE + 2 * 8), size);
+  assertEqual(times[1], getUInt32(page + JOURNAL_PAGE_HEADER_SIZE));
+  assertEqual(1, page[JOURNAL_PAGE_HEADER_SIZE + 7]);
+  assertEqual(2, page[JOURNAL_PAGE_HEADER_SIZE + 8 + 7]);
+}
+
+test(pagesThruSectors)
+{
+  mockErasePartition();
+  TrafficJournal journal;
+  journal.init();
+  journal.setRecording(true);
+  uint8_t data[JOURNAL_CHUNK_SIZE];
+  // Long writes are split in chunks, a sector takes a few of them
+  for (int i = 0; i < 40; i++)
+  {
+    memset(data, i, sizeof(data));
+    journal.append(journalFromRadio, data, sizeof(data));
+  }
+
+  uint8_t page[PAGE_SIZE];
+  uint32_t cursor = journal.seek(0);
+  int count = 0;
+  for (;;)
+  {
+    size_t size = journal.read(cursor, page, sizeof(page));
+    if (size == JOURNAL_PAGE_HEADER_SIZE)
+    {
+      break;
+    }
+    for (size_t offset = JOURNAL_PAGE_HEADER_SIZE; offset < size; offset += 7 + recordLength(page + offset))
+    {
+      assertEqual((size_t)JOURNAL_CHUNK_SIZE, recordLength(page + offset));
+      assertEqual(count, page[offset + 7]);
+      count++;
+    }
+    cursor = getUInt32(page + 4);
+  }
+  assertEqual(40, count);
+}
+
+test(wrapsAroundThePartition)
+{
+  mockErasePartition();
+  TrafficJournal journal;
+  journal.init();
+  journal.setRecording(true);
+  uint8_t data[JOURNAL_CHUNK_SIZE];
+  uint32_t firstCursor = journal.seek(0);
+  // Twice the partition worth
+  int chunks = 2 * MOCK_PARTITION_SIZE / (JOURNAL_RECORD_HEADER_SIZE + JOURNAL_CHUNK_SIZE);
+  for (int i = 0; i < chunks; i++)
+  {
+    data[0] = i & 0xFF;
+    data[1] = i >> 8;
+    journal.append(journalFromRadio, data, sizeof(data));
+  }
+
+  // A cursor to an erased sector goes on from the oldest record left
+  uint8_t page[PAGE_SIZE];
+  journal.read(firstCursor, page, sizeof(page));
+  int oldest = page[JOURNAL_PAGE_HEADER_SIZE + 7] | (page[JOURNAL_PAGE_HEADER_SIZE + 8] << 8);
+  assertTrue(oldest > chunks / 2);
+
+  // Still there after a power cycle
+  TrafficJournal again;
+  again.init();
+  again.read(again.seek(0), page, sizeof(page));
+  assertEqual(oldest, page[JOURNAL_PAGE_HEADER_SIZE + 7] | (page[JOURNAL_PAGE_HEADER_SIZE + 8] << 8));
+}
+
+void setup()
+{
+  Serial.begin(115200);
+  while (!Serial);
+  delay(1000);
+  Log.begin(LOG_LEVEL_SILENT, &Serial);
+}
+
+void loop()
+{
+  TestRunner::run();
+}